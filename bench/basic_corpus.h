@@ -0,0 +1,212 @@
+// Seeded generator for synthetic HX-20 BASIC programs.
+//
+// The same seed always yields the same corpus on every platform (the
+// generator uses its own xorshift instead of <random> distributions), so
+// tokenizer engines can be compared on identical input. Needs the keyword
+// tables from hx20tokenizer.cpp to be visible.
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class BasicCorpus {
+    uint32_t state;
+    std::vector<std::string> commands;   // alphabetic statement keywords
+    std::vector<std::string> operators;  // symbolic and word operators
+    std::vector<std::string> functions;
+    size_t commandCursor = 0;
+    size_t functionCursor = 0;
+    int lineNumber = 10;
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    uint32_t below(uint32_t n) { return next() % n; }
+
+    template <typename T>
+    const T& pick(const std::vector<T>& v) { return v[below((uint32_t)v.size())]; }
+
+    // Keywords appear in upper, lower and mixed case
+    std::string cased(const std::string& keyword) {
+        std::string out = keyword;
+        switch (below(6)) {
+            case 0:
+                for (char& c : out) c = (char)std::tolower((unsigned char)c);
+                break;
+            case 1:
+                for (size_t i = 1; i < out.size(); i++) out[i] = (char)std::tolower((unsigned char)out[i]);
+                break;
+            default:
+                break;
+        }
+        return out;
+    }
+
+    std::string variable() {
+        static const char* names[] = {"A", "B", "X", "Y", "I", "J", "N", "K1", "ZZ", "CT"};
+        static const char* suffixes[] = {"", "", "", "%", "!", "#"};
+        return std::string(names[below(10)]) + suffixes[below(6)];
+    }
+
+    std::string stringVariable() {
+        static const char* names[] = {"A$", "B$", "N$", "T$", "X1$"};
+        return names[below(5)];
+    }
+
+    std::string number() {
+        switch (below(4)) {
+            case 0: return std::to_string(below(10));
+            case 1: return std::to_string(below(32768));
+            case 2: return std::to_string(below(1000)) + "." + std::to_string(below(100));
+            default: return "&H" + std::string(1, "0123456789ABCDEF"[below(16)]) + "F";
+        }
+    }
+
+    std::string stringLiteral() {
+        static const char* words[] = {"HELLO", "PRINT", "GOTO 10", "A:B", "REM", "THE END",
+                                      "fortune", "  spaced  ", "'quote", "X=Y+1"};
+        return "\"" + std::string(words[below(10)]) + "\"";
+    }
+
+    std::string expression(int depth = 0) {
+        std::string lhs;
+        switch (below(depth > 1 ? 2 : 4)) {
+            case 0: lhs = variable(); break;
+            case 1: lhs = number(); break;
+            case 2: lhs = cased(pick(functions)) + "(" + expression(depth + 1) + ")"; break;
+            default: lhs = "(" + expression(depth + 1) + ")"; break;
+        }
+        if (depth > 2 || below(3) == 0) return lhs;
+        return lhs + cased(pick(operators)) + expression(depth + 1);
+    }
+
+    std::string statement() {
+        switch (below(14)) {
+            case 0: return variable() + "=" + expression();
+            case 1: return cased("LET") + " " + variable() + "=" + expression();
+            case 2: return cased("PRINT") + " " + stringLiteral() + ";" + expression();
+            case 3: return stringVariable() + "=" + cased("MID$") + "(" + stringVariable() + ",2,3)";
+            case 4: return cased("FOR") + " I=1 " + cased("TO") + " " + number() + " " + cased("STEP") + " 2";
+            case 5: return cased("NEXT") + " I";
+            case 6: return cased("IF") + " " + expression() + " " + cased("THEN") + " " +
+                           std::to_string(lineNumber + 10) + " " + cased("ELSE") + " " + variable() + "=0";
+            case 7: return cased("GOSUB") + " " + std::to_string(10 * (1 + below(100)));
+            case 8: return cased("GOTO") + " " + std::to_string(10 * (1 + below(100)));
+            case 9: return cased("RETURN");
+            case 10: return cased("LOCATE") + " " + number() + "," + number();
+            case 11: return cased("ON") + " " + variable() + " " + cased("GOTO") + " 10,20,30";
+            case 12: return tourCommand();
+            default: return variable() + "=" + tourFunction();
+        }
+    }
+
+    // Walk every keyword in the tables so each one is exercised
+    std::string tourCommand() {
+        const std::string& keyword = commands[commandCursor++ % commands.size()];
+        return cased(keyword) + " " + expression();
+    }
+
+    std::string tourFunction() {
+        const std::string& keyword = functions[functionCursor++ % functions.size()];
+        return cased(keyword) + "(" + expression() + ")";
+    }
+
+    std::string line() {
+        std::string out = std::to_string(lineNumber) + " ";
+        lineNumber += 10;
+        switch (below(10)) {
+            case 0:
+                return out + cased("REM") + " comment with GOTO 100 and \"quotes\" PRINT " + number();
+            case 1:
+                return out + "' " + "note: FOR I=1 TO 10 " + stringLiteral();
+            case 2: {
+                out += cased("DATA") + " ";
+                int n = 4 + (int)below(20);
+                for (int i = 0; i < n; i++) out += (i ? "," : "") + number();
+                return out;
+            }
+            case 3: {
+                // Long multi-statement line close to the HX-20 limit
+                out += statement();
+                while (out.size() < 200) out += ":" + statement();
+                return out;
+            }
+            default: {
+                out += statement();
+                int extra = (int)below(3);
+                for (int i = 0; i < extra; i++) out += ":" + statement();
+                return out;
+            }
+        }
+    }
+
+public:
+    BasicCorpus(uint32_t seed,
+                const std::map<std::string, uint8_t>& commandTable,
+                const std::map<std::string, uint8_t>& functionTable)
+        : state(seed ? seed : 0x9E3779B9u) {
+        for (const auto& pair : commandTable) {
+            bool word = std::isalpha((unsigned char)pair.first[0]);
+            if (word && pair.first != "MOD" && pair.first != "AND" && pair.first != "OR" &&
+                pair.first != "XOR" && pair.first != "EQV" && pair.first != "IMP") {
+                commands.push_back(pair.first);
+            } else if (pair.first != "'") {
+                operators.push_back(pair.first == "MOD" || pair.first == "AND" || pair.first == "OR" ||
+                                    pair.first == "XOR" || pair.first == "EQV" || pair.first == "IMP"
+                                        ? " " + pair.first + " " : pair.first);
+            }
+        }
+        for (const auto& pair : functionTable) functions.push_back(pair.first);
+    }
+
+    // Realistic program of at least targetBytes, LF terminated lines
+    std::string program(size_t targetBytes) {
+        lineNumber = 10;
+        std::string out;
+        while (out.size() < targetBytes && lineNumber < 65000) {
+            out += line() + "\n";
+        }
+        return out;
+    }
+
+    // Inputs aimed at the keyword boundary rules in tokenizeBasicLine
+    static std::string pathological() {
+        static const char* lines[] = {
+            "10 FORK=1TO10:PRINTK:NEXTK",
+            "20 IFX=1THENPRINT\"Y\"ELSEPRINT\"N\"",
+            "30 TOTAL=TOP+STOPPER+ENDX",
+            "40 Print pRINT PrInT print",
+            "50 ENDx=1:ENDXy=2:ENDXY=3",
+            "60 A$=\"unterminated string with PRINT GOTO",
+            "70 REM \"quote inside remark",
+            "80 'PRINT looks like code but is a comment",
+            "90 X=Y<>Z:X=Y<=Z:X=Y>=Z:X=A\\B",
+            "100 GOTO100:GOSUB100:GO TO 100:GO SUB 100",
+            "110 ONERRORGOTO200",
+            "120 X=1E10+1.5E-3-&HFF+&O17",
+            "130 LOAD?\"CAS0:\"",
+            "140 DEFFNA(X)=X*X:DEFINTI-N:DEFSTRS",
+            "150 X=INSTR(A$,\"\")+LEN(\"\")+LEFT$(A$,0)",
+            "160 ",
+            "170",
+            "   180    PRINT   \"leading spaces\"   ",
+            "190 PRINT\"\"\"\"",
+            "200 A=NOTB ANDC ORD XORE",
+            "210 TAPCNT=TAPCNT+1:TIME$=\"12:00:00\"",
+            "220 x=mid$(a$,1,1)+chr$(13)+string$(3,\"*\")",
+        };
+        std::string out;
+        for (const char* line : lines) out += std::string(line) + "\n";
+        std::string longLine = "230 ";
+        while (longLine.size() < 250) longLine += "X=X+1:";
+        out += longLine + "\n";
+        return out;
+    }
+};
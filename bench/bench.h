@@ -0,0 +1,138 @@
+// Shared helpers for the benchmark programs in this directory.
+//
+// Each benchmark is timed by repeating it until at least minSeconds have
+// passed, so short kernels and full encodes get comparable accuracy.
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+struct BenchResult {
+    std::string name;
+    size_t bytes = 0;           // input bytes per iteration
+    size_t samples = 0;         // audio samples produced per iteration
+    size_t iterations = 0;
+    double seconds = 0.0;       // total time over all iterations
+    double allocationsPerLine = -1.0;  // reported when >= 0
+    double sampleRate = 0.0;    // of the samples, for a real-time factor when > 0
+
+    double nsPerByte() const {
+        return bytes ? seconds * 1e9 / ((double)bytes * iterations) : 0.0;
+    }
+    double samplesPerSec() const {
+        return samples ? (double)samples * iterations / seconds : 0.0;
+    }
+    double mbPerSec() const {
+        return bytes ? (double)bytes * iterations / seconds / 1e6 : 0.0;
+    }
+    double realtime() const {
+        return sampleRate > 0 ? samplesPerSec() / sampleRate : 0.0;
+    }
+};
+
+struct BenchOptions {
+    bool json = false;
+    double minSeconds = 0.2;
+    std::string filter;         // only run benchmarks whose name contains this
+};
+
+// Keeps the optimizer from discarding benchmark results
+inline volatile uint64_t benchSink = 0;
+
+inline double benchNow() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline long peakRSSKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;     // kilobytes on Linux
+}
+
+inline bool parseBenchArgs(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            options.json = true;
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.minSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--json] [--min-time <seconds>] [--filter <name>]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run fn repeatedly for at least options.minSeconds. Returns the stored
+// result, or nullptr when the benchmark was filtered out. With a sample
+// rate, the samples are audio at that rate and the row also gives how many
+// times faster than real time they were processed.
+template <typename Fn>
+BenchResult* benchRun(std::vector<BenchResult>& results, const BenchOptions& options,
+              const std::string& name, size_t bytes, size_t samples, double sampleRate, Fn fn) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return nullptr;
+
+    BenchResult r;
+    r.name = name;
+    r.bytes = bytes;
+    r.samples = samples;
+    r.sampleRate = sampleRate;
+
+    fn(); // warm-up
+    double start = benchNow();
+    do {
+        fn();
+        r.iterations++;
+        r.seconds = benchNow() - start;
+    } while (r.seconds < options.minSeconds);
+
+    if (!options.json) {
+        printf("%-32s %10zu B %9zu it %12.2f ns/B %10.2f MB/s", name.c_str(), bytes,
+               r.iterations, r.nsPerByte(), r.mbPerSec());
+        if (samples) printf(" %12.0f samples/s", r.samplesPerSec());
+        if (sampleRate > 0) printf(" %8.0fx real time", r.realtime());
+        printf("\n");
+        fflush(stdout);
+    }
+    results.push_back(r);
+    return &results.back();
+}
+
+template <typename Fn>
+BenchResult* benchRun(std::vector<BenchResult>& results, const BenchOptions& options,
+              const std::string& name, size_t bytes, size_t samples, Fn fn) {
+    return benchRun(results, options, name, bytes, samples, 0.0, fn);
+}
+
+inline void benchReport(const char* suite, const std::vector<BenchResult>& results,
+                        const BenchOptions& options) {
+    if (!options.json) {
+        printf("Peak RSS: %ld KB\n", peakRSSKB());
+        return;
+    }
+
+    printf("{\n  \"suite\": \"%s\",\n  \"peak_rss_kb\": %ld,\n  \"results\": [\n",
+           suite, peakRSSKB());
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        printf("    {\"name\": \"%s\", \"bytes\": %zu, \"iterations\": %zu, "
+               "\"seconds\": %.6f, \"ns_per_byte\": %.3f, \"mb_per_sec\": %.3f, "
+               "\"samples_per_sec\": %.0f",
+               r.name.c_str(), r.bytes, r.iterations, r.seconds, r.nsPerByte(),
+               r.mbPerSec(), r.samplesPerSec());
+        if (r.allocationsPerLine >= 0) {
+            printf(", \"allocations_per_line\": %.2f", r.allocationsPerLine);
+        }
+        if (r.sampleRate > 0) printf(", \"realtime_factor\": %.1f", r.realtime());
+        printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
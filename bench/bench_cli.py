@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""
+End-to-end throughput and startup-latency harness for hx20tape and
+hx20tokenizer.
+
+Runs the real binaries over a generated corpus in three deployment modes:
+
+  per-file  one process per input file (today's usage)
+  batch     one process, all jobs passed with -b
+  batch-sync  hx20tape only: batch with --sync-write, to show what the
+            asynchronous writer overlaps
+  daemon    one long-lived process (-D), jobs sent one at a time and each
+            answer awaited, as a service would use it
+
+and reports process startup time (banner and iostream setup, measured as
+`-h` round trips), wall time, files/sec and the time spent in each phase
+(read, tokenize, block build, render, normalize, write), summed over the
+`--stats=json` reports of every process in the run.
+
+  bench/bench_cli.py [--files 50] [--size 2048] [--repeat 3] [--csv | --json]
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+
+PHASES = ["read", "tokenize", "block_build", "render", "normalize", "write"]
+
+
+def run_quiet(cmd, **kw):
+    return subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, **kw)
+
+
+def add_phases(phases, stderr):
+    """Add the phase seconds of every --stats=json report in stderr."""
+    for line in stderr.decode(errors="replace").splitlines():
+        if line.startswith("{") and '"phases"' in line:
+            for name, seconds in json.loads(line)["phases"].items():
+                phases[name] = phases.get(name, 0.0) + seconds
+
+
+def timed(fn, repeat):
+    """Best-of-repeat wall time of fn(phases) in seconds, with the phase
+    times that run reported."""
+    best, best_phases = None, {}
+    for _ in range(repeat):
+        phases = {}
+        start = time.perf_counter()
+        fn(phases)
+        elapsed = time.perf_counter() - start
+        if best is None or elapsed < best:
+            best, best_phases = elapsed, phases
+    return best, best_phases
+
+
+def startup_seconds(binary, repeat):
+    n = 20
+    best, _ = timed(lambda phases: [run_quiet([binary, "-h"]) for _ in range(n)], repeat)
+    return best / n
+
+
+def per_file(binary, jobs, phases):
+    for job in jobs:
+        cmd = [binary, "-i", job[0], "-o", job[1], "--stats=json"]
+        result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+        if result.returncode != 0:
+            raise SystemExit(f"failed: {' '.join(cmd)}")
+        add_phases(phases, result.stderr)
+
+
+def batch(binary, jobs, phases, extra=()):
+    listing = "".join(f"{i} {o}\n" for i, o in jobs)
+    result = subprocess.run([binary, "-b", "-", "--stats=json", *extra], input=listing.encode(),
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    if result.returncode != 0:
+        raise SystemExit(f"batch run of {binary} failed")
+    add_phases(phases, result.stderr)
+
+
+def daemon(binary, jobs, phases, latencies):
+    proc = subprocess.Popen([binary, "-D", "--stats=json"], stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    for i, o in jobs:
+        start = time.perf_counter()
+        proc.stdin.write(f"{i} {o}\n".encode())
+        proc.stdin.flush()
+        while True:
+            line = proc.stdout.readline().decode()
+            if not line:
+                raise SystemExit(f"daemon {binary} exited early")
+            if line.startswith("OK ") or line.startswith("ERR "):
+                break
+        if line.startswith("ERR "):
+            raise SystemExit(f"daemon {binary} failed on {i}")
+        latencies.append(time.perf_counter() - start)
+    proc.stdin.write(b"quit\n")
+    proc.stdin.close()
+    add_phases(phases, proc.stderr.read())
+    proc.wait()
+
+
+def main():
+    ap = argparse.ArgumentParser(description="hx20 CLI throughput and startup benchmark")
+    ap.add_argument("--files", type=int, default=50, help="corpus size in files (default: 50)")
+    ap.add_argument("--size", type=int, default=2048, help="bytes per program (default: 2048)")
+    ap.add_argument("--repeat", type=int, default=3, help="best-of repetitions (default: 3)")
+    ap.add_argument("--bindir", default=ROOT, help="directory holding the binaries")
+    ap.add_argument("--keep", action="store_true", help="keep the scratch directory")
+    out = ap.add_mutually_exclusive_group()
+    out.add_argument("--csv", action="store_true", help="CSV output")
+    out.add_argument("--json", action="store_true", help="JSON output")
+    args = ap.parse_args()
+
+    tape = os.path.join(args.bindir, "hx20tape")
+    tokenizer = os.path.join(args.bindir, "hx20tokenizer")
+    gen = os.path.join(HERE, "gen_corpus")
+    for b in (tape, tokenizer, gen):
+        if not os.access(b, os.X_OK):
+            raise SystemExit(f"missing {b}; run `make all bench/gen_corpus` first")
+
+    scratch = tempfile.mkdtemp(prefix="hx20bench-")
+    rows = []
+    try:
+        src = os.path.join(scratch, "src")
+        start = time.perf_counter()
+        subprocess.run([gen, src, "--count", str(args.files), "--size", str(args.size)], check=True)
+        corpus_s = time.perf_counter() - start
+        inputs = sorted(os.path.join(src, f) for f in os.listdir(src))
+
+        tools = [
+            ("hx20tokenizer", tokenizer, ".bas"),
+            ("hx20tape", tape, ".wav"),
+        ]
+        for name, binary, ext in tools:
+            outdir = os.path.join(scratch, name)
+            os.makedirs(outdir, exist_ok=True)
+            jobs = [(i, os.path.join(outdir, os.path.basename(i) + ext)) for i in inputs]
+            startup = startup_seconds(binary, args.repeat)
+
+            latencies = []
+            modes = [
+                ("per-file", lambda phases: per_file(binary, jobs, phases)),
+                ("batch", lambda phases: batch(binary, jobs, phases)),
+                ("daemon", lambda phases: daemon(binary, jobs, phases, latencies)),
+            ]
+            if name == "hx20tape":
+                modes.insert(2, ("batch-sync", lambda phases: batch(binary, jobs, phases, ["--sync-write"])))
+            for mode, fn in modes:
+                latencies.clear()
+                wall, phases = timed(fn, args.repeat)
+                row = {
+                    "tool": name,
+                    "mode": mode,
+                    "files": len(jobs),
+                    "bytes_per_file": args.size,
+                    "startup_ms": round(startup * 1e3, 3),
+                    "wall_s": round(wall, 4),
+                    "per_file_ms": round(wall / len(jobs) * 1e3, 3),
+                    "files_per_sec": round(len(jobs) / wall, 1),
+                }
+                for phase in PHASES:
+                    row[f"{phase}_ms"] = round(phases.get(phase, 0.0) * 1e3, 3)
+                if mode == "per-file":
+                    # Work left once process startup is taken out
+                    row["work_ms"] = round(max(0.0, wall / len(jobs) - startup) * 1e3, 3)
+                if latencies:
+                    latencies.sort()
+                    row["latency_p50_ms"] = round(latencies[len(latencies) // 2] * 1e3, 3)
+                    row["latency_max_ms"] = round(latencies[-1] * 1e3, 3)
+                rows.append(row)
+    finally:
+        if args.keep:
+            print(f"scratch kept in {scratch}", file=sys.stderr)
+        else:
+            shutil.rmtree(scratch)
+
+    if args.json:
+        json.dump({"corpus_generation_s": round(corpus_s, 4), "results": rows}, sys.stdout, indent=2)
+        print()
+    elif args.csv:
+        keys = []
+        for r in rows:
+            keys += [k for k in r if k not in keys]
+        print(",".join(keys))
+        for r in rows:
+            print(",".join(str(r.get(k, "")) for k in keys))
+    else:
+        print(f"Corpus: {args.files} files x {args.size} bytes (generated in {corpus_s:.3f} s)")
+        print(f"{'tool':<14} {'mode':<10} {'startup ms':>10} {'wall s':>9} {'ms/file':>9} {'files/s':>9} {'p50 ms':>8}")
+        for r in rows:
+            print(f"{r['tool']:<14} {r['mode']:<10} {r['startup_ms']:>10} {r['wall_s']:>9} "
+                  f"{r['per_file_ms']:>9} {r['files_per_sec']:>9} {r.get('latency_p50_ms', ''):>8}")
+        print()
+        print(f"{'phase ms':<25} " + " ".join(f"{p:>11}" for p in PHASES))
+        for r in rows:
+            print(f"{r['tool']:<14} {r['mode']:<10} " + " ".join(f"{r[p + '_ms']:>11}" for p in PHASES))
+
+
+if __name__ == "__main__":
+    main()
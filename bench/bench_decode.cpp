@@ -0,0 +1,130 @@
+// Microbenchmarks for the tape decoder: channel splitting, resampling and
+// the decode stages, on a tape rendered by the encoder.
+//
+// Build and run with `make bench`, or run bench/bench_decode directly:
+//   bench/bench_decode [--json] [--min-time <seconds>] [--filter <name>]
+//
+// Every resampled capture is also decoded, and the run fails unless the
+// program comes back intact.
+
+#define HX20TAPE_NO_MAIN
+#include "../hx20tape.cpp"
+#include "../hx20decoder.h"
+#include "bench.h"
+
+// Deterministic ASCII BASIC program of roughly the given size, CRLF terminated
+static std::string makeProgram(size_t size) {
+    std::string program;
+    for (int lineNumber = 10; program.size() < size; lineNumber += 10) {
+        program += std::to_string(lineNumber) + " PRINT \"LINE \";" + std::to_string(lineNumber) + ":X=X+" +
+                   std::to_string(lineNumber % 97) + "\r\n";
+    }
+    return program;
+}
+
+// The tape as floats at `rate`, made from the 11025 Hz rendering with the
+// resampler under test (the benchmarks below then time it on its own)
+static std::vector<float> capture(const std::vector<uint8_t>& tape, double rate) {
+    std::vector<float> mono(tape.size()), out;
+    for (size_t i = 0; i < tape.size(); i++) mono[i] = (tape[i] - 128) * (1.0f / 128);
+    if (rate == SAMPLE_RATE) return mono;
+    SincResampler resampler;
+    resampler.begin(SAMPLE_RATE, rate);
+    resampler.process(mono.data(), mono.size(), out);
+    resampler.finish(out);
+    return out;
+}
+
+static bool decodes(const std::vector<float>& samples, double rate, const std::string& program) {
+    TapeDecoder decoder;
+    decoder.begin(rate);
+    decoder.feed(samples.data(), samples.size());
+    decoder.finish();
+    return decoder.files().size() == 1 && decoder.files()[0].complete && decoder.files()[0].data == program;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseBenchArgs(argc, argv, options)) return 1;
+
+    std::string program = makeProgram(4096);
+    HX20TapeEncoder encoder;
+    encoder.encodeBasicProgram(program, "BENCH   ", BasicType::ASCII);
+    ChannelRenderer renderer;
+    encoder.render(renderer);
+    renderer.normalize(100);
+    const std::vector<uint8_t>& tape = renderer.samples();
+
+    std::vector<BenchResult> results;
+    int failures = 0;
+    const size_t CHUNK = 16384;
+
+    // Capture rate to the 22050 Hz analysis rate (and 96 kHz to 11025),
+    // streamed in decoder-sized chunks
+    const double conversions[][2] = {{44100, 22050}, {48000, 22050}, {96000, 22050}, {96000, 11025}, {11025, 22050}};
+    for (const auto& conversion : conversions) {
+        double from = conversion[0], to = conversion[1];
+        std::vector<float> in = capture(tape, from), out;
+        out.reserve((size_t)(in.size() * to / from) + 16);
+        std::string name = "resample/" + std::to_string((int)from) + "-" + std::to_string((int)to);
+        const BenchResult* r = benchRun(results, options, name, in.size() * sizeof(float), in.size(), from, [&] {
+            SincResampler resampler;
+            resampler.begin(from, to);
+            out.clear();
+            for (size_t i = 0; i < in.size(); i += CHUNK) {
+                resampler.process(in.data() + i, std::min(CHUNK, in.size() - i), out);
+            }
+            resampler.finish(out);
+            benchSink += out.size();
+        });
+        if (r && !decodes(out, to, program)) {
+            fprintf(stderr, "FAIL: %s did not decode\n", name.c_str());
+            failures++;
+        }
+    }
+
+    // De-interleaving every channel of a chunk (3 channels has no SIMD path)
+    const unsigned layouts[][2] = {{2, 16}, {4, 8}, {8, 16}, {3, 16}};
+    for (const auto& layout : layouts) {
+        unsigned channels = layout[0], bits = layout[1];
+        std::vector<uint8_t> frames(CHUNK * channels * bits / 8);
+        for (size_t i = 0; i < frames.size(); i++) frames[i] = (uint8_t)(i * 2654435761u >> 13);
+        std::vector<std::vector<float>> planes(channels, std::vector<float>(CHUNK));
+        std::vector<float*> outputs;
+        for (auto& plane : planes) outputs.push_back(plane.data());
+        ChannelSplitter splitter;
+        std::string name = "split/" + std::to_string(channels) + "x" + std::to_string(bits);
+        if (!benchRun(results, options, name, frames.size(), CHUNK * channels, [&] {
+                splitter.split(frames.data(), CHUNK, channels, bits, outputs.data());
+                benchSink += (uint64_t)planes[0][1];
+            })) {
+            continue;
+        }
+        std::vector<float> expected(CHUNK);
+        for (unsigned c = 0; c < channels; c++) {
+            pcmToFloat(frames.data(), CHUNK, channels, bits, c, expected.data());
+            if (expected != planes[c]) {
+                fprintf(stderr, "FAIL: %s channel %u differs from pcmToFloat\n", name.c_str(), c);
+                failures++;
+            }
+        }
+    }
+
+    // The decode stages themselves, at the analysis rates
+    for (double rate : {11025.0, 22050.0, 44100.0}) {
+        std::vector<float> in = capture(tape, rate);
+        std::string name = "decode/" + std::to_string((int)rate);
+        benchRun(results, options, name, in.size() * sizeof(float), in.size(), rate, [&] {
+            TapeDecoder decoder;
+            decoder.begin(rate);
+            for (size_t i = 0; i < in.size(); i += CHUNK) {
+                decoder.feed(in.data() + i, std::min(CHUNK, in.size() - i));
+            }
+            decoder.finish();
+            benchSink += decoder.blockCount();
+        });
+    }
+
+    benchReport("decode", results, options);
+    return failures ? 1 : 0;
+}
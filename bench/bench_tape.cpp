@@ -0,0 +1,186 @@
+// Microbenchmarks for the HX-20 tape encoder.
+//
+// Build and run with `make bench`, or run bench/bench_tape directly:
+//   bench/bench_tape [--json] [--min-time <seconds>] [--filter <name>]
+
+#define HX20TAPE_NO_MAIN
+// hx20stats.h counts every allocation, to hold the encoder's hot path at zero
+#define HX20_STATS_MAIN
+#include "../hx20tape.cpp"
+#include "bench.h"
+
+#include <sstream>
+
+// Access to the encoder's private stages
+struct HX20TapeBench {
+    static void addBytes(HX20TapeEncoder& encoder, const std::vector<uint8_t>& data) {
+        for (uint8_t byte : data) encoder.addByte(byte);
+    }
+    static void addGap(HX20TapeEncoder& encoder, int bytes) {
+        encoder.addInterblockGap(bytes);
+    }
+    static uint16_t crc(HX20TapeEncoder& encoder, const std::vector<uint8_t>& data) {
+        return encoder.calculateCRC({data.data(), data.size()});
+    }
+    static uint16_t crcKermit(HX20TapeEncoder& encoder, const std::vector<uint8_t>& data) {
+        return encoder.calculateCRC_Kermit({data.data(), data.size()});
+    }
+};
+
+// Deterministic ASCII BASIC program of roughly the given size, CRLF terminated
+static std::string makeProgram(size_t size) {
+    std::string program;
+    int lineNumber = 10;
+    while (program.size() < size) {
+        std::ostringstream line;
+        switch (lineNumber % 40) {
+            case 10: line << lineNumber << " PRINT \"LINE \";" << lineNumber << ";A$"; break;
+            case 20: line << lineNumber << " FOR I=1 TO " << lineNumber << ":X=X+I*2:NEXT I"; break;
+            case 30: line << lineNumber << " IF X>100 THEN GOSUB " << lineNumber + 10; break;
+            default: line << lineNumber << " REM SOME COMMENT TEXT " << lineNumber; break;
+        }
+        program += line.str() + "\r\n";
+        lineNumber += 10;
+    }
+    program.resize(size);
+    return program;
+}
+
+static std::vector<uint8_t> makeBytes(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint32_t state = 12345;
+    for (auto& b : data) {
+        state = state * 1103515245 + 12345;
+        b = (uint8_t)(state >> 16);
+    }
+    return data;
+}
+
+// Renders into memory only, so encode timings exclude file I/O
+class NullAudioRenderer : public AudioRenderer {
+public:
+    size_t sampleCount() const { return audioData.size(); }
+};
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseBenchArgs(argc, argv, options)) return 1;
+
+    // normalizeAudio() reports on stdout; keep that out of the results
+    std::ostringstream discard;
+    std::streambuf* coutBuf = std::cout.rdbuf(discard.rdbuf());
+
+    std::vector<BenchResult> results;
+    const size_t sizes[] = {1024, 4096, 16384, 65536};
+
+    // addPulse: raw sample generation for one short and one long pulse
+    {
+        NullAudioRenderer audio;
+        size_t pulses = 4096;
+        audio.addPulse(PULSE_SHORT);
+        audio.addPulse(PULSE_LONG);
+        size_t perPair = audio.sampleCount();
+        benchRun(results, options, "addPulse", 0, pulses * perPair / 2, [&] {
+            PulseStream empty;
+            audio.begin(empty);
+            for (size_t i = 0; i < pulses / 2; i++) {
+                audio.addPulse(PULSE_SHORT);
+                audio.addPulse(PULSE_LONG);
+            }
+            benchSink += audio.sampleCount();
+        });
+    }
+
+    for (size_t size : sizes) {
+        std::vector<uint8_t> data = makeBytes(size);
+        std::string suffix = "/" + std::to_string(size);
+
+        // Byte framing and gap generation into the pulse stream
+        benchRun(results, options, "addByte" + suffix, size, 0, [&] {
+            HX20TapeEncoder encoder;
+            HX20TapeBench::addBytes(encoder, data);
+            benchSink += encoder.pulses().codes.size();
+        });
+        benchRun(results, options, "addInterblockGap" + suffix, size, 0, [&] {
+            HX20TapeEncoder encoder;
+            HX20TapeBench::addGap(encoder, (int)size);
+            benchSink += encoder.pulses().codes.size();
+        });
+
+        // Byte and gap rendering from the pulse stream to samples
+        {
+            HX20TapeEncoder encoder;
+            HX20TapeBench::addBytes(encoder, data);
+            NullAudioRenderer audio;
+            encoder.render(audio);
+            size_t samples = audio.sampleCount();
+            benchRun(results, options, "renderBytes" + suffix, size, samples, [&] {
+                encoder.render(audio);
+                benchSink += audio.sampleCount();
+            });
+        }
+
+        HX20TapeEncoder encoder;
+        benchRun(results, options, "calculateCRC" + suffix, size, 0, [&] {
+            benchSink += HX20TapeBench::crc(encoder, data);
+        });
+        benchRun(results, options, "calculateCRC_Kermit" + suffix, size, 0, [&] {
+            benchSink += HX20TapeBench::crcKermit(encoder, data);
+        });
+    }
+
+    // A reused encoder must build blocks without touching the heap: the
+    // arena covers block assembly and the stream keeps its capacity
+    bool allocationFree = true;
+    for (size_t size : sizes) {
+        std::string program = makeProgram(size);
+        HX20TapeEncoder encoder;
+        encoder.encodeBasicProgram(program, "BENCH   ", BasicType::ASCII);
+        size_t exact = encoder.pulses().codes.size();
+        encoder.reset();
+
+        size_t before = allocationCounter().load();
+        encoder.encodeBasicProgram(program, "BENCH   ", BasicType::ASCII);
+        size_t allocations = allocationCounter().load() - before;
+        if (allocations != 0 || encoder.pulses().codes.capacity() != exact) {
+            fprintf(stderr, "encodeBasicProgram/%zu: %zu heap allocations, stream capacity %zu for %zu codes\n",
+                    size, allocations, encoder.pulses().codes.capacity(), exact);
+            allocationFree = false;
+        }
+    }
+
+    const std::string wavFile = "bench_tape_output.wav";
+    for (size_t size : sizes) {
+        std::string program = makeProgram(size);
+        std::string suffix = "/" + std::to_string(size);
+
+        HX20TapeEncoder encoder;
+        encoder.encodeBasicProgram(program, "BENCH   ", BasicType::ASCII);
+        NullAudioRenderer audio;
+        encoder.render(audio);
+        size_t samples = audio.sampleCount();
+
+        benchRun(results, options, "normalizeAudio" + suffix, size, samples, [&] {
+            audio.normalizeAudio(95);
+        });
+        benchRun(results, options, "saveToWAV" + suffix, size, samples, [&] {
+            benchSink += audio.saveToWAV(wavFile, 0);
+        });
+
+        // Full encode: program text to normalized samples in memory
+        benchRun(results, options, "encodeBasicProgram" + suffix, size, samples, [&] {
+            HX20TapeEncoder full;
+            full.encodeBasicProgram(program, "BENCH   ", BasicType::ASCII);
+            NullAudioRenderer out;
+            full.render(out);
+            out.normalizeAudio(95);
+            benchSink += out.sampleCount();
+        });
+    }
+    std::remove(wavFile.c_str());
+
+    std::cout.rdbuf(coutBuf);
+    benchReport("tape", results, options);
+    if (!options.json) printf("Hot-path allocations: %s\n", allocationFree ? "none" : "FOUND");
+    return allocationFree ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// Tokenizer/detokenizer benchmarks over a seeded synthetic BASIC corpus.
+//
+// Every program is round-tripped while it is measured: the detokenized text
+// must match the source. Keyword case and whitespace outside string
+// literals are not kept by the tokenizer, so both sides are normalized
+// before they are compared.
+// Renumbering away and back again must reproduce the tokenized image
+// exactly (the corpus numbers its lines 10, 20, ...). Mismatches are
+// reported and make the benchmark exit non-zero.
+//
+//   bench/bench_tokenizer [--json] [--min-time <seconds>] [--filter <name>]
+
+#define HX20TOKENIZER_NO_MAIN
+// hx20stats.h counts every allocation, for allocations-per-line figures
+#define HX20_STATS_MAIN
+#include "../hx20tokenizer.cpp"
+#include "basic_corpus.h"
+#include "bench.h"
+
+static size_t countLines(const std::string& text) {
+    return (size_t)std::count(text.begin(), text.end(), '\n');
+}
+
+// The source as the detokenizer writes it back, for comparison: one line
+// per LF with CRs dropped, upper case and no spaces outside string
+// literals, and lines that hold no more than a line number left out
+static std::string normalized(const std::string& text) {
+    std::string out, line;
+    bool inString = false;
+    for (size_t i = 0; i <= text.size(); i++) {
+        char ch = i < text.size() ? text[i] : '\n';
+        if (ch == '\n') {
+            size_t digits = line.find_first_not_of("0123456789");
+            if (digits != std::string::npos && digits > 0) out += line + "\n";
+            line.clear();
+            inString = false;
+            continue;
+        }
+        if (ch == '"') inString = !inString;
+        if (ch == '\r' || (ch == ' ' && !inString)) continue;
+        line += inString ? ch : (char)std::toupper((unsigned char)ch);
+    }
+    return out;
+}
+
+// Returns true when detokenize(tokenize(text)) gives back the source, up to
+// the spacing and keyword case the tokenizer does not keep
+static bool roundTrip(const std::string& name, const std::string& text) {
+    std::string source = normalized(text);
+    std::string back = normalized(detokenizeBasicProgram(tokenizeBasicProgram(text)));
+    if (source == back) return true;
+
+    size_t at = 0;
+    while (at < source.size() && at < back.size() && source[at] == back[at]) at++;
+    size_t lineStart = source.rfind('\n', at);
+    lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+    size_t backStart = back.rfind('\n', at);
+    backStart = backStart == std::string::npos ? 0 : backStart + 1;
+    fprintf(stderr, "Round-trip mismatch in %s at byte %zu:\n  source: %s\n  back:   %s\n", name.c_str(), at,
+            source.substr(lineStart, source.find('\n', at) - lineStart).c_str(),
+            back.substr(backStart, back.find('\n', at) - backStart).c_str());
+    return false;
+}
+
+// Returns true when renumbering to a distant range and back to 10,10 is the identity
+static bool renumberRoundTrip(const std::string& name, const std::string& tokenized) {
+    std::string image = tokenized;
+    RenumberReport report;
+    std::string error;
+    if (!renumberTokenizedProgram(image, 50000, 3, report, error) ||
+        !renumberTokenizedProgram(image, 10, 10, report, error)) {
+        fprintf(stderr, "Renumber failed in %s: %s\n", name.c_str(), error.c_str());
+        return false;
+    }
+    if (image == tokenized) return true;
+    size_t at = 0;
+    while (at < image.size() && at < tokenized.size() && image[at] == tokenized[at]) at++;
+    fprintf(stderr, "Renumber round-trip mismatch in %s at byte %zu\n", name.c_str(), at);
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseBenchArgs(argc, argv, options)) return 1;
+
+    std::vector<BenchResult> results;
+    bool roundTripOK = true;
+
+    struct Workload { std::string name; std::string text; };
+    std::vector<Workload> workloads;
+    const size_t sizes[] = {1024, 8192, 32768};
+    for (size_t size : sizes) {
+        BasicCorpus corpus(20240601u + (uint32_t)size, basicCommands, basicFunctions);
+        workloads.push_back({"corpus/" + std::to_string(size), corpus.program(size)});
+    }
+    workloads.push_back({"pathological", BasicCorpus::pathological()});
+
+    for (const Workload& w : workloads) {
+        roundTripOK &= roundTrip(w.name, w.text);
+
+        std::string tokenized = tokenizeBasicProgram(w.text);
+        double lines = (double)std::max<size_t>(1, countLines(w.text));
+
+        size_t before = allocationCounter().load();
+        BenchResult* r = benchRun(results, options, "tokenize/" + w.name, w.text.size(), 0, [&] {
+            benchSink += tokenizeBasicProgram(w.text).size();
+        });
+        if (r) r->allocationsPerLine = (allocationCounter().load() - before) / (lines * (r->iterations + 1));
+
+        before = allocationCounter().load();
+        r = benchRun(results, options, "detokenize/" + w.name, tokenized.size(), 0, [&] {
+            benchSink += detokenizeBasicProgram(tokenized).size();
+        });
+        if (r) r->allocationsPerLine = (allocationCounter().load() - before) / (lines * (r->iterations + 1));
+
+        roundTripOK &= renumberRoundTrip(w.name, tokenized);
+        before = allocationCounter().load();
+        r = benchRun(results, options, "renumber/" + w.name, tokenized.size(), 0, [&] {
+            std::string image = tokenized;
+            RenumberReport report;
+            std::string error;
+            renumberTokenizedProgram(image, 1000, 10, report, error);
+            benchSink += image.size();
+        });
+        if (r) r->allocationsPerLine = (allocationCounter().load() - before) / (lines * (r->iterations + 1));
+
+        // Every tokenized workload must pass the structural validator
+        ValidationResult validation;
+        if (!validateTokenizedProgram((const uint8_t*)tokenized.data(), tokenized.size(), validation)) {
+            fprintf(stderr, "Validator rejected %s: %s\n", w.name.c_str(),
+                    validation.issues.empty() ? "?" : validation.issues[0].message.c_str());
+            roundTripOK = false;
+        }
+        before = allocationCounter().load();
+        r = benchRun(results, options, "validate/" + w.name, tokenized.size(), 0, [&] {
+            ValidationResult result;
+            benchSink += validateTokenizedProgram((const uint8_t*)tokenized.data(), tokenized.size(), result);
+        });
+        if (r) r->allocationsPerLine = (allocationCounter().load() - before) / (lines * (r->iterations + 1));
+
+        // One-line edit in the middle of the program, for comparison with
+        // a detokenize/retokenize round trip
+        std::vector<LineIndexEntry> index;
+        std::string error;
+        if (indexTokenizedProgram(tokenized, index, error) && !index.empty()) {
+            std::vector<LinePatch> patches(1);
+            patches[0].kind = LinePatch::REPLACE;
+            patches[0].number = index[index.size() / 2].number;
+            patches[0].text = "PRINT \"PATCHED\":GOSUB 10";
+            before = allocationCounter().load();
+            r = benchRun(results, options, "patch/" + w.name, tokenized.size(), 0, [&] {
+                std::string image = tokenized;
+                PatchReport report;
+                patchTokenizedProgram(image, patches, report, error);
+                benchSink += image.size();
+            });
+            if (r) r->allocationsPerLine = (allocationCounter().load() - before) / (lines * (r->iterations + 1));
+        }
+    }
+
+    if (!options.json) {
+        for (const BenchResult& r : results) {
+            if (r.allocationsPerLine < 0) continue;
+            printf("%-32s %10.2f allocations/line\n", r.name.c_str(), r.allocationsPerLine);
+        }
+    }
+    benchReport("tokenizer", results, options);
+    if (!options.json) printf("Round trip: %s\n", roundTripOK ? "OK" : "MISMATCH");
+    return roundTripOK ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+// Writes a seeded synthetic BASIC corpus to a directory, one program per file.
+//
+//   bench/gen_corpus <dir> [--count <n>] [--size <bytes>] [--seed <n>]
+
+#define HX20TOKENIZER_NO_MAIN
+#include "../hx20tokenizer.cpp"
+#include "basic_corpus.h"
+
+#include <filesystem>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <dir> [--count <n>] [--size <bytes>] [--seed <n>]\n";
+        return 1;
+    }
+
+    std::string dir = argv[1];
+    size_t count = 100;
+    size_t size = 2048;
+    uint32_t seed = 1;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--count") == 0) count = strtoul(argv[i + 1], nullptr, 10);
+        else if (strcmp(argv[i], "--size") == 0) size = strtoul(argv[i + 1], nullptr, 10);
+        else if (strcmp(argv[i], "--seed") == 0) seed = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+    }
+
+    std::filesystem::create_directories(dir);
+    for (size_t i = 0; i < count; i++) {
+        BasicCorpus corpus(seed + (uint32_t)i, basicCommands, basicFunctions);
+        char name[32];
+        snprintf(name, sizeof(name), "prog%05zu.txt", i);
+        std::ofstream out(std::filesystem::path(dir) / name, std::ios::binary);
+        out << corpus.program(size);
+        if (!out) {
+            std::cerr << "Error: Could not write " << name << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,410 @@
+// Loopback stress test: random programs through the encoder, a seeded
+// model of a worn cassette deck, and back through the decoder.
+//
+// Every trial generates an ASCII or tokenized program and encodes it with
+// HX20TapeEncoder. The rendered audio is played through each timing
+// profile: tape speed, wow and flutter, plus a common channel with head
+// roll-off, DC drift, hiss and dropouts. The result is decoded with the
+// hx20decode stages and compared with what was sent. Everything runs in
+// memory, so no audio hardware or files are needed. Trial N uses the same
+// program and noise on every run and every machine.
+//
+//   bench/loopback [--trials <n>] [--seed <n>] [-j <n>] [--snr <dB>] [--json]
+//
+// Build and run with `make stress`.
+
+#define HX20TAPE_NO_MAIN
+#include "../hx20tape.cpp"
+#define HX20TOKENIZER_NO_MAIN
+#include "../hx20tokenizer.cpp"
+#include "../hx20decoder.h"
+#include "basic_corpus.h"
+#include "bench.h"
+
+#include <atomic>
+#include <cmath>
+
+struct TimingProfile {
+    const char* name;
+    double speed;               // 1.0 = nominal; above 1 the tape runs fast
+    double wow, wowHz;          // slow speed variation, fraction of speed
+    double flutter, flutterHz;  // fast speed variation
+};
+
+const TimingProfile PROFILES[] = {
+    {"nominal", 1.00, 0, 0, 0, 0},
+    {"slow-5%", 0.95, 0, 0, 0, 0},
+    {"fast-5%", 1.05, 0, 0, 0, 0},
+    {"slow-10%", 0.90, 0, 0, 0, 0},
+    {"fast-10%", 1.10, 0, 0, 0, 0},
+    {"wow", 1.00, 0.015, 0.5, 0.003, 8},
+    {"worn", 0.97, 0.025, 0.6, 0.006, 11},
+};
+const size_t PROFILE_COUNT = sizeof(PROFILES) / sizeof(PROFILES[0]);
+
+struct ChannelOptions {
+    double rate = 22050;        // capture sample rate
+    double snrDb = 24;
+    double dropoutsPerSecond = 0.02;
+    double lowPassHz = 3500;    // playback head roll-off
+};
+
+// xorshift64* plus Box-Muller: the same numbers on every platform
+class TrialRandom {
+    uint64_t state;
+    bool haveSpare = false;
+    double spare = 0;
+
+public:
+    explicit TrialRandom(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    double gaussian() {
+        if (haveSpare) {
+            haveSpare = false;
+            return spare;
+        }
+        double u = std::max(uniform(), 1e-300), v = uniform();
+        double r = std::sqrt(-2 * std::log(u));
+        spare = r * std::sin(2 * M_PI * v);
+        haveSpare = true;
+        return r * std::cos(2 * M_PI * v);
+    }
+};
+
+// Gaussian samples for the hiss, drawn once; a trial picks entries at random
+const std::vector<float>& noiseTable() {
+    static const std::vector<float> table = [] {
+        TrialRandom random(0x5EED);
+        std::vector<float> t(1 << 16);
+        for (float& x : t) x = (float)random.gaussian();
+        return t;
+    }();
+    return table;
+}
+
+// sin(2 pi f t + phase) a sample at a time, by rotation
+class Oscillator {
+    double c, s, cr, sr;
+
+public:
+    Oscillator(double hz, double rate, double phase)
+        : c(std::cos(phase)), s(std::sin(phase)), cr(std::cos(2 * M_PI * hz / rate)), sr(std::sin(2 * M_PI * hz / rate)) {}
+    double next() {
+        double value = s;
+        double nc = c * cr - s * sr;
+        s = s * cr + c * sr;
+        c = nc;
+        return value;
+    }
+};
+
+inline uint64_t mixSeed(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Keeps the rendered samples instead of writing them
+class LoopbackRenderer : public AudioRenderer {
+public:
+    const std::vector<uint8_t>& samples() const { return audioData; }
+};
+
+// Play the rendered tape through one profile. The read position advances by
+// the momentary tape speed; the rest of the channel follows.
+void playTape(const std::vector<uint8_t>& tape, const TimingProfile& profile, const ChannelOptions& channel,
+              TrialRandom& random, std::vector<float>& out) {
+    out.clear();
+    if (tape.size() < 2) return;
+    uint8_t low = 255, high = 0;
+    for (uint8_t s : tape) {
+        low = std::min(low, s);
+        high = std::max(high, s);
+    }
+    const float center = (low + high) / 2.0f;
+    const float scale = high > low ? 0.74f / ((high - low) / 2.0f) : 0;
+
+    const double step = SAMPLE_RATE / channel.rate;
+    Oscillator wow(profile.wowHz, channel.rate, 2 * M_PI * random.uniform());
+    Oscillator flutter(profile.flutterHz, channel.rate, 2 * M_PI * random.uniform());
+    Oscillator dcDrift(0.2, channel.rate, 2 * M_PI * random.uniform());
+    const double gain = 0.3 + 0.7 * random.uniform();
+    const double drift = 0.05 * random.uniform();
+    const float lowAlpha = (float)(1 - std::exp(-2 * M_PI * channel.lowPassHz / channel.rate));
+    const float noise = (float)(0.74 * 0.7 * gain / std::pow(10.0, channel.snrDb / 20));
+    const double dropoutChance = channel.dropoutsPerSecond / channel.rate;
+    const std::vector<float>& hiss = noiseTable();
+
+    out.reserve((size_t)(tape.size() / step / profile.speed * 1.05) + 16);
+    double position = 0;
+    float smooth = 0;
+    size_t dropoutLeft = 0;
+    double dropoutDepth = 1;
+    for (;;) {
+        position += step * profile.speed * (1 + profile.wow * wow.next() + profile.flutter * flutter.next());
+        size_t k = (size_t)position;
+        if (k + 1 >= tape.size()) break;
+        float frac = (float)(position - k);
+        float x = ((tape[k] + (tape[k + 1] - tape[k]) * frac) - center) * scale;
+
+        smooth += lowAlpha * (x - smooth);
+        uint64_t r = random.next();
+        if (dropoutLeft == 0 && (r & 0xFFFFFFFF) * (1.0 / 4294967296.0) < dropoutChance) {
+            dropoutLeft = (size_t)(channel.rate * (0.002 + 0.018 * random.uniform()));
+            dropoutDepth = 0.1 + 0.5 * random.uniform();
+        }
+        double level = gain;
+        if (dropoutLeft) {
+            dropoutLeft--;
+            level *= dropoutDepth;
+        }
+        double y = smooth * level + drift * dcDrift.next() + noise * hiss[r >> 48];
+        out.push_back((float)std::max(-1.0, std::min(1.0, y)));
+    }
+}
+
+struct TrialResult {
+    bool recovered = false;         // the program came back byte for byte
+    uint64_t bitsSent = 0;          // in data block copies that were received
+    uint64_t bitErrors = 0;
+    uint32_t copiesSent = 0;        // data block copies
+    uint32_t copiesLost = 0;        // never framed
+    uint32_t blocksSent = 0;        // blocks of every type, both copies counted once
+    uint32_t blocksFailed = 0;      // lost after pairing and repair
+    uint32_t blocksMerged = 0;
+    double audioSeconds = 0;
+};
+
+// Bytes of a data block copy as sent: ID, 256 data bytes, CRC (LSB first)
+void expectedDataBlock(const std::string& program, const BlockInfo& info, uint8_t* bytes) {
+    bytes[0] = 'D';
+    bytes[1] = (uint8_t)(info.number >> 8);
+    bytes[2] = (uint8_t)info.number;
+    bytes[3] = info.copy;
+    size_t offset = (size_t)(info.number - 1) * DATA_BLOCK_SIZE;
+    memset(bytes + 4, 0, DATA_BLOCK_SIZE);
+    if (offset < program.size()) {
+        memcpy(bytes + 4, program.data() + offset, std::min((size_t)DATA_BLOCK_SIZE, program.size() - offset));
+    }
+    bytes[4 + DATA_BLOCK_SIZE] = (uint8_t)info.crc;
+    bytes[5 + DATA_BLOCK_SIZE] = (uint8_t)(info.crc >> 8);
+}
+
+// Decode, then line the received block copies up with the sent ones: by ID
+// where it is readable, otherwise by position
+void decodeAndCompare(const std::vector<float>& capture, double rate, bool adaptive, const std::string& program,
+                      const std::vector<BlockInfo>& sent, TrialResult& result) {
+    EdgeDetector edges;
+    PulseFramer framer;
+    framer.adaptive = adaptive;
+    BlockAssembler assembler;
+    std::vector<TapeBlock> received;
+    edges.begin(rate);
+    edges.process(capture.data(), capture.size(), [&](const TapePulse& pulse) {
+        framer.feed(pulse, [&](const TapeBlock& block) {
+            received.push_back(block);
+            assembler.add(block);
+        });
+    });
+    assembler.finish();
+
+    std::vector<bool> matched(sent.size(), false);
+    size_t cursor = 0;
+    uint8_t expected[TapeFormat::MAX_BLOCK];
+    for (const TapeBlock& block : received) {
+        size_t match = sent.size();
+        for (size_t i = cursor; i < std::min(sent.size(), cursor + 4); i++) {
+            if (sent[i].type == block.type && sent[i].number == block.number && sent[i].copy == block.copy) {
+                match = i;
+                break;
+            }
+        }
+        if (match == sent.size() && cursor < sent.size() && sent[cursor].length == block.length) match = cursor;
+        if (match == sent.size()) continue;
+        matched[match] = true;
+        cursor = match + 1;
+        if (sent[match].type != 'D') continue;
+        expectedDataBlock(program, sent[match], expected);
+        size_t size = 4 + DATA_BLOCK_SIZE + 2;
+        result.bitsSent += size * 8;
+        for (size_t i = 0; i < size; i++) result.bitErrors += __builtin_popcount(expected[i] ^ block.bytes[i]);
+    }
+    for (size_t i = 0; i < sent.size(); i++) {
+        if (sent[i].type != 'D') continue;
+        result.copiesSent++;
+        result.copiesLost += !matched[i];
+    }
+
+    // A block counts once, however many copies arrived
+    std::vector<std::pair<char, uint16_t>> good;
+    for (const BlockRecord& record : assembler.records) {
+        if (record.status != BlockRecord::LOST) good.push_back({record.type, record.number});
+        result.blocksMerged += record.status == BlockRecord::MERGED;
+    }
+    std::sort(good.begin(), good.end());
+    good.erase(std::unique(good.begin(), good.end()), good.end());
+    for (const BlockInfo& info : sent) {
+        if (info.copy != 0) continue;
+        result.blocksSent++;
+        result.blocksFailed += !std::binary_search(good.begin(), good.end(), std::make_pair(info.type, info.number));
+    }
+    result.recovered = !assembler.files.empty() && assembler.files.front().complete &&
+                       assembler.files.front().data == program;
+}
+
+struct LoopbackOptions {
+    size_t trials = 200;        // per profile
+    uint64_t seed = 1;
+    unsigned jobs = 0;
+    size_t maxBytes = 2048;
+    std::string profile;        // run only this one
+    bool json = false;
+    bool fixedThreshold = false;    // decode with the fixed 750 µs threshold
+    double failAbove = -1;      // exit 1 if a profile's failure rate is higher
+    ChannelOptions channel;
+};
+
+// The program for trial `n`: the same on every run, for every profile
+std::string trialProgram(uint64_t seed, size_t n, size_t maxBytes, BasicType& type) {
+    TrialRandom random(mixSeed(seed * 0x100000001b3ull + n));
+    BasicCorpus corpus((uint32_t)random.next(), basicCommands, basicFunctions);
+    std::string text = corpus.program(64 + random.next() % std::max<size_t>(1, maxBytes - 64));
+    if (random.next() & 1) {
+        type = BasicType::TOKEN;
+        return tokenizeBasicProgram(text);
+    }
+    type = BasicType::ASCII;
+    std::string crlf;
+    for (char c : text) crlf += c == '\n' ? std::string("\r\n") : std::string(1, c);
+    return crlf;
+}
+
+int main(int argc, char* argv[]) {
+    LoopbackOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+        if (arg == "--trials" && more) {
+            options.trials = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && more) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-j" && more) {
+            options.jobs = (unsigned)atoi(argv[++i]);
+        } else if (arg == "--max-bytes" && more) {
+            options.maxBytes = std::max<size_t>(128, strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--profile" && more) {
+            options.profile = argv[++i];
+        } else if (arg == "--snr" && more) {
+            options.channel.snrDb = atof(argv[++i]);
+        } else if (arg == "--dropouts" && more) {
+            options.channel.dropoutsPerSecond = atof(argv[++i]);
+        } else if (arg == "--rate" && more) {
+            options.channel.rate = std::max(8000.0, atof(argv[++i]));
+        } else if (arg == "--fail-above" && more) {
+            options.failAbove = atof(argv[++i]);
+        } else if (arg == "--fixed-threshold") {
+            options.fixedThreshold = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--trials <n per profile>] [--seed <n>] [-j <n>] [--max-bytes <n>]\n"
+                    "          [--profile <name>] [--snr <dB>] [--dropouts <per s>] [--rate <Hz>]\n"
+                    "          [--fixed-threshold] [--fail-above <rate>] [--json]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<const TimingProfile*> profiles;
+    for (const TimingProfile& p : PROFILES) {
+        if (options.profile.empty() || options.profile == p.name) profiles.push_back(&p);
+    }
+    if (profiles.empty()) {
+        fprintf(stderr, "Unknown profile '%s'\n", options.profile.c_str());
+        return 1;
+    }
+
+    initReverseMaps();
+    std::vector<TrialResult> results(options.trials * profiles.size());
+    double start = benchNow();
+    parallelFor(options.trials, options.jobs, [&](size_t n) {
+        BasicType type;
+        std::string program = trialProgram(options.seed, n, options.maxBytes, type);
+        HX20TapeEncoder encoder;
+        encoder.encodeBasicProgram(program, "P" + std::to_string(n % 10000000), type);
+        LoopbackRenderer tape;
+        encoder.render(tape);
+
+        std::vector<float> capture;
+        for (size_t p = 0; p < profiles.size(); p++) {
+            TrialRandom random(mixSeed(options.seed ^ mixSeed(n * PROFILE_COUNT + p)));
+            playTape(tape.samples(), *profiles[p], options.channel, random, capture);
+            TrialResult& result = results[p * options.trials + n];
+            result.audioSeconds = capture.size() / options.channel.rate;
+            decodeAndCompare(capture, options.channel.rate, !options.fixedThreshold, program, encoder.pulses().blocks, result);
+        }
+    });
+    double seconds = benchNow() - start;
+
+    if (!options.json) {
+        printf("%-10s %7s %7s %12s %10s %8s %14s %8s\n", "Profile", "Trials", "Failed", "Bit errors", "BER",
+               "Lost", "Block failures", "Merged");
+    } else {
+        printf("{\n  \"suite\": \"loopback\",\n  \"seed\": %llu,\n  \"snr_db\": %.1f,\n  \"profiles\": [\n",
+               (unsigned long long)options.seed, options.channel.snrDb);
+    }
+    int status = 0;
+    double audio = 0;
+    for (size_t p = 0; p < profiles.size(); p++) {
+        TrialResult sum;
+        size_t failed = 0;
+        for (size_t n = 0; n < options.trials; n++) {
+            const TrialResult& r = results[p * options.trials + n];
+            failed += !r.recovered;
+            sum.bitsSent += r.bitsSent;
+            sum.bitErrors += r.bitErrors;
+            sum.copiesSent += r.copiesSent;
+            sum.copiesLost += r.copiesLost;
+            sum.blocksSent += r.blocksSent;
+            sum.blocksFailed += r.blocksFailed;
+            sum.blocksMerged += r.blocksMerged;
+            audio += r.audioSeconds;
+        }
+        double ber = sum.bitsSent ? (double)sum.bitErrors / sum.bitsSent : 0;
+        double lost = sum.copiesSent ? (double)sum.copiesLost / sum.copiesSent : 0;
+        double blockRate = sum.blocksSent ? (double)sum.blocksFailed / sum.blocksSent : 0;
+        double failRate = options.trials ? (double)failed / options.trials : 0;
+        if (options.failAbove >= 0 && failRate > options.failAbove) status = 1;
+        if (!options.json) {
+            printf("%-10s %7zu %7zu %12llu %10.2e %7.3f%% %6u (%5.3f%%) %8u\n", profiles[p]->name, options.trials, failed,
+                   (unsigned long long)sum.bitErrors, ber, 100 * lost, sum.blocksFailed, 100 * blockRate,
+                   sum.blocksMerged);
+        } else {
+            printf("    {\"name\": \"%s\", \"trials\": %zu, \"failed\": %zu, \"bits\": %llu, \"bit_errors\": %llu, "
+                   "\"ber\": %.3e, \"copies_lost_rate\": %.5f, \"blocks\": %u, \"block_failures\": %u, "
+                   "\"block_failure_rate\": %.5f, \"merged\": %u}%s\n",
+                   profiles[p]->name, options.trials, failed, (unsigned long long)sum.bitsSent,
+                   (unsigned long long)sum.bitErrors, ber, lost, sum.blocksSent, sum.blocksFailed, blockRate,
+                   sum.blocksMerged, p + 1 < profiles.size() ? "," : "");
+        }
+    }
+    size_t total = options.trials * profiles.size();
+    if (!options.json) {
+        printf("%zu trials in %.2f s: %.1f trials/s, %.0fx real time\n", total, seconds, total / seconds,
+               audio / seconds);
+    } else {
+        printf("  ],\n  \"trials\": %zu,\n  \"seconds\": %.3f,\n  \"trials_per_second\": %.2f,\n"
+               "  \"realtime_factor\": %.1f\n}\n",
+               total, seconds, total / seconds, audio / seconds);
+    }
+    return status;
+}
@@ -0,0 +1,538 @@
+// Asynchronous file output for batch encoding.
+//
+// submit() hands a finished file image to a background I/O thread and
+// returns at once, so the caller renders the next file while earlier ones
+// are still being written. On Linux the I/O thread drives io_uring through
+// the raw system calls and keeps chunk writes for many files in flight at
+// the same time. Elsewhere, or when the kernel refuses io_uring (kernels
+// before 5.6 that lack IORING_OP_WRITE, seccomp filters) or the ring
+// breaks mid-batch, the same thread falls back to blocking pwrite() calls.
+// Files of at least directMinBytes are opened with O_DIRECT where the
+// filesystem allows it; their buffers are padded to a whole number of
+// pages and the file is truncated back afterwards.
+//
+// Build with -DHX20_NO_IO_URING to leave the io_uring back-end out.
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hx20trace.h"
+
+#if defined(__linux__) && !defined(HX20_NO_IO_URING) && __has_include(<linux/io_uring.h>)
+#define HX20_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Page-aligned, move-only byte buffer holding one complete output file
+class WriteBuffer {
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    size_t padded = 0;
+
+public:
+    static const size_t ALIGN = 4096;
+
+    WriteBuffer() = default;
+    explicit WriteBuffer(size_t size)
+        : length(size), padded((size + ALIGN - 1) / ALIGN * ALIGN) {
+        if (padded == 0) padded = ALIGN;
+        bytes = static_cast<uint8_t*>(std::aligned_alloc(ALIGN, padded));
+        if (!bytes) throw std::bad_alloc();
+        memset(bytes + length, 0, padded - length);
+    }
+    WriteBuffer(WriteBuffer&& other) noexcept { *this = std::move(other); }
+    WriteBuffer& operator=(WriteBuffer&& other) noexcept {
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+        std::swap(padded, other.padded);
+        return *this;
+    }
+    WriteBuffer(const WriteBuffer&) = delete;
+    WriteBuffer& operator=(const WriteBuffer&) = delete;
+    ~WriteBuffer() { std::free(bytes); }
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    size_t paddedSize() const { return padded; }    // multiple of ALIGN
+};
+
+struct AsyncWriterOptions {
+    size_t chunkBytes = 1 << 20;            // per write request, multiple of ALIGN
+    unsigned queueDepth = 32;               // io_uring writes in flight
+    size_t maxPendingBytes = 256u << 20;    // submit() blocks above this
+    size_t directMinBytes = 0;              // O_DIRECT threshold, 0 = never
+    bool useIoUring = true;
+};
+
+#ifdef HX20_HAVE_IO_URING
+// Minimal io_uring submission/completion ring over the raw system calls
+class IoUring {
+    int fd = -1;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    io_uring_cqe* cqes = nullptr;
+    unsigned entries = 0;
+    unsigned unsubmitted = 0;
+
+    // IORING_OP_WRITE came in 5.6 together with the probe; older kernels
+    // set up a ring but fail every write with -EINVAL
+    bool supportsWrite() {
+        const unsigned ops = 256;
+        std::vector<uint8_t> storage(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, ops) < 0) return false;
+        return IORING_OP_WRITE <= probe->last_op &&
+               (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    }
+
+public:
+    ~IoUring() { shutdown(); }
+
+    bool init(unsigned depth) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0) return false;
+        if (!supportsWrite()) return false;
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = single ? sqRing
+                        : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    unsigned capacity() const { return entries; }
+
+    // Queue a write; it reaches the kernel with the next enter()
+    bool write(int file, const void* buffer, unsigned length, uint64_t offset, uint64_t userData) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) return false;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+        return true;
+    }
+
+    // Submit queued writes and wait for at least waitFor completions
+    int enter(unsigned waitFor) {
+        int result;
+        do {
+            result = (int)syscall(__NR_io_uring_enter, fd, unsubmitted, waitFor,
+                                  waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while (result < 0 && errno == EINTR);
+        if (result > 0) unsubmitted -= std::min<unsigned>(unsubmitted, (unsigned)result);
+        return result;
+    }
+
+    // Wait for completions without submitting anything
+    int wait(unsigned waitFor) {
+        int result;
+        do {
+            result = (int)syscall(__NR_io_uring_enter, fd, 0, waitFor, IORING_ENTER_GETEVENTS, nullptr, 0);
+        } while (result < 0 && errno == EINTR);
+        return result;
+    }
+
+    // Take back the writes the kernel has not seen yet; returns how many
+    unsigned discardQueued() {
+        unsigned count = unsubmitted;
+        __atomic_store_n(sqTail, *sqTail - count, __ATOMIC_RELEASE);
+        unsubmitted = 0;
+        return count;
+    }
+
+    bool nextCompletion(io_uring_cqe& out) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        out = cqes[head & *cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Unmap and close the ring; the kernel cancels whatever is left
+    void shutdown() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        cqRing = sqRing = MAP_FAILED;
+        fd = -1;
+    }
+};
+#endif // HX20_HAVE_IO_URING
+
+class AsyncWriter {
+    struct Job {
+        std::string path;
+        WriteBuffer buffer;
+        uint64_t tag = 0;
+        int fd = -1;
+        bool direct = false;
+        bool failed = false;
+        size_t writeSize = 0;       // bytes to put on disk (padded for O_DIRECT)
+        size_t nextOffset = 0;      // first byte not yet queued
+        unsigned inFlight = 0;
+        uint64_t startNs = 0;
+    };
+
+    // One outstanding write request
+    struct Chunk {
+        Job* job;
+        size_t offset;
+        size_t length;
+    };
+
+    struct TagState {
+        unsigned pending = 0;
+        bool failed = false;
+    };
+
+    AsyncWriterOptions options;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeWaiters;
+    std::deque<std::unique_ptr<Job>> queue;
+    std::map<uint64_t, TagState> tags;
+    size_t pendingBytes = 0;
+    bool stopping = false;
+    bool uring = false;
+    std::thread thread;
+
+    // Blocks until a job is queued; null once stopping with nothing left
+    std::unique_ptr<Job> takeJob(bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait) wakeWriter.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) return nullptr;
+        std::unique_ptr<Job> job = std::move(queue.front());
+        queue.pop_front();
+        return job;
+    }
+
+    bool openJob(Job& job) {
+        job.startNs = TRACER.nowNs();
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+        if (options.directMinBytes && job.buffer.size() >= options.directMinBytes) {
+            job.fd = open(job.path.c_str(), flags | O_DIRECT, 0644);
+            // tmpfs and some network filesystems reject O_DIRECT
+            job.direct = job.fd >= 0;
+        }
+#endif
+        if (job.fd < 0) job.fd = open(job.path.c_str(), flags, 0644);
+        if (job.fd < 0) {
+            fprintf(stderr, "Error: Could not create file %s\n", job.path.c_str());
+            job.failed = true;
+            return false;
+        }
+        job.writeSize = job.direct ? job.buffer.paddedSize() : job.buffer.size();
+        return true;
+    }
+
+    void finishJob(std::unique_ptr<Job> job) {
+        if (job->fd >= 0) {
+            if (!job->failed && job->direct && ftruncate(job->fd, (off_t)job->buffer.size()) != 0) {
+                job->failed = true;
+            }
+            if (close(job->fd) != 0) job->failed = true;
+            if (job->failed) fprintf(stderr, "Error: Could not write file %s\n", job->path.c_str());
+        }
+        if (TRACER.enabled.load(std::memory_order_relaxed)) {
+            TRACER.record("write file", job->startNs, TRACER.nowNs());
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        TagState& state = tags[job->tag];
+        state.pending--;
+        state.failed |= job->failed;
+        pendingBytes -= job->buffer.size();
+        wakeWaiters.notify_all();
+    }
+
+    // Write [offset, end) of an open file with pwrite()
+    void writeRange(Job& job, size_t offset, size_t end) {
+        while (offset < end) {
+            size_t length = std::min(options.chunkBytes, end - offset);
+            ssize_t written = pwrite(job.fd, job.buffer.data() + offset, length, (off_t)offset);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                job.failed = true;
+                return;
+            }
+            offset += (size_t)written;
+        }
+    }
+
+    // Write the rest of an open file with pwrite()
+    void writeBlocking(Job& job) {
+        writeRange(job, job.nextOffset, job.writeSize);
+        job.nextOffset = job.writeSize;
+    }
+
+    void runBlocking() {
+        while (std::unique_ptr<Job> job = takeJob(true)) {
+            if (openJob(*job)) writeBlocking(*job);
+            finishJob(std::move(job));
+        }
+    }
+
+#ifdef HX20_HAVE_IO_URING
+    // Keeps up to queueDepth chunk writes in flight across all open files
+    void runUring(IoUring& ring) {
+        std::vector<std::unique_ptr<Job>> active;
+        std::vector<Chunk> chunks(ring.capacity());
+        std::vector<unsigned> freeChunks;
+        for (unsigned i = 0; i < ring.capacity(); i++) freeChunks.push_back(i);
+        unsigned inFlight = 0;
+
+        auto queueChunk = [&](Job& job, size_t offset, size_t length) {
+            unsigned slot = freeChunks.back();
+            if (!ring.write(job.fd, job.buffer.data() + offset, (unsigned)length, offset, slot)) {
+                return false;
+            }
+            freeChunks.pop_back();
+            chunks[slot] = {&job, offset, length};
+            job.inFlight++;
+            inFlight++;
+            return true;
+        };
+
+        for (;;) {
+            // Admit new files, at most one per possible request
+            while (active.size() < ring.capacity()) {
+                std::unique_ptr<Job> job = takeJob(inFlight == 0 && active.empty());
+                if (!job) break;
+                if (openJob(*job)) {
+                    active.push_back(std::move(job));
+                } else {
+                    finishJob(std::move(job));
+                }
+            }
+            if (active.empty() && inFlight == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping && queue.empty()) return;
+                continue;
+            }
+
+            // Fill the ring round-robin so many files progress together
+            bool queued = true;
+            while (queued && !freeChunks.empty()) {
+                queued = false;
+                for (auto& job : active) {
+                    if (freeChunks.empty()) break;
+                    if (job->failed || job->nextOffset >= job->writeSize) continue;
+                    size_t length = std::min(options.chunkBytes, job->writeSize - job->nextOffset);
+                    if (!queueChunk(*job, job->nextOffset, length)) break;
+                    job->nextOffset += length;
+                    queued = true;
+                }
+            }
+
+            if (ring.enter(inFlight ? 1 : 0) < 0) {
+                // The ring itself broke. The kernel may still be writing
+                // from the buffers, so wait for what it took (or close the
+                // ring if even that fails) before the files are rewritten
+                // on the blocking path and closed
+                unsigned taken = inFlight - ring.discardQueued();
+                io_uring_cqe cqe;
+                while (taken) {
+                    while (taken && ring.nextCompletion(cqe)) taken--;
+                    if (taken && ring.wait(1) < 0) break;
+                }
+                ring.shutdown();
+                for (auto& job : active) {
+                    job->failed = false;
+                    job->nextOffset = 0;
+                    writeBlocking(*job);
+                    finishJob(std::move(job));
+                }
+                runBlocking();
+                return;
+            }
+
+            io_uring_cqe cqe;
+            while (ring.nextCompletion(cqe)) {
+                Chunk chunk = chunks[cqe.user_data];
+                freeChunks.push_back((unsigned)cqe.user_data);
+                inFlight--;
+                chunk.job->inFlight--;
+                if (cqe.res <= 0) {
+                    chunk.job->failed = true;
+                } else if ((size_t)cqe.res < chunk.length) {
+                    // Short write: queue the remainder, or write it here if
+                    // the submission queue is full
+                    size_t offset = chunk.offset + cqe.res;
+                    if (!queueChunk(*chunk.job, offset, chunk.length - cqe.res)) {
+                        writeRange(*chunk.job, offset, chunk.offset + chunk.length);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < active.size();) {
+                Job& job = *active[i];
+                bool done = job.inFlight == 0 && (job.failed || job.nextOffset >= job.writeSize);
+                if (done) {
+                    finishJob(std::move(active[i]));
+                    active[i] = std::move(active.back());
+                    active.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+#endif // HX20_HAVE_IO_URING
+
+    void run() {
+        TRACER.setThreadName("writer");
+#ifdef HX20_HAVE_IO_URING
+        if (uring) {
+            IoUring ring;
+            if (ring.init(options.queueDepth)) {
+                runUring(ring);
+                return;
+            }
+            uring = false;
+        }
+#endif
+        runBlocking();
+    }
+
+public:
+    explicit AsyncWriter(const AsyncWriterOptions& options = AsyncWriterOptions())
+        : options(options) {
+#ifdef HX20_HAVE_IO_URING
+        uring = options.useIoUring;
+        if (uring) {
+            // Probe here so backend() is accurate before the first submit
+            IoUring probe;
+            uring = probe.init(1);
+        }
+#endif
+        thread = std::thread(&AsyncWriter::run, this);
+    }
+
+    ~AsyncWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeWriter.notify_all();
+        thread.join();
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    const char* backend() const { return uring ? "io_uring" : "thread"; }
+
+    // Queue a whole file for writing; blocks only while too much is pending
+    void submit(const std::string& path, WriteBuffer&& buffer, uint64_t tag = 0) {
+        auto job = std::make_unique<Job>();
+        job->path = path;
+        job->buffer = std::move(buffer);
+        job->tag = tag;
+        size_t size = job->buffer.size();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeWaiters.wait(lock, [&] {
+            return pendingBytes == 0 || pendingBytes + size <= options.maxPendingBytes;
+        });
+        pendingBytes += size;
+        tags[tag].pending++;
+        queue.push_back(std::move(job));
+        wakeWriter.notify_one();
+    }
+
+    // True once every file submitted under tag is on disk; ok reports failures
+    bool finished(uint64_t tag, bool& ok) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tags.find(tag);
+        if (it == tags.end()) {
+            ok = true;
+            return true;
+        }
+        if (it->second.pending) return false;
+        ok = !it->second.failed;
+        tags.erase(it);
+        return true;
+    }
+
+    // Wait for every file submitted under tag; returns false on any failure
+    bool wait(uint64_t tag) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeWaiters.wait(lock, [&] {
+                auto it = tags.find(tag);
+                return it == tags.end() || it->second.pending == 0;
+            });
+        }
+        bool ok = true;
+        finished(tag, ok);
+        return ok;
+    }
+};
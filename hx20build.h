@@ -0,0 +1,247 @@
+// Incremental builds over directory trees (hx20tokenizer -i <dir|glob>).
+//
+// expandSources() turns a directory or a glob into a sorted list of files.
+// "*" and "?" stay inside one path component; "**" spans any number of
+// directories. BuildDatabase remembers, for every output, the size, mtime
+// and content hash of the source it was built from, plus the size and mtime
+// of the output itself. An output is current when both files still match
+// on size and mtime, which takes two stat calls and no reads. When only the
+// source's stamp moved, its content hash decides. parallelFor() spreads the
+// per-file work over a few threads.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace hx20fs = std::filesystem;
+
+// 64-bit FNV-1a; enough to tell an edited source from a touched one
+inline uint64_t contentHash(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline uint64_t contentHash(const std::string& data) {
+    return contentHash(data.data(), data.size());
+}
+
+// Size and modification time of a regular file; false if it is missing
+inline bool fileStamp(const hx20fs::path& path, uint64_t& size, int64_t& mtimeNs) {
+    std::error_code ec;
+    size = hx20fs::file_size(path, ec);
+    if (ec) return false;
+    auto mtime = hx20fs::last_write_time(path, ec);
+    if (ec) return false;
+    mtimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    return true;
+}
+
+inline bool hasWildcard(const std::string& s) {
+    return s.find_first_of("*?") != std::string::npos;
+}
+
+// Match a '/'-separated relative path against a glob pattern
+inline bool globMatch(const char* p, const char* s) {
+    while (*p) {
+        if (p[0] == '*' && p[1] == '*') {
+            p += 2;
+            if (*p == '/') {
+                // "**/" matches zero or more whole directories
+                p++;
+                for (;;) {
+                    if (globMatch(p, s)) return true;
+                    const char* slash = strchr(s, '/');
+                    if (!slash) return false;
+                    s = slash + 1;
+                }
+            }
+            for (;; s++) {
+                if (globMatch(p, s)) return true;
+                if (!*s) return false;
+            }
+        }
+        if (*p == '*') {
+            p++;
+            for (;; s++) {
+                if (globMatch(p, s)) return true;
+                if (!*s || *s == '/') return false;
+            }
+        }
+        if (!*s || (*p == '?' ? *s == '/' : *p != *s)) return false;
+        p++;
+        s++;
+    }
+    return !*s;
+}
+
+inline std::string lowerExtension(const hx20fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+struct SourceFile {
+    hx20fs::path path;
+    hx20fs::path relative;      // to the walk's base directory
+};
+
+// Expand a file, a directory (recursively, files ending in `extension`) or
+// a glob into sources. `base` is the directory the relative paths start at.
+inline bool expandSources(const std::string& input, const std::string& extension,
+                          std::vector<SourceFile>& sources, hx20fs::path& base, std::string& error) {
+    std::error_code ec;
+    std::string pattern;
+
+    if (hasWildcard(input)) {
+        // Everything before the first component with a wildcard is the base
+        hx20fs::path literal;
+        hx20fs::path rest;
+        bool wild = false;
+        for (const auto& part : hx20fs::path(input)) {
+            wild = wild || hasWildcard(part.string());
+            (wild ? rest : literal) /= part;
+        }
+        base = literal.empty() ? hx20fs::path(".") : literal;
+        pattern = rest.generic_string();
+    } else if (hx20fs::is_directory(input, ec)) {
+        base = input;
+    } else if (hx20fs::is_regular_file(input, ec)) {
+        base = hx20fs::path(input).parent_path();
+        sources.push_back({input, hx20fs::path(input).filename()});
+        return true;
+    } else {
+        error = "no such file or directory: " + input;
+        return false;
+    }
+
+    bool recursive = pattern.empty() || pattern.find('/') != std::string::npos ||
+                     pattern.find("**") != std::string::npos;
+    auto consider = [&](const hx20fs::directory_entry& entry) {
+        if (!entry.is_regular_file(ec)) return;
+        hx20fs::path relative = entry.path().lexically_relative(base);
+        bool match = pattern.empty() ? lowerExtension(entry.path()) == extension
+                                     : globMatch(pattern.c_str(), relative.generic_string().c_str());
+        if (match) sources.push_back({entry.path(), relative});
+    };
+
+    if (recursive) {
+        hx20fs::recursive_directory_iterator it(base, hx20fs::directory_options::skip_permission_denied, ec), end;
+        for (; !ec && it != end; it.increment(ec)) consider(*it);
+    } else {
+        hx20fs::directory_iterator it(base, ec), end;
+        for (; !ec && it != end; it.increment(ec)) consider(*it);
+    }
+    if (ec) {
+        error = "could not scan " + base.string() + ": " + ec.message();
+        return false;
+    }
+
+    std::sort(sources.begin(), sources.end(),
+              [](const SourceFile& a, const SourceFile& b) { return a.path < b.path; });
+    return true;
+}
+
+struct BuildRecord {
+    std::string source;
+    uint64_t sourceSize = 0;
+    int64_t sourceMtime = 0;
+    uint64_t sourceHash = 0;
+    uint64_t outputSize = 0;
+    int64_t outputMtime = 0;
+};
+
+// Text file, one tab-separated record per output, keyed by output path.
+// The first line names the configuration (tool mode and token tables);
+// a database written for another configuration is ignored.
+class BuildDatabase {
+    std::unordered_map<std::string, BuildRecord> entries;
+
+public:
+    // Returns false if the file existed but was for another configuration
+    bool load(const hx20fs::path& file, const std::string& config) {
+        entries.clear();
+        std::ifstream in(file);
+        if (!in) return true;
+
+        std::string line;
+        if (!std::getline(in, line) || line != "# hx20build 1 " + config) return false;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            BuildRecord record;
+            std::string output, hash;
+            if (!std::getline(fields, output, '\t')) continue;
+            fields >> hash >> record.sourceSize >> record.sourceMtime
+                   >> record.outputSize >> record.outputMtime;
+            fields.ignore(1);
+            if (!fields || !std::getline(fields, record.source)) continue;
+            record.sourceHash = strtoull(hash.c_str(), nullptr, 16);
+            entries[output] = record;
+        }
+        return true;
+    }
+
+    // Write through a temporary file so an interrupted run keeps the old one
+    bool save(const hx20fs::path& file, const std::string& config) const {
+        std::vector<const std::pair<const std::string, BuildRecord>*> sorted;
+        for (const auto& entry : entries) sorted.push_back(&entry);
+        std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+
+        hx20fs::path temp = file;
+        temp += ".tmp";
+        FILE* out = fopen(temp.string().c_str(), "w");
+        if (!out) return false;
+        fprintf(out, "# hx20build 1 %s\n", config.c_str());
+        for (const auto* entry : sorted) {
+            const BuildRecord& r = entry->second;
+            fprintf(out, "%s\t%016llx %llu %lld %llu %lld\t%s\n", entry->first.c_str(),
+                    (unsigned long long)r.sourceHash, (unsigned long long)r.sourceSize,
+                    (long long)r.sourceMtime, (unsigned long long)r.outputSize,
+                    (long long)r.outputMtime, r.source.c_str());
+        }
+        if (fclose(out) != 0) return false;
+        std::error_code ec;
+        hx20fs::rename(temp, file, ec);
+        return !ec;
+    }
+
+    const BuildRecord* find(const std::string& output) const {
+        auto it = entries.find(output);
+        return it == entries.end() ? nullptr : &it->second;
+    }
+
+    void update(const std::string& output, const BuildRecord& record) { entries[output] = record; }
+    void erase(const std::string& output) { entries.erase(output); }
+    const std::unordered_map<std::string, BuildRecord>& records() const { return entries; }
+};
+
+// Run fn(0) .. fn(count - 1) on up to `threads` threads (0 = one per core)
+template <typename Fn>
+void parallelFor(size_t count, unsigned threads, Fn fn) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(count, 1));
+
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned) {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : pool) thread.join();
+}
@@ -0,0 +1,325 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <getopt.h>
+#include <time.h>
+
+#ifndef HX20DECODE_NO_MAIN
+#define HX20_STATS_MAIN
+#endif
+#include "hx20stats.h"
+#include "hx20trace.h"
+#include "hx20decoder.h"
+#include "hx20pipeline.h"
+
+const size_t DECODE_CHUNK = 16384;     // samples read and decoded at a time
+const size_t CHANNEL_QUEUE = 16;       // chunks queued per decode thread
+
+void printUsage(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " -i <capture.wav> [-o <program>] [--metrics <file>]\n\n"
+        << "Decodes an HX-20 tape capture and measures its signal quality\n\n"
+        << "Options:\n"
+        << "  -i <file>   Captured WAV (8- or 16-bit PCM, any sample rate) (REQUIRED)\n"
+        << "  -o <file>   Write the first recovered program (tokenized image or ASCII text)\n"
+        << "  -c <n>      Channel to decode (default: 0), or 'all' for every channel\n"
+        << "  -j <n>      With -c all: decode threads (default: one per channel)\n"
+        << "  --metrics <file>  Write signal-quality metrics as JSON ('-' = stdout)\n"
+        << "  --fixed-threshold Use a fixed 750 us bit threshold instead of following the tape speed\n"
+        << "  --stats[=json]    Report phase timings and counters on stderr\n"
+        << "  --trace <file>    Write a Chrome/Perfetto trace-event timeline\n"
+        << "  -h          Show this help and exit\n";
+}
+
+// Decode one channel of a capture in a single streaming pass
+bool decodeCapture(const std::string& inputFile, unsigned channel, bool adaptive, TapeDecoder& decoder,
+                   std::string& error) {
+    HX20_TRACE_SPAN("decode capture");
+    WavReader wav;
+    if (!wav.open(inputFile, error)) return false;
+    if (channel >= wav.channels) {
+        error = inputFile + " has " + std::to_string(wav.channels) + " channel(s)";
+        return false;
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, wav.dataOffset + wav.frames * wav.channels * (wav.bitsPerSample / 8));
+
+    decoder.begin(wav.sampleRate, adaptive);
+    std::vector<float> samples(DECODE_CHUNK);
+    for (;;) {
+        size_t count;
+        {
+            HX20_STATS_PHASE(PHASE_READ);
+            count = wav.read(samples.data(), samples.size(), channel);
+        }
+        if (count == 0) break;
+        HX20_STATS_PHASE(PHASE_DECODE);
+        decoder.feed(samples.data(), count);
+    }
+    decoder.finish();
+    HX20_STATS_ADD(STAT_SAMPLES, decoder.sampleCount());
+    HX20_STATS_ADD(STAT_PULSES, decoder.pulseCount());
+    HX20_STATS_ADD(STAT_BLOCKS, decoder.blockCount());
+    return true;
+}
+
+inline double threadCPUSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// A run of one channel's samples, on its way to that channel's decoder
+struct ChannelChunk {
+    unsigned channel;
+    std::vector<float> samples;
+};
+
+// Decode every channel of a capture. This thread reads each chunk once and
+// splits it into channels; the channels are decoded on `threads` threads
+// (0 = one per channel), each channel always on the same one.
+bool decodeAllChannels(const std::string& inputFile, unsigned threads, bool adaptive,
+                       std::vector<TapeDecoder>& decoders, std::string& error) {
+    HX20_TRACE_SPAN("decode channels");
+    WavReader wav;
+    if (!wav.open(inputFile, error)) return false;
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, wav.dataOffset + wav.frames * wav.channels * (wav.bitsPerSample / 8));
+
+    const unsigned channels = wav.channels;
+    threads = std::min(threads ? threads : channels, channels);
+    decoders = std::vector<TapeDecoder>(channels);
+    for (TapeDecoder& decoder : decoders) decoder.begin(wav.sampleRate, adaptive);
+
+    StageLink<ChannelChunk> link(threads, 1, CHANNEL_QUEUE);
+    std::vector<StageCounters> counters(threads);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            // CPU time, so that more threads than cores do not inflate it
+            while (std::unique_ptr<ChannelChunk> chunk = link.receive(t, counters[t])) {
+                double start = threadCPUSeconds();
+                decoders[chunk->channel].feed(chunk->samples.data(), chunk->samples.size());
+                counters[t].busySeconds += threadCPUSeconds() - start;
+                counters[t].units += chunk->samples.size();
+            }
+        });
+    }
+
+    StageCounters readCounters;
+    ChannelSplitter splitter;
+    std::vector<std::unique_ptr<ChannelChunk>> chunks(channels);
+    std::vector<float*> outputs(channels);
+    for (;;) {
+        size_t count;
+        {
+            HX20_STATS_PHASE(PHASE_READ);
+            const uint8_t* frames;
+            count = wav.readFrames(frames, DECODE_CHUNK);
+            if (count == 0) break;
+            for (unsigned c = 0; c < channels; c++) {
+                chunks[c].reset(new ChannelChunk{c, std::vector<float>(count)});
+                outputs[c] = chunks[c]->samples.data();
+            }
+            splitter.split(frames, count, channels, wav.bitsPerSample, outputs.data());
+        }
+        // Channel c goes to thread c % threads
+        for (unsigned c = 0; c < channels; c++) link.send(c, std::move(chunks[c]), readCounters);
+    }
+    link.close(readCounters);
+    for (std::thread& thread : pool) thread.join();
+
+    for (TapeDecoder& decoder : decoders) {
+        decoder.finish();
+        HX20_STATS_ADD(STAT_SAMPLES, decoder.sampleCount());
+        HX20_STATS_ADD(STAT_PULSES, decoder.pulseCount());
+        HX20_STATS_ADD(STAT_BLOCKS, decoder.blockCount());
+    }
+    for (const StageCounters& c : counters) STATS.phaseSeconds[PHASE_DECODE] += c.busySeconds;
+    return true;
+}
+
+// <stem>-ch<n><extension>, for the per-channel outputs of -c all
+std::string channelFileName(const std::string& path, unsigned channel) {
+    size_t slash = path.find_last_of('/');
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+    return path.substr(0, dot) + "-ch" + std::to_string(channel) + path.substr(dot);
+}
+
+void printSummary(std::ostream& out, const std::string& inputFile, const TapeDecoder& decoder) {
+    const SignalQuality& q = decoder.signal();
+    const PulseFramer& framing = decoder.framing();
+    out << "Capture: " << inputFile << " (" << (long)decoder.rate() << " Hz, "
+        << jsonNumber(decoder.sampleCount() / decoder.rate(), 1) << " s)\n";
+    for (const TapeFile& file : decoder.files()) {
+        out << "File " << file.name << ": " << file.type << ", " << file.isoDate() << " " << file.isoTime() << ", "
+            << file.data.size() << " bytes in " << file.blocks << " blocks";
+        if (file.blocksMerged) out << ", " << file.blocksMerged << " merged from two damaged copies";
+        if (file.blocksLost) out << ", " << file.blocksLost << " LOST";
+        out << (file.complete ? "" : " (incomplete)") << "\n";
+    }
+    if (decoder.files().empty()) out << "No file found\n";
+    out << "Blocks: " << decoder.blockCount() << " received, " << decoder.badBlockCount() << " CRC errors, "
+        << framing.framingErrors << " framing errors\n";
+    out << "Pulses: short " << jsonNumber(q.shortWidths.mean, 0) << " +/- " << jsonNumber(q.shortWidths.stddev(), 1)
+        << " us, long " << jsonNumber(q.longWidths.mean, 0) << " +/- " << jsonNumber(q.longWidths.stddev(), 1)
+        << " us\n";
+    out << "Threshold: ";
+    if (framing.adaptive && q.thresholds.count) {
+        out << jsonNumber(q.thresholds.min, 0) << "-" << jsonNumber(q.thresholds.max, 0) << " us, following the tape";
+    } else {
+        out << jsonNumber(framing.thresholdUs, 0) << " us";
+    }
+    out << ", margin " << jsonNumber(decoder.worstMarginUs(), 0) << " us (" << jsonNumber(decoder.robustMarginUs(), 0)
+        << " us without the closest 0.1%)\n";
+    out << "Signal: amplitude " << jsonNumber(q.amplitude.mean * 100, 1) << "% of full scale, DC drift "
+        << jsonNumber((q.level.max - q.level.min) * 100, 2) << "%, wow " << jsonNumber(q.rmsWow(), 3)
+        << "% rms (" << jsonNumber(q.wowPeak, 3) << "% peak)\n";
+}
+
+#ifndef HX20DECODE_NO_MAIN
+int main(int argc, char* argv[]) {
+    auto wallStart = std::chrono::steady_clock::now();
+    std::string inputFile;
+    std::string outputFile;
+    std::string metricsFile;
+    std::string traceFile;
+    unsigned channel = 0;
+    bool allChannels = false;
+    unsigned threads = 0;
+    bool adaptive = true;
+
+    static const struct option longOptions[] = {
+        {"metrics", required_argument, nullptr, 'M'},
+        {"stats", optional_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"fixed-threshold", no_argument, nullptr, 'F'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, ":i:o:c:j:h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                inputFile = optarg;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            case 'c':
+                allChannels = strcmp(optarg, "all") == 0;
+                channel = allChannels ? 0 : (unsigned)atoi(optarg);
+                break;
+            case 'j':
+                threads = (unsigned)std::max(0, atoi(optarg));
+                break;
+            case 'F':
+                adaptive = false;
+                break;
+            case 'M':
+                metricsFile = optarg;
+                break;
+            case 'S':
+                STATS.enabled = true;
+                STATS.json = optarg && strcmp(optarg, "json") == 0;
+                break;
+            case 'T':
+                traceFile = optarg;
+                TRACER.enabled = true;
+                TRACER.setThreadName("main");
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            case ':':
+                std::cerr << "Error: Option '-" << char(optopt) << "' requires an argument.\n";
+                printUsage(argv[0]);
+                return 1;
+            case '?':
+            default:
+                std::cerr << "Error: Unknown option '-" << char(optopt) << "'.\n";
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (inputFile.empty()) {
+        std::cerr << "Error: -i <capture.wav> is required.\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string error;
+    std::vector<TapeDecoder> decoders(1);
+    if (allChannels) {
+        if (!decodeAllChannels(inputFile, threads, adaptive, decoders, error)) {
+            std::cerr << "Error: " << error << "\n";
+            return 1;
+        }
+    } else if (!decodeCapture(inputFile, channel, adaptive, decoders[0], error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    // Metrics on stdout move the summary to stderr. With -c all, channels
+    // are numbered from 1 and every output gets a -ch<n> suffix.
+    std::ostream& summary = metricsFile == "-" ? std::cerr : std::cout;
+    int result = 0;
+    for (size_t c = 0; c < decoders.size(); c++) {
+        const TapeDecoder& decoder = decoders[c];
+        unsigned number = (unsigned)c + 1;
+        if (allChannels) summary << (c ? "\n" : "") << "Channel " << number << "\n";
+        printSummary(summary, inputFile, decoder);
+
+        if (!metricsFile.empty()) {
+            std::string json = decoder.metricsJSON(inputFile, allChannels ? (int)number : -1) + "\n";
+            if (metricsFile == "-") {
+                std::cout << json;
+            } else {
+                std::string path = allChannels ? channelFileName(metricsFile, number) : metricsFile;
+                std::ofstream out(path);
+                if (!(out << json)) {
+                    std::cerr << "Error: Could not write " << path << "\n";
+                    result = 1;
+                }
+            }
+        }
+
+        if (!outputFile.empty()) {
+            std::string path = allChannels ? channelFileName(outputFile, number) : outputFile;
+            if (decoder.files().empty()) {
+                std::cerr << "Error: no program recovered from " << inputFile
+                          << (allChannels ? " channel " + std::to_string(number) : "") << "\n";
+                result = 1;
+            } else {
+                HX20_STATS_PHASE(PHASE_WRITE);
+                const std::string& data = decoder.files().front().data;
+                std::ofstream out(path, std::ios::binary);
+                if (!out.write(data.data(), data.size())) {
+                    std::cerr << "Error: Could not write " << path << "\n";
+                    result = 1;
+                }
+                HX20_STATS_ADD(STAT_BYTES_WRITTEN, data.size());
+            }
+        }
+        for (const TapeFile& file : decoder.files()) {
+            if (!file.complete) result = result ? result : 2;
+        }
+    }
+
+    if (!traceFile.empty() && !TRACER.writeTrace(traceFile)) {
+        std::cerr << "Error: Could not write trace file " << traceFile << "\n";
+        result = 1;
+    }
+    if (STATS.enabled) {
+        printStats("hx20decode", std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - wallStart).count());
+    }
+    return result;
+}
+#endif // HX20DECODE_NO_MAIN
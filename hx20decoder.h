@@ -0,0 +1,1099 @@
+// Streaming decoder for HX-20 tape captures.
+//
+// Samples pass through three stages, each O(1) per sample or pulse.
+// EdgeDetector finds rising crossings of the tracked DC level and yields one
+// pulse per cycle. PulseFramer turns pulse widths into bits, bytes and
+// CRC-checked blocks. BlockAssembler pairs the two copies of every block,
+// merges them when both are damaged, and collects files. SignalQuality
+// watches all three stages but keeps only fixed-size histograms, running
+// moments and time series. A capture of any length is therefore decoded and
+// measured in one pass, holding nothing but the recovered programs.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Tape format, as written by hx20tape
+struct TapeFormat {
+    static constexpr double THRESHOLD_US = 750.0;   // shorter is a 0, longer a 1
+    static constexpr double ZERO_US = 545.0;        // a 0 pulse at nominal speed
+    static constexpr double MIN_PULSE_US = 150.0;   // outside this range is noise or a gap
+    static constexpr double MAX_PULSE_US = 2500.0;
+    static const int MIN_SYNC_BITS = 16;            // zeros before a block (80 are sent)
+    static const int DATA_BLOCK = 256;
+    static const int LABEL_BLOCK = 80;              // HDR1 and EOF labels
+    static const int MAX_BLOCK = 4 + DATA_BLOCK + 2;
+
+    static uint16_t crcKermit(const uint8_t* data, size_t size) {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < size; i++) {
+            crc ^= data[i];
+            for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+        return crc;
+    }
+};
+
+// 8- and 16-bit PCM WAV files, read a chunk at a time
+// One channel of interleaved 8-bit (unsigned) or 16-bit PCM as floats, full scale 1.0
+inline void pcmToFloat(const uint8_t* frames, size_t count, unsigned channels, unsigned bitsPerSample,
+                       unsigned channel, float* out) {
+    const size_t frameBytes = channels * (bitsPerSample / 8);
+    const uint8_t* p = frames + channel * (bitsPerSample / 8);
+    if (bitsPerSample == 8) {
+        for (size_t i = 0; i < count; i++, p += frameBytes) out[i] = (p[0] - 128) * (1.0f / 128);
+    } else {
+        for (size_t i = 0; i < count; i++, p += frameBytes) out[i] = (int16_t)(p[0] | (p[1] << 8)) * (1.0f / 32768);
+    }
+}
+
+class WavReader {
+    FILE* file = nullptr;
+    uint64_t remaining = 0;         // frames left in the data chunk
+    std::vector<uint8_t> buffer;
+
+public:
+    uint32_t sampleRate = 0;
+    uint16_t channels = 0;
+    uint16_t bitsPerSample = 0;
+    uint64_t frames = 0;
+    uint64_t dataOffset = 0;
+
+    WavReader() = default;
+    WavReader(const WavReader&) = delete;
+    WavReader& operator=(const WavReader&) = delete;
+    ~WavReader() { close(); }
+
+    void close() {
+        if (file) fclose(file);
+        file = nullptr;
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        close();
+        file = fopen(path.c_str(), "rb");
+        if (!file) {
+            error = "could not open " + path;
+            return false;
+        }
+        uint8_t riff[12];
+        if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+            error = path + " is not a WAV file";
+            return false;
+        }
+        bool haveFormat = false;
+        uint64_t offset = 12;
+        for (;;) {
+            uint8_t chunk[8];
+            if (fread(chunk, 1, 8, file) != 8) {
+                error = path + " has no data chunk";
+                return false;
+            }
+            uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+            offset += 8;
+            if (memcmp(chunk, "fmt ", 4) == 0) {
+                uint8_t format[16];
+                if (size < 16 || fread(format, 1, 16, file) != 16) {
+                    error = path + " has a short fmt chunk";
+                    return false;
+                }
+                uint16_t audioFormat = format[0] | (format[1] << 8);
+                channels = format[2] | (format[3] << 8);
+                sampleRate = format[4] | (format[5] << 8) | (format[6] << 16) | ((uint32_t)format[7] << 24);
+                bitsPerSample = format[14] | (format[15] << 8);
+                if ((audioFormat != 1 && audioFormat != 0xFFFE) || channels == 0 || sampleRate == 0 ||
+                    (bitsPerSample != 8 && bitsPerSample != 16)) {
+                    error = path + ": only 8- and 16-bit PCM is supported";
+                    return false;
+                }
+                if (fseek(file, (long)(size - 16 + (size & 1)), SEEK_CUR) != 0) break;
+                haveFormat = true;
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                if (!haveFormat) break;
+                dataOffset = offset;
+                frames = remaining = size / (channels * (bitsPerSample / 8));
+                return true;
+            } else if (fseek(file, (long)(size + (size & 1)), SEEK_CUR) != 0) {
+                break;
+            }
+            offset += size + (size & 1);
+        }
+        error = path + " is not a PCM WAV file";
+        return false;
+    }
+
+    double seconds() const { return sampleRate ? (double)frames / sampleRate : 0.0; }
+
+    // Read up to maxFrames frames of one channel as floats, full scale 1.0.
+    // Returns 0 at the end of the data.
+    size_t read(float* out, size_t maxFrames, unsigned channel = 0) {
+        const uint8_t* frames;
+        size_t count = readFrames(frames, maxFrames);
+        pcmToFloat(frames, count, channels, bitsPerSample, channel, out);
+        return count;
+    }
+
+    // Read up to maxFrames interleaved frames as stored; `frames` points into
+    // a buffer that the next read reuses. Returns 0 at the end of the data.
+    size_t readFrames(const uint8_t*& frames, size_t maxFrames) {
+        frames = buffer.data();
+        if (!file || remaining == 0) return 0;
+        const size_t frameBytes = channels * (bitsPerSample / 8);
+        size_t count = (size_t)std::min<uint64_t>(maxFrames, remaining);
+        buffer.resize(count * frameBytes);
+        count = fread(buffer.data(), frameBytes, count, file);
+        remaining = count ? remaining - count : 0;
+        frames = buffer.data();
+        return count;
+    }
+};
+
+// Every channel of interleaved 8- or 16-bit PCM as floats in one pass, the
+// same values pcmToFloat gives. With SSE2, 8-bit samples are first widened
+// to 16 bits, and two, four or eight channels are split by unpack shuffles
+// that transpose a block of frames into runs of each channel.
+class ChannelSplitter {
+#if defined(__SSE2__)
+    std::vector<int16_t> wide;
+
+    static void store(__m128i v, float* out) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768);
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale));
+        _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale));
+    }
+
+    // Four stereo frames: the left sample is the low half of each 32-bit lane
+    static void storeStereo(__m128i v, float* left, float* right) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768);
+        _mm_storeu_ps(left, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16)), scale));
+        _mm_storeu_ps(right, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(v, 16)), scale));
+    }
+
+    // Returns the frames done; the caller finishes the rest
+    static size_t splitWide(const int16_t* in, size_t count, unsigned channels, float* const* out) {
+        size_t i = 0;
+        const __m128i* p = reinterpret_cast<const __m128i*>(in);
+        switch (channels) {
+            case 1:
+                for (; i + 8 <= count; i += 8) store(_mm_loadu_si128(p++), out[0] + i);
+                break;
+            case 2:
+                for (; i + 4 <= count; i += 4) storeStereo(_mm_loadu_si128(p++), out[0] + i, out[1] + i);
+                break;
+            case 4:
+                // Gather channels 0-1 and 2-3 of four frames as 32-bit pairs
+                for (; i + 4 <= count; i += 4, p += 2) {
+                    __m128i a = _mm_shuffle_epi32(_mm_loadu_si128(p), _MM_SHUFFLE(3, 1, 2, 0));
+                    __m128i b = _mm_shuffle_epi32(_mm_loadu_si128(p + 1), _MM_SHUFFLE(3, 1, 2, 0));
+                    storeStereo(_mm_unpacklo_epi64(a, b), out[0] + i, out[1] + i);
+                    storeStereo(_mm_unpackhi_epi64(a, b), out[2] + i, out[3] + i);
+                }
+                break;
+            case 8:
+                // 8x8 transpose: eight frames in, eight channel runs out
+                for (; i + 8 <= count; i += 8, p += 8) {
+                    __m128i a0 = _mm_unpacklo_epi16(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+                    __m128i a1 = _mm_unpackhi_epi16(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+                    __m128i a2 = _mm_unpacklo_epi16(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+                    __m128i a3 = _mm_unpackhi_epi16(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+                    __m128i a4 = _mm_unpacklo_epi16(_mm_loadu_si128(p + 4), _mm_loadu_si128(p + 5));
+                    __m128i a5 = _mm_unpackhi_epi16(_mm_loadu_si128(p + 4), _mm_loadu_si128(p + 5));
+                    __m128i a6 = _mm_unpacklo_epi16(_mm_loadu_si128(p + 6), _mm_loadu_si128(p + 7));
+                    __m128i a7 = _mm_unpackhi_epi16(_mm_loadu_si128(p + 6), _mm_loadu_si128(p + 7));
+                    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+                    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+                    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+                    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+                    store(_mm_unpacklo_epi64(b0, b4), out[0] + i);
+                    store(_mm_unpackhi_epi64(b0, b4), out[1] + i);
+                    store(_mm_unpacklo_epi64(b1, b5), out[2] + i);
+                    store(_mm_unpackhi_epi64(b1, b5), out[3] + i);
+                    store(_mm_unpacklo_epi64(b2, b6), out[4] + i);
+                    store(_mm_unpackhi_epi64(b2, b6), out[5] + i);
+                    store(_mm_unpacklo_epi64(b3, b7), out[6] + i);
+                    store(_mm_unpackhi_epi64(b3, b7), out[7] + i);
+                }
+                break;
+        }
+        return i;
+    }
+#endif
+
+public:
+    void split(const uint8_t* frames, size_t count, unsigned channels, unsigned bitsPerSample, float* const* out) {
+#if defined(__SSE2__)
+        // x86 is little-endian, so 16-bit samples can be loaded in place
+        const size_t values = count * channels;
+        const int16_t* in = reinterpret_cast<const int16_t*>(frames);
+        if (bitsPerSample == 8) {
+            wide.resize(values);
+            const __m128i zero = _mm_setzero_si128(), center = _mm_set1_epi16(128);
+            size_t k = 0;
+            for (; k + 16 <= values; k += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frames + k));
+                __m128i lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), center), 8);
+                __m128i hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v, zero), center), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&wide[k]), lo);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&wide[k + 8]), hi);
+            }
+            for (; k < values; k++) wide[k] = (int16_t)((frames[k] - 128) * 256);
+            in = wide.data();
+        }
+        size_t done = splitWide(in, count, channels, out);
+#else
+        size_t done = 0;
+#endif
+        const size_t frameBytes = channels * (bitsPerSample / 8);
+        for (unsigned c = 0; c < channels; c++) {
+            pcmToFloat(frames + done * frameBytes, count - done, channels, bitsPerSample, c, out[c] + done);
+        }
+    }
+};
+
+// Windowed-sinc sample-rate converter for a stream of chunks, at any pair
+// of rates. The filter is a Blackman-windowed sinc cut off at 90% of the
+// lower Nyquist frequency, so downsampling does not fold hiss onto the
+// pulses. It is stored as a polyphase table: PHASES rows, one for each
+// position of an output sample between two input samples. Each output is
+// then one dot product of the input around it with one row. Memory is the
+// table plus one filter length of input, whatever the stream length.
+class SincResampler {
+public:
+    static const int PHASES = 128;          // 1/128 sample of timing resolution
+    static const int ZERO_CROSSINGS = 12;   // each side of the peak, at the lower rate
+
+private:
+    double step = 1;            // input samples per output sample
+    double position = 0;        // next output, as an index into `history`
+    size_t half = 0;            // filter reach each side, in input samples
+    size_t taps = 0;            // 2 * half, rounded up to a multiple of 8
+    size_t end = 0;             // history index after the last real input
+    std::vector<float> table;   // PHASES + 1 rows of `taps`
+    std::vector<float> history;
+
+    static float dot(const float* x, const float* h, size_t n) {
+#if defined(__SSE2__)
+        __m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+        for (size_t i = 0; i < n; i += 8) {
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+        }
+        a = _mm_add_ps(a, b);
+        a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+        return _mm_cvtss_f32(a);
+#else
+        float sum = 0;
+        for (size_t i = 0; i < n; i++) sum += x[i] * h[i];
+        return sum;
+#endif
+    }
+
+    // Produce every output whose filter window is in `history` (and, when
+    // finishing, that lies before the end of the input)
+    void run(std::vector<float>& out, bool finishing) {
+        for (;;) {
+            size_t n = (size_t)position;
+            size_t first = n + 1 - half;
+            if (first + taps > history.size() || (finishing && n >= end)) break;
+            size_t row = (size_t)((position - n) * PHASES + 0.5);
+            out.push_back(dot(&history[first], &table[row * taps], taps));
+            position += step;
+        }
+        size_t drop = std::min((size_t)position + 1 - half, history.size());
+        history.erase(history.begin(), history.begin() + drop);
+        position -= drop;
+        end -= std::min(end, drop);
+    }
+
+public:
+    void begin(double inputRate, double outputRate) {
+        step = inputRate / outputRate;
+        const double stretch = std::max(1.0, step);
+        const double cutoff = 0.45 / stretch;     // cycles per input sample
+        half = (size_t)std::ceil(ZERO_CROSSINGS * stretch);
+        taps = (2 * half + 7) & ~(size_t)7;
+
+        table.assign((PHASES + 1) * taps, 0.0f);
+        for (int p = 0; p <= PHASES; p++) {
+            float* row = &table[p * taps];
+            double sum = 0;
+            for (size_t i = 0; i < 2 * half; i++) {
+                double d = (double)i - (double)(half - 1) - (double)p / PHASES;
+                double u = d / half;
+                if (std::fabs(u) >= 1) continue;
+                double x = 2 * cutoff * d;
+                double sinc = x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                double window = 0.42 + 0.5 * std::cos(M_PI * u) + 0.08 * std::cos(2 * M_PI * u);
+                row[i] = (float)(sinc * window);
+                sum += row[i];
+            }
+            for (size_t i = 0; i < 2 * half; i++) row[i] = (float)(row[i] / sum);   // unity gain at DC
+        }
+
+        // The first output lines up with the first input sample
+        history.assign(half - 1, 0.0f);
+        position = (double)(half - 1);
+        end = history.size();
+    }
+
+    // Appends the output for `count` more input samples to `out`. Outputs
+    // lag the input by half the filter length until finish().
+    void process(const float* in, size_t count, std::vector<float>& out) {
+        history.insert(history.end(), in, in + count);
+        end = history.size();
+        run(out, false);
+    }
+
+    // Appends the outputs still held back at the end of the stream
+    void finish(std::vector<float>& out) {
+        history.insert(history.end(), taps, 0.0f);
+        run(out, true);
+    }
+};
+
+// One cycle of the tape signal, rising crossing to rising crossing
+struct TapePulse {
+    double widthUs;
+    float amplitude;        // half the peak-to-peak swing within the cycle
+    float level;            // tracked DC level at the crossing
+    uint64_t position;      // sample index of the crossing that ends it
+};
+
+// Rising crossings of a slowly tracked DC level, with hysteresis at a
+// fraction of the tracked amplitude so noise in silence makes no pulses
+class EdgeDetector {
+    double sampleRate = 0;
+    float dcAlpha = 0;          // ~20 ms time constant
+    float lowAlpha = 1;         // two-pole low-pass against hiss
+    float smooth1 = 0, smooth2 = 0;
+    float dc = 0;
+    float envelope = 0;
+    float previous = 0;
+    bool armed = false;         // went below the lower hysteresis bound
+    bool haveEdge = false;
+    double lastEdge = 0;        // sample time of the last rising crossing
+    float high = -1, low = 1;   // extremes since the last crossing
+    uint64_t index = 0;
+
+public:
+    static constexpr float MIN_HYSTERESIS = 0.02f;
+    static constexpr double LOW_PASS_HZ = 4000;     // well above the 1.8 kHz fundamental
+
+    void begin(double rate) {
+        sampleRate = rate;
+        dcAlpha = (float)(1.0 - std::exp(-1.0 / (0.020 * rate)));
+        lowAlpha = (float)std::min(1.0, 1.0 - std::exp(-2 * M_PI * LOW_PASS_HZ / rate));
+        smooth1 = smooth2 = 0;
+        dc = envelope = previous = 0;
+        armed = haveEdge = false;
+        high = -1;
+        low = 1;
+        index = 0;
+    }
+
+    float level() const { return dc; }
+
+    template <typename Fn>
+    void process(const float* samples, size_t count, Fn onPulse) {
+        for (size_t i = 0; i < count; i++, index++) {
+            smooth1 += lowAlpha * (samples[i] - smooth1);
+            smooth2 += lowAlpha * (smooth1 - smooth2);
+            float x = smooth2;
+            dc += dcAlpha * (x - dc);
+            high = std::max(high, x);
+            low = std::min(low, x);
+            float hysteresis = std::max(MIN_HYSTERESIS, 0.25f * envelope);
+            if (x < dc - hysteresis) armed = true;
+            if (armed && previous < dc && x >= dc) {
+                double edge = (double)index - 1 + (dc - previous) / (x - previous);
+                float amplitude = 0.5f * (high - low);
+                if (haveEdge) {
+                    envelope += 0.05f * (amplitude - envelope);
+                    onPulse(TapePulse{(edge - lastEdge) * 1e6 / sampleRate, amplitude, dc, index});
+                }
+                haveEdge = true;
+                lastEdge = edge;
+                armed = false;
+                high = low = x;
+            }
+            previous = x;
+        }
+    }
+};
+
+// A block as received: ID field, data and CRC, and whether the CRC matched
+struct TapeBlock {
+    char type;              // 'H', 'D' or 'E'
+    uint16_t number;
+    uint8_t copy;
+    uint16_t length;        // data bytes
+    bool crcOK;
+    uint64_t position;      // sample index of the first byte
+    uint8_t bytes[TapeFormat::MAX_BLOCK];
+
+    const uint8_t* data() const { return bytes + 4; }
+
+    bool checkCRC() const {
+        uint16_t crc = bytes[4 + length] | (bytes[5 + length] << 8);
+        return TapeFormat::crcKermit(bytes, 4 + length) == crc;
+    }
+};
+
+// Bits from pulse widths, then the HX-20 framing: a run of zeros, a 1, the
+// FF AA preamble, LSB-first bytes each followed by a 1 stop bit, a 4-byte
+// ID, 256 or 80 data bytes and a CRC-Kermit.
+//
+// The threshold follows the tape: each pulse pulls the centre of its class
+// towards its width, and the threshold sits halfway between the two centres.
+// A change in tape speed moves both centres together (fast), and the spacing
+// of the two classes is learnt slowly, so a long run of one class still
+// carries the other along. The centres cannot leave ±SPEED_RANGE of where
+// they started. Only pulses followed by one of the same class are tracked:
+// the last pulse before a change of class is a sample or so off, and how
+// often that happens depends on the data.
+class PulseFramer {
+    enum State { HUNT, BYTES };
+    State state = HUNT;
+    int zeroRun = 0;
+    int bitCount = 0;
+    uint16_t shift = 0;
+    size_t received = 0;        // bytes of the current block, preamble included
+    size_t expected = 0;
+    TapeBlock block;
+    double shortUs = 0, longUs = 0;     // class centres; 0 until the first tracked pulse
+    double shortStartUs = 0, longStartUs = 0;
+    double previousUs = 0;              // the last pulse, waiting for its successor
+    bool previousOne = false;
+
+    void track(double widthUs, bool one) {
+        if (shortUs == 0) {
+            shortStartUs = shortUs = std::min(TapeFormat::ZERO_US, thresholdUs * 0.8);
+            longStartUs = longUs = 2 * thresholdUs - shortUs;
+        }
+        double& centre = one ? longUs : shortUs;
+        double error = widthUs / centre - 1;
+        double speed = 1 + SPEED_GAIN * error;
+        shortUs *= speed;
+        longUs *= speed;
+        centre *= 1 + SPACING_GAIN * error;
+        shortUs = std::min(std::max(shortUs, shortStartUs * (1 - SPEED_RANGE)), shortStartUs * (1 + SPEED_RANGE));
+        longUs = std::min(std::max(longUs, longStartUs * (1 - SPEED_RANGE)), longStartUs * (1 + SPEED_RANGE));
+        thresholdUs = (shortUs + longUs) / 2;
+    }
+
+public:
+    static constexpr double SPEED_GAIN = 1.0 / 64;     // ~60 pulses, about 50 ms of tape
+    static constexpr double SPACING_GAIN = 1.0 / 256;
+    static constexpr double SPEED_RANGE = 0.3;
+
+    double thresholdUs = TapeFormat::THRESHOLD_US;   // the starting point when adaptive
+    bool adaptive = true;       // false keeps thresholdUs fixed
+    bool verify = true;         // false leaves crcOK unset, for a later stage to check
+    uint64_t framingErrors = 0; // missing stop bit inside a block
+    uint64_t preambleErrors = 0;
+    uint64_t outOfRange = 0;    // pulses too short or too long to be bits
+
+    void reset() {
+        state = HUNT;
+        zeroRun = 0;
+    }
+
+    template <typename Fn>
+    void feed(const TapePulse& pulse, Fn onBlock) {
+        if (pulse.widthUs < TapeFormat::MIN_PULSE_US || pulse.widthUs > TapeFormat::MAX_PULSE_US) {
+            outOfRange++;
+            if (state == BYTES) framingErrors++;
+            reset();
+            previousUs = 0;
+            return;
+        }
+        bool one = pulse.widthUs > thresholdUs;
+        if (adaptive) {
+            if (previousUs > 0 && one == previousOne) track(previousUs, previousOne);
+            previousUs = pulse.widthUs;
+            previousOne = one;
+        }
+        bit(one, pulse.position, onBlock);
+    }
+
+    template <typename Fn>
+    void bit(bool one, uint64_t position, Fn onBlock) {
+        if (state == HUNT) {
+            if (!one) {
+                zeroRun++;
+            } else {
+                if (zeroRun >= TapeFormat::MIN_SYNC_BITS) {
+                    state = BYTES;
+                    bitCount = 0;
+                    shift = 0;
+                    received = 0;
+                    expected = 0;
+                    block.position = position;
+                }
+                zeroRun = 0;
+            }
+            return;
+        }
+
+        if (bitCount < 8) {
+            shift |= (uint16_t)one << bitCount++;
+            return;
+        }
+        bitCount = 0;
+        uint8_t byte = (uint8_t)shift;
+        shift = 0;
+        if (!one) {
+            framingErrors++;
+            state = HUNT;
+            zeroRun = 1;
+            return;
+        }
+        if ((received == 0 && byte != 0xFF) || (received == 1 && byte != 0xAA)) {
+            preambleErrors++;
+            state = HUNT;
+            return;
+        }
+        if (received >= 2) block.bytes[received - 2] = byte;
+        received++;
+        if (received == 2 + 1) {
+            // The type byte fixes the block length
+            block.length = byte == 'D' ? TapeFormat::DATA_BLOCK : TapeFormat::LABEL_BLOCK;
+            expected = 2 + 4 + block.length + 2;
+        }
+        if (expected && received == expected) {
+            const uint8_t* b = block.bytes;
+            block.type = (char)b[0];
+            block.number = (b[1] << 8) | b[2];
+            block.copy = b[3];
+            block.crcOK = verify && block.checkCRC();
+            onBlock(block);
+            state = HUNT;
+        }
+    }
+};
+
+// A file recovered from tape
+struct TapeFile {
+    std::string name;           // HDR1 name, trailing spaces removed
+    std::string type;           // ASCII, TOKEN, SEQUENTIAL or BINARY
+    std::string date;           // MMDDYY and HHMMSS as written in HDR1
+    std::string time;
+    std::string data;
+    size_t blocks = 0;          // data blocks expected (from the EOF label)
+    size_t blocksMerged = 0;    // rebuilt from two damaged copies
+    size_t blocksLost = 0;
+    bool complete = false;      // EOF label seen and no block lost
+
+    // The HDR1 date as YYYY-MM-DD, or "" if it is not a date
+    std::string isoDate() const {
+        if (date.size() != 6 || !std::all_of(date.begin(), date.end(), ::isdigit)) return "";
+        int year = std::stoi(date.substr(4, 2));
+        return std::to_string(year < 70 ? 2000 + year : 1900 + year) + "-" + date.substr(0, 2) + "-" +
+               date.substr(2, 2);
+    }
+    std::string isoTime() const {
+        if (time.size() != 6 || !std::all_of(time.begin(), time.end(), ::isdigit)) return "";
+        return time.substr(0, 2) + ":" + time.substr(2, 2) + ":" + time.substr(4, 2);
+    }
+};
+
+// Outcome of one block after both copies were seen
+struct BlockRecord {
+    char type;
+    uint16_t number;
+    uint8_t copies;             // copies received
+    uint8_t good;               // copies with a good CRC
+    uint16_t differing;         // bytes where the two copies disagree
+    enum Status { OK, MERGED, LOST } status;
+};
+
+// Pairs copy 0 and copy 1 of each block and builds files from the result
+class BlockAssembler {
+    TapeBlock pending;
+    bool havePending = false;
+    bool inFile = false;
+    TapeFile file;
+    std::vector<bool> present;  // data blocks of the current file received
+
+    static const size_t MAX_MERGE_BYTES = 10;   // 2^10 CRC checks at most
+
+    static void parseLabel(const TapeBlock& label, TapeFile& out) {
+        const uint8_t* d = label.data();
+        out.name.assign((const char*)d + 4, 8);
+        out.name.erase(out.name.find_last_not_of(' ') + 1);
+        out.type = d[15] == 0x02 ? "BINARY" : d[15] == 0x01 ? "SEQUENTIAL" : d[16] == 0xFF ? "ASCII" : "TOKEN";
+        out.date.assign((const char*)d + 32, 6);
+        out.time.assign((const char*)d + 38, 6);
+    }
+
+    // Two damaged copies: where they differ, try every combination of the
+    // two versions against the CRC
+    static bool merge(const TapeBlock& a, const TapeBlock& b, TapeBlock& out) {
+        size_t size = 4 + a.length + 2;
+        size_t positions[MAX_MERGE_BYTES];
+        size_t count = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (a.bytes[i] == b.bytes[i]) continue;
+            if (count == MAX_MERGE_BYTES) return false;
+            positions[count++] = i;
+        }
+        out = a;
+        for (uint32_t mask = 0; mask < (1u << count); mask++) {
+            for (size_t k = 0; k < count; k++) {
+                out.bytes[positions[k]] = (mask >> k & 1 ? b : a).bytes[positions[k]];
+            }
+            if (out.checkCRC()) {
+                out.type = (char)out.bytes[0];
+                out.number = (out.bytes[1] << 8) | out.bytes[2];
+                out.crcOK = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void use(const TapeBlock& block) {
+        if (block.type == 'H') {
+            finishFile();
+            file = TapeFile();
+            present.clear();
+            parseLabel(block, file);
+            inFile = true;
+        } else if (block.type == 'D' && inFile && block.number > 0) {
+            size_t offset = (size_t)(block.number - 1) * TapeFormat::DATA_BLOCK;
+            if (file.data.size() < offset + TapeFormat::DATA_BLOCK) file.data.resize(offset + TapeFormat::DATA_BLOCK);
+            memcpy(&file.data[offset], block.data(), TapeFormat::DATA_BLOCK);
+            if (present.size() < block.number) present.resize(block.number);
+            present[block.number - 1] = true;
+            file.blocks = std::max<size_t>(file.blocks, block.number);
+        } else if (block.type == 'E' && inFile) {
+            file.blocks = block.number > 0 ? block.number - 1u : 0;
+            file.complete = true;
+            finishFile();
+        }
+    }
+
+    void resolve(const TapeBlock& first, const TapeBlock* second) {
+        BlockRecord record{first.type, first.number, (uint8_t)(second ? 2 : 1),
+                           (uint8_t)(first.crcOK + (second && second->crcOK)), 0, BlockRecord::OK};
+        if (second && first.length == second->length) {
+            // The copy byte and the CRC always differ
+            for (size_t i = 0; i < 4u + first.length; i++) record.differing += i != 3 && first.bytes[i] != second->bytes[i];
+        }
+        if (first.crcOK) {
+            use(first);
+        } else if (second && second->crcOK) {
+            record.type = second->type;
+            record.number = second->number;
+            use(*second);
+        } else if (second && first.length == second->length && merge(first, *second, merged)) {
+            record.type = merged.type;
+            record.number = merged.number;
+            record.status = BlockRecord::MERGED;
+            if (inFile) file.blocksMerged++;
+            use(merged);
+        } else {
+            record.status = BlockRecord::LOST;
+        }
+        records.push_back(record);
+    }
+
+    void finishFile() {
+        if (!inFile) return;
+        inFile = false;
+        // Data blocks are zero-padded: a tokenized image knows its size,
+        // ASCII text ends at the first padding byte
+        size_t have = std::count(present.begin(), present.end(), true);
+        file.blocksLost = file.blocks > have ? file.blocks - have : 0;
+        if (file.type == "TOKEN" && file.data.size() >= 3 && (uint8_t)file.data[0] == 0xFF) {
+            size_t size = ((uint8_t)file.data[1] << 8) | (uint8_t)file.data[2];
+            if (size >= 3 && size <= file.data.size()) file.data.resize(size);
+        } else {
+            file.data.erase(file.data.find_last_not_of('\0') + 1);
+        }
+        file.complete = file.complete && file.blocksLost == 0;
+        files.push_back(std::move(file));
+    }
+
+    TapeBlock merged;
+
+public:
+    std::vector<TapeFile> files;
+    std::vector<BlockRecord> records;   // one per block, in tape order
+
+    // The file whose label has been read but whose EOF label has not
+    const TapeFile* current() const { return inFile ? &file : nullptr; }
+
+    void add(const TapeBlock& block) {
+        if (havePending) {
+            // Copy 1 of the pending block; a damaged ID still pairs up
+            if (pending.copy == 0 && block.copy == 1 &&
+                ((block.type == pending.type && block.number == pending.number) || !block.crcOK ||
+                 !pending.crcOK)) {
+                resolve(pending, &block);
+                havePending = false;
+                return;
+            }
+            resolve(pending, nullptr);
+        }
+        pending = block;
+        havePending = true;
+    }
+
+    void finish() {
+        if (havePending) resolve(pending, nullptr);
+        havePending = false;
+        finishFile();
+    }
+};
+
+// Running mean, deviation and extremes (Welford)
+struct RunningStats {
+    uint64_t count = 0;
+    double mean = 0, m2 = 0;
+    double min = 0, max = 0;
+
+    void add(double x) {
+        if (count == 0) min = max = x;
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+    double stddev() const { return count > 1 ? std::sqrt(m2 / (count - 1)) : 0.0; }
+};
+
+// Pulse widths in 10 µs bins up to the longest valid pulse
+struct PulseHistogram {
+    static const int BIN_US = 10;
+    static const int BINS = (int)(TapeFormat::MAX_PULSE_US / BIN_US) + 1;
+    uint64_t counts[BINS] = {};
+    uint64_t total = 0;
+
+    void add(double us) {
+        counts[std::min(BINS - 1, std::max(0, (int)(us / BIN_US)))]++;
+        total++;
+    }
+    // Width below which a fraction p of the pulses fall, to the bin
+    double percentile(double p) const {
+        uint64_t target = (uint64_t)std::ceil(p * total), seen = 0;
+        for (int i = 0; i < BINS; i++) {
+            seen += counts[i];
+            if (seen >= std::max<uint64_t>(target, 1)) return (i + 0.5) * BIN_US;
+        }
+        return 0;
+    }
+};
+
+// A value over time in at most POINTS buckets. When the buckets run out,
+// neighbours are merged and each bucket covers twice the time.
+class TimeSeries {
+public:
+    static const int POINTS = 64;
+
+private:
+    double sums[POINTS] = {};
+    uint32_t counts[POINTS] = {};
+    uint64_t span = 0;          // samples per bucket
+
+public:
+    void begin(uint64_t samplesPerBucket) {
+        std::fill(sums, sums + POINTS, 0.0);
+        std::fill(counts, counts + POINTS, 0u);
+        span = std::max<uint64_t>(1, samplesPerBucket);
+    }
+
+    void add(uint64_t position, double value) {
+        while (position / span >= (uint64_t)POINTS) {
+            for (int i = 0; i < POINTS / 2; i++) {
+                sums[i] = sums[2 * i] + sums[2 * i + 1];
+                counts[i] = counts[2 * i] + counts[2 * i + 1];
+            }
+            std::fill(sums + POINTS / 2, sums + POINTS, 0.0);
+            std::fill(counts + POINTS / 2, counts + POINTS, 0u);
+            span *= 2;
+        }
+        size_t i = position / span;
+        sums[i] += value;
+        counts[i]++;
+    }
+
+    uint64_t samplesPerPoint() const { return span; }
+    // Bucket means up to the last bucket with data; empty buckets are NaN
+    std::vector<double> points() const {
+        int last = POINTS - 1;
+        while (last >= 0 && counts[last] == 0) last--;
+        std::vector<double> out;
+        for (int i = 0; i <= last; i++) out.push_back(counts[i] ? sums[i] / counts[i] : NAN);
+        return out;
+    }
+};
+
+// Signal-quality measurements for one capture
+class SignalQuality {
+    double slowMean[2] = {};    // per-class mean width of clean pulses, ~2000 pulses
+    int warmup[2] = {};
+    double fastRatio = 1;       // width / slowMean, ~30 pulses
+    int previousClass = -1;     // the previous pulse, waiting for its successor
+    double previousWidth = 0;
+    uint64_t previousPosition = 0;
+
+    // Wow from pulses whose successor is of the same class. Where the class
+    // changes, the crossing moves within the cycle and shifts the width
+    // (by a sample or so at 11 kHz), which would read as a speed change.
+    void speed(int cls, double width, uint64_t position) {
+        double& mean = slowMean[cls];
+        if (warmup[cls] < WARMUP_PULSES) {
+            mean = warmup[cls]++ == 0 ? width : mean + 0.1 * (width - mean);
+            return;
+        }
+        mean += (width - mean) / 2000;
+        fastRatio += (width / mean - fastRatio) / 30;
+        double deviation = (fastRatio - 1) * 100;
+        wow.add(deviation);
+        wowPeak = std::max(wowPeak, std::fabs(deviation));
+        speedSeries.add(position, fastRatio * 100);
+    }
+
+public:
+    static const int WARMUP_PULSES = 64;
+    static constexpr double NEAR_THRESHOLD_US = 50.0;
+
+    PulseHistogram shortHistogram, longHistogram;
+    RunningStats shortWidths, longWidths;
+    RunningStats thresholds;            // the threshold each pulse was judged by
+    PulseHistogram shortMargins, longMargins;
+    double worstMargin = 1e9;
+    RunningStats amplitude, level, wow;
+    uint64_t nearThreshold = 0;
+    double wowPeak = 0;
+    TimeSeries amplitudeSeries, levelSeries, speedSeries;
+
+    void begin(double rate) {
+        *this = SignalQuality();
+        uint64_t bucket = (uint64_t)rate;   // one second to start with
+        amplitudeSeries.begin(bucket);
+        levelSeries.begin(bucket);
+        speedSeries.begin(bucket);
+    }
+
+    // A gap or noise burst: speed tracking starts over
+    void interrupt() {
+        warmup[0] = warmup[1] = 0;
+        fastRatio = 1;
+        previousClass = -1;
+    }
+
+    void add(const TapePulse& pulse, double thresholdUs) {
+        int cls = pulse.widthUs > thresholdUs;
+        (cls ? longHistogram : shortHistogram).add(pulse.widthUs);
+        (cls ? longWidths : shortWidths).add(pulse.widthUs);
+        double margin = std::fabs(pulse.widthUs - thresholdUs);
+        (cls ? longMargins : shortMargins).add(margin);
+        worstMargin = std::min(worstMargin, margin);
+        thresholds.add(thresholdUs);
+        if (margin < NEAR_THRESHOLD_US) nearThreshold++;
+        amplitude.add(pulse.amplitude);
+        level.add(pulse.level);
+        amplitudeSeries.add(pulse.position, pulse.amplitude);
+        levelSeries.add(pulse.position, pulse.level);
+
+        if (previousClass == cls) speed(cls, previousWidth, previousPosition);
+        previousClass = cls;
+        previousWidth = pulse.widthUs;
+        previousPosition = pulse.position;
+    }
+
+    // A pulse from the edge detector; out-of-range widths are gaps or noise
+    void observe(const TapePulse& pulse, double thresholdUs) {
+        if (pulse.widthUs < TapeFormat::MIN_PULSE_US || pulse.widthUs > TapeFormat::MAX_PULSE_US) {
+            interrupt();
+        } else {
+            add(pulse, thresholdUs);
+        }
+    }
+
+    double rmsWow() const { return std::sqrt(wow.mean * wow.mean + wow.stddev() * wow.stddev()); }
+
+    // Margin between a pulse and the threshold it was judged by: worst case,
+    // and ignoring the closest 0.1% of each class
+    double worstMarginUs() const { return worstMargin == 1e9 ? 0 : worstMargin; }
+    double robustMarginUs() const {
+        double margin = 1e9;
+        if (shortMargins.total) margin = std::min(margin, shortMargins.percentile(0.001));
+        if (longMargins.total) margin = std::min(margin, longMargins.percentile(0.001));
+        return margin == 1e9 ? 0 : margin;
+    }
+};
+
+// All stages together for one channel of one capture
+class TapeDecoder {
+    EdgeDetector edges;
+    PulseFramer framer;
+    BlockAssembler assembler;
+    SignalQuality quality;
+    double sampleRate = 0;
+    uint64_t samples = 0;
+    uint64_t pulses = 0;
+    uint64_t blocksSeen = 0, blocksBad = 0;
+
+public:
+    // `adaptive` false decodes with the fixed threshold
+    void begin(double rate, bool adaptive = true) {
+        sampleRate = rate;
+        edges.begin(rate);
+        framer = PulseFramer();
+        framer.adaptive = adaptive;
+        assembler = BlockAssembler();
+        quality.begin(rate);
+        samples = pulses = blocksSeen = blocksBad = 0;
+    }
+
+    void feed(const float* data, size_t count) {
+        samples += count;
+        edges.process(data, count, [&](const TapePulse& pulse) {
+            pulses++;
+            quality.observe(pulse, framer.thresholdUs);
+            framer.feed(pulse, [&](const TapeBlock& block) {
+                blocksSeen++;
+                blocksBad += !block.crcOK;
+                assembler.add(block);
+            });
+        });
+    }
+
+    void finish() { assembler.finish(); }
+
+    const std::vector<TapeFile>& files() const { return assembler.files; }
+    const TapeFile* currentFile() const { return assembler.current(); }
+    const std::vector<BlockRecord>& blocks() const { return assembler.records; }
+    const SignalQuality& signal() const { return quality; }
+    const PulseFramer& framing() const { return framer; }
+    uint64_t sampleCount() const { return samples; }
+    uint64_t pulseCount() const { return pulses; }
+    uint64_t blockCount() const { return blocksSeen; }
+    uint64_t badBlockCount() const { return blocksBad; }
+    double rate() const { return sampleRate; }
+
+    double worstMarginUs() const { return quality.worstMarginUs(); }
+    double robustMarginUs() const { return quality.robustMarginUs(); }
+
+    // `channel` is included when it is not negative
+    std::string metricsJSON(const std::string& capture, int channel = -1) const;
+};
+
+inline std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((uint8_t)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+inline std::string jsonNumber(double value, int decimals = 3) {
+    if (!std::isfinite(value)) return "null";
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", decimals, value);
+    return text;
+}
+
+// Signal level as a percentage of full scale
+inline std::string jsonSeries(const TimeSeries& series, double rate, double scale) {
+    std::string out = "{\"seconds_per_point\": " + jsonNumber(series.samplesPerPoint() / rate) + ", \"points\": [";
+    std::vector<double> points = series.points();
+    for (size_t i = 0; i < points.size(); i++) out += (i ? ", " : "") + jsonNumber(points[i] * scale, 2);
+    return out + "]}";
+}
+
+inline std::string jsonPulses(const RunningStats& widths, const PulseHistogram& histogram) {
+    std::string out = "{\"count\": " + std::to_string(widths.count) + ", \"mean_us\": " + jsonNumber(widths.mean, 1) +
+                      ", \"stddev_us\": " + jsonNumber(widths.stddev(), 1) + ", \"min_us\": " +
+                      jsonNumber(widths.min, 1) + ", \"max_us\": " + jsonNumber(widths.max, 1) +
+                      ", \"histogram\": {\"bin_us\": " + std::to_string(PulseHistogram::BIN_US);
+    int first = 0, last = PulseHistogram::BINS - 1;
+    while (first <= last && histogram.counts[first] == 0) first++;
+    while (last >= first && histogram.counts[last] == 0) last--;
+    out += ", \"first_us\": " + std::to_string(first <= last ? first * PulseHistogram::BIN_US : 0) + ", \"counts\": [";
+    for (int i = first; i <= last; i++) out += (i > first ? ", " : "") + std::to_string(histogram.counts[i]);
+    return out + "]}}";
+}
+
+inline std::string TapeDecoder::metricsJSON(const std::string& capture, int channel) const {
+    const SignalQuality& q = quality;
+    size_t merged = 0, lost = 0;
+    for (const BlockRecord& record : assembler.records) {
+        merged += record.status == BlockRecord::MERGED;
+        lost += record.status == BlockRecord::LOST;
+    }
+
+    std::string out = "{\"capture\": " + jsonString(capture);
+    if (channel >= 0) out += ", \"channel\": " + std::to_string(channel);
+    out += ", \"sample_rate\": " + std::to_string((long)sampleRate);
+    out += ", \"seconds\": " + jsonNumber(samples / sampleRate);
+    out += ", \"pulses\": {\"total\": " + std::to_string(pulses) +
+           ", \"out_of_range\": " + std::to_string(framer.outOfRange) +
+           ", \"short\": " + jsonPulses(q.shortWidths, q.shortHistogram) +
+           ", \"long\": " + jsonPulses(q.longWidths, q.longHistogram) + "}";
+    out += ", \"threshold\": {\"us\": " + jsonNumber(q.thresholds.count ? q.thresholds.mean : framer.thresholdUs, 1) +
+           ", \"min_us\": " + jsonNumber(q.thresholds.count ? q.thresholds.min : framer.thresholdUs, 1) +
+           ", \"max_us\": " + jsonNumber(q.thresholds.count ? q.thresholds.max : framer.thresholdUs, 1) +
+           ", \"adaptive\": " + (framer.adaptive ? "true" : "false") +
+           ", \"margin_us\": " + jsonNumber(worstMarginUs(), 1) +
+           ", \"robust_margin_us\": " + jsonNumber(robustMarginUs(), 1) +
+           ", \"near_threshold\": " + std::to_string(q.nearThreshold) + "}";
+    out += ", \"blocks\": {\"received\": " + std::to_string(blocksSeen) +
+           ", \"crc_errors\": " + std::to_string(blocksBad) +
+           ", \"error_rate\": " + jsonNumber(blocksSeen ? (double)blocksBad / blocksSeen : 0.0, 4) +
+           ", \"framing_errors\": " + std::to_string(framer.framingErrors) +
+           ", \"preamble_errors\": " + std::to_string(framer.preambleErrors) +
+           ", \"merged\": " + std::to_string(merged) + ", \"lost\": " + std::to_string(lost) + ", \"list\": [";
+    for (size_t i = 0; i < assembler.records.size(); i++) {
+        const BlockRecord& r = assembler.records[i];
+        static const char* status[] = {"ok", "merged", "lost"};
+        out += std::string(i ? ", " : "") + "{\"type\": " + jsonString(std::string(1, isprint((uint8_t)r.type) ? r.type : '?')) +
+               ", \"number\": " + std::to_string(r.number) + ", \"copies\": " + std::to_string(r.copies) +
+               ", \"good\": " + std::to_string(r.good) + ", \"differing_bytes\": " + std::to_string(r.differing) +
+               ", \"status\": \"" + status[r.status] + "\"}";
+    }
+    out += "]}";
+    out += ", \"amplitude\": {\"mean_percent\": " + jsonNumber(q.amplitude.mean * 100, 2) +
+           ", \"min_percent\": " + jsonNumber(q.amplitude.min * 100, 2) +
+           ", \"max_percent\": " + jsonNumber(q.amplitude.max * 100, 2) +
+           ", \"series\": " + jsonSeries(q.amplitudeSeries, sampleRate, 100) + "}";
+    out += ", \"dc\": {\"mean_percent\": " + jsonNumber(q.level.mean * 100, 2) +
+           ", \"drift_percent\": " + jsonNumber((q.level.max - q.level.min) * 100, 2) +
+           ", \"series\": " + jsonSeries(q.levelSeries, sampleRate, 100) + "}";
+    out += ", \"wow\": {\"rms_percent\": " + jsonNumber(q.rmsWow(), 3) +
+           ", \"peak_percent\": " + jsonNumber(q.wowPeak, 3) +
+           ", \"speed_series\": " + jsonSeries(q.speedSeries, sampleRate, 1) + "}";
+    out += ", \"files\": [";
+    for (size_t i = 0; i < assembler.files.size(); i++) {
+        const TapeFile& f = assembler.files[i];
+        out += std::string(i ? ", " : "") + "{\"name\": " + jsonString(f.name) + ", \"type\": \"" + f.type +
+               "\", \"date\": " + jsonString(f.isoDate()) + ", \"time\": " + jsonString(f.isoTime()) +
+               ", \"bytes\": " + std::to_string(f.data.size()) + ", \"blocks\": " + std::to_string(f.blocks) +
+               ", \"merged\": " + std::to_string(f.blocksMerged) + ", \"lost\": " + std::to_string(f.blocksLost) +
+               ", \"complete\": " + (f.complete ? "true" : "false") + "}";
+    }
+    return out + "]}";
+}
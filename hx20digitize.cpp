@@ -0,0 +1,672 @@
+// hx20digitize: a directory of tape captures in, recovered programs and a
+// report out.
+//
+// Each capture flows through six stages, connected by bounded queues
+// (hx20pipeline.h):
+//
+//   read      map the WAV and fault its pages in, one slice at a time
+//   resample  convert one channel to float, and to --rate if asked
+//   edge      find the pulses (EdgeDetector)
+//   frame     bits, bytes and blocks (PulseFramer), signal quality
+//   merge     CRC check, pairing and repair of the two copies (BlockAssembler)
+//   write     detokenize and write the recovered files
+//
+// Every stage runs on its own threads. A capture always takes the same
+// path through them, so its chunks stay in order. With several captures in
+// flight, every stage is kept busy.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HX20_STATS_MAIN
+#include "hx20stats.h"
+#define HX20TOKENIZER_NO_MAIN
+#include "hx20tokenizer.cpp"
+#include "hx20decoder.h"
+#include "hx20pipeline.h"
+
+const size_t SLICE_FRAMES = 32768;      // frames per read slice
+const size_t QUEUE_CAPACITY = 64;       // items per stage thread
+
+enum Stage { STAGE_READ, STAGE_RESAMPLE, STAGE_EDGE, STAGE_FRAME, STAGE_MERGE, STAGE_WRITE, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"read", "resample", "edge", "frame", "merge", "write"};
+const char* const STAGE_UNITS[STAGE_COUNT] = {"bytes", "samples", "samples", "pulses", "blocks", "bytes"};
+
+// Everything known about one capture. Each stage fills in its own fields
+// before it passes the capture's last chunk on, so no locks are needed.
+struct Capture {
+    hx20fs::path path;
+    hx20fs::path relative;
+    std::string error;
+    uint32_t sampleRate = 0;
+    double seconds = 0;
+    uint64_t bytes = 0;
+    uint64_t samples = 0;
+    uint64_t pulses = 0;
+    uint64_t blocks = 0;
+    uint64_t crcErrors = 0;
+    uint64_t framingErrors = 0;
+    double marginUs = 0;
+    double robustMarginUs = 0;
+    std::vector<TapeFile> files;
+    std::vector<std::string> outputs;   // per file, comma-separated
+};
+
+// A capture mapped into memory; unmapped when the last slice is converted
+struct MappedCapture {
+    void* base = MAP_FAILED;
+    size_t length = 0;
+    ~MappedCapture() {
+        if (base != MAP_FAILED) munmap(base, length);
+    }
+};
+
+struct RawSlice {
+    size_t capture;
+    bool last;
+    std::shared_ptr<const MappedCapture> map;
+    const uint8_t* frames;
+    size_t count;
+    unsigned channels, bitsPerSample;
+    double rate;
+};
+
+struct SampleChunk {
+    size_t capture;
+    bool last;
+    double rate;
+    std::vector<float> samples;
+};
+
+struct PulseChunk {
+    size_t capture;
+    bool last;
+    double rate;
+    std::vector<TapePulse> pulses;
+};
+
+struct BlockChunk {
+    size_t capture;
+    bool last;
+    std::vector<TapeBlock> blocks;
+};
+
+struct CaptureDone {
+    size_t capture;
+    bool last;
+};
+
+struct DigitizeOptions {
+    hx20fs::path outputDir;
+    std::string reportFile;
+    unsigned jobs = 0;                      // 0 = one per core
+    unsigned threads[STAGE_COUNT] = {};     // 0 = from jobs
+    unsigned channel = 0;
+    double rate = 0;                        // resample to this rate; 0 = keep
+    bool adaptive = true;                   // false: fixed 750 µs bit threshold
+};
+
+// Open, check and map a capture; the first slice starts at `data`
+bool mapCapture(Capture& capture, unsigned channel, std::shared_ptr<MappedCapture>& map, const uint8_t*& data,
+                uint64_t& frames, unsigned& channels, unsigned& bits) {
+    WavReader wav;
+    if (!wav.open(capture.path.string(), capture.error)) return false;
+    if (channel >= wav.channels) {
+        capture.error = capture.path.string() + " has " + std::to_string(wav.channels) + " channel(s)";
+        return false;
+    }
+    int fd = ::open(capture.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        capture.error = "could not open " + capture.path.string();
+        return false;
+    }
+    map = std::make_shared<MappedCapture>();
+    map->length = (size_t)st.st_size;
+    map->base = mmap(nullptr, map->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map->base == MAP_FAILED) {
+        capture.error = "could not map " + capture.path.string();
+        return false;
+    }
+    madvise(map->base, map->length, MADV_SEQUENTIAL);
+
+    // A capture cut short keeps the frames that are there
+    size_t frameBytes = wav.channels * (wav.bitsPerSample / 8);
+    uint64_t available = wav.dataOffset < map->length ? (map->length - wav.dataOffset) / frameBytes : 0;
+    frames = std::min<uint64_t>(wav.frames, available);
+    data = (const uint8_t*)map->base + wav.dataOffset;
+    channels = wav.channels;
+    bits = wav.bitsPerSample;
+    capture.sampleRate = wav.sampleRate;
+    capture.seconds = (double)frames / wav.sampleRate;
+    capture.bytes = map->length;
+    return true;
+}
+
+std::string fileStem(const std::string& name) {
+    std::string stem;
+    for (char c : name) stem += isalnum((uint8_t)c) || c == '-' ? c : '_';
+    return stem.empty() ? "NONAME" : stem;
+}
+
+bool writeFile(const hx20fs::path& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    return (bool)out.write(data.data(), data.size());
+}
+
+// Recovered files go to <output>/<capture path without .wav>/: tokenized
+// programs as NAME.bas plus a detokenized NAME.txt, ASCII programs as
+// NAME.txt, data files as NAME.dat
+uint64_t writeCapture(Capture& capture, const hx20fs::path& outputDir) {
+    HX20_TRACE_SPAN("write capture");
+    hx20fs::path dir = outputDir / capture.relative;
+    dir.replace_extension();
+    std::error_code ec;
+    if (!capture.files.empty()) hx20fs::create_directories(dir, ec);
+    if (ec) {
+        capture.error = "could not create " + dir.string();
+        return 0;
+    }
+
+    uint64_t written = 0;
+    std::unordered_map<std::string, int> used;
+    for (const TapeFile& file : capture.files) {
+        std::string stem = fileStem(file.name);
+        if (int n = used[stem]++) stem += "_" + std::to_string(n + 1);
+        std::vector<std::pair<std::string, std::string>> outputs;
+        if (file.type == "TOKEN") {
+            outputs.push_back({stem + ".bas", file.data});
+            outputs.push_back({stem + ".txt", detokenizeBasicProgram(file.data)});
+        } else if (file.type == "ASCII") {
+            std::string text;
+            text.reserve(file.data.size());
+            for (char c : file.data) {
+                if (c != '\r') text += c;
+            }
+            outputs.push_back({stem + ".txt", text});
+        } else {
+            outputs.push_back({stem + ".dat", file.data});
+        }
+
+        std::string names;
+        for (const auto& output : outputs) {
+            hx20fs::path path = dir / output.first;
+            if (!writeFile(path, output.second)) {
+                capture.error = "could not write " + path.string();
+                continue;
+            }
+            written += output.second.size();
+            names += (names.empty() ? "" : ",") + path.string();
+        }
+        capture.outputs.push_back(names);
+    }
+    return written;
+}
+
+// Per-stage thread counts: the explicit ones, then the rest of -j spread
+// over the stages in proportion to their usual share of the work
+void planThreads(DigitizeOptions& options) {
+    static const double weight[STAGE_COUNT] = {0.5, 1.5, 4, 1.5, 0.5, 0.5};
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    double open = 0;
+    unsigned fixed = 0;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (options.threads[s]) {
+            fixed += options.threads[s];
+        } else {
+            open += weight[s];
+        }
+    }
+    unsigned spare = jobs > fixed ? jobs - fixed : 0;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (!options.threads[s]) options.threads[s] = std::max(1u, (unsigned)(spare * weight[s] / open));
+    }
+}
+
+// Run the whole pipeline over `captures`; returns the wall time
+double runPipeline(std::vector<Capture>& captures, const DigitizeOptions& options, std::vector<StageMetrics>& metrics) {
+    const unsigned* n = options.threads;
+    StageLink<RawSlice> toResample(n[STAGE_RESAMPLE], n[STAGE_READ], QUEUE_CAPACITY);
+    StageLink<SampleChunk> toEdge(n[STAGE_EDGE], n[STAGE_RESAMPLE], QUEUE_CAPACITY);
+    StageLink<PulseChunk> toFrame(n[STAGE_FRAME], n[STAGE_EDGE], QUEUE_CAPACITY);
+    StageLink<BlockChunk> toMerge(n[STAGE_MERGE], n[STAGE_FRAME], QUEUE_CAPACITY);
+    StageLink<CaptureDone> toWrite(n[STAGE_WRITE], n[STAGE_MERGE], QUEUE_CAPACITY);
+
+    metrics.resize(STAGE_COUNT);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        metrics[s].name = STAGE_NAMES[s];
+        metrics[s].unit = STAGE_UNITS[s];
+        metrics[s].threads = n[s];
+        metrics[s].perThread.assign(n[s], StageCounters());
+    }
+
+    // Receive until every producer is done, then close the link downstream
+    auto consume = [](auto& input, unsigned thread, StageCounters& counters, auto process) {
+        auto start = std::chrono::steady_clock::now();
+        while (auto item = input.receive(thread, counters)) {
+            counters.items++;
+            process(*item);
+        }
+        counters.busySeconds = pipelineSeconds(start) - counters.inputWaitSeconds - counters.outputWaitSeconds;
+    };
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned t = 0; t < n[STAGE_READ]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("read " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_READ].perThread[t];
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t c = t; c < captures.size(); c += n[STAGE_READ]) {
+                Capture& capture = captures[c];
+                std::shared_ptr<MappedCapture> map;
+                const uint8_t* data = nullptr;
+                uint64_t frames = 0;
+                unsigned channels = 0, bits = 0;
+                if (!mapCapture(capture, options.channel, map, data, frames, channels, bits)) frames = 0;
+                size_t frameBytes = channels * (bits / 8);
+                uint64_t done = 0;
+                do {
+                    HX20_TRACE_SPAN("read slice");
+                    size_t count = (size_t)std::min<uint64_t>(SLICE_FRAMES, frames - done);
+                    const uint8_t* slice = data + done * frameBytes;
+                    // Fault the pages in here rather than in the converter
+                    volatile uint8_t sink = 0;
+                    for (size_t i = 0; i < count * frameBytes; i += 4096) sink = sink + slice[i];
+                    counters.units += count * frameBytes;
+                    done += count;
+                    auto item = std::unique_ptr<RawSlice>(new RawSlice{c, done == frames, map, slice, count, channels,
+                                                                       bits, (double)capture.sampleRate});
+                    toResample.send(c, std::move(item), counters);
+                    counters.items++;
+                } while (done < frames);
+            }
+            toResample.close(counters);
+            counters.busySeconds = pipelineSeconds(begin) - counters.outputWaitSeconds;
+        });
+    }
+
+    for (unsigned t = 0; t < n[STAGE_RESAMPLE]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("resample " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_RESAMPLE].perThread[t];
+            std::unordered_map<size_t, SincResampler> resamplers;
+            std::vector<float> converted;
+            consume(toResample, t, counters, [&](RawSlice& slice) {
+                HX20_TRACE_SPAN("resample");
+                auto out = std::unique_ptr<SampleChunk>(new SampleChunk{slice.capture, slice.last, slice.rate, {}});
+                if (options.rate > 0 && options.rate != slice.rate) {
+                    auto it = resamplers.find(slice.capture);
+                    if (it == resamplers.end()) {
+                        it = resamplers.emplace(slice.capture, SincResampler()).first;
+                        it->second.begin(slice.rate, options.rate);
+                    }
+                    out->samples.reserve((size_t)(slice.count * options.rate / slice.rate) + 2);
+                    if (slice.count) {
+                        converted.resize(slice.count);
+                        pcmToFloat(slice.frames, slice.count, slice.channels, slice.bitsPerSample, options.channel,
+                                   converted.data());
+                        it->second.process(converted.data(), slice.count, out->samples);
+                    }
+                    if (slice.last) it->second.finish(out->samples);
+                    out->rate = options.rate;
+                } else if (slice.count) {
+                    out->samples.resize(slice.count);
+                    pcmToFloat(slice.frames, slice.count, slice.channels, slice.bitsPerSample, options.channel,
+                               out->samples.data());
+                }
+                counters.units += slice.count;
+                if (slice.last) resamplers.erase(slice.capture);
+                slice.map.reset();
+                toEdge.send(slice.capture, std::move(out), counters);
+            });
+            toEdge.close(counters);
+        });
+    }
+
+    for (unsigned t = 0; t < n[STAGE_EDGE]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("edge " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_EDGE].perThread[t];
+            std::unordered_map<size_t, EdgeDetector> detectors;
+            consume(toEdge, t, counters, [&](SampleChunk& chunk) {
+                HX20_TRACE_SPAN("edge");
+                auto out = std::unique_ptr<PulseChunk>(new PulseChunk{chunk.capture, chunk.last, chunk.rate, {}});
+                if (!chunk.samples.empty()) {
+                    auto it = detectors.find(chunk.capture);
+                    if (it == detectors.end()) {
+                        it = detectors.emplace(chunk.capture, EdgeDetector()).first;
+                        it->second.begin(chunk.rate);
+                    }
+                    it->second.process(chunk.samples.data(), chunk.samples.size(),
+                                       [&](const TapePulse& pulse) { out->pulses.push_back(pulse); });
+                    captures[chunk.capture].samples += chunk.samples.size();
+                }
+                counters.units += chunk.samples.size();
+                if (chunk.last) detectors.erase(chunk.capture);
+                toFrame.send(chunk.capture, std::move(out), counters);
+            });
+            toFrame.close(counters);
+        });
+    }
+
+    struct FrameState {
+        PulseFramer framer;
+        SignalQuality quality;
+    };
+    for (unsigned t = 0; t < n[STAGE_FRAME]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("frame " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_FRAME].perThread[t];
+            std::unordered_map<size_t, FrameState> states;
+            consume(toFrame, t, counters, [&](PulseChunk& chunk) {
+                HX20_TRACE_SPAN("frame");
+                auto out = std::unique_ptr<BlockChunk>(new BlockChunk{chunk.capture, chunk.last, {}});
+                auto it = states.find(chunk.capture);
+                if (it == states.end()) {
+                    it = states.emplace(chunk.capture, FrameState()).first;
+                    it->second.framer.verify = false;   // the merge stage checks
+                    it->second.framer.adaptive = options.adaptive;
+                    it->second.quality.begin(chunk.rate);
+                }
+                FrameState& state = it->second;
+                for (const TapePulse& pulse : chunk.pulses) {
+                    state.quality.observe(pulse, state.framer.thresholdUs);
+                    state.framer.feed(pulse, [&](const TapeBlock& block) { out->blocks.push_back(block); });
+                }
+                counters.units += chunk.pulses.size();
+                Capture& capture = captures[chunk.capture];
+                capture.pulses += chunk.pulses.size();
+                if (chunk.last) {
+                    capture.framingErrors = state.framer.framingErrors;
+                    capture.marginUs = state.quality.worstMarginUs();
+                    capture.robustMarginUs = state.quality.robustMarginUs();
+                    states.erase(it);
+                }
+                toMerge.send(chunk.capture, std::move(out), counters);
+            });
+            toMerge.close(counters);
+        });
+    }
+
+    for (unsigned t = 0; t < n[STAGE_MERGE]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("merge " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_MERGE].perThread[t];
+            std::unordered_map<size_t, BlockAssembler> assemblers;
+            consume(toMerge, t, counters, [&](BlockChunk& chunk) {
+                HX20_TRACE_SPAN("merge");
+                Capture& capture = captures[chunk.capture];
+                BlockAssembler& assembler = assemblers[chunk.capture];
+                for (TapeBlock& block : chunk.blocks) {
+                    block.crcOK = block.checkCRC();
+                    capture.crcErrors += !block.crcOK;
+                    assembler.add(block);
+                }
+                capture.blocks += chunk.blocks.size();
+                counters.units += chunk.blocks.size();
+                if (!chunk.last) return;
+                assembler.finish();
+                capture.files = std::move(assembler.files);
+                assemblers.erase(chunk.capture);
+                toWrite.send(chunk.capture, std::unique_ptr<CaptureDone>(new CaptureDone{chunk.capture, true}),
+                             counters);
+            });
+            toWrite.close(counters);
+        });
+    }
+
+    for (unsigned t = 0; t < n[STAGE_WRITE]; t++) {
+        threads.emplace_back([&, t] {
+            TRACER.setThreadName("write " + std::to_string(t));
+            StageCounters& counters = metrics[STAGE_WRITE].perThread[t];
+            consume(toWrite, t, counters, [&](CaptureDone& done) {
+                counters.units += writeCapture(captures[done.capture], options.outputDir);
+            });
+        });
+    }
+
+    for (auto& thread : threads) thread.join();
+    return pipelineSeconds(start);
+}
+
+bool writeReport(const std::string& file, const std::vector<Capture>& captures) {
+    std::ofstream out(file, std::ios::trunc);
+    out << "capture\tfile\ttype\tdate\ttime\tbytes\tblocks\tmerged\tlost\tstatus\tcrc_errors\tframing_errors"
+           "\tmargin_us\toutputs\n";
+    for (const Capture& capture : captures) {
+        std::string tail = "\t" + std::to_string(capture.crcErrors) + "\t" + std::to_string(capture.framingErrors) +
+                           "\t" + jsonNumber(capture.marginUs, 0);
+        if (!capture.error.empty() || capture.files.empty()) {
+            out << capture.path.string() << "\t-\t-\t-\t-\t0\t0\t0\t0\t"
+                << (capture.error.empty() ? "no file" : "error: " + capture.error) << tail << "\t-\n";
+            continue;
+        }
+        for (size_t i = 0; i < capture.files.size(); i++) {
+            const TapeFile& f = capture.files[i];
+            out << capture.path.string() << "\t" << f.name << "\t" << f.type << "\t" << f.isoDate() << "\t"
+                << f.isoTime() << "\t" << f.data.size() << "\t" << f.blocks << "\t" << f.blocksMerged << "\t"
+                << f.blocksLost << "\t" << (f.complete ? "complete" : "incomplete") << tail << "\t"
+                << (i < capture.outputs.size() ? capture.outputs[i] : "-") << "\n";
+        }
+    }
+    out.close();
+    return (bool)out;
+}
+
+void printStageTable(const std::vector<StageMetrics>& metrics, double wallSeconds) {
+    std::cout << "\nStage      Threads     Items  Throughput/thread     Busy  Starved  Blocked\n";
+    const StageMetrics* bottleneck = nullptr;
+    for (const StageMetrics& stage : metrics) {
+        StageCounters total = stage.total();
+        double rate = total.busySeconds > 0 ? total.units / total.busySeconds : 0;
+        double threadSeconds = stage.threads * wallSeconds;
+        char line[160];
+        snprintf(line, sizeof(line), "%-10s %7u %9llu %9.1f M%-7s %7.0f%% %7.0f%% %7.0f%%\n", stage.name.c_str(),
+                 stage.threads, (unsigned long long)total.items, rate / 1e6, stage.unit.c_str(),
+                 100 * stage.utilization(wallSeconds), threadSeconds > 0 ? 100 * total.inputWaitSeconds / threadSeconds : 0,
+                 threadSeconds > 0 ? 100 * total.outputWaitSeconds / threadSeconds : 0);
+        std::cout << line;
+        if (!bottleneck || stage.utilization(wallSeconds) > bottleneck->utilization(wallSeconds)) bottleneck = &stage;
+    }
+    if (bottleneck) {
+        std::cout << "Bottleneck: " << bottleneck->name << " (" << jsonNumber(100 * bottleneck->utilization(wallSeconds), 0)
+                  << "% busy; give it more threads with --threads " << bottleneck->name << "=<n>)\n";
+    }
+}
+
+bool parseThreads(const std::string& spec, unsigned* threads) {
+    std::stringstream list(spec);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq);
+        int count = atoi(item.c_str() + eq + 1);
+        int stage = 0;
+        while (stage < STAGE_COUNT && name != STAGE_NAMES[stage]) stage++;
+        if (stage == STAGE_COUNT || count < 1) return false;
+        threads[stage] = (unsigned)count;
+    }
+    return true;
+}
+
+void printUsage(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " -i <dir|'glob'> -o <output dir> [-j <n>] [--threads <stage>=<n>,...]\n\n"
+        << "Recovers the programs from a directory of tape captures, with a report\n\n"
+        << "Options:\n"
+        << "  -i <dir|'glob'>  Captures: a WAV, a directory (every *.wav below it) or a glob (REQUIRED)\n"
+        << "  -o <dir>    Output directory; each capture gets a subdirectory (REQUIRED)\n"
+        << "  -j <n>      Threads in all (default: one per core)\n"
+        << "  --threads <list>  Threads per stage, e.g. edge=4,frame=2\n"
+        << "                    (stages: read, resample, edge, frame, merge, write)\n"
+        << "  --rate <hz>  Resample every capture to <hz> before decoding\n"
+        << "  -c <n>      Channel to decode (default: 0)\n"
+        << "  --fixed-threshold  Use a fixed 750 us bit threshold instead of following the tape speed\n"
+        << "  --report <file>  Report, tab-separated (default: <output dir>/report.tsv)\n"
+        << "  --stats[=json]   Report counters on stderr\n"
+        << "  --trace <file>   Write a Chrome/Perfetto trace-event timeline\n"
+        << "  -h          Show this help and exit\n";
+}
+
+int main(int argc, char* argv[]) {
+    auto wallStart = std::chrono::steady_clock::now();
+    std::string input;
+    std::string traceFile;
+    DigitizeOptions options;
+
+    static const struct option longOptions[] = {
+        {"threads", required_argument, nullptr, 'P'},
+        {"rate", required_argument, nullptr, 'R'},
+        {"report", required_argument, nullptr, 'E'},
+        {"fixed-threshold", no_argument, nullptr, 'F'},
+        {"stats", optional_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, ":i:o:j:c:h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                options.outputDir = optarg;
+                break;
+            case 'j':
+                options.jobs = (unsigned)atoi(optarg);
+                break;
+            case 'c':
+                options.channel = (unsigned)atoi(optarg);
+                break;
+            case 'P':
+                if (!parseThreads(optarg, options.threads)) {
+                    std::cerr << "Error: --threads takes <stage>=<n>,... with stages read, resample, edge, frame, "
+                                 "merge, write.\n";
+                    return 1;
+                }
+                break;
+            case 'R':
+                options.rate = atof(optarg);
+                if (options.rate < 4000) {
+                    std::cerr << "Error: --rate must be at least 4000 Hz.\n";
+                    return 1;
+                }
+                break;
+            case 'E':
+                options.reportFile = optarg;
+                break;
+            case 'F':
+                options.adaptive = false;
+                break;
+            case 'S':
+                STATS.enabled = true;
+                STATS.json = optarg && strcmp(optarg, "json") == 0;
+                break;
+            case 'T':
+                traceFile = optarg;
+                TRACER.enabled = true;
+                TRACER.setThreadName("main");
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            case ':':
+                std::cerr << "Error: Option '-" << char(optopt) << "' requires an argument.\n";
+                printUsage(argv[0]);
+                return 1;
+            case '?':
+            default:
+                std::cerr << "Error: Unknown option '-" << char(optopt) << "'.\n";
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (input.empty() || options.outputDir.empty()) {
+        std::cerr << "Error: -i <captures> and -o <output dir> are required.\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<SourceFile> sources;
+    hx20fs::path base;
+    std::string error;
+    if (!expandSources(input, ".wav", sources, base, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    std::vector<Capture> captures(sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+        captures[i].path = sources[i].path;
+        captures[i].relative = sources[i].relative;
+    }
+    std::error_code ec;
+    hx20fs::create_directories(options.outputDir, ec);
+    if (ec) {
+        std::cerr << "Error: could not create " << options.outputDir.string() << "\n";
+        return 1;
+    }
+
+    initReverseMaps();
+    planThreads(options);
+    std::vector<StageMetrics> metrics;
+    double seconds = runPipeline(captures, options, metrics);
+
+    size_t files = 0, incomplete = 0, failed = 0;
+    double audio = 0;
+    for (const Capture& capture : captures) {
+        HX20_STATS_ADD(STAT_FILES, 1);
+        HX20_STATS_ADD(STAT_INPUT_BYTES, capture.bytes);
+        HX20_STATS_ADD(STAT_SAMPLES, capture.samples);
+        HX20_STATS_ADD(STAT_PULSES, capture.pulses);
+        HX20_STATS_ADD(STAT_BLOCKS, capture.blocks);
+        audio += capture.seconds;
+        files += capture.files.size();
+        for (const TapeFile& file : capture.files) incomplete += !file.complete;
+        if (!capture.error.empty()) {
+            failed++;
+            std::cerr << "Error: " << capture.error << "\n";
+        }
+    }
+    for (const StageMetrics& stage : metrics) {
+        if (stage.name == "write") HX20_STATS_ADD(STAT_BYTES_WRITTEN, stage.total().units);
+    }
+
+    std::string reportFile = options.reportFile.empty() ? (options.outputDir / "report.tsv").string()
+                                                        : options.reportFile;
+    int result = failed ? 1 : incomplete ? 2 : 0;
+    if (!writeReport(reportFile, captures)) {
+        std::cerr << "Error: Could not write " << reportFile << "\n";
+        result = 1;
+    }
+    std::cout << "Digitized " << captures.size() << " captures (" << jsonNumber(audio / 60, 1) << " min of audio): "
+              << files << " files recovered, " << incomplete << " incomplete, " << failed << " failed in "
+              << jsonNumber(seconds, 2) << " s (" << jsonNumber(seconds > 0 ? audio / seconds : 0, 0)
+              << "x real time)\n";
+    std::cout << "Report: " << reportFile << "\n";
+    printStageTable(metrics, seconds);
+
+    if (!traceFile.empty() && !TRACER.writeTrace(traceFile)) {
+        std::cerr << "Error: Could not write trace file " << traceFile << "\n";
+        result = 1;
+    }
+    if (STATS.enabled) {
+        printStats("hx20digitize", std::chrono::duration<double>(
+                                       std::chrono::steady_clock::now() - wallStart).count());
+    }
+    return result;
+}
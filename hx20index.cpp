@@ -0,0 +1,642 @@
+// hx20index: a searchable catalog of a tape and program library.
+//
+// A scan walks the library on a pool of threads. Captures (*.wav) are
+// decoded, and programs (*.bas, *.txt) are read directly. Each program found
+// becomes one fixed-size entry: its name, type, HDR1 date and time, size, a
+// hash of its bytes, and a fingerprint of its token stream. The fingerprint
+// is the same for a program saved as ASCII or tokenized, on tape or on
+// disk. The index is one flat file that queries map and scan in place.
+// Rescans only reopen files whose size or mtime changed.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HX20_STATS_MAIN
+#include "hx20stats.h"
+#define HX20TOKENIZER_NO_MAIN
+#include "hx20tokenizer.cpp"
+#include "hx20decoder.h"
+
+// On-disk layout, in host byte order: IndexHeader, the entries sorted by
+// name and date, one IndexSource per scanned file, then the source paths
+const char INDEX_MAGIC[8] = {'H', 'X', '2', '0', 'I', 'D', 'X', 0};
+const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t sourceCount;
+    uint32_t pathBytes;
+    uint64_t reserved;
+};
+
+enum ProgramType : uint8_t { TYPE_TOKEN, TYPE_ASCII, TYPE_SEQUENTIAL, TYPE_BINARY, TYPE_COUNT };
+const char* const PROGRAM_TYPES[TYPE_COUNT] = {"TOKEN", "ASCII", "SEQUENTIAL", "BINARY"};
+
+enum EntryFlags : uint8_t {
+    ENTRY_FROM_TAPE = 1,
+    ENTRY_HEADER_ONLY = 2,      // size, hash and fingerprint unknown
+    ENTRY_INCOMPLETE = 4,       // blocks lost on tape
+};
+
+struct IndexEntry {
+    char name[8];               // zero-padded
+    uint32_t source;
+    uint16_t fileNumber;        // position on the tape, from 1; 0 for program files
+    uint8_t type;
+    uint8_t flags;
+    uint32_t date;              // YYYYMMDD, 0 if unknown
+    uint32_t time;              // HHMMSS
+    uint32_t size;
+    uint32_t lines;
+    uint64_t contentHash;
+    uint64_t fingerprint;       // 0 if not a BASIC program
+};
+
+enum SourceFlags : uint32_t { SOURCE_HEADER_ONLY = 1, SOURCE_UNREADABLE = 2 };
+
+struct IndexSource {
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t flags;
+    uint32_t entryCount;
+};
+
+static_assert(sizeof(IndexHeader) == 32 && sizeof(IndexEntry) == 48 && sizeof(IndexSource) == 32,
+              "index records must keep their on-disk size");
+
+// A read-only view of an index file
+class MappedIndex {
+    void* base = MAP_FAILED;
+    size_t length = 0;
+
+public:
+    const IndexHeader* header = nullptr;
+    const IndexEntry* entries = nullptr;
+    const IndexSource* sources = nullptr;
+    const char* paths = nullptr;
+
+    MappedIndex() = default;
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+    ~MappedIndex() {
+        if (base != MAP_FAILED) munmap(base, length);
+    }
+
+    bool open(const std::string& file, std::string& error) {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "could not open " + file;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(IndexHeader)) {
+            length = (size_t)st.st_size;
+            base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            error = file + " is not an index";
+            return false;
+        }
+        const char* data = (const char*)base;
+        header = (const IndexHeader*)data;
+        size_t need = sizeof(IndexHeader) + (size_t)header->entryCount * sizeof(IndexEntry) +
+                      (size_t)header->sourceCount * sizeof(IndexSource) + header->pathBytes;
+        if (memcmp(header->magic, INDEX_MAGIC, 8) != 0 || header->version != INDEX_VERSION || need != length) {
+            error = file + " is not an index, or was written by another version";
+            return false;
+        }
+        entries = (const IndexEntry*)(data + sizeof(IndexHeader));
+        sources = (const IndexSource*)(entries + header->entryCount);
+        paths = (const char*)(sources + header->sourceCount);
+        for (uint32_t i = 0; i < header->sourceCount; i++) {
+            if ((uint64_t)sources[i].pathOffset + sources[i].pathLength > header->pathBytes) {
+                error = file + " is damaged";
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < header->entryCount; i++) {
+            if (entries[i].source >= header->sourceCount || entries[i].type >= TYPE_COUNT) {
+                error = file + " is damaged";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t entryCount() const { return header->entryCount; }
+    uint32_t sourceCount() const { return header->sourceCount; }
+    std::string path(uint32_t source) const {
+        return std::string(paths + sources[source].pathOffset, sources[source].pathLength);
+    }
+};
+
+// One scanned file and the programs found in it, before they are written
+struct ScannedSource {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint32_t flags = 0;
+    std::vector<IndexEntry> entries;
+    std::string error;
+    uint64_t bytesRead = 0;
+    uint64_t samples = 0;       // decoded from a capture
+    bool reused = false;
+};
+
+// The line numbers and bodies of the tokenized program: identical for the
+// same program saved as ASCII or as an image, whatever the line endings
+bool tokenFingerprint(const std::string& data, uint8_t type, uint64_t& fingerprint, uint32_t& lineCount) {
+    std::string image;
+    if (type == TYPE_TOKEN) {
+        image = data;
+    } else if (type == TYPE_ASCII) {
+        image = tokenizeBasicProgram(data);
+    } else {
+        return false;
+    }
+    std::vector<ProgramLine> lines;
+    std::string error;
+    if (!splitTokenizedProgram(image, lines, error) || lines.empty()) return false;
+    uint64_t hash = contentHash("", 0);
+    for (const ProgramLine& line : lines) {
+        char header[3] = {(char)(line.number >> 8), (char)(line.number & 0xFF), 0};
+        hash = contentHash(header, 2, hash);
+        hash = contentHash(line.body.c_str(), line.body.size() + 1, hash);
+    }
+    fingerprint = hash;
+    lineCount = (uint32_t)lines.size();
+    return true;
+}
+
+void describeProgram(const std::string& data, uint8_t type, IndexEntry& entry) {
+    entry.size = (uint32_t)data.size();
+    entry.contentHash = contentHash(data);
+    entry.fingerprint = 0;
+    entry.lines = 0;
+    tokenFingerprint(data, type, entry.fingerprint, entry.lines);
+}
+
+void setName(IndexEntry& entry, const std::string& name) {
+    memset(entry.name, 0, sizeof(entry.name));
+    memcpy(entry.name, name.data(), std::min(name.size(), sizeof(entry.name)));
+}
+
+IndexEntry tapeEntry(const TapeFile& file, uint16_t number, bool headerOnly) {
+    IndexEntry entry{};
+    setName(entry, file.name);
+    entry.fileNumber = number;
+    entry.type = file.type == "ASCII" ? TYPE_ASCII : file.type == "SEQUENTIAL" ? TYPE_SEQUENTIAL
+               : file.type == "BINARY" ? TYPE_BINARY : TYPE_TOKEN;
+    entry.flags = ENTRY_FROM_TAPE;
+    std::string date = file.isoDate();
+    std::string time = file.isoTime();
+    if (!date.empty()) entry.date = (uint32_t)std::stoul(date.substr(0, 4) + date.substr(5, 2) + date.substr(8, 2));
+    if (!time.empty()) entry.time = (uint32_t)std::stoul(time.substr(0, 2) + time.substr(3, 2) + time.substr(6, 2));
+    if (headerOnly) {
+        entry.flags |= ENTRY_HEADER_ONLY;
+    } else {
+        if (!file.complete) entry.flags |= ENTRY_INCOMPLETE;
+        describeProgram(file.data, entry.type, entry);
+    }
+    return entry;
+}
+
+// Decode a capture (channel 0). A header-only scan stops at the first
+// HDR1 label, a few seconds into the tape.
+void scanCapture(ScannedSource& source, bool headerOnly) {
+    WavReader wav;
+    if (!wav.open(source.path, source.error)) return;
+    TapeDecoder decoder;
+    decoder.begin(wav.sampleRate);
+    std::vector<float> samples(16384);
+    size_t count;
+    while ((count = wav.read(samples.data(), samples.size(), 0)) > 0) {
+        decoder.feed(samples.data(), count);
+        if (headerOnly && (decoder.currentFile() || !decoder.files().empty())) break;
+    }
+    source.samples = decoder.sampleCount();
+    source.bytesRead = wav.dataOffset + source.samples * wav.channels * (wav.bitsPerSample / 8);
+    if (headerOnly) {
+        const TapeFile* file = decoder.currentFile();
+        if (!file && !decoder.files().empty()) file = &decoder.files().front();
+        if (file) source.entries.push_back(tapeEntry(*file, 1, true));
+        source.flags |= SOURCE_HEADER_ONLY;
+        return;
+    }
+    decoder.finish();
+    for (size_t i = 0; i < decoder.files().size(); i++) {
+        source.entries.push_back(tapeEntry(decoder.files()[i], (uint16_t)(i + 1), false));
+    }
+}
+
+// A program file: named after the file, dated by its mtime
+void scanProgram(ScannedSource& source) {
+    std::ifstream in(source.path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) {
+        source.error = "could not read " + source.path;
+        return;
+    }
+    source.bytesRead = data.size();
+    IndexEntry entry{};
+    std::string stem = hx20fs::path(source.path).stem().string();
+    std::transform(stem.begin(), stem.end(), stem.begin(), ::toupper);
+    setName(entry, stem);
+    entry.type = !data.empty() && (uint8_t)data[0] == 0xFF ? TYPE_TOKEN : TYPE_ASCII;
+
+    struct stat st;
+    struct tm local;
+    if (::stat(source.path.c_str(), &st) == 0 && localtime_r(&st.st_mtime, &local)) {
+        entry.date = (uint32_t)((local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday);
+        entry.time = (uint32_t)(local.tm_hour * 10000 + local.tm_min * 100 + local.tm_sec);
+    }
+    describeProgram(data, entry.type, entry);
+    source.entries.push_back(entry);
+}
+
+// Files from the previous index, by path, to skip the unchanged ones
+void loadPrevious(const MappedIndex& index, std::unordered_map<std::string, ScannedSource>& previous) {
+    std::vector<std::vector<IndexEntry>> entries(index.sourceCount());
+    for (uint32_t i = 0; i < index.entryCount(); i++) entries[index.entries[i].source].push_back(index.entries[i]);
+    for (uint32_t i = 0; i < index.sourceCount(); i++) {
+        // Entries keep the file order of the tape
+        std::sort(entries[i].begin(), entries[i].end(),
+                  [](const IndexEntry& a, const IndexEntry& b) { return a.fileNumber < b.fileNumber; });
+        ScannedSource& source = previous[index.path(i)];
+        source.path = index.path(i);
+        source.size = index.sources[i].size;
+        source.mtime = index.sources[i].mtime;
+        source.flags = index.sources[i].flags;
+        source.entries = std::move(entries[i]);
+    }
+}
+
+// Write through a temporary file so that readers never see half an index
+bool saveIndex(const std::string& file, const std::vector<ScannedSource>& scanned) {
+    std::vector<IndexEntry> entries;
+    std::vector<IndexSource> sources;
+    std::string paths;
+    for (const ScannedSource& s : scanned) {
+        IndexSource source{(uint32_t)paths.size(), (uint32_t)s.path.size(), s.size, s.mtime, s.flags,
+                           (uint32_t)s.entries.size()};
+        for (IndexEntry entry : s.entries) {
+            entry.source = (uint32_t)sources.size();
+            entries.push_back(entry);
+        }
+        sources.push_back(source);
+        paths += s.path;
+    }
+    std::sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        int name = memcmp(a.name, b.name, sizeof(a.name));
+        if (name != 0) return name < 0;
+        if (a.date != b.date) return a.date < b.date;
+        if (a.time != b.time) return a.time < b.time;
+        return a.source != b.source ? a.source < b.source : a.fileNumber < b.fileNumber;
+    });
+
+    IndexHeader header{};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.entryCount = (uint32_t)entries.size();
+    header.sourceCount = (uint32_t)sources.size();
+    header.pathBytes = (uint32_t)paths.size();
+
+    std::string temp = file + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), entries.size() * sizeof(IndexEntry));
+    out.write((const char*)sources.data(), sources.size() * sizeof(IndexSource));
+    out.write(paths.data(), paths.size());
+    out.close();
+    if (!out) return false;
+    std::error_code ec;
+    hx20fs::rename(temp, file, ec);
+    return !ec;
+}
+
+struct ScanOptions {
+    unsigned jobs = 0;          // 0 = one per core
+    bool headerOnly = false;    // captures: stop after the first label
+    bool force = false;         // rescan unchanged files
+};
+
+// Catalog every *.wav, *.bas and *.txt under a directory, or a glob
+int buildIndex(const std::string& input, const std::string& indexFile, const ScanOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SourceFile> files;
+    hx20fs::path base;
+    std::string error;
+    std::error_code ec;
+    bool ok = true;
+    if (!hasWildcard(input) && hx20fs::is_directory(input, ec)) {
+        for (const char* extension : {".wav", ".bas", ".txt"}) {
+            ok = ok && expandSources(input, extension, files, base, error);
+        }
+        std::sort(files.begin(), files.end(),
+                  [](const SourceFile& a, const SourceFile& b) { return a.path < b.path; });
+    } else {
+        ok = expandSources(input, "", files, base, error);
+    }
+    if (!ok) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    std::unordered_map<std::string, ScannedSource> previous;
+    if (!options.force) {
+        MappedIndex old;
+        if (old.open(indexFile, error)) loadPrevious(old, previous);
+    }
+
+    std::vector<ScannedSource> scanned(files.size());
+    parallelFor(files.size(), options.jobs, [&](size_t i) {
+        HX20_TRACE_SPAN("scan file");
+        ScannedSource& source = scanned[i];
+        source.path = files[i].path.string();
+        if (!fileStamp(files[i].path, source.size, source.mtime)) {
+            source.error = "could not stat " + source.path;
+            source.flags = SOURCE_UNREADABLE;
+            return;
+        }
+        auto it = previous.find(source.path);
+        if (it != previous.end() && it->second.size == source.size && it->second.mtime == source.mtime &&
+            !(it->second.flags & SOURCE_UNREADABLE) &&
+            (options.headerOnly || !(it->second.flags & SOURCE_HEADER_ONLY))) {
+            source.flags = it->second.flags;
+            source.entries = it->second.entries;
+            source.reused = true;
+            return;
+        }
+        if (lowerExtension(files[i].path) == ".wav") {
+            scanCapture(source, options.headerOnly);
+        } else {
+            scanProgram(source);
+        }
+        if (!source.error.empty()) source.flags |= SOURCE_UNREADABLE;
+    });
+
+    size_t programs = 0, reused = 0, failed = 0;
+    for (const ScannedSource& source : scanned) {
+        HX20_STATS_ADD(STAT_FILES, 1);
+        HX20_STATS_ADD(STAT_INPUT_BYTES, source.bytesRead);
+        HX20_STATS_ADD(STAT_SAMPLES, source.samples);
+        programs += source.entries.size();
+        reused += source.reused;
+        if (!source.error.empty()) {
+            failed++;
+            std::cerr << "Error: " << source.error << "\n";
+        }
+    }
+    {
+        HX20_STATS_PHASE(PHASE_WRITE);
+        if (!saveIndex(indexFile, scanned)) {
+            std::cerr << "Error: Could not write " << indexFile << "\n";
+            return 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Indexed " << files.size() << " files (" << programs << " programs): "
+              << files.size() - reused << " scanned, " << reused << " unchanged, " << failed
+              << " unreadable in " << seconds << " s\n";
+    return failed ? 1 : 0;
+}
+
+struct Query {
+    std::string name;           // glob, case-insensitive; empty matches all
+    uint32_t from = 0, to = 0;  // YYYYMMDD, inclusive; 0 = open
+    bool duplicates = false;
+};
+
+bool parseDate(const std::string& text, uint32_t& date) {
+    int year, month, day;
+    char tail;
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%c", &year, &month, &day, &tail) != 3 || month < 1 || month > 12 ||
+        day < 1 || day > 31) {
+        return false;
+    }
+    date = (uint32_t)(year * 10000 + month * 100 + day);
+    return true;
+}
+
+bool matches(const IndexEntry& entry, const Query& query) {
+    if (query.from && (entry.date == 0 || entry.date < query.from)) return false;
+    if (query.to && (entry.date == 0 || entry.date > query.to)) return false;
+    if (!query.name.empty()) {
+        char name[sizeof(entry.name) + 1] = {};
+        for (size_t i = 0; i < sizeof(entry.name) && entry.name[i]; i++) name[i] = (char)toupper((uint8_t)entry.name[i]);
+        if (!globMatch(query.name.c_str(), name)) return false;
+    }
+    return true;
+}
+
+void printEntry(const MappedIndex& index, const IndexEntry& entry) {
+    char line[160];
+    std::string name(entry.name, strnlen(entry.name, sizeof(entry.name)));
+    std::string date = entry.date ? std::to_string(entry.date / 10000) + "-" + std::to_string(entry.date / 100 % 100 + 100).substr(1) +
+                                        "-" + std::to_string(entry.date % 100 + 100).substr(1)
+                                  : "----------";
+    snprintf(line, sizeof(line), "%-8s %-10s %s %02u:%02u:%02u ", name.c_str(), PROGRAM_TYPES[entry.type],
+             date.c_str(), entry.time / 10000, entry.time / 100 % 100, entry.time % 100);
+    std::cout << line;
+    if (entry.flags & ENTRY_HEADER_ONLY) {
+        std::cout << std::setw(7) << "?";
+    } else {
+        std::cout << std::setw(7) << entry.size;
+    }
+    std::cout << "  " << index.path(entry.source);
+    if (entry.flags & ENTRY_FROM_TAPE) std::cout << "#" << entry.fileNumber;
+    if (entry.flags & ENTRY_INCOMPLETE) std::cout << " (incomplete)";
+    std::cout << "\n";
+}
+
+// Entries that hold the same program: equal token fingerprints, or equal
+// bytes for files that are not BASIC
+size_t printDuplicates(const MappedIndex& index, const std::vector<uint32_t>& selected) {
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    for (uint32_t i : selected) {
+        const IndexEntry& entry = index.entries[i];
+        if (entry.flags & ENTRY_HEADER_ONLY) continue;
+        keys.push_back({entry.fingerprint ? entry.fingerprint : entry.contentHash, i});
+    }
+    std::sort(keys.begin(), keys.end());
+    size_t groups = 0;
+    for (size_t i = 0; i < keys.size();) {
+        size_t j = i;
+        while (j < keys.size() && keys[j].first == keys[i].first) j++;
+        if (j - i > 1) {
+            bool identical = true;
+            for (size_t k = i + 1; k < j; k++) {
+                identical = identical && index.entries[keys[k].second].contentHash == index.entries[keys[i].second].contentHash;
+            }
+            std::cout << (groups ? "\n" : "") << j - i << " copies" << (identical ? "" : " (same program, different bytes)") << ":\n";
+            for (size_t k = i; k < j; k++) printEntry(index, index.entries[keys[k].second]);
+            groups++;
+        }
+        i = j;
+    }
+    return groups;
+}
+
+int queryIndex(const std::string& indexFile, const Query& query) {
+    auto start = std::chrono::steady_clock::now();
+    MappedIndex index;
+    std::string error;
+    if (!index.open(indexFile, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    std::vector<uint32_t> selected;
+    for (uint32_t i = 0; i < index.entryCount(); i++) {
+        if (matches(index.entries[i], query)) selected.push_back(i);
+    }
+    size_t shown = selected.size();
+    if (query.duplicates) {
+        shown = printDuplicates(index, selected);
+    } else {
+        for (uint32_t i : selected) printEntry(index, index.entries[i]);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << shown << (query.duplicates ? " duplicate groups" : " programs") << " of " << index.entryCount()
+              << " in " << ms << " ms\n";
+    return 0;
+}
+
+void printUsage(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " -i <library> [-x <index>] [-j <n>] [--headers-only] [--force]\n"
+        << "       " << prog << " [-x <index>] [--name <glob>] [--from <date>] [--to <date>] [--dupes]\n\n"
+        << "Catalogs tape captures and program files, and searches the catalog\n\n"
+        << "Options:\n"
+        << "  -i <dir|'glob'>  Scan a library: a directory (every *.wav, *.bas, *.txt) or a glob\n"
+        << "  -x <file>   Index file (default: hx20.idx)\n"
+        << "  -j <n>      Worker threads for the scan (default: one per core)\n"
+        << "  --headers-only  Captures: read only the first label (name, type, date, time)\n"
+        << "  --force     Rescan files that have not changed\n"
+        << "  --name <glob>   Programs whose name matches, e.g. 'GAME*' (case-insensitive)\n"
+        << "  --from <date>   Saved on or after YYYY-MM-DD\n"
+        << "  --to <date>     Saved on or before YYYY-MM-DD\n"
+        << "  --dupes     List programs stored more than once\n"
+        << "  --stats[=json]  Report phase timings and counters on stderr\n"
+        << "  --trace <file>  Write a Chrome/Perfetto trace-event timeline\n"
+        << "  -h          Show this help and exit\n\n"
+        << "Without a query, a scan only updates the index and a lookup lists every program.\n";
+}
+
+int main(int argc, char* argv[]) {
+    auto wallStart = std::chrono::steady_clock::now();
+    std::string inputFile;
+    std::string indexFile = "hx20.idx";
+    std::string traceFile;
+    ScanOptions scan;
+    Query query;
+    bool haveQuery = false;
+
+    static const struct option longOptions[] = {
+        {"headers-only", no_argument, nullptr, 'H'},
+        {"force", no_argument, nullptr, 'F'},
+        {"name", required_argument, nullptr, 'N'},
+        {"from", required_argument, nullptr, 'A'},
+        {"to", required_argument, nullptr, 'B'},
+        {"dupes", no_argument, nullptr, 'U'},
+        {"stats", optional_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, ":i:x:j:h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                inputFile = optarg;
+                break;
+            case 'x':
+                indexFile = optarg;
+                break;
+            case 'j':
+                scan.jobs = (unsigned)atoi(optarg);
+                break;
+            case 'H':
+                scan.headerOnly = true;
+                break;
+            case 'F':
+                scan.force = true;
+                break;
+            case 'N':
+                query.name = optarg;
+                std::transform(query.name.begin(), query.name.end(), query.name.begin(), ::toupper);
+                haveQuery = true;
+                break;
+            case 'A':
+            case 'B':
+                if (!parseDate(optarg, opt == 'A' ? query.from : query.to)) {
+                    std::cerr << "Error: dates are YYYY-MM-DD, not '" << optarg << "'.\n";
+                    return 1;
+                }
+                haveQuery = true;
+                break;
+            case 'U':
+                query.duplicates = true;
+                haveQuery = true;
+                break;
+            case 'S':
+                STATS.enabled = true;
+                STATS.json = optarg && strcmp(optarg, "json") == 0;
+                break;
+            case 'T':
+                traceFile = optarg;
+                TRACER.enabled = true;
+                TRACER.setThreadName("main");
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            case ':':
+                std::cerr << "Error: Option '-" << char(optopt) << "' requires an argument.\n";
+                printUsage(argv[0]);
+                return 1;
+            case '?':
+            default:
+                std::cerr << "Error: Unknown option '-" << char(optopt) << "'.\n";
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        std::cerr << "Error: Unexpected argument '" << argv[optind] << "'.\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    initReverseMaps();
+    int result = 0;
+    if (!inputFile.empty()) result = buildIndex(inputFile, indexFile, scan);
+    if (haveQuery || inputFile.empty()) {
+        int queried = queryIndex(indexFile, query);
+        result = result ? result : queried;
+    }
+
+    if (!traceFile.empty() && !TRACER.writeTrace(traceFile)) {
+        std::cerr << "Error: Could not write trace file " << traceFile << "\n";
+        result = 1;
+    }
+    if (STATS.enabled) {
+        printStats("hx20index", std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - wallStart).count());
+    }
+    return result;
+}
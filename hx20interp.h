@@ -0,0 +1,1299 @@
+// Reference interpreter for tokenized HX-20 BASIC (hx20tokenizer --optimize).
+//
+// Runs a program on scripted INPUT values and records what it prints, how
+// it ended and the final variables, so two versions of a program can be
+// compared. It covers what measurement programs use: assignment, PRINT,
+// INPUT, IF/THEN/ELSE, GOTO, GOSUB/RETURN [<line>], ON GOTO/GOSUB,
+// FOR/NEXT (the body always runs once, as in the ROM), WHILE/WEND,
+// READ/DATA/RESTORE, DIM, SWAP, DEFINT/DEFSNG/DEFDBL/DEFSTR, CLS, RANDOMIZE
+// and END/STOP, and the numeric and string functions. Anything else ends the run as
+// UNSUPPORTED rather than guessing.
+//
+// It also counts the work the HX-20 interpreter does for the same run:
+// statements, program bytes scanned, line headers walked (the ROM follows
+// the link chain, from the top of the program for a backward jump) and
+// entries compared in the variable table, which is searched linearly in
+// creation order.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BasicValue {
+    bool isString = false;
+    bool isInteger = false;     // %-typed: + - * of two such values is integer arithmetic
+    double number = 0;
+    std::string text;
+
+    bool operator==(const BasicValue& other) const {
+        return isString == other.isString && (isString ? text == other.text : number == other.number);
+    }
+};
+
+struct InterpreterCounters {
+    uint64_t statements = 0;
+    uint64_t bytesScanned = 0;
+    uint64_t linesWalked = 0;
+    uint64_t variableProbes = 0;
+    uint64_t operations = 0;        // operators and function calls
+
+    void add(const InterpreterCounters& other) {
+        statements += other.statements;
+        bytesScanned += other.bytesScanned;
+        linesWalked += other.linesWalked;
+        variableProbes += other.variableProbes;
+        operations += other.operations;
+    }
+};
+
+struct InterpreterRun {
+    enum Outcome { ENDED, ERROR, OUT_OF_INPUT, STEP_LIMIT, UNSUPPORTED } outcome = ENDED;
+    std::string detail;             // error message, or "statement"/"function"
+    uint8_t token = 0;              // UNSUPPORTED: the command or function token
+    int line = 0;                   // where the run stopped
+    std::string output;             // PRINT output, prompts and echoed input
+    struct Variable {
+        std::string name;           // as first written, e.g. "I" or "A$"
+        std::string key;            // name with its resolved type, e.g. "I!"
+        BasicValue value;
+        uint64_t lookups = 0;
+    };
+    std::vector<Variable> variables;    // in creation order
+    InterpreterCounters counters;
+};
+
+class BasicInterpreter {
+    // Token values, as in hx20tokenizer's tables
+    enum : uint8_t {
+        T_END = 0x80, T_FOR = 0x81, T_NEXT = 0x82, T_DATA = 0x83, T_DIM = 0x84, T_READ = 0x85,
+        T_LET = 0x86, T_GO = 0x87, T_IF = 0x89, T_RESTORE = 0x8A, T_RETURN = 0x8B, T_REM = 0x8C,
+        T_REM_QUOTE = 0x8D, T_STOP = 0x8E, T_ELSE = 0x8F, T_SWAP = 0x92, T_DEFSTR = 0x93,
+        T_DEFINT = 0x94, T_DEFSNG = 0x95, T_DEFDBL = 0x96, T_ON = 0x98, T_LPRINT = 0x99,
+        T_PRINT = 0xA2, T_RANDOMIZE = 0xA7, T_WHILE = 0xA8, T_WEND = 0xA9, T_CLS = 0xBE,
+        T_TAB = 0xCF, T_TO = 0xD0, T_SUB = 0xD1, T_SPC = 0xD3, T_THEN = 0xDA, T_NOT = 0xDB,
+        T_STEP = 0xDC, T_PLUS = 0xDD, T_MINUS = 0xDE, T_TIMES = 0xDF, T_DIVIDE = 0xE0,
+        T_POWER = 0xE1, T_AND = 0xE2, T_OR = 0xE3, T_XOR = 0xE4, T_EQV = 0xE5, T_IMP = 0xE6,
+        T_MOD = 0xE7, T_IDIV = 0xE8, T_GREATER = 0xE9, T_EQUAL = 0xEA, T_LESS = 0xEB,
+        T_ESCAPE = 0xFF
+    };
+    // Function tokens (after 0xFF)
+    enum : uint8_t {
+        F_SGN = 0x80, F_INT = 0x81, F_ABS = 0x82, F_SQR = 0x85, F_LOG = 0x86, F_EXP = 0x87,
+        F_COS = 0x88, F_SIN = 0x89, F_TAN = 0x8A, F_ATN = 0x8B, F_LEN = 0x8D, F_STR = 0x8E,
+        F_VAL = 0x8F, F_ASC = 0x90, F_CHR = 0x91, F_CINT = 0x94, F_CSNG = 0x95, F_CDBL = 0x96,
+        F_FIX = 0x97, F_SPACE = 0x98, F_LEFT = 0x9B, F_RIGHT = 0x9C, F_MID = 0x9D,
+        F_INSTR = 0x9E, F_RND = 0xA1, F_INPUT = 0xA6
+    };
+
+    struct Line {
+        int number;
+        size_t body;
+        size_t end;                 // the terminator
+    };
+    struct Array {
+        std::vector<int> bounds;
+        std::vector<BasicValue> values;
+    };
+    struct LValue {
+        bool array = false;
+        size_t index = 0;           // variable or array
+        size_t element = 0;
+        char type = '!';
+    };
+    struct ForFrame {
+        size_t variable;
+        double limit, step;
+        size_t line, pos;
+    };
+    struct Position {
+        size_t line, pos;
+    };
+
+    const uint8_t* data;
+    std::vector<Line> lines;
+    std::vector<int32_t> lineAt = std::vector<int32_t>(65536, -1);
+
+    // Run state
+    InterpreterRun* result = nullptr;
+    bool stopped = false;
+    bool chained = false;           // pos is already at the next statement
+    bool transferred = false;       // control moved; bytes already counted
+    size_t line = 0, pos = 0, end = 0, statementStart = 0;
+    char defaultType[26];
+    std::unordered_map<std::string, size_t> variableIndex;
+    std::unordered_map<std::string, size_t> arrayIndex;
+    std::vector<Array> arrays;
+    std::vector<ForFrame> forStack;
+    std::vector<Position> gosubStack;
+    std::vector<Position> whileStack;
+    size_t dataLine = 0, dataPos = 0;
+    bool dataList = false;          // dataPos is just after an item of a DATA list
+    uint32_t rndState = 0, rndLast = 0;
+    size_t column = 0;
+    const std::vector<std::string>* inputs = nullptr;
+    size_t nextInput = 0;
+
+    void finish(InterpreterRun::Outcome outcome, const std::string& detail) {
+        if (stopped) return;
+        stopped = true;
+        result->outcome = outcome;
+        result->detail = detail;
+        result->line = line < lines.size() ? lines[line].number : 0;
+    }
+    void fail(const char* message) { finish(InterpreterRun::ERROR, message); }
+    void unsupported(const char* what, uint8_t token) {
+        if (!stopped) result->token = token;
+        finish(InterpreterRun::UNSUPPORTED, what);
+    }
+
+    uint8_t peek() {
+        while (pos < end && data[pos] == ' ') pos++;
+        return pos < end ? data[pos] : 0;
+    }
+    bool accept(uint8_t byte) {
+        if (peek() != byte) return false;
+        pos++;
+        return true;
+    }
+    void expect(uint8_t byte) {
+        if (!accept(byte)) fail("Syntax error");
+    }
+    static bool isLetter(uint8_t c) { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+    static bool isDigit(uint8_t c) { return c >= '0' && c <= '9'; }
+
+    // GO TO / GO SUB, with GO as a token or as the letters the tokenizer leaves
+    uint8_t goKind() {
+        uint8_t c = peek();
+        size_t p = pos;
+        if (c == T_GO) {
+            p++;
+        } else if ((c == 'G' || c == 'g') && p + 1 < end && (data[p + 1] == 'O' || data[p + 1] == 'o')) {
+            p += 2;
+        } else {
+            return 0;
+        }
+        while (p < end && data[p] == ' ') p++;
+        return p < end && (data[p] == T_TO || data[p] == T_SUB) ? data[p] : 0;
+    }
+    void consumeGo() {
+        if (data[pos] == T_GO) pos++;
+        else pos += 2;
+        peek();
+        pos++;                      // TO or SUB
+    }
+
+    void transfer(size_t newLine, size_t newPos) {
+        if (!transferred) result->counters.bytesScanned += pos - statementStart;
+        transferred = true;
+        line = newLine;
+        pos = newPos;
+        end = lines[line].end;
+        chained = true;
+    }
+
+    // Index of a line, walking the link chain the way the ROM does
+    long findLine(long number) {
+        if (number < 0 || number > 65535 || lineAt[number] < 0) {
+            fail("Undefined line number");
+            return -1;
+        }
+        size_t target = (size_t)lineAt[number];
+        bool forward = line < lines.size() && number > lines[line].number;
+        result->counters.linesWalked += forward ? target - line : target + 1;
+        return (long)target;
+    }
+    void jump(long number) {
+        long target = findLine(number);
+        if (target >= 0) transfer((size_t)target, lines[target].body);
+    }
+    long lineNumber() {
+        if (!isDigit(peek())) {
+            fail("Syntax error");
+            return -1;
+        }
+        long number = 0;
+        while (pos < end && isDigit(data[pos])) number = number * 10 + (data[pos++] - '0');
+        return number;
+    }
+
+    // Numbers
+
+    static bool toInteger(double v, int& out) {
+        double r = std::round(v);
+        if (r < -32768 || r > 32767) return false;
+        out = (int)r;
+        return true;
+    }
+    int integer(const BasicValue& v) {
+        int out = 0;
+        if (v.isString) fail("Type mismatch");
+        else if (!toInteger(v.number, out)) fail("Overflow");
+        return out;
+    }
+    double numeric(const BasicValue& v) {
+        if (v.isString) fail("Type mismatch");
+        return v.number;
+    }
+    static BasicValue number(double v) {
+        BasicValue value;
+        value.number = v;
+        return value;
+    }
+    static BasicValue integerNumber(double v) {
+        BasicValue value = number(v);
+        value.isInteger = true;
+        return value;
+    }
+    static BasicValue string(std::string text) {
+        BasicValue value;
+        value.isString = true;
+        value.text = std::move(text);
+        return value;
+    }
+
+public:
+    // Sign position, at most 7 significant digits, no leading zero
+    static std::string formatNumber(double v) {
+        char buffer[40];
+        if (v == std::floor(v) && std::fabs(v) < 1e9) {
+            snprintf(buffer, sizeof(buffer), "%.0f", std::fabs(v));
+        } else {
+            snprintf(buffer, sizeof(buffer), "%.7G", std::fabs(v));
+        }
+        std::string digits = buffer;
+        if (digits.size() > 1 && digits[0] == '0' && digits[1] == '.') digits.erase(0, 1);
+        return (v < 0 ? "-" : " ") + digits;
+    }
+
+    // Parse a number the way VAL and INPUT do; false if there is none
+    static bool parseNumber(const std::string& text, double& value) {
+        const char* s = text.c_str();
+        while (*s == ' ') s++;
+        char* stop;
+        value = strtod(s, &stop);
+        if (stop == s) return false;
+        while (*stop == ' ') stop++;
+        return *stop == 0;
+    }
+
+private:
+    // Literal at pos: digits, fraction, exponent (the tokenizer turns its
+    // sign into an operator token) and type suffix, or &H hex
+    BasicValue literal() {
+        if (data[pos] == '&' && pos + 1 < end && (data[pos + 1] == 'H' || data[pos + 1] == 'h')) {
+            pos += 2;
+            long v = 0;
+            while (pos < end && isxdigit(data[pos])) {
+                v = v * 16 + (isDigit(data[pos]) ? data[pos] - '0' : (toupper(data[pos]) - 'A' + 10));
+                pos++;
+            }
+            return number(v > 32767 ? v - 65536 : v);
+        }
+        std::string text;
+        while (pos < end && (isDigit(data[pos]) || data[pos] == '.')) text += (char)data[pos++];
+        if (pos < end && (data[pos] == 'E' || data[pos] == 'e' || data[pos] == 'D' || data[pos] == 'd')) {
+            size_t mark = pos++;
+            std::string exponent = "E";
+            if (pos < end && (data[pos] == T_PLUS || data[pos] == '+')) pos++;
+            else if (pos < end && (data[pos] == T_MINUS || data[pos] == '-')) pos++, exponent += '-';
+            if (pos < end && isDigit(data[pos])) {
+                while (pos < end && isDigit(data[pos])) exponent += (char)data[pos++];
+                text += exponent;
+            } else {
+                pos = mark;
+            }
+        }
+        if (pos < end && data[pos] == '%') {
+            pos++;
+            return integerNumber(strtod(text.c_str(), nullptr));
+        }
+        if (pos < end && (data[pos] == '!' || data[pos] == '#')) pos++;
+        return number(strtod(text.c_str(), nullptr));
+    }
+
+    // Variables
+
+    std::string name() {
+        std::string text;
+        while (pos < end && (isLetter(data[pos]) || isDigit(data[pos]))) text += (char)toupper(data[pos++]);
+        return text;
+    }
+    char typeOf(const std::string& text, char suffix) {
+        return suffix ? suffix : defaultType[text[0] - 'A'];
+    }
+    char suffix() {
+        if (pos < end && (data[pos] == '$' || data[pos] == '%' || data[pos] == '!' || data[pos] == '#')) {
+            return (char)data[pos++];
+        }
+        return 0;
+    }
+    static BasicValue initial(char type) {
+        return type == '$' ? string("") : type == '%' ? integerNumber(0) : number(0);
+    }
+
+    size_t variable(const std::string& text, char type, const std::string& spelling) {
+        std::string key = text + type;
+        auto it = variableIndex.find(key);
+        size_t index;
+        if (it == variableIndex.end()) {
+            index = result->variables.size();
+            result->counters.variableProbes += index;
+            variableIndex.emplace(key, index);
+            result->variables.push_back({spelling, key, initial(type), 0});
+        } else {
+            index = it->second;
+            result->counters.variableProbes += index + 1;
+        }
+        result->variables[index].lookups++;
+        return index;
+    }
+
+    size_t array(const std::string& key, size_t dimensions) {
+        auto it = arrayIndex.find(key);
+        if (it != arrayIndex.end()) {
+            result->counters.variableProbes += it->second + 1;
+            return it->second;
+        }
+        // Used before DIM: every dimension runs 0..10
+        Array created;
+        created.bounds.assign(dimensions, 10);
+        size_t count = 1;
+        for (size_t i = 0; i < dimensions; i++) count *= 11;
+        created.values.assign(count, initial(key[key.size() - 1]));
+        result->counters.variableProbes += arrays.size();
+        arrayIndex.emplace(key, arrays.size());
+        arrays.push_back(std::move(created));
+        return arrays.size() - 1;
+    }
+
+    std::vector<int> subscripts() {
+        std::vector<int> indices;
+        do {
+            int i = integer(expression());
+            if (stopped) return indices;
+            indices.push_back(i);
+        } while (accept(','));
+        expect(')');
+        return indices;
+    }
+
+    // A variable or array element that can be assigned
+    LValue lvalue() {
+        LValue target;
+        if (!isLetter(peek())) {
+            fail("Syntax error");
+            return target;
+        }
+        size_t first = pos;
+        std::string text = name();
+        char sfx = suffix();
+        std::string spelling((const char*)data + first, pos - first);
+        target.type = typeOf(text, sfx);
+        if (accept('(')) {
+            std::vector<int> indices = subscripts();
+            if (stopped) return target;
+            target.array = true;
+            target.index = array(text + target.type + "(", indices.size());
+            target.element = element(arrays[target.index], indices);
+        } else {
+            target.index = variable(text, target.type, spelling);
+        }
+        return target;
+    }
+
+    size_t element(const Array& a, const std::vector<int>& indices) {
+        if (indices.size() != a.bounds.size()) {
+            fail("Subscript out of range");
+            return 0;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (indices[i] < 0 || indices[i] > a.bounds[i]) {
+                fail("Subscript out of range");
+                return 0;
+            }
+            offset = offset * (a.bounds[i] + 1) + indices[i];
+        }
+        return offset;
+    }
+
+    BasicValue& slot(const LValue& target) {
+        return target.array ? arrays[target.index].values[target.element]
+                            : result->variables[target.index].value;
+    }
+
+    void store(const LValue& target, BasicValue value) {
+        if (stopped) return;
+        if ((target.type == '$') != value.isString) {
+            fail("Type mismatch");
+            return;
+        }
+        if (target.type == '%') {
+            int i;
+            if (!toInteger(value.number, i)) {
+                fail("Overflow");
+                return;
+            }
+            value.number = i;
+            value.isInteger = true;
+        } else if (target.type == '!') {
+            value.number = (float)value.number;
+            value.isInteger = false;
+        } else {
+            value.isInteger = false;
+        }
+        slot(target) = std::move(value);
+    }
+
+    // Expressions, by precedence from IMP (1) to ^ (13)
+
+    static int precedence(uint8_t op) {
+        switch (op) {
+            case T_IMP: return 1;
+            case T_EQV: return 2;
+            case T_XOR: return 3;
+            case T_OR: return 4;
+            case T_AND: return 5;
+            case T_GREATER: case T_EQUAL: case T_LESS: return 7;
+            case T_PLUS: case T_MINUS: return 8;
+            case T_MOD: return 9;
+            case T_IDIV: return 10;
+            case T_TIMES: case T_DIVIDE: return 11;
+            case T_POWER: return 13;
+            default: return 0;
+        }
+    }
+
+    BasicValue expression() { return binary(1); }
+
+    BasicValue binary(int minimum) {
+        BasicValue left = unary();
+        while (!stopped) {
+            uint8_t op = peek();
+            int level = precedence(op);
+            if (level == 0 || level < minimum) break;
+            pos++;
+            int relation = 0;       // bit 1: <, bit 2: =, bit 4: >
+            if (level == 7) {
+                relation = op == T_LESS ? 1 : op == T_EQUAL ? 2 : 4;
+                uint8_t second = peek();
+                if (second == T_LESS || second == T_EQUAL || second == T_GREATER) {
+                    relation |= second == T_LESS ? 1 : second == T_EQUAL ? 2 : 4;
+                    pos++;
+                }
+            }
+            BasicValue right = binary(level + 1);
+            if (stopped) break;
+            result->counters.operations++;
+            left = apply(op, relation, left, right);
+        }
+        return left;
+    }
+
+    BasicValue apply(uint8_t op, int relation, const BasicValue& a, const BasicValue& b) {
+        if (relation) {
+            if (a.isString != b.isString) {
+                fail("Type mismatch");
+                return number(0);
+            }
+            int order = a.isString ? (a.text < b.text ? -1 : a.text > b.text ? 1 : 0)
+                                   : (a.number < b.number ? -1 : a.number > b.number ? 1 : 0);
+            bool truth = (order < 0 && (relation & 1)) || (order == 0 && (relation & 2)) ||
+                         (order > 0 && (relation & 4));
+            return number(truth ? -1 : 0);
+        }
+        if (op == T_PLUS && a.isString && b.isString) {
+            if (a.text.size() + b.text.size() > 255) fail("String too long");
+            return string(a.text + b.text);
+        }
+        if (a.isString || b.isString) {
+            fail("Type mismatch");
+            return number(0);
+        }
+        double x = a.number, y = b.number;
+        if (a.isInteger && b.isInteger && (op == T_PLUS || op == T_MINUS || op == T_TIMES)) {
+            double r = op == T_PLUS ? x + y : op == T_MINUS ? x - y : x * y;
+            if (r < -32768 || r > 32767) {
+                fail("Overflow");
+                return number(0);
+            }
+            return integerNumber(r);
+        }
+        switch (op) {
+            case T_PLUS: return number(x + y);
+            case T_MINUS: return number(x - y);
+            case T_TIMES: return number(x * y);
+            case T_DIVIDE:
+                if (y == 0) fail("Division by zero");
+                return number(y == 0 ? 0 : x / y);
+            case T_POWER: return number(std::pow(x, y));
+            default: break;
+        }
+        int i = integer(a), j = integer(b);
+        if (stopped) return number(0);
+        switch (op) {
+            case T_IDIV:
+            case T_MOD:
+                if (j == 0) {
+                    fail("Division by zero");
+                    return number(0);
+                }
+                return number(op == T_IDIV ? i / j : i % j);
+            case T_AND: return number((int16_t)(i & j));
+            case T_OR: return number((int16_t)(i | j));
+            case T_XOR: return number((int16_t)(i ^ j));
+            case T_EQV: return number((int16_t)~(i ^ j));
+            case T_IMP: return number((int16_t)(~i | j));
+            default: return number(0);
+        }
+    }
+
+    BasicValue unary() {
+        uint8_t c = peek();
+        if (c == T_MINUS) {
+            pos++;
+            BasicValue v = binary(12);
+            result->counters.operations++;
+            return number(-numeric(v));
+        }
+        if (c == T_PLUS) {
+            pos++;
+            return binary(12);
+        }
+        if (c == T_NOT) {
+            pos++;
+            BasicValue v = binary(7);
+            result->counters.operations++;
+            return number((int16_t)~integer(v));
+        }
+        return primary();
+    }
+
+    BasicValue primary() {
+        uint8_t c = peek();
+        if (c == '"') {
+            size_t start = ++pos;
+            while (pos < end && data[pos] != '"') pos++;
+            std::string text((const char*)data + start, pos - start);
+            if (pos < end) pos++;
+            return string(text);
+        }
+        if (isDigit(c) || c == '.' || c == '&') return literal();
+        if (c == '(') {
+            pos++;
+            BasicValue v = expression();
+            expect(')');
+            return v;
+        }
+        if (c == T_ESCAPE && pos + 1 < end) {
+            uint8_t function = data[pos + 1];
+            pos += 2;
+            return call(function);
+        }
+        if (isLetter(c)) {
+            size_t first = pos;
+            std::string text = name();
+            char sfx = suffix();
+            char type = typeOf(text, sfx);
+            if (accept('(')) {
+                std::vector<int> indices = subscripts();
+                if (stopped) return number(0);
+                Array& a = arrays[array(text + type + "(", indices.size())];
+                size_t offset = element(a, indices);
+                return stopped ? number(0) : a.values[offset];
+            }
+            std::string spelling((const char*)data + first, pos - first);
+            return result->variables[variable(text, type, spelling)].value;
+        }
+        if (c >= 0x80) unsupported("statement", c);
+        else fail("Syntax error");
+        return number(0);
+    }
+
+    uint32_t random() {
+        rndState = rndState * 1103515245u + 12345u;
+        return rndLast = (rndState >> 8) & 0xFFFFFF;
+    }
+
+    BasicValue call(uint8_t function) {
+        result->counters.operations++;
+        if (function == F_RND) {
+            double x = 1;
+            if (accept('(')) {
+                x = numeric(expression());
+                expect(')');
+            }
+            if (x < 0) rndState = (uint32_t)(int32_t)x;
+            if (x != 0) random();
+            return number(rndLast / 16777216.0);
+        }
+        expect('(');
+        if (stopped) return number(0);
+        std::vector<BasicValue> args;
+        do {
+            args.push_back(expression());
+        } while (!stopped && accept(','));
+        expect(')');
+        if (stopped) return number(0);
+
+        auto arity = [&](size_t low, size_t high) {
+            if (args.size() < low || args.size() > high) fail("Syntax error");
+            return !stopped;
+        };
+        auto text = [&](size_t i) -> const std::string& {
+            if (!args[i].isString) fail("Type mismatch");
+            return args[i].text;
+        };
+        auto illegal = [&](bool bad) {
+            if (bad) fail("Illegal function call");
+            return bad;
+        };
+        double x = args[0].number;
+        switch (function) {
+            case F_SGN: if (!arity(1, 1)) break; return number(numeric(args[0]) > 0 ? 1 : x < 0 ? -1 : 0);
+            case F_INT: if (!arity(1, 1)) break; return number(std::floor(numeric(args[0])));
+            case F_FIX: if (!arity(1, 1)) break; return number(std::trunc(numeric(args[0])));
+            case F_ABS: if (!arity(1, 1)) break; return number(std::fabs(numeric(args[0])));
+            case F_SQR: if (!arity(1, 1) || illegal(numeric(args[0]) < 0)) break; return number(std::sqrt(x));
+            case F_LOG: if (!arity(1, 1) || illegal(numeric(args[0]) <= 0)) break; return number(std::log(x));
+            case F_EXP: if (!arity(1, 1)) break; return number(std::exp(numeric(args[0])));
+            case F_COS: if (!arity(1, 1)) break; return number(std::cos(numeric(args[0])));
+            case F_SIN: if (!arity(1, 1)) break; return number(std::sin(numeric(args[0])));
+            case F_TAN: if (!arity(1, 1)) break; return number(std::tan(numeric(args[0])));
+            case F_ATN: if (!arity(1, 1)) break; return number(std::atan(numeric(args[0])));
+            case F_CINT: if (!arity(1, 1)) break; return number(integer(args[0]));
+            case F_CSNG: if (!arity(1, 1)) break; return number((float)numeric(args[0]));
+            case F_CDBL: if (!arity(1, 1)) break; return number(numeric(args[0]));
+            case F_LEN: if (!arity(1, 1)) break; return number((double)text(0).size());
+            case F_ASC: {
+                if (!arity(1, 1) || illegal(text(0).empty())) break;
+                return number((uint8_t)args[0].text[0]);
+            }
+            case F_VAL: {
+                if (!arity(1, 1)) break;
+                double v = 0;
+                return number(parseNumber(text(0), v) ? v : strtod(args[0].text.c_str(), nullptr));
+            }
+            case F_CHR: {
+                if (!arity(1, 1)) break;
+                int i = integer(args[0]);
+                if (illegal(i < 0 || i > 255)) break;
+                return string(std::string(1, (char)i));
+            }
+            case F_STR: if (!arity(1, 1)) break; return string(formatNumber(numeric(args[0])));
+            case F_SPACE: {
+                if (!arity(1, 1)) break;
+                int i = integer(args[0]);
+                if (illegal(i < 0 || i > 255)) break;
+                return string(std::string(i, ' '));
+            }
+            case F_LEFT:
+            case F_RIGHT: {
+                if (!arity(2, 2)) break;
+                const std::string& s = text(0);
+                int n = integer(args[1]);
+                if (illegal(n < 0 || n > 255)) break;
+                size_t count = std::min<size_t>(n, s.size());
+                return string(function == F_LEFT ? s.substr(0, count) : s.substr(s.size() - count));
+            }
+            case F_MID: {
+                if (!arity(2, 3)) break;
+                const std::string& s = text(0);
+                int start = integer(args[1]);
+                int count = args.size() > 2 ? integer(args[2]) : 255;
+                if (illegal(start < 1 || start > 255 || count < 0 || count > 255)) break;
+                return string((size_t)start > s.size() ? "" : s.substr(start - 1, count));
+            }
+            case F_INSTR: {
+                if (!arity(2, 3)) break;
+                size_t first = args.size() == 3 ? 1 : 0;
+                int start = first ? integer(args[0]) : 1;
+                if (illegal(start < 1 || start > 255)) break;
+                const std::string& s = text(first);
+                const std::string& find = text(first + 1);
+                if ((size_t)start > s.size()) return number(0);
+                size_t at = s.find(find, start - 1);
+                return number(at == std::string::npos ? 0 : (double)at + 1);
+            }
+            default:
+                unsupported("function", function);
+                break;
+        }
+        return number(0);
+    }
+
+    // Output
+
+    void print(const std::string& text) {
+        for (char c : text) {
+            result->output += c;
+            column = c == '\n' ? 0 : column + 1;
+        }
+    }
+
+    // Statements
+
+    void statement() {
+        result->counters.statements++;
+        uint8_t c = peek();
+        if (isLetter(c)) {
+            if (goKind()) {
+                goStatement();
+            } else {
+                assignment();
+            }
+            return;
+        }
+        switch (c) {
+            case T_LET: pos++; assignment(); break;
+            case T_GO: goStatement(); break;
+            case T_PRINT: case T_LPRINT: pos++; printStatement(); break;
+            case T_IF: pos++; ifStatement(); break;
+            case T_ON: pos++; onStatement(); break;
+            case T_FOR: pos++; forStatement(); break;
+            case T_NEXT: pos++; nextStatement(); break;
+            case T_WHILE: pos++; whileStatement(); break;
+            case T_WEND: pos++; wendStatement(); break;
+            case T_RETURN: {
+                pos++;
+                if (gosubStack.empty()) {
+                    fail("RETURN without GOSUB");
+                    break;
+                }
+                Position back = gosubStack.back();
+                gosubStack.pop_back();
+                if (isDigit(peek())) {
+                    jump(lineNumber());     // RETURN <line>
+                } else {
+                    transfer(back.line, back.pos);
+                }
+                break;
+            }
+            case T_END: finish(InterpreterRun::ENDED, "END"); break;
+            case T_STOP: finish(InterpreterRun::ENDED, "STOP"); break;
+            case T_REM: case T_REM_QUOTE: pos = end; break;
+            case T_DATA: pos++; skipData(pos); break;
+            case T_READ: pos++; readStatement(); break;
+            case T_RESTORE: {
+                pos++;
+                dataLine = 0;
+                if (isDigit(peek())) {
+                    long target = findLine(lineNumber());
+                    if (target >= 0) dataLine = (size_t)target;
+                }
+                dataPos = lines[dataLine].body;
+                dataList = false;
+                break;
+            }
+            case T_DIM: pos++; dimStatement(); break;
+            case T_SWAP: {
+                pos++;
+                LValue a = lvalue();
+                expect(',');
+                LValue b = stopped ? a : lvalue();
+                if (stopped) break;
+                if (a.type != b.type) fail("Type mismatch");
+                else std::swap(slot(a), slot(b));
+                break;
+            }
+            case T_DEFSTR: case T_DEFINT: case T_DEFSNG: case T_DEFDBL: pos++; defStatement(c); break;
+            case T_CLS: pos++; break;
+            case T_RANDOMIZE:
+                pos++;
+                if (peek() && peek() != ':' && peek() != T_ELSE) rndState = (uint32_t)integer(expression());
+                break;
+            case T_ESCAPE:
+                if (pos + 1 < end && data[pos + 1] == F_INPUT) {
+                    pos += 2;
+                    inputStatement();
+                } else {
+                    unsupported("statement", pos + 1 < end ? data[pos + 1] : 0);
+                }
+                break;
+            default:
+                if (c >= 0x80) unsupported("statement", c);
+                else fail("Syntax error");
+                break;
+        }
+    }
+
+    void assignment() {
+        LValue target = lvalue();
+        expect(T_EQUAL);
+        if (stopped) return;
+        store(target, expression());
+    }
+
+    void goStatement() {
+        uint8_t kind = goKind();
+        if (!kind) {
+            fail("Syntax error");
+            return;
+        }
+        consumeGo();
+        long target = lineNumber();
+        if (stopped) return;
+        if (kind == T_SUB) gosubStack.push_back({line, pos});
+        jump(target);
+    }
+
+    void printStatement() {
+        bool newline = true;
+        for (;;) {
+            uint8_t c = peek();
+            if (c == 0 || c == ':' || c == T_ELSE || stopped) break;
+            newline = true;
+            if (c == ';') {
+                pos++;
+                newline = false;
+            } else if (c == ',') {
+                pos++;
+                print(std::string(14 - column % 14, ' '));
+                newline = false;
+            } else if (c == T_TAB || c == T_SPC) {
+                pos++;
+                expect('(');
+                int n = integer(expression());
+                expect(')');
+                if (stopped) break;
+                if (c == T_SPC) print(std::string(std::max(n, 0), ' '));
+                else if ((size_t)n > column + 1) print(std::string(n - 1 - column, ' '));
+                newline = false;
+            } else {
+                BasicValue v = expression();
+                if (stopped) break;
+                print(v.isString ? v.text : formatNumber(v.number) + " ");
+            }
+        }
+        if (newline && !stopped) print("\n");
+    }
+
+    void ifStatement() {
+        BasicValue condition = expression();
+        if (stopped) return;
+        bool truth = numeric(condition) != 0;
+        bool then = peek() == T_THEN;
+        if (!then && !goKind()) {
+            fail("Syntax error");
+            return;
+        }
+        if (truth) {
+            if (then) pos++;
+            if (then && isDigit(peek())) {
+                jump(lineNumber());
+            } else {
+                chained = true;
+            }
+            return;
+        }
+        // Skip to the ELSE of this IF, if there is one
+        int depth = 0;
+        for (bool inString = false; pos < end; pos++) {
+            uint8_t b = data[pos];
+            if (inString) {
+                inString = b != '"';
+            } else if (b == '"') {
+                inString = true;
+            } else if (b == T_REM || b == T_REM_QUOTE) {
+                break;
+            } else if (b == T_ESCAPE) {
+                pos++;
+            } else if (b == T_IF) {
+                depth++;
+            } else if (b == T_ELSE && depth-- == 0) {
+                pos++;
+                if (isDigit(peek())) {
+                    jump(lineNumber());
+                } else {
+                    chained = true;
+                }
+                return;
+            }
+        }
+        pos = end;
+        chained = true;
+    }
+
+    void onStatement() {
+        int selector = integer(expression());
+        if (stopped) return;
+        uint8_t kind = goKind();
+        if (!kind) {
+            if (peek() >= 0x80) unsupported("statement", peek());
+            else fail("Syntax error");
+            return;
+        }
+        consumeGo();
+        std::vector<long> targets;
+        do {
+            targets.push_back(lineNumber());
+        } while (!stopped && accept(','));
+        if (stopped) return;
+        if (selector < 0 || selector > 255) {
+            fail("Illegal function call");
+            return;
+        }
+        if (selector == 0 || (size_t)selector > targets.size()) return;
+        if (kind == T_SUB) gosubStack.push_back({line, pos});
+        jump(targets[selector - 1]);
+    }
+
+    void forStatement() {
+        LValue counter = lvalue();
+        if (stopped) return;
+        if (counter.array || counter.type == '$') {
+            fail("Syntax error");
+            return;
+        }
+        expect(T_EQUAL);
+        BasicValue start = stopped ? number(0) : expression();
+        expect(T_TO);
+        double limit = stopped ? 0 : numeric(expression());
+        double step = 1;
+        if (accept(T_STEP)) step = numeric(expression());
+        store(counter, start);
+        if (stopped) return;
+        for (size_t i = forStack.size(); i-- > 0;) {
+            if (forStack[i].variable == counter.index) {
+                forStack.resize(i);
+                break;
+            }
+        }
+        forStack.push_back({counter.index, limit, step, line, pos});
+    }
+
+    void nextStatement() {
+        do {
+            size_t frame = forStack.size();
+            if (isLetter(peek())) {
+                LValue counter = lvalue();
+                if (stopped) return;
+                while (frame > 0 && forStack[frame - 1].variable != counter.index) frame--;
+            }
+            if (frame == 0) {
+                fail("NEXT without FOR");
+                return;
+            }
+            forStack.resize(frame);
+            ForFrame& f = forStack.back();
+            LValue counter;
+            counter.index = f.variable;
+            counter.type = result->variables[f.variable].key.back();
+            result->counters.operations++;
+            store(counter, number(result->variables[f.variable].value.number + f.step));
+            if (stopped) return;
+            double v = result->variables[f.variable].value.number;
+            if (f.step >= 0 ? v <= f.limit : v >= f.limit) {
+                transfer(f.line, f.pos);
+                return;
+            }
+            forStack.pop_back();
+        } while (accept(','));
+    }
+
+    // Step over the items of a DATA statement
+    void skipData(size_t& p) {
+        bool quoted = false;
+        while (p < end && (quoted || data[p] != ':')) {
+            if (data[p] == '"') quoted = !quoted;
+            p++;
+        }
+    }
+
+    void whileStatement() {
+        size_t start = statementStart;
+        size_t startLine = line;
+        bool truth = numeric(expression()) != 0;
+        if (stopped) return;
+        if (truth) {
+            whileStack.push_back({startLine, start});
+            return;
+        }
+        // Find the matching WEND
+        int depth = 0;
+        for (size_t l = line, p = pos; l < lines.size(); p = ++l < lines.size() ? lines[l].body : 0) {
+            for (bool inString = false; p < lines[l].end; p++) {
+                uint8_t b = data[p];
+                if (inString) {
+                    inString = b != '"';
+                } else if (b == '"') {
+                    inString = true;
+                } else if (b == T_REM || b == T_REM_QUOTE) {
+                    break;
+                } else if (b == T_ESCAPE) {
+                    p++;
+                } else if (b == T_WHILE) {
+                    depth++;
+                } else if (b == T_WEND && depth-- == 0) {
+                    result->counters.linesWalked += l - line;
+                    transfer(l, p + 1);
+                    chained = false;    // check what follows the WEND
+                    return;
+                }
+            }
+        }
+        fail("WHILE without WEND");
+    }
+
+    void wendStatement() {
+        if (whileStack.empty()) {
+            fail("WEND without WHILE");
+            return;
+        }
+        Position back = whileStack.back();
+        whileStack.pop_back();
+        transfer(back.line, back.pos);
+    }
+
+    void takeItem(std::string& item, bool& quoted) {
+        item.clear();
+        quoted = peek() == '"';
+        if (quoted) {
+            pos++;
+            while (pos < end && data[pos] != '"') item += (char)data[pos++];
+            if (pos < end) pos++;
+        } else {
+            while (pos < end && data[pos] != ',' && data[pos] != ':') item += (char)data[pos++];
+            while (!item.empty() && item.back() == ' ') item.pop_back();
+        }
+    }
+
+    // Next DATA item: the rest of the current DATA list, or the first item
+    // of the next DATA statement at or after dataPos
+    bool nextDatum(std::string& item, bool& quoted) {
+        size_t savePos = pos, saveEnd = end;
+        bool found = false;
+        while (!found && dataLine < lines.size()) {
+            pos = dataPos;
+            end = lines[dataLine].end;
+            if (dataList) {
+                dataList = accept(',');
+                found = dataList;
+                continue;
+            }
+            for (bool inString = false; pos < end; pos++) {
+                uint8_t b = data[pos];
+                if (inString) {
+                    inString = b != '"';
+                } else if (b == '"') {
+                    inString = true;
+                } else if (b == T_REM || b == T_REM_QUOTE) {
+                    pos = end;
+                } else if (b == T_ESCAPE) {
+                    pos++;
+                } else if (b == T_DATA) {
+                    break;
+                }
+            }
+            if (pos < end) {
+                pos++;
+                found = dataList = true;
+            } else if (++dataLine < lines.size()) {
+                dataPos = lines[dataLine].body;
+            }
+        }
+        if (found) {
+            takeItem(item, quoted);
+            dataPos = pos;
+        }
+        pos = savePos;
+        end = saveEnd;
+        return found;
+    }
+
+    void readStatement() {
+        do {
+            LValue target = lvalue();
+            if (stopped) return;
+            std::string item;
+            bool quoted = false;
+            if (!nextDatum(item, quoted)) {
+                fail("Out of DATA");
+                return;
+            }
+            if (target.type == '$') {
+                store(target, string(item));
+            } else {
+                double v = 0;
+                if (quoted || (!item.empty() && !parseNumber(item, v))) {
+                    fail("Syntax error");
+                    return;
+                }
+                store(target, number(v));
+            }
+        } while (!stopped && accept(','));
+    }
+
+    void inputStatement() {
+        std::string prompt = "? ";
+        if (peek() == '"') {
+            BasicValue text = primary();
+            if (accept(';')) prompt = text.text + "? ";
+            else if (accept(',')) prompt = text.text;
+            else fail("Syntax error");
+        }
+        print(prompt);
+        do {
+            LValue target = lvalue();
+            if (stopped) return;
+            if (nextInput >= inputs->size()) {
+                finish(InterpreterRun::OUT_OF_INPUT, "");
+                return;
+            }
+            const std::string& value = (*inputs)[nextInput++];
+            print(value + "\n");
+            if (target.type == '$') {
+                store(target, string(value));
+            } else {
+                double v = 0;
+                if (!parseNumber(value, v)) {
+                    fail("Redo from start");
+                    return;
+                }
+                store(target, number(v));
+            }
+        } while (!stopped && accept(','));
+    }
+
+    void dimStatement() {
+        do {
+            if (!isLetter(peek())) {
+                fail("Syntax error");
+                return;
+            }
+            std::string text = name();
+            char type = typeOf(text, suffix());
+            expect('(');
+            std::vector<int> bounds = subscripts();
+            if (stopped) return;
+            std::string key = text + type + "(";
+            if (arrayIndex.count(key)) {
+                fail("Duplicate Definition");
+                return;
+            }
+            Array created;
+            size_t count = 1;
+            for (int b : bounds) {
+                if (b < 0) {
+                    fail("Illegal function call");
+                    return;
+                }
+                count *= (size_t)b + 1;
+            }
+            created.bounds = bounds;
+            created.values.assign(count, initial(type));
+            result->counters.variableProbes += arrays.size();
+            arrayIndex.emplace(key, arrays.size());
+            arrays.push_back(std::move(created));
+        } while (accept(','));
+    }
+
+    void defStatement(uint8_t token) {
+        char type = token == T_DEFSTR ? '$' : token == T_DEFINT ? '%' : token == T_DEFDBL ? '#' : '!';
+        do {
+            uint8_t first = peek();
+            if (!isLetter(first)) {
+                fail("Syntax error");
+                return;
+            }
+            pos++;
+            uint8_t last = first;
+            if (accept(T_MINUS)) {
+                last = peek();
+                if (!isLetter(last)) {
+                    fail("Syntax error");
+                    return;
+                }
+                pos++;
+            }
+            for (int c = toupper(first); c <= toupper(last); c++) defaultType[c - 'A'] = type;
+        } while (accept(','));
+    }
+
+public:
+    explicit BasicInterpreter(const std::string& image) : data((const uint8_t*)image.data()) {
+        if (image.size() < 3 || data[0] != 0xFF) return;
+        size_t size = std::min<size_t>(image.size(), (data[1] << 8) | data[2]);
+        for (size_t p = 3; p + 4 <= size;) {
+            const void* terminator = memchr(data + p + 4, 0x00, size - p - 4);
+            if (!terminator) break;
+            size_t e = (const uint8_t*)terminator - data;
+            int number = (data[p + 2] << 8) | data[p + 3];
+            if (lineAt[number] < 0) lineAt[number] = (int32_t)lines.size();
+            lines.push_back({number, p + 4, e});
+            p = e + 1;
+        }
+    }
+
+    // Run from the first line until END, an error, the end of the inputs or
+    // maxStatements statements
+    InterpreterRun run(const std::vector<std::string>& inputValues, uint64_t maxStatements) {
+        InterpreterRun run;
+        result = &run;
+        stopped = false;
+        chained = false;
+        memset(defaultType, '!', sizeof(defaultType));
+        variableIndex.clear();
+        arrayIndex.clear();
+        arrays.clear();
+        forStack.clear();
+        gosubStack.clear();
+        whileStack.clear();
+        dataLine = 0;
+        dataPos = lines.empty() ? 0 : lines[0].body;
+        dataList = false;
+        rndState = 1;
+        rndLast = 0;
+        column = 0;
+        inputs = &inputValues;
+        nextInput = 0;
+
+        line = 0;
+        if (lines.empty()) return run;
+        pos = lines[0].body;
+        end = lines[0].end;
+        result->counters.linesWalked++;
+        while (!stopped) {
+            if (pos >= end) {
+                if (line + 1 >= lines.size()) break;
+                line++;
+                pos = lines[line].body;
+                end = lines[line].end;
+                result->counters.linesWalked++;
+                continue;
+            }
+            if (peek() == ':') {
+                pos++;
+                result->counters.bytesScanned++;
+                continue;
+            }
+            if (pos >= end) continue;
+            if (result->counters.statements >= maxStatements) {
+                finish(InterpreterRun::STEP_LIMIT, "");
+                break;
+            }
+            statementStart = pos;
+            chained = false;
+            transferred = false;
+            statement();
+            if (!transferred) result->counters.bytesScanned += pos - statementStart;
+            if (stopped || chained) continue;
+            uint8_t c = peek();
+            if (c == ':') {
+                pos++;
+            } else if (c == T_ELSE) {
+                pos = end;          // the THEN branch ran; skip the ELSE branch
+            } else if (pos < end) {
+                fail("Syntax error");
+            }
+        }
+        result = nullptr;
+        return run;
+    }
+};
@@ -0,0 +1,191 @@
+// Stage threads connected by bounded lock-free queues (hx20digitize).
+//
+// A pipeline is a chain of stages, each run by one or more threads. Items
+// carry a key (a capture number). A link sends every item with the same key
+// to the same thread of the next stage, so the stateful stages see each
+// capture in order while different captures run side by side. Every thread
+// owns one BoundedQueue (Vyukov's array queue: one CAS per push or pop, no
+// locks) that all threads of the previous stage push into. A full queue
+// holds the producer back, so memory stays bounded however fast the
+// reader is. Each stage thread records how long it worked, waited for
+// input and waited for room downstream, which is what shows the bottleneck.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class BoundedQueue {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};   // next push
+    alignas(64) std::atomic<size_t> tail{0};   // next pop
+
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // full
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // empty
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Waiting on a queue: spin briefly, then yield, then sleep, so that idle
+// stages leave the cores to the busy ones
+class Backoff {
+    unsigned rounds = 0;
+
+public:
+    void pause() {
+        if (rounds < 16) {
+            rounds++;
+        } else if (rounds < 64) {
+            rounds++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+// What one stage thread did; summed per stage for the report
+struct StageCounters {
+    uint64_t items = 0;
+    uint64_t units = 0;         // stage-specific: bytes, samples, pulses, blocks
+    double busySeconds = 0;
+    double inputWaitSeconds = 0;
+    double outputWaitSeconds = 0;
+};
+
+struct StageMetrics {
+    std::string name;
+    std::string unit;
+    unsigned threads = 1;
+    std::vector<StageCounters> perThread;
+
+    StageCounters total() const {
+        StageCounters sum;
+        for (const StageCounters& c : perThread) {
+            sum.items += c.items;
+            sum.units += c.units;
+            sum.busySeconds += c.busySeconds;
+            sum.inputWaitSeconds += c.inputWaitSeconds;
+            sum.outputWaitSeconds += c.outputWaitSeconds;
+        }
+        return sum;
+    }
+    // Share of the stage's thread time spent working
+    double utilization(double wallSeconds) const {
+        return wallSeconds > 0 ? total().busySeconds / (threads * wallSeconds) : 0;
+    }
+};
+
+inline double pipelineSeconds(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Items from every thread of one stage to the threads of the next. An
+// empty pointer closes the link for one producer; receive() returns empty
+// once all producers have closed.
+template <typename T>
+class StageLink {
+    std::vector<std::unique_ptr<BoundedQueue<std::unique_ptr<T>>>> queues;
+    std::vector<unsigned> closed;   // per consumer, touched only by it
+    unsigned producers;
+
+public:
+    StageLink(unsigned consumers, unsigned producers, size_t capacity) : closed(consumers, 0), producers(producers) {
+        for (unsigned i = 0; i < consumers; i++) queues.emplace_back(new BoundedQueue<std::unique_ptr<T>>(capacity));
+    }
+
+    unsigned consumers() const { return (unsigned)queues.size(); }
+
+    void send(size_t key, std::unique_ptr<T> item, StageCounters& counters) {
+        push(queues[key % queues.size()], item, counters);
+    }
+
+    // Called once by every producer thread when it has sent its last item
+    void close(StageCounters& counters) {
+        for (auto& queue : queues) {
+            std::unique_ptr<T> end;
+            push(queue, end, counters);
+        }
+    }
+
+    std::unique_ptr<T> receive(unsigned consumer, StageCounters& counters) {
+        std::unique_ptr<T> item;
+        auto start = std::chrono::steady_clock::now();
+        Backoff backoff;
+        for (;;) {
+            if (queues[consumer]->tryPop(item)) {
+                if (item) break;
+                if (++closed[consumer] == producers) break;
+                continue;
+            }
+            backoff.pause();
+        }
+        counters.inputWaitSeconds += pipelineSeconds(start);
+        return item;
+    }
+
+private:
+    static void push(std::unique_ptr<BoundedQueue<std::unique_ptr<T>>>& queue, std::unique_ptr<T>& item,
+                     StageCounters& counters) {
+        if (queue->tryPush(item)) return;
+        auto start = std::chrono::steady_clock::now();
+        Backoff backoff;
+        while (!queue->tryPush(item)) backoff.pause();
+        counters.outputWaitSeconds += pipelineSeconds(start);
+    }
+};
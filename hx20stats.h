@@ -0,0 +1,159 @@
+// Operational statistics for the HX-20 tools (--stats / --stats=json).
+//
+// Phase timers and counters are plain adds into one global record, so they
+// stay compiled in for production builds. Building with -DHX20_NO_STATS
+// turns every HX20_STATS_* macro into nothing and drops the allocation hook.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+enum StatPhase {
+    PHASE_READ,
+    PHASE_CRLF,
+    PHASE_TOKENIZE,
+    PHASE_BLOCKS,
+    PHASE_RENDER,
+    PHASE_NORMALIZE,
+    PHASE_WRITE,
+    PHASE_DECODE,
+    PHASE_COUNT
+};
+
+enum StatCounter {
+    STAT_FILES,
+    STAT_INPUT_BYTES,
+    STAT_BLOCKS,
+    STAT_PULSES,
+    STAT_SAMPLES,
+    STAT_BYTES_WRITTEN,
+    STAT_PEAK_BUFFER,       // largest single buffer, in bytes
+    STAT_ALLOCATIONS,
+    STAT_COUNT
+};
+
+struct Stats {
+    double phaseSeconds[PHASE_COUNT] = {};
+    uint64_t counters[STAT_COUNT] = {};
+    bool enabled = false;   // set by --stats; only gates the report
+    bool json = false;
+};
+
+inline Stats STATS;
+
+#ifndef HX20_NO_STATS
+
+inline std::atomic<uint64_t>& allocationCounter() {
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+// Times one phase for the lifetime of the object
+class StatsTimer {
+    StatPhase phase;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit StatsTimer(StatPhase phase)
+        : phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~StatsTimer() {
+        STATS.phaseSeconds[phase] += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#define HX20_STATS_CONCAT2(a, b) a##b
+#define HX20_STATS_CONCAT(a, b) HX20_STATS_CONCAT2(a, b)
+#define HX20_STATS_PHASE(phase) StatsTimer HX20_STATS_CONCAT(statsTimer, __LINE__)(phase)
+#define HX20_STATS_ADD(counter, n) (STATS.counters[counter] += (uint64_t)(n))
+#define HX20_STATS_MAX(counter, n) \
+    (STATS.counters[counter] = std::max<uint64_t>(STATS.counters[counter], (uint64_t)(n)))
+
+// Counts every allocation made by the process. Defined once per program by
+// the translation unit that includes this header with HX20_STATS_MAIN.
+#ifdef HX20_STATS_MAIN
+// GCC flags free() in the replacement delete once it can inline both sides
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t size) {
+    allocationCounter().fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#else
+
+#define HX20_STATS_PHASE(phase) ((void)0)
+#define HX20_STATS_ADD(counter, n) ((void)0)
+#define HX20_STATS_MAX(counter, n) ((void)0)
+
+#endif // HX20_NO_STATS
+
+inline const char* statPhaseName(int phase) {
+    static const char* names[PHASE_COUNT] = {
+        "read", "crlf_normalize", "tokenize", "block_build", "render", "normalize", "write", "decode"
+    };
+    return names[phase];
+}
+
+inline const char* statCounterName(int counter) {
+    static const char* names[STAT_COUNT] = {
+        "files", "input_bytes", "blocks", "pulses", "samples", "bytes_written",
+        "peak_buffer_bytes", "allocations"
+    };
+    return names[counter];
+}
+
+// Print the collected statistics to stderr; stdout may carry job replies
+inline void printStats(const char* tool, double wallSeconds) {
+#ifdef HX20_NO_STATS
+    (void)wallSeconds;
+    fprintf(stderr, "%s: statistics not compiled in (built with HX20_NO_STATS)\n", tool);
+#else
+    STATS.counters[STAT_ALLOCATIONS] = allocationCounter().load();
+    double mbPerSec = wallSeconds > 0 ? STATS.counters[STAT_INPUT_BYTES] / wallSeconds / 1e6 : 0.0;
+    double samplesPerSec = wallSeconds > 0 ? STATS.counters[STAT_SAMPLES] / wallSeconds : 0.0;
+
+    if (STATS.json) {
+        fprintf(stderr, "{\"tool\": \"%s\", \"wall_seconds\": %.6f, \"phases\": {", tool, wallSeconds);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(stderr, "%s\"%s\": %.6f", i ? ", " : "", statPhaseName(i), STATS.phaseSeconds[i]);
+        }
+        fprintf(stderr, "}, \"counters\": {");
+        for (int i = 0; i < STAT_COUNT; i++) {
+            fprintf(stderr, "%s\"%s\": %llu", i ? ", " : "", statCounterName(i),
+                    (unsigned long long)STATS.counters[i]);
+        }
+        fprintf(stderr, "}, \"throughput\": {\"input_mb_per_sec\": %.3f, \"samples_per_sec\": %.0f}}\n",
+                mbPerSec, samplesPerSec);
+        return;
+    }
+
+    fprintf(stderr, "\nStatistics (%s)\n", tool);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (STATS.phaseSeconds[i] > 0) {
+            fprintf(stderr, "  %-18s %10.3f ms\n", statPhaseName(i), STATS.phaseSeconds[i] * 1e3);
+        }
+    }
+    fprintf(stderr, "  %-18s %10.3f ms\n", "wall", wallSeconds * 1e3);
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(stderr, "  %-18s %10llu\n", statCounterName(i), (unsigned long long)STATS.counters[i]);
+    }
+    fprintf(stderr, "  %-18s %10.3f MB/s\n", "input throughput", mbPerSec);
+    if (STATS.counters[STAT_SAMPLES]) {
+        fprintf(stderr, "  %-18s %10.0f samples/s\n", "render throughput", samplesPerSec);
+    }
+#endif
+}
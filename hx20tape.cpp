@@ -2,11 +2,26 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
+#include <cmath>
 #include <cstdint>
 #include <ctime>
 #include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <deque>
+#include <memory>
+#include <thread>
 #include <filesystem>
 #include <unistd.h>
+#include <getopt.h>
+
+#ifndef HX20TAPE_NO_MAIN
+#define HX20_STATS_MAIN
+#endif
+#include "hx20stats.h"
+#include "hx20trace.h"
+#include "hx20aio.h"
+#include "hx20validate.h"
 namespace fs = std::filesystem;
 
 #define KERMIT true
@@ -26,6 +41,8 @@ const int PULSE_LONG = 1080;   // ~1000μs for bit '1' (> 750μs threshold)
 const int SYNC_BITS = 80;      // 80 bits of '0' for synchronization
 //const int HEADER_DATA_SIZE = 80;
 const int DATA_BLOCK_SIZE = 256;
+const int LABEL_SIZE = 80;     // HDR1 / EOFD label blocks
+const int MAX_BLOCK_BYTES = 4 + DATA_BLOCK_SIZE + 2;  // ID + data + CRC
 
 enum class BasicType { ASCII, TOKEN, SEQUENTIAL, BINARY };
 bool DEBUG = false;
@@ -46,29 +63,96 @@ struct WAVHeader {
     uint32_t dataSize;
 };
 
+// Pulse-stream intermediate representation
+//
+// The encoder does not produce samples directly. It emits a compact stream of
+// pulse durations (in microseconds) interleaved with marker codes, and one or
+// more renderers turn that stream into output. Marker codes sit above any real
+// pulse width so a renderer can tell them apart with a single compare.
+const uint16_t MARK_BLOCK_END   = 0xFFFD;  // end of the current block
+const uint16_t MARK_BLOCK_START = 0xFFFE;  // start of block, see PulseStream::blocks
+const uint16_t MARK_BYTE        = 0xFFFF;  // next 9 pulses are one framed byte
+
+const size_t RENDER_BATCH = 4096;          // codes handed to a renderer per call
+
+inline bool isMarker(uint16_t code) { return code >= MARK_BLOCK_END; }
+
+// Identification of one block, in the order its MARK_BLOCK_START appears
+struct BlockInfo {
+    char type;          // 'H', 'D' or 'E'
+    uint16_t number;
+    uint8_t copy;       // 0 or 1 (double write)
+    uint16_t crc;
+    uint16_t length;    // data field length, without ID and CRC
+};
+
+struct PulseStream {
+    std::vector<uint16_t> codes;
+    std::vector<BlockInfo> blocks;
+
+    void clear() {
+        codes.clear();
+        blocks.clear();
+    }
+};
+
+// Render back-end interface. A renderer is handed the whole stream once in
+// begin() (for the block table and sizing), then consumes the codes in
+// batches of at most RENDER_BATCH.
+class PulseRenderer {
+public:
+    virtual ~PulseRenderer() = default;
+    virtual void begin(const PulseStream& /*stream*/) {}
+    virtual void consume(const uint16_t* codes, size_t count) = 0;
+    virtual bool finish() { return true; }
+};
+
+// Read-only view of bytes owned elsewhere (arena, stack or caller)
+struct ByteSpan {
+    const uint8_t* data;
+    size_t size;
+
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+};
+
+// Scratch memory for block assembly. It holds everything one file needs at
+// a time (a label, a padded data block and the block being assembled) and
+// is reset between files, so building blocks never touches the heap.
+class BlockArena {
+    static const size_t CAPACITY = 1024;
+
+    alignas(16) uint8_t storage[CAPACITY];
+    size_t used = 0;
+
+public:
+    uint8_t* allocate(size_t size) {
+        if (used + size > CAPACITY) {
+            fprintf(stderr, "Internal error: block arena exhausted\n");
+            abort();
+        }
+        uint8_t* p = storage + used;
+        used += size;
+        return p;
+    }
+
+    // Release everything allocated after `mark`
+    size_t mark() const { return used; }
+    void rewind(size_t mark) { used = mark; }
+
+    void reset() { used = 0; }
+};
+
 class HX20TapeEncoder {
 private:
-    std::vector<uint8_t> audioData;
+    friend struct HX20TapeBench;
 
-    // Generate a single pulse (rising edge to rising edge)
+    PulseStream stream;
+    BlockArena arena;
+
+    // Add a single pulse (rising edge to rising edge)
     void addPulse(int durationUs) {
-        int samples = (durationUs * SAMPLE_RATE) / 1000000;
-        int halfSamples = samples / 2;
-        
-        // Rising edge + high period
-        for (int i = 0; i < halfSamples; i++) {
-            double t = (double)i / halfSamples;
-            // Smooth transition using tanh for soft edges
-            double value = DC_OFFSET + AMPLITUDE * tanh(4.0 * (t - 0.5));
-            audioData.push_back((uint8_t)value);
-        }
-        
-        // Falling edge + low period
-        for (int i = 0; i < halfSamples; i++) {
-            double t = (double)i / halfSamples;
-            double value = DC_OFFSET - AMPLITUDE * tanh(4.0 * (t - 0.5));
-            audioData.push_back((uint8_t)value);
-        }
+        stream.codes.push_back((uint16_t)durationUs);
     }
 
     // Add a single bit using pulse-width encoding
@@ -82,6 +166,7 @@ private:
 
     // Add a byte (LSB first + stop bit)
     void addByte(uint8_t byte) {
+        stream.codes.push_back(MARK_BYTE);
         // Send bits 0-7 (LSB first)
         for (int i = 0; i < 8; i++) {
             addBit((byte >> i) & 1);
@@ -111,7 +196,7 @@ private:
     }
 
     // Calculate CRC-CCITT for block check
-    uint16_t calculateCRC(const std::vector<uint8_t>& data) {
+    uint16_t calculateCRC(ByteSpan data) {
         uint16_t crc = 0xFFFF;
         
         for (uint8_t byte : data) {
@@ -130,7 +215,7 @@ private:
     
     // Calculate CRC-16-Kermit 
     // This is the reflected version of CRC-CCITT
-    uint16_t calculateCRC_Kermit(const std::vector<uint8_t>& data) {
+    uint16_t calculateCRC_Kermit(ByteSpan data) {
         uint16_t crc = 0x0000; // Kermit starts with 0x0000
         
         for (uint8_t byte : data) {
@@ -151,29 +236,42 @@ private:
 
     //Add a complete block - new version
     void addBlock(char blockType, uint16_t blockNumber, uint8_t blockID,
-                  const std::vector<uint8_t>& data) {
+                  ByteSpan data) {
+        HX20_TRACE_SPAN("addBlock");
         
-        
-        // Build block data
-        std::vector<uint8_t> blockData;
+        // Build block data in arena scratch space (at most MAX_BLOCK_BYTES)
+        size_t arenaMark = arena.mark();
+        uint8_t* block = arena.allocate(4 + data.size + 2);
+        size_t blockSize = 0;
         
         // Block identification field (4 bytes)
-        blockData.push_back(blockType);                     // 'H', 'D', or 'E'
-        blockData.push_back((blockNumber >> 8) & 0xFF);     // MSB
-        blockData.push_back(blockNumber & 0xFF);            // LSB
-        blockData.push_back(blockID);                       // Block ID (0 or 1 for double write)
+        block[blockSize++] = blockType;                     // 'H', 'D', or 'E'
+        block[blockSize++] = (blockNumber >> 8) & 0xFF;     // MSB
+        block[blockSize++] = blockNumber & 0xFF;            // LSB
+        block[blockSize++] = blockID;                       // Block ID (0 or 1 for double write)
         // Data field
-        blockData.insert(blockData.end(), data.begin(), data.end());
+        memcpy(block + blockSize, data.data, data.size);
+        blockSize += data.size;
         
         
         // Calculate CRC
-        uint16_t crc = KERMIT ? calculateCRC_Kermit(blockData) : calculateCRC(blockData);
+        uint16_t crc;
+        {
+            HX20_TRACE_SPAN("crc");
+            ByteSpan covered = {block, blockSize};
+            crc = KERMIT ? calculateCRC_Kermit(covered) : calculateCRC(covered);
+        }
         
-        blockData.push_back(crc & 0xFF);               //CRC LSB
-        blockData.push_back((crc >> 8) & 0xFF);        //CRC MSB
+        block[blockSize++] = crc & 0xFF;               //CRC LSB
+        block[blockSize++] = (crc >> 8) & 0xFF;        //CRC MSB
+        ByteSpan blockData = {block, blockSize};
         
         
-        // Now write the complete block to audio
+        // Now write the complete block to the pulse stream
+        HX20_STATS_ADD(STAT_BLOCKS, 1);
+        stream.blocks.push_back({blockType, blockNumber, blockID, crc,
+                                 (uint16_t)data.size});
+        stream.codes.push_back(MARK_BLOCK_START);
         addSyncField();
         addPreamble();
     
@@ -184,6 +282,7 @@ private:
 
         
         addPostamble();
+        stream.codes.push_back(MARK_BLOCK_END);
         
         if(DEBUG)
         {
@@ -197,6 +296,7 @@ private:
             }
             printf("\n");
         }
+        arena.rewind(arenaMark);
         addInterblockGap(100); //<--- this seems to do the trick
     }
     
@@ -219,10 +319,32 @@ private:
     
 
 
+    // Pulse-stream codes needed for one block of `length` data bytes,
+    // including its trailing interblock gap
+    static size_t codesPerBlock(size_t length) {
+        const size_t byteCodes = 10;    // MARK_BYTE + 8 data + stop
+        return 2 + SYNC_BITS + 1 + (2 + 4 + length + 2 + 2) * byteCodes + 100 * byteCodes;
+    }
+
+    // Reserve the exact stream size for a program, so encoding it does not
+    // reallocate. Capacity is kept across reset(), so a reused encoder only
+    // allocates when a larger program comes along.
+    void reserveFor(size_t programSize) {
+        const size_t byteCodes = 10;
+        size_t dataBlocks = (programSize + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+        size_t codes = 2 * 614 * byteCodes                  // file gaps
+                     + 4 * codesPerBlock(LABEL_SIZE)        // header and footer, twice each
+                     + 100 * byteCodes                      // gap after the header
+                     + dataBlocks * (2 * codesPerBlock(DATA_BLOCK_SIZE) + 300 * byteCodes);
+        stream.codes.reserve(stream.codes.size() + codes);
+        stream.blocks.reserve(stream.blocks.size() + 4 + 2 * dataBlocks);
+    }
+
     // Create header block data (80 bytes)
-    std::vector<uint8_t> createHeaderData(const std::string& filename,
-                                          BasicType type) {
-        std::vector<uint8_t> header(80, 0x20); // Fill with spaces
+    ByteSpan createHeaderData(const std::string& filename,
+                              BasicType type) {
+        uint8_t* header = arena.allocate(LABEL_SIZE);
+        memset(header, 0x20, LABEL_SIZE); // Fill with spaces
         
         // ID field: "HDR1"
         header[0] = 'H';
@@ -285,7 +407,7 @@ private:
         time_t now = time(nullptr);
         struct tm* t = localtime(&now);
         char dateStr[7];
-        snprintf(dateStr, 7, "%02d%02d%02d", t->tm_mon + 1, t->tm_mday, t->tm_year % 100);
+        strftime(dateStr, sizeof(dateStr), "%m%d%y", t);
         for (int i = 0; i < 6; i++) {
             header[32 + i] = dateStr[i];
         }
@@ -307,13 +429,14 @@ private:
             header[52 + i] = sysname[i];
         }
         
-        return header;
+        return {header, LABEL_SIZE};
     }
 
     // Create header block data (80 bytes)
-    std::vector<uint8_t> createFooterData(const std::string& filename,
-                                          BasicType type) {
-        std::vector<uint8_t> header(80, 0x20); // Fill with spaces
+    ByteSpan createFooterData(const std::string& filename,
+                              BasicType type) {
+        uint8_t* header = arena.allocate(LABEL_SIZE);
+        memset(header, 0x20, LABEL_SIZE); // Fill with spaces
         
         // ID field: "HDR1"
         header[0] = 'E';
@@ -359,7 +482,7 @@ private:
         time_t now = time(nullptr);
         struct tm* t = localtime(&now);
         char dateStr[7];
-        snprintf(dateStr, 7, "%02d%02d%02d", t->tm_mon + 1, t->tm_mday, t->tm_year % 100);
+        strftime(dateStr, sizeof(dateStr), "%m%d%y", t);
         for (int i = 0; i < 6; i++) {
             header[32 + i] = dateStr[i];
         }
@@ -381,12 +504,13 @@ private:
             header[52 + i] = sysname[i];
         }
         
-        return header;
+        return {header, LABEL_SIZE};
     }
     
     // Create EOF block data (80 bytes)
-    std::vector<uint8_t> createEOFData() {
-        std::vector<uint8_t> eof(80, 0x20); // Fill with spaces
+    ByteSpan createEOFData() {
+        uint8_t* eof = arena.allocate(LABEL_SIZE);
+        memset(eof, 0x20, LABEL_SIZE); // Fill with spaces
         
         // ID field: "EOFD"
         eof[0] = 'E';
@@ -394,7 +518,7 @@ private:
         eof[2] = 'F';
         eof[3] = 'D';
         
-        return eof;
+        return {eof, LABEL_SIZE};
     }
 
 public:
@@ -402,37 +526,51 @@ public:
     void encodeBasicProgram(const std::string& programText,
                            const std::string& filename = "PROGRAM",
                            const BasicType filetype = BasicType::ASCII) {
+        HX20_STATS_PHASE(PHASE_BLOCKS);
+        HX20_TRACE_SPAN("encodeBasicProgram");
+        arena.reset();
+        reserveFor(programText.size());
         
         // Add initial file gap
         addFileGap();
                 
         // Create and add header block (written twice)
-        std::vector<uint8_t> headerData = createHeaderData(filename, filetype);
-        addBlock('H', 0, 0, headerData); // First write
-        addBlock('H', 0, 1, headerData); // Second write (double write)
-        addInterblockGap(100); //100 bytes = 815ms
+        {
+            HX20_TRACE_SPAN("header blocks");
+            size_t arenaMark = arena.mark();
+            ByteSpan headerData = createHeaderData(filename, filetype);
+            addBlock('H', 0, 0, headerData); // First write
+            addBlock('H', 0, 1, headerData); // Second write (double write)
+            addInterblockGap(100); //100 bytes = 815ms
+            arena.rewind(arenaMark);
+        }
         
         // Split program into 256-byte data blocks
-        std::vector<uint8_t> programBytes(programText.begin(), programText.end());
+        const uint8_t* programBytes = reinterpret_cast<const uint8_t*>(programText.data());
+        size_t programSize = programText.size();
+        uint8_t* padded = arena.allocate(DATA_BLOCK_SIZE);
          
         int blockNumber = 1;
-        for (size_t i = 0; i < programBytes.size(); i += DATA_BLOCK_SIZE) {
-            
-            std::vector<uint8_t> blockData(DATA_BLOCK_SIZE, 0x00);
-            
-            size_t copySize = std::min((size_t)DATA_BLOCK_SIZE,
-                                       programBytes.size() - i);
-            std::copy(programBytes.begin() + i,
-                     programBytes.begin() + i + copySize,
-                     blockData.begin());
-            
+        {
+            HX20_TRACE_SPAN("data blocks");
+            for (size_t i = 0; i < programSize; i += DATA_BLOCK_SIZE) {
             
+                // Full blocks are sent straight from the program text; the last
+                // one is zero-padded in the arena
+                ByteSpan blockData = {programBytes + i, (size_t)DATA_BLOCK_SIZE};
+                size_t copySize = std::min((size_t)DATA_BLOCK_SIZE, programSize - i);
+                if (copySize < (size_t)DATA_BLOCK_SIZE) {
+                    memset(padded, 0x00, DATA_BLOCK_SIZE);
+                    memcpy(padded, programBytes + i, copySize);
+                    blockData.data = padded;
+                }
             
-            // Write block twice (double write)
-            addBlock('D', blockNumber, 0, blockData);
-            addBlock('D', blockNumber, 1, blockData);
-            addInterblockGap(300);
-            blockNumber++;
+                // Write block twice (double write)
+                addBlock('D', blockNumber, 0, blockData);
+                addBlock('D', blockNumber, 1, blockData);
+                addInterblockGap(300);
+                blockNumber++;
+            }
         }
         
         // Add EOF block (written twice)
@@ -441,20 +579,94 @@ public:
         addBlock('E', blockNumber, 0, eofData);
         addBlock('E', blockNumber, 1, eofData);
         */
-        std::vector<uint8_t> footerData = createFooterData(filename, filetype);
-        addBlock('E', blockNumber, 0, footerData);
-        addBlock('E', blockNumber, 1, footerData);
+        {
+            HX20_TRACE_SPAN("footer blocks");
+            ByteSpan footerData = createFooterData(filename, filetype);
+            addBlock('E', blockNumber, 0, footerData);
+            addBlock('E', blockNumber, 1, footerData);
+        }
         
         // Add final file gap
         addFileGap();
 //        addBit(0);
+
+#ifndef HX20_NO_STATS
+        if (STATS.enabled) {
+            HX20_STATS_ADD(STAT_PULSES, std::count_if(stream.codes.begin(), stream.codes.end(),
+                                                      [](uint16_t c) { return !isMarker(c); }));
+            HX20_STATS_MAX(STAT_PEAK_BUFFER, stream.codes.size() * sizeof(uint16_t));
+        }
+#endif
         
     }
 
-    // Normalize audio to target amplitude
-    void normalizeAudio(double targetAmplitude = 50.0) {
-        if (audioData.empty()) return;
+    // Feed the pulse stream to a renderer in batches
+    bool render(PulseRenderer& renderer) const {
+        HX20_TRACE_SPAN("render");
+        {
+            HX20_STATS_PHASE(PHASE_RENDER);
+            feed(renderer);
+        }
+        return renderer.finish();
+    }
+
+    // Hand the codes to a renderer without finishing it or touching the
+    // global stats, so channels can be rendered on worker threads
+    void feed(PulseRenderer& renderer) const {
+        renderer.begin(stream);
+        for (size_t i = 0; i < stream.codes.size(); i += RENDER_BATCH) {
+            size_t count = std::min(RENDER_BATCH, stream.codes.size() - i);
+            renderer.consume(stream.codes.data() + i, count);
+        }
+    }
+
+    const PulseStream& pulses() const {
+        return stream;
+    }
+
+    void reset() {
+        stream.clear();
+    }
+};
+
+// Renders pulses to 8-bit unsigned PCM samples at SAMPLE_RATE
+class AudioRenderer : public PulseRenderer {
+protected:
+    std::vector<uint8_t> audioData;
+
+    // Sample shapes are cached per duration; a tape only uses a handful
+    std::vector<std::pair<uint16_t, std::vector<uint8_t>>> shapes;
+
+    const std::vector<uint8_t>& pulseShape(int durationUs) {
+        for (const auto& shape : shapes) {
+            if (shape.first == durationUs) return shape.second;
+        }
+
+        std::vector<uint8_t> samplesOut;
+        int halfSamples = (int)pulseLength(durationUs) / 2;
         
+        // Rising edge + high period
+        for (int i = 0; i < halfSamples; i++) {
+            double t = (double)i / halfSamples;
+            // Smooth transition using tanh for soft edges
+            double value = DC_OFFSET + AMPLITUDE * tanh(4.0 * (t - 0.5));
+            samplesOut.push_back((uint8_t)value);
+        }
+        
+        // Falling edge + low period
+        for (int i = 0; i < halfSamples; i++) {
+            double t = (double)i / halfSamples;
+            double value = DC_OFFSET - AMPLITUDE * tanh(4.0 * (t - 0.5));
+            samplesOut.push_back((uint8_t)value);
+        }
+
+        shapes.emplace_back((uint16_t)durationUs, std::move(samplesOut));
+        return shapes.back().second;
+    }
+
+    // Center the samples and scale them to +-targetAmplitude; returns the
+    // amplitude found, 0 if there was nothing to scale
+    double normalizeSamples(double targetAmplitude) {
         // Find min and max values
         uint8_t minVal = 255, maxVal = 0;
         for (uint8_t sample : audioData) {
@@ -466,7 +678,7 @@ public:
         double currentCenter = (minVal + maxVal) / 2.0;
         double currentAmplitude = (maxVal - minVal) / 2.0;
         
-        if (currentAmplitude < 0.1) return; // Avoid division by zero
+        if (currentAmplitude < 0.1) return 0; // Avoid division by zero
         
         // Calculate scaling factor
         double scale = targetAmplitude / currentAmplitude;
@@ -483,9 +695,58 @@ public:
             
             audioData[i] = (uint8_t)result;
         }
+        return currentAmplitude;
+    }
+
+public:
+    // Samples one pulse of durationUs renders to (always an even count)
+    static size_t pulseLength(int durationUs) {
+        int samples = (durationUs * SAMPLE_RATE) / 1000000;
+        return (size_t)(samples / 2) * 2;
+    }
+
+    // Samples a whole pulse stream renders to
+    static size_t streamLength(const PulseStream& stream) {
+        size_t total = 0;
+        for (uint16_t code : stream.codes) {
+            if (!isMarker(code)) total += pulseLength(code);
+        }
+        return total;
+    }
+
+    // Generate a single pulse (rising edge to rising edge)
+    void addPulse(int durationUs) {
+        const std::vector<uint8_t>& shape = pulseShape(durationUs);
+        audioData.insert(audioData.end(), shape.begin(), shape.end());
+    }
+
+    void begin(const PulseStream& stream) override {
+        audioData.clear();
+
+        size_t total = 0;
+        for (uint16_t code : stream.codes) {
+            if (!isMarker(code)) total += pulseShape(code).size();
+        }
+        audioData.reserve(total);
+    }
+
+    void consume(const uint16_t* codes, size_t count) override {
+        for (size_t i = 0; i < count; i++) {
+            if (!isMarker(codes[i])) addPulse(codes[i]);
+        }
+    }
+
+    // Normalize audio to target amplitude
+    void normalizeAudio(double targetAmplitude = 50.0) {
+        if (audioData.empty()) return;
+        HX20_STATS_PHASE(PHASE_NORMALIZE);
+        HX20_TRACE_SPAN("normalizeAudio");
+
+        double currentAmplitude = normalizeSamples(targetAmplitude);
+        if (currentAmplitude == 0) return;
         
         std::cout << "Normalized: amplitude " << currentAmplitude
-                  << " -> " << targetAmplitude << " (scale: " << scale << "x)\n";
+                  << " -> " << targetAmplitude << " (scale: " << targetAmplitude / currentAmplitude << "x)\n";
     }
 
     // Save to WAV file
@@ -493,6 +754,10 @@ public:
         if (normalize > 0) {
             normalizeAudio(normalize); // Normalize to ±40 amplitude
         }
+        HX20_STATS_PHASE(PHASE_WRITE);
+        HX20_TRACE_SPAN("write wav");
+        HX20_STATS_ADD(STAT_SAMPLES, audioData.size());
+        HX20_STATS_MAX(STAT_PEAK_BUFFER, audioData.size());
         
         std::ofstream file(filename, std::ios::binary);
         if (!file) {
@@ -506,15 +771,262 @@ public:
 
         file.write(reinterpret_cast<char*>(&header), sizeof(WAVHeader));
         file.write(reinterpret_cast<char*>(audioData.data()), audioData.size());
+        HX20_STATS_ADD(STAT_BYTES_WRITTEN, sizeof(WAVHeader) + audioData.size());
         
         file.close();
         return true;
     }
 
-    
+    // Save headerless samples (8-bit unsigned, mono, SAMPLE_RATE)
+    bool saveToRaw(const std::string& filename, int normalize = 50) {
+        if (normalize > 0) {
+            normalizeAudio(normalize);
+        }
+        HX20_STATS_PHASE(PHASE_WRITE);
+        HX20_TRACE_SPAN("write raw");
 
-    void reset() {
-        audioData.clear();
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Could not create file " << filename << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<char*>(audioData.data()), audioData.size());
+        HX20_STATS_ADD(STAT_BYTES_WRITTEN, audioData.size());
+
+        file.close();
+        return true;
+    }
+
+    // Queue the file on an asynchronous writer instead of writing it here;
+    // only the copy into the writer's buffer happens on this thread
+    bool submitFile(AsyncWriter& writer, const std::string& filename, bool wavHeader,
+                    int normalize, uint64_t tag) {
+        if (normalize > 0) {
+            normalizeAudio(normalize);
+        }
+        HX20_STATS_PHASE(PHASE_WRITE);
+        HX20_TRACE_SPAN("submit write");
+        size_t headerSize = wavHeader ? sizeof(WAVHeader) : 0;
+        HX20_STATS_ADD(STAT_SAMPLES, wavHeader ? audioData.size() : 0);
+        HX20_STATS_MAX(STAT_PEAK_BUFFER, audioData.size());
+
+        WriteBuffer buffer(headerSize + audioData.size());
+        if (wavHeader) {
+            WAVHeader header;
+            header.dataSize = audioData.size();
+            header.fileSize = sizeof(WAVHeader) - 8 + audioData.size();
+            memcpy(buffer.data(), &header, sizeof(WAVHeader));
+        }
+        memcpy(buffer.data() + headerSize, audioData.data(), audioData.size());
+        HX20_STATS_ADD(STAT_BYTES_WRITTEN, buffer.size());
+
+        writer.submit(filename, std::move(buffer), tag);
+        return true;
+    }
+
+    const std::vector<uint8_t>& samples() const {
+        return audioData;
+    }
+};
+
+// WAV back-end
+class WAVRenderer : public AudioRenderer {
+    std::string filename;
+    int normalize;
+    AsyncWriter* writer;
+    uint64_t tag;
+public:
+    WAVRenderer(const std::string& filename, int normalize,
+                AsyncWriter* writer = nullptr, uint64_t tag = 0)
+        : filename(filename), normalize(normalize), writer(writer), tag(tag) {}
+
+    bool finish() override {
+        if (writer) return submitFile(*writer, filename, true, normalize, tag);
+        return saveToWAV(filename, normalize);
+    }
+};
+
+// Raw PCM back-end
+class RawPCMRenderer : public AudioRenderer {
+    std::string filename;
+    int normalize;
+    AsyncWriter* writer;
+    uint64_t tag;
+public:
+    RawPCMRenderer(const std::string& filename, int normalize,
+                   AsyncWriter* writer = nullptr, uint64_t tag = 0)
+        : filename(filename), normalize(normalize), writer(writer), tag(tag) {}
+
+    bool finish() override {
+        if (writer) return submitFile(*writer, filename, false, normalize, tag);
+        return saveToRaw(filename, normalize);
+    }
+};
+
+// Pulse-list back-end: one text line per framed byte (its 9 pulse widths),
+// one line per loose pulse (sync, gaps), and a comment line per block
+class PulseListRenderer : public PulseRenderer {
+    std::string filename;
+    std::ofstream file;
+    const std::vector<BlockInfo>* blocks = nullptr;
+    size_t blockIndex = 0;
+    int pendingByte = 0;    // pulses left in the current byte
+public:
+    explicit PulseListRenderer(const std::string& filename) : filename(filename) {}
+
+    void begin(const PulseStream& stream) override {
+        blocks = &stream.blocks;
+        blockIndex = 0;
+        pendingByte = 0;
+        file.open(filename);
+        if (file) file << "# HX-20 pulse list, durations in microseconds\n";
+    }
+
+    void consume(const uint16_t* codes, size_t count) override {
+        if (!file) return;
+        for (size_t i = 0; i < count; i++) {
+            uint16_t code = codes[i];
+            if (code == MARK_BYTE) {
+                pendingByte = 9;
+            } else if (code == MARK_BLOCK_START) {
+                const BlockInfo& b = (*blocks)[blockIndex++];
+                char line[64];
+                snprintf(line, sizeof(line), "# block %c %u copy %u crc %04X len %u\n",
+                         b.type, b.number, b.copy, b.crc, b.length);
+                file << line;
+            } else if (code == MARK_BLOCK_END) {
+                file << "# end\n";
+            } else if (pendingByte > 0) {
+                file << code << (--pendingByte > 0 ? ' ' : '\n');
+            } else {
+                file << code << '\n';
+            }
+        }
+    }
+
+    bool finish() override {
+        if (!file) {
+            std::cerr << "Error: Could not create file " << filename << std::endl;
+            return false;
+        }
+        file.close();
+        return true;
+    }
+};
+
+// Receiver-model back-end: decodes the pulse widths the way the HX-20 does
+// (750μs threshold, sync run, FF AA preamble, LSB-first bytes with stop bit,
+// CRC-Kermit) and checks every block against what the encoder meant to send
+class ReceiverCheckRenderer : public PulseRenderer {
+    enum class State { Hunt, Bytes };
+
+    const std::vector<BlockInfo>* blocks = nullptr;
+    size_t expected = 0;        // index of the block being transmitted
+    State state = State::Hunt;
+    int zeroRun = 0;
+    int bitCount = 0;
+    uint16_t shift = 0;
+    std::vector<uint8_t> bytes;
+    std::vector<BlockInfo> decoded;
+
+    static const int THRESHOLD_US = 750;
+    static const int MIN_SYNC = 16;
+
+    void onByte(uint8_t byte) {
+        bytes.push_back(byte);
+        size_t n = bytes.size();
+        if ((n == 1 && byte != 0xFF) || (n == 2 && byte != 0xAA)) {
+            state = State::Hunt;
+            return;
+        }
+        if (n < 6) return;
+
+        uint16_t length = bytes[2] == 'D' ? DATA_BLOCK_SIZE : 80;
+        if (n < (size_t)(2 + 4 + length + 2)) return;
+
+        uint16_t crc = 0;
+        for (size_t i = 2; i < n - 2; i++) {
+            crc ^= bytes[i];
+            for (int b = 0; b < 8; b++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+            }
+        }
+        uint16_t received = bytes[n - 2] | (bytes[n - 1] << 8);
+        if (crc == received) {
+            decoded.push_back({(char)bytes[2], (uint16_t)((bytes[3] << 8) | bytes[4]),
+                               bytes[5], crc, length});
+        }
+        state = State::Hunt;
+    }
+
+public:
+    size_t blocksOK = 0;
+    size_t blocksFailed = 0;
+
+    void begin(const PulseStream& stream) override {
+        blocks = &stream.blocks;
+        expected = 0;
+        state = State::Hunt;
+        zeroRun = 0;
+        decoded.clear();
+        blocksOK = blocksFailed = 0;
+    }
+
+    void consume(const uint16_t* codes, size_t count) override {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t code = codes[i];
+            if (code == MARK_BLOCK_END) {
+                const BlockInfo& want = (*blocks)[expected++];
+                bool ok = false;
+                for (const BlockInfo& got : decoded) {
+                    ok |= got.type == want.type && got.number == want.number &&
+                          got.copy == want.copy && got.crc == want.crc;
+                }
+                if (ok) blocksOK++;
+                else blocksFailed++;
+                decoded.clear();
+                continue;
+            }
+            if (isMarker(code)) continue;
+
+            bool bit = code > THRESHOLD_US;
+            if (state == State::Hunt) {
+                if (!bit) {
+                    zeroRun++;
+                } else {
+                    if (zeroRun >= MIN_SYNC) {
+                        state = State::Bytes;
+                        bitCount = 0;
+                        shift = 0;
+                        bytes.clear();
+                    }
+                    zeroRun = 0;
+                }
+                continue;
+            }
+
+            // LSB first, 8 data bits followed by a '1' stop bit
+            if (bitCount < 8) {
+                shift |= (uint16_t)bit << bitCount;
+                bitCount++;
+            } else {
+                bitCount = 0;
+                uint8_t byte = (uint8_t)shift;
+                shift = 0;
+                if (!bit) {
+                    state = State::Hunt;
+                    zeroRun = 1;
+                    continue;
+                }
+                onByte(byte);
+            }
+        }
+    }
+
+    bool finish() override {
+        std::cout << "Receiver check: " << blocksOK << " blocks OK, "
+                  << blocksFailed << " failed\n";
+        return blocksFailed == 0;
     }
 };
 
@@ -529,10 +1041,26 @@ void printUsage(const char* prog) {
         << "  -n <name>   Program name (max 8 chars, default: PROGRAM)\n"
         /* << "  -t <type>   File type    (ASCII or TOKEN, default: ASCII)\n" */
         << "  -a <level>  Amplitude    (default: 95) \n"
+        << "  -r <file>   Also write raw PCM samples (no WAV header)\n"
+        << "  -p <file>   Also write the pulse list (durations in us)\n"
+        << "  -c          Check the encoded pulses with a receiver model\n"
+        << "  -b <file>   Batch mode: encode every job listed in <file> ('-' = stdin)\n"
+        << "  -D          Daemon mode: read jobs from stdin, answer each immediately\n"
+        << "  -m <file>   Multichannel: one channel of <file> per input (-i and arguments)\n"
+        << "  --channels <k>  Multichannel: schedule the inputs over <k> channels\n"
+        << "  --pause <s>     Multichannel: silence between programs on a channel (default: 5)\n"
+        << "  --plan          Multichannel: print the schedule only\n"
+        << "  --split         Multichannel: write <file>-ch<k>-<n>.wav per program instead\n"
+        << "  --sync-write    Batch mode: write each file before encoding the next\n"
+        << "  --direct[=<MB>] Batch mode: O_DIRECT for outputs of at least <MB> (default: 1)\n"
         << "  -d          Dump encoded payload  \n"
+        << "  --stats[=json]  Report phase timings and counters on stderr\n"
+        << "  --trace <file>  Write a Chrome/Perfetto trace-event timeline\n"
         << "  -h          Show this help and exit\n\n"
         << "Example:\n"
-        << "  " << prog << " -i hello.bas -o hello.wav -n HELLO -t BAS\n";
+        << "  " << prog << " -i hello.bas -o hello.wav -n HELLO -t BAS\n"
+        << "  " << prog << " -m bench.wav one.bas two.bas three.bas\n\n"
+        << "Jobs (-b, -D) are one per line: <input> [<output> [<name>]]\n";
 }
 
 BasicType detectFileType(const std::string& ft) {
@@ -542,108 +1070,104 @@ BasicType detectFileType(const std::string& ft) {
     return BasicType::ASCII;
 }
 
-int main(int argc, char* argv[]) {
-    std::cout << "HX-20 Tape Encoder v2.0 (Official Format)\n";
-    std::cout << "==========================================\n\n";
-
-    std::string inputFile;
-    std::string outputFile;
+// Settings shared by every file encoded in one run
+struct TapeOptions {
     std::string programName = "PROGRAM";
-    //std::string fileType = "";
+    std::string rawFile;
+    std::string pulseFile;
+    bool receiverCheck = false;
     int normalizeLevel = 95;
-    BasicType fileType = BasicType::ASCII;
-    
-
-    int opt;
-    while ((opt = getopt(argc, argv, ":i:o:n:a:dh")) != -1) {
-        switch (opt) {
-            case 'i':
-                inputFile = optarg ? std::string(optarg) : "";
-                break;
-            case 'o':
-                outputFile = optarg ? std::string(optarg) : "";
-                break;
-            case 'n':
-                programName = optarg ? std::string(optarg) : programName;
-                break;
-//            case 't':
-//                fileType = optarg ? std::string(optarg) : fileType;
-//                break;
-            case 'h':
-                printUsage(argv[0]);
-                return 0;
-            case 'a':
-                normalizeLevel = atoi(optarg);
-                break;
-            case 'd':
-                DEBUG = true;
-                break;
-            case ':': // missing argument to option
-                std::cerr << "Error: Option '-" << char(optopt) << "' requires an argument.\n";
-                printUsage(argv[0]);
-                return 1;
-            case '?': // unknown option
-            default:
-                std::cerr << "Error: Unknown option '-" << char(optopt) << "'.\n";
-                printUsage(argv[0]);
-                return 1;
-        }
-    }
+    bool asyncWrite = true;         // batch mode hands files to an AsyncWriter
+    size_t directMinBytes = 0;      // O_DIRECT for outputs this large, 0 = off
 
-    // Validate required options
-    if (inputFile.empty()) {
-        std::cerr << "Error: -i <input.bas> is required.\n";
-        printUsage(argv[0]);
-        return 1;
-    }
-    if (outputFile.empty()) {
-        fs::path p(inputFile);
-        outputFile = p.stem().string() + ".wav";
-    }
-    
-
-    // Convert to uppercase and pad/truncate
-    std::transform(programName.begin(), programName.end(),
-                   programName.begin(), ::toupper);
+    // Set per job by runJobs when writing asynchronously
+    AsyncWriter* writer = nullptr;
+    uint64_t writeTag = 0;
+};
 
-//    std::transform(fileType.begin(), fileType.end(), fileType.begin(), ::toupper);
-    
-    programName.resize(8, ' ');
-    //fileType.resize(8, ' ');
+// Read a program, refuse a malformed tokenized image and normalize line
+// endings to CRLF; errors are reported on stderr
+bool loadProgram(const std::string& inputFile, std::string& normalized, BasicType& fileType) {
+    fileType = BasicType::ASCII;
 
     // Read input file
-    std::ifstream inFile(inputFile);
-    if (!inFile) {
-        std::cerr << "Error: Could not open input file " << inputFile << std::endl;
-        return 1;
-    }
+    std::string programText;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        std::ifstream inFile(inputFile);
+        if (!inFile) {
+            std::cerr << "Error: Could not open input file " << inputFile << std::endl;
+            return false;
+        }
 
-    
-    std::string programText((std::istreambuf_iterator<char>(inFile)),
-                            std::istreambuf_iterator<char>());
-    inFile.close();
+        
+        programText.assign((std::istreambuf_iterator<char>(inFile)),
+                           std::istreambuf_iterator<char>());
+        inFile.close();
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, programText.size());
 
     
     // Determine operation based on first byte
     bool isTokenized = !programText.empty() && (uint8_t)programText[0] == 0xFF;
     if(isTokenized) fileType = BasicType::TOKEN;
 
+    // Refuse malformed tokenized images rather than put them on tape
+    if (isTokenized) {
+        ValidationResult validation;
+        validateTokenizedProgram((const uint8_t*)programText.data(), programText.size(), validation);
+        for (const ValidationIssue& issue : validation.issues) {
+            std::cerr << inputFile << ": " << (issue.fatal ? "error" : "warning") << " (offset "
+                      << issue.offset << "): " << issue.message << "\n";
+        }
+        if (!validation.ok()) {
+            std::cerr << "Error: " << inputFile << " is not a valid tokenized program\n";
+            return false;
+        }
+    }
+
     
     if (programText.empty()) {
         std::cerr << "Error: Input file is empty\n";
-        return 1;
+        return false;
     }
 
     // Ensure CRLF line endings
-    std::string normalized;
-    for (size_t i = 0; i < programText.length(); i++) {
-        if (programText[i] == '\n' && (i == 0 || programText[i-1] != '\r')) {
-            normalized += "\r\n";
-        } else if (programText[i] != '\r' ||
-                   (i + 1 < programText.length() && programText[i+1] == '\n')) {
-            normalized += programText[i];
+    normalized.clear();
+    {
+        HX20_STATS_PHASE(PHASE_CRLF);
+        HX20_TRACE_SPAN("crlf normalize");
+        for (size_t i = 0; i < programText.length(); i++) {
+            if (programText[i] == '\n' && (i == 0 || programText[i-1] != '\r')) {
+                normalized += "\r\n";
+            } else if (programText[i] != '\r' ||
+                       (i + 1 < programText.length() && programText[i+1] == '\n')) {
+                normalized += programText[i];
+            }
         }
     }
+    return true;
+}
+
+// Encode one input file to outputFile; returns a process exit code
+int encodeFile(const std::string& inputFile, const std::string& outputFile,
+               const TapeOptions& options) {
+    std::string programName = options.programName;
+    BasicType fileType = BasicType::ASCII;
+
+    // Convert to uppercase and pad/truncate
+    std::transform(programName.begin(), programName.end(),
+                   programName.begin(), ::toupper);
+
+//    std::transform(fileType.begin(), fileType.end(), fileType.begin(), ::toupper);
+    
+    programName.resize(8, ' ');
+    //fileType.resize(8, ' ');
+
+    std::string normalized;
+    if (!loadProgram(inputFile, normalized, fileType)) return 1;
 
     std::cout << "Input file: " << inputFile << "\n";
     std::cout << "Output file: " << outputFile << "\n";
@@ -658,9 +1182,33 @@ int main(int argc, char* argv[]) {
     encoder.encodeBasicProgram(normalized, programName, fileType);
 
 
+    // Render the pulse stream to every requested back-end
+    if (options.receiverCheck) {
+        ReceiverCheckRenderer check;
+        if (!encoder.render(check)) {
+            std::cerr << "Error: Receiver model rejected the encoded stream\n";
+            return 1;
+        }
+    }
+    if (!options.pulseFile.empty()) {
+        std::cout << "Writing pulse list...\n";
+        PulseListRenderer pulses(options.pulseFile);
+        if (!encoder.render(pulses)) {
+            return 1;
+        }
+    }
+    if (!options.rawFile.empty()) {
+        std::cout << "Writing raw PCM file...\n";
+        RawPCMRenderer raw(options.rawFile, options.normalizeLevel, options.writer, options.writeTag);
+        if (!encoder.render(raw)) {
+            return 1;
+        }
+    }
+
     // Save with normalization
     std::cout << "Writing WAV file...\n";
-    if (!encoder.saveToWAV(outputFile, normalizeLevel)) {
+    WAVRenderer wav(outputFile, options.normalizeLevel, options.writer, options.writeTag);
+    if (!encoder.render(wav)) {
         return 1;
     }
 
@@ -673,3 +1221,505 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+
+std::string defaultOutputFile(const std::string& inputFile) {
+    fs::path p(inputFile);
+    return p.stem().string() + ".wav";
+}
+
+// Batch and daemon mode: read jobs from `jobs`, one per line:
+//   <input> [<output> [<name>]]
+// and answer each with "OK <output> <ms>" or "ERR <input>" on stdout.
+// Per-file progress text is suppressed; errors still go to stderr. In daemon
+// mode every answer is flushed immediately so a client can wait for it.
+// Batch mode hands finished files to an AsyncWriter and renders the next
+// job while they are written; a job is answered, in input order, once its
+// files are on disk, and its time covers encoding plus the write.
+int runJobs(std::istream& jobs, const TapeOptions& options, bool daemon) {
+    std::ostream reply(std::cout.rdbuf());
+    std::ostringstream discard;
+    std::cout.rdbuf(discard.rdbuf());
+
+    std::unique_ptr<AsyncWriter> writer;
+    if (!daemon && options.asyncWrite) {
+        AsyncWriterOptions writerOptions;
+        writerOptions.directMinBytes = options.directMinBytes;
+        writer = std::make_unique<AsyncWriter>(writerOptions);
+    }
+
+    struct PendingJob {
+        uint64_t tag;
+        std::string inputFile, outputFile;
+        std::chrono::steady_clock::time_point start;
+        int result;
+    };
+    std::deque<PendingJob> pending;
+    size_t done = 0, failed = 0;
+
+    // Answer finished jobs from the front of the queue
+    auto answer = [&](bool wait) {
+        while (!pending.empty()) {
+            PendingJob& job = pending.front();
+            if (job.result == 0 && writer) {
+                bool ok = true;
+                if (wait) {
+                    ok = writer->wait(job.tag);
+                } else if (!writer->finished(job.tag, ok)) {
+                    break;
+                }
+                if (!ok) job.result = 1;
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - job.start).count();
+            if (job.result == 0) {
+                reply << "OK " << job.outputFile << " " << ms << "\n";
+                done++;
+            } else {
+                reply << "ERR " << job.inputFile << "\n";
+                failed++;
+            }
+            pending.pop_front();
+        }
+        if (daemon) reply.flush();
+    };
+
+    uint64_t nextTag = 0;
+    std::string line;
+    while (std::getline(jobs, line)) {
+        std::istringstream fields(line);
+        std::string inputFile, outputFile, name;
+        if (!(fields >> inputFile)) continue;
+        if (daemon && inputFile == "quit") break;
+        fields >> outputFile >> name;
+        if (outputFile.empty()) outputFile = defaultOutputFile(inputFile);
+
+        TapeOptions jobOptions = options;
+        if (!name.empty()) jobOptions.programName = name;
+        jobOptions.writer = writer.get();
+        jobOptions.writeTag = nextTag;
+
+        PendingJob job{nextTag++, inputFile, outputFile, std::chrono::steady_clock::now(), 0};
+        {
+            HX20_TRACE_SPAN("job");
+            job.result = encodeFile(inputFile, outputFile, jobOptions);
+        }
+        discard.str("");
+        pending.push_back(job);
+        answer(false);
+    }
+    answer(true);
+
+    std::cout.rdbuf(reply.rdbuf());
+    if (!daemon) {
+        std::cout << "Processed " << done + failed << " files, " << failed << " failed\n";
+    }
+    return failed ? 1 : 0;
+}
+
+// Multichannel output: programs spread over the channels of one
+// interleaved WAV, so that several HX-20s wired to one audio interface load
+// at the same time
+const int MAX_CHANNELS = 32;
+
+struct MultichannelOptions {
+    unsigned channels = 0;      // 0 = one channel per program
+    double pauseSeconds = 5;    // silence between programs on one channel
+    bool planOnly = false;      // print the schedule, write nothing
+    bool split = false;         // one mono WAV per program instead
+};
+
+// Renders one program in memory; the caller interleaves the samples
+class ChannelRenderer : public AudioRenderer {
+public:
+    // Append gap pulses (all ones, like the 0xFF gap bytes) up to `length`
+    // samples, cutting the last one short
+    void padTo(size_t length) {
+        while (audioData.size() < length) addPulse(PULSE_LONG);
+        audioData.resize(length);
+    }
+
+    void normalize(double targetAmplitude) { normalizeSamples(targetAmplitude); }
+};
+
+// Program name for a channel: the file name without extension
+std::string channelProgramName(const std::string& inputFile) {
+    std::string name = fs::path(inputFile).stem().string();
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    name.resize(8, ' ');
+    return name;
+}
+
+// One input, encoded to pulses; its length is known without rendering
+struct ChannelProgram {
+    std::string inputFile;
+    std::string name;
+    BasicType type = BasicType::ASCII;
+    size_t bytes = 0;
+    size_t samples = 0;
+    HX20TapeEncoder encoder;
+};
+
+// What each channel plays, in order, and when
+struct ChannelPlan {
+    std::vector<size_t> programs;
+    std::vector<size_t> starts;     // sample offset of each program
+    size_t length = 0;              // samples, pauses included
+};
+
+// With a channel for every program, input k plays on channel k, so each
+// machine on the bench gets the program it was given. Otherwise, longest
+// processing time first: take the programs longest first and give each to
+// the channel that is free soonest. The result is within 4/3 of the best
+// possible makespan.
+std::vector<ChannelPlan> scheduleChannels(const std::vector<std::unique_ptr<ChannelProgram>>& programs,
+                                          unsigned channels, size_t pauseSamples) {
+    if (programs.size() <= channels) {
+        std::vector<ChannelPlan> plan(channels);
+        for (size_t i = 0; i < programs.size(); i++) {
+            plan[i].programs.push_back(i);
+            plan[i].starts.push_back(0);
+            plan[i].length = programs[i]->samples;
+        }
+        return plan;
+    }
+
+    std::vector<size_t> order(programs.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return programs[a]->samples > programs[b]->samples; });
+
+    std::vector<ChannelPlan> plan(channels);
+    for (size_t i : order) {
+        ChannelPlan* best = &plan[0];
+        for (ChannelPlan& channel : plan) {
+            if (channel.length < best->length) best = &channel;
+        }
+        size_t start = best->programs.empty() ? 0 : best->length + pauseSamples;
+        best->programs.push_back(i);
+        best->starts.push_back(start);
+        best->length = start + programs[i]->samples;
+    }
+    return plan;
+}
+
+// Write interleaved 8-bit frames with a WAV header
+bool writeMultichannelWAV(const std::string& filename, const std::vector<uint8_t>& frames, unsigned channels) {
+    HX20_STATS_PHASE(PHASE_WRITE);
+    HX20_TRACE_SPAN("write wav");
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not create file " << filename << std::endl;
+        return false;
+    }
+    WAVHeader header;
+    header.numChannels = (uint16_t)channels;
+    header.byteRate = SAMPLE_RATE * channels;
+    header.blockAlign = (uint16_t)channels;
+    header.dataSize = (uint32_t)frames.size();
+    header.fileSize = (uint32_t)(sizeof(WAVHeader) - 8 + frames.size());
+    file.write(reinterpret_cast<char*>(&header), sizeof(WAVHeader));
+    file.write(reinterpret_cast<const char*>(frames.data()), frames.size());
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, sizeof(WAVHeader) + frames.size());
+    return true;
+}
+
+// <stem>-ch<k>-<n>.wav next to outputFile, for --split
+std::string splitFileName(const std::string& outputFile, size_t channel, size_t index) {
+    fs::path p(outputFile);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-ch%zu-%02zu.wav", channel + 1, index + 1);
+    return (p.parent_path() / (p.stem().string() + suffix)).string();
+}
+
+void printChannelPlan(const std::vector<std::unique_ptr<ChannelProgram>>& programs,
+                      const std::vector<ChannelPlan>& plan, size_t pauseSamples) {
+    size_t total = 0, longest = 0, makespan = 0;
+    for (const auto& program : programs) {
+        total += program->samples;
+        longest = std::max(longest, program->samples);
+    }
+    for (size_t c = 0; c < plan.size(); c++) {
+        makespan = std::max(makespan, plan[c].length);
+        printf("Channel %zu: %zu program(s), %.1f s\n", c + 1, plan[c].programs.size(),
+               (double)plan[c].length / SAMPLE_RATE);
+        for (size_t k = 0; k < plan[c].programs.size(); k++) {
+            const ChannelProgram& program = *programs[plan[c].programs[k]];
+            printf("  %7.1f s  %-8s %6.1f s  %5zu bytes  %-9s  %s\n", (double)plan[c].starts[k] / SAMPLE_RATE,
+                   program.name.c_str(), (double)program.samples / SAMPLE_RATE, program.bytes,
+                   program.type == BasicType::ASCII ? "ASCII" : "tokenized", program.inputFile.c_str());
+        }
+    }
+
+    // No schedule beats the longest tape or an even split of all the work,
+    // counting the pauses the extra programs cannot avoid
+    size_t channels = plan.size();
+    size_t pauses = programs.size() > channels ? programs.size() - channels : 0;
+    double ideal = std::max((double)longest, (double)(total + pauses * pauseSamples) / channels);
+    printf("\nMakespan: %.1f s predicted, %.1f s ideal (+%.1f%%), %.1f s on one channel\n",
+           (double)makespan / SAMPLE_RATE, ideal / SAMPLE_RATE, ideal > 0 ? 100.0 * (makespan - ideal) / ideal : 0.0,
+           (double)(total + (programs.size() - 1) * pauseSamples) / SAMPLE_RATE);
+}
+
+// Encode every input and spread the programs over the channels of
+// outputFile; returns a process exit code. Programs are encoded here (which
+// fixes their lengths), scheduled, then each channel is rendered and
+// normalized on its own thread.
+int encodeMultichannel(const std::vector<std::string>& inputFiles, const std::string& outputFile,
+                       const TapeOptions& options, const MultichannelOptions& multi) {
+    unsigned channels = multi.channels ? multi.channels : (unsigned)inputFiles.size();
+    if (inputFiles.empty() || channels == 0 || channels > (unsigned)MAX_CHANNELS) {
+        std::cerr << "Error: Multichannel output takes 1 to " << MAX_CHANNELS << " channels\n";
+        return 1;
+    }
+    channels = std::min<unsigned>(channels, (unsigned)inputFiles.size());
+    const size_t pauseSamples = (size_t)(std::max(0.0, multi.pauseSeconds) * SAMPLE_RATE);
+
+    std::vector<std::unique_ptr<ChannelProgram>> programs;
+    for (const std::string& inputFile : inputFiles) {
+        auto program = std::make_unique<ChannelProgram>();
+        std::string normalized;
+        if (!loadProgram(inputFile, normalized, program->type)) return 1;
+        program->inputFile = inputFile;
+        program->name = channelProgramName(inputFile);
+        program->bytes = normalized.length();
+        program->encoder.encodeBasicProgram(normalized, program->name, program->type);
+        program->samples = AudioRenderer::streamLength(program->encoder.pulses());
+        programs.push_back(std::move(program));
+    }
+
+    std::vector<ChannelPlan> plan = scheduleChannels(programs, channels, pauseSamples);
+    printChannelPlan(programs, plan, pauseSamples);
+    if (multi.planOnly) return 0;
+
+    size_t longest = 0;
+    for (const ChannelPlan& channel : plan) longest = std::max(longest, channel.length);
+    uint64_t dataSize = multi.split ? 0 : (uint64_t)longest * channels;
+    if (sizeof(WAVHeader) - 8 + dataSize > UINT32_MAX) {
+        std::cerr << "Error: " << outputFile << " would exceed the 4 GB WAV limit\n";
+        return 1;
+    }
+
+    // Pauses stay at the center level. Each thread writes its own column of
+    // the interleaved frames, or its own files with --split.
+    std::vector<uint8_t> frames(dataSize, 128);
+    std::vector<char> failed(programs.size(), 0);
+    {
+        HX20_STATS_PHASE(PHASE_RENDER);
+        HX20_TRACE_SPAN("render channels");
+        std::vector<std::thread> threads;
+        for (unsigned c = 0; c < channels; c++) {
+            threads.emplace_back([&, c] {
+                const ChannelPlan& channel = plan[c];
+                for (size_t k = 0; k < channel.programs.size(); k++) {
+                    ChannelRenderer renderer;
+                    programs[channel.programs[k]]->encoder.feed(renderer);
+                    bool last = k + 1 == channel.programs.size();
+                    if (multi.split) {
+                        if (options.normalizeLevel > 0) renderer.normalize(options.normalizeLevel);
+                        std::string filename = splitFileName(outputFile, c, k);
+                        std::ofstream file(filename, std::ios::binary);
+                        WAVHeader header;
+                        header.dataSize = (uint32_t)renderer.samples().size();
+                        header.fileSize = sizeof(WAVHeader) - 8 + header.dataSize;
+                        file.write(reinterpret_cast<char*>(&header), sizeof(WAVHeader));
+                        file.write(reinterpret_cast<const char*>(renderer.samples().data()), header.dataSize);
+                        if (!file) failed[channel.programs[k]] = 1;
+                        continue;
+                    }
+                    // The last tape on a channel runs on in gap pulses to
+                    // the end of the file
+                    if (last) renderer.padTo(longest - channel.starts[k]);
+                    if (options.normalizeLevel > 0) renderer.normalize(options.normalizeLevel);
+                    const uint8_t* in = renderer.samples().data();
+                    uint8_t* out = frames.data() + channel.starts[k] * channels + c;
+                    for (size_t i = 0, n = renderer.samples().size(); i < n; i++, out += channels) *out = in[i];
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    if (multi.split) {
+        for (unsigned c = 0; c < channels; c++) {
+            for (size_t k = 0; k < plan[c].programs.size(); k++) {
+                std::string filename = splitFileName(outputFile, c, k);
+                if (failed[plan[c].programs[k]]) {
+                    std::cerr << "Error: Could not write " << filename << std::endl;
+                    continue;
+                }
+                HX20_STATS_ADD(STAT_SAMPLES, programs[plan[c].programs[k]]->samples);
+                HX20_STATS_ADD(STAT_BYTES_WRITTEN, sizeof(WAVHeader) + programs[plan[c].programs[k]]->samples);
+                std::cout << "Wrote " << filename << "\n";
+            }
+        }
+        return std::count(failed.begin(), failed.end(), 1) ? 1 : 0;
+    }
+
+    HX20_STATS_ADD(STAT_SAMPLES, dataSize);
+    HX20_STATS_MAX(STAT_PEAK_BUFFER, dataSize);
+    if (!writeMultichannelWAV(outputFile, frames, channels)) return 1;
+
+    std::cout << "\nSuccess! " << channels << "-channel WAV file created: " << outputFile << " ("
+              << (double)longest / SAMPLE_RATE << " s)\n";
+    std::cout << "Start playback on all machines at once: LOAD\"CAS1:\" on each HX-20 first.\n";
+    return 0;
+}
+
+#ifndef HX20TAPE_NO_MAIN
+int main(int argc, char* argv[]) {
+    auto wallStart = std::chrono::steady_clock::now();
+    std::cout << "HX-20 Tape Encoder v2.0 (Official Format)\n";
+    std::cout << "==========================================\n\n";
+
+    std::string inputFile;
+    std::string outputFile;
+    std::string jobFile;
+    std::string multiFile;
+    MultichannelOptions multi;
+    bool daemon = false;
+    std::string traceFile;
+    TapeOptions options;
+    
+
+    static const struct option longOptions[] = {
+        {"stats", optional_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"sync-write", no_argument, nullptr, 'W'},
+        {"direct", optional_argument, nullptr, 'O'},
+        {"channels", required_argument, nullptr, 'K'},
+        {"pause", required_argument, nullptr, 'P'},
+        {"plan", no_argument, nullptr, 'L'},
+        {"split", no_argument, nullptr, 'X'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, ":i:o:n:a:r:p:b:m:cDdh", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                inputFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'o':
+                outputFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'n':
+                options.programName = optarg ? std::string(optarg) : options.programName;
+                break;
+//            case 't':
+//                fileType = optarg ? std::string(optarg) : fileType;
+//                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            case 'a':
+                options.normalizeLevel = atoi(optarg);
+                break;
+            case 'r':
+                options.rawFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'p':
+                options.pulseFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'c':
+                options.receiverCheck = true;
+                break;
+            case 'b':
+                jobFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'm':
+                multiFile = optarg ? std::string(optarg) : "";
+                break;
+            case 'D':
+                daemon = true;
+                break;
+            case 'd':
+                DEBUG = true;
+                break;
+            case 'S':
+                STATS.enabled = true;
+                STATS.json = optarg && strcmp(optarg, "json") == 0;
+                break;
+            case 'T':
+                traceFile = optarg;
+                TRACER.enabled = true;
+                TRACER.setThreadName("main");
+                break;
+            case 'W':
+                options.asyncWrite = false;
+                break;
+            case 'O':
+                // --direct=0 puts every file on O_DIRECT
+                options.directMinBytes = std::max<size_t>(1, (size_t)(std::max(optarg ? atof(optarg) : 1.0, 0.0) * 1024 * 1024));
+                break;
+            case 'K':
+                multi.channels = (unsigned)std::max(1, atoi(optarg));
+                break;
+            case 'P':
+                multi.pauseSeconds = atof(optarg);
+                break;
+            case 'L':
+                multi.planOnly = true;
+                break;
+            case 'X':
+                multi.split = true;
+                break;
+            case ':': // missing argument to option
+                std::cerr << "Error: Option '-" << char(optopt) << "' requires an argument.\n";
+                printUsage(argv[0]);
+                return 1;
+            case '?': // unknown option
+            default:
+                std::cerr << "Error: Unknown option '-" << char(optopt) << "'.\n";
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    int result;
+    if (!multiFile.empty()) {
+        std::vector<std::string> inputs;
+        if (!inputFile.empty()) inputs.push_back(inputFile);
+        for (int i = optind; i < argc; i++) inputs.push_back(argv[i]);
+        result = encodeMultichannel(inputs, multiFile, options, multi);
+    } else if (daemon) {
+        result = runJobs(std::cin, options, true);
+    } else if (!jobFile.empty()) {
+        if (jobFile == "-") {
+            result = runJobs(std::cin, options, false);
+        } else {
+            std::ifstream jobs(jobFile);
+            if (!jobs) {
+                std::cerr << "Error: Could not open job list " << jobFile << std::endl;
+                return 1;
+            }
+            result = runJobs(jobs, options, false);
+        }
+    } else {
+        // Validate required options
+        if (inputFile.empty()) {
+            std::cerr << "Error: -i <input.bas> is required.\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (outputFile.empty()) {
+            outputFile = defaultOutputFile(inputFile);
+        }
+
+        result = encodeFile(inputFile, outputFile, options);
+    }
+
+    if (!traceFile.empty() && !TRACER.writeTrace(traceFile)) {
+        std::cerr << "Error: Could not write trace file " << traceFile << std::endl;
+        result = 1;
+    }
+    if (STATS.enabled) {
+        printStats("hx20tape", std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - wallStart).count());
+    }
+    return result;
+}
+#endif // HX20TAPE_NO_MAIN
@@ -6,7 +6,19 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <cstring>
+#include <chrono>
+#include <mutex>
+
+#ifndef HX20TOKENIZER_NO_MAIN
+#define HX20_STATS_MAIN
+#endif
+#include "hx20stats.h"
+#include "hx20trace.h"
+#include "hx20build.h"
+#include "hx20validate.h"
+#include "hx20interp.h"
 
 // Token tables
 const uint8_t FUNCTION_ESCAPE = 0xFF;
@@ -59,13 +71,17 @@ std::map<std::string, uint8_t> basicFunctions = {
 std::map<uint8_t, std::string> commandTokens;
 std::map<uint8_t, std::string> functionTokens;
 
+// Built once; detokenizeBasicProgram may run on several threads at a time
 void initReverseMaps() {
-    for (const auto& pair : basicCommands) {
-        commandTokens[pair.second] = " " + pair.first + " ";
-    }
-    for (const auto& pair : basicFunctions) {
-        functionTokens[pair.second] = " " + pair.first + " ";
-    }
+    static std::once_flag once;
+    std::call_once(once, [] {
+        for (const auto& pair : basicCommands) {
+            commandTokens[pair.second] = " " + pair.first + " ";
+        }
+        for (const auto& pair : basicFunctions) {
+            functionTokens[pair.second] = " " + pair.first + " ";
+        }
+    });
 }
 
 uint16_t readWord(std::ifstream& in) {
@@ -79,123 +95,128 @@ void writeWord(std::ofstream& out, uint16_t value) {
     out.put(value & 0xFF);          // Low byte second
 }
 
-std::string tokenizeBasicLine(const std::string& line, int lineNumber) {
+// The keywords that can match at a character, in the order
+// tokenizeBasicLine tries them: functions, then commands, each from the end
+// of its table, so the first match wins as it always has
+struct KeywordCandidate {
+    const char* keyword;
+    size_t length;
+    uint8_t token;
+    bool function;
+    bool isOperator;        // tokenized even inside a name
+    bool remark;            // REM or ': the rest of the line is copied
+};
+
+struct KeywordIndex {
+    std::vector<KeywordCandidate> candidates[256];
+    bool plain[256];        // cannot start a keyword or a string: copied as is
+
+    KeywordIndex() {
+        auto add = [&](const std::string& keyword, uint8_t token, bool function) {
+            KeywordCandidate candidate{keyword.c_str(), keyword.length(), token, function, false,
+                                       keyword == "REM" || keyword == "'"};
+            candidate.isOperator = (keyword.length() <= 2 && !std::isalpha(keyword[0])) ||
+                                   (keyword == "AND" || keyword == "OR" || keyword == "XOR" ||
+                                    keyword == "EQV" || keyword == "IMP" || keyword == "MOD" ||
+                                    keyword == "NOT");
+            uint8_t first = keyword[0];
+            candidates[first].push_back(candidate);
+            if (std::isupper(first)) candidates[std::tolower(first)].push_back(candidate);
+        };
+        for (auto it = basicFunctions.rbegin(); it != basicFunctions.rend(); ++it) add(it->first, it->second, true);
+        for (auto it = basicCommands.rbegin(); it != basicCommands.rend(); ++it) add(it->first, it->second, false);
+        for (int c = 0; c < 256; c++) plain[c] = c != '"' && candidates[c].empty();
+    }
+
+    static const KeywordIndex& instance() {
+        static const KeywordIndex index;
+        return index;
+    }
+};
+
+std::string tokenizeBasicLine(const std::string& line, int /*lineNumber*/) {
+    const KeywordIndex& index = KeywordIndex::instance();
+    const size_t n = line.length();
+    const char* text = line.data();
     std::string result;
+    result.reserve(n);
     size_t pos = 0;
-    bool inString = false;
-    bool inRemark = false;
     
     // Skip line number in input if present
-    while (pos < line.length() && std::isdigit(line[pos])) {
+    while (pos < n && std::isspace(line[pos])) {
+        pos++;
+    }
+    while (pos < n && std::isdigit(line[pos])) {
         pos++;
     }
-    while (pos < line.length() && std::isspace(line[pos])) {
+    while (pos < n && std::isspace(line[pos])) {
         pos++;
     }
     
-   
-    while (pos < line.length()) {
-        char ch = line[pos];
-        
-        // Handle strings - pass through unchanged
-        if (ch == '"') {
-            result += ch;
-            pos++;
-            inString = !inString;
-            continue;
-        }
-        
-        if (inString) {
-            result += ch;
-            pos++;
-            continue;
-        }
-        
-        // Handle REM - rest of line is comment
-        if (inRemark) {
-            result += ch;
-            pos++;
-            continue;
+    while (pos < n) {
+        // Digits, spaces, punctuation and letters no keyword starts with
+        // pass through unchanged, a whole run at a time
+        size_t run = pos;
+        while (run < n && index.plain[(uint8_t)text[run]]) run++;
+        if (run > pos) {
+            result.append(text + pos, run - pos);
+            pos = run;
+            if (pos == n) break;
         }
+        char ch = text[pos];
         
-        // Skip whitespace (preserve it)
-        if (std::isspace(ch)) {
-            result += ch;
-            pos++;
+        // Strings pass through unchanged up to the closing quote
+        if (ch == '"') {
+            const void* quote = memchr(text + pos + 1, '"', n - pos - 1);
+            size_t end = quote ? static_cast<const char*>(quote) - text + 1 : n;
+            result.append(text + pos, end - pos);
+            pos = end;
             continue;
         }
         
         bool matched = false;
-        
-        // Try to match functions first (longest match)
-        for (auto it = basicFunctions.rbegin(); it != basicFunctions.rend(); ++it) {
-            const std::string& keyword = it->first;
-            if (pos + keyword.length() <= line.length()) {
-                std::string upper = line.substr(pos, keyword.length());
-                std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
-                
-                if (upper == keyword) {
-                    result += (char)FUNCTION_ESCAPE;
-                    result += (char)it->second;
-                    pos += keyword.length();
-                    matched = true;
-                    break;
-                }
-            }
-        }
-        
-        if (matched) continue;
-        
-        // Try to match commands (longest match)
-        for (auto it = basicCommands.rbegin(); it != basicCommands.rend(); ++it) {
-            const std::string& keyword = it->first;
-            if (pos + keyword.length() <= line.length()) {
-                std::string upper = line.substr(pos, keyword.length());
-                std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
-                
-                if (upper == keyword) {
-                    bool isOperator = (keyword.length() <= 2 && !std::isalpha(keyword[0])) ||
-                                     (keyword == "AND" || keyword == "OR" || keyword == "XOR" ||
-                                      keyword == "EQV" || keyword == "IMP" || keyword == "MOD" ||
-                                      keyword == "NOT");
-                    
-                    bool validMatch = false;
-                    
-                    if (isOperator) {
+        for (const KeywordCandidate& candidate : index.candidates[(uint8_t)ch]) {
+            const size_t length = candidate.length;
+            if (pos + length > n) continue;
+            size_t k = 1;
+            while (k < length && std::toupper((uint8_t)text[pos + k]) == candidate.keyword[k]) k++;
+            if (k < length) continue;
+            
+            // Functions always match; so do operators. Other commands only
+            // where the letters after them do not read as part of a name.
+            bool validMatch = candidate.function || candidate.isOperator;
+            if (!validMatch) {
+                size_t nextPos = pos + length;
+                if (nextPos >= n) {
+                    validMatch = true;
+                } else {
+                    char nextChar = text[nextPos];
+                    if (!std::isalpha(nextChar)) {
                         validMatch = true;
-                    } else {
-                        size_t nextPos = pos + keyword.length();
-                        if (nextPos >= line.length()) {
+                    } else if (std::isupper(nextChar)) {
+                        if (nextPos + 1 >= n || !std::isalpha(text[nextPos + 1])) {
+                            validMatch = true;
+                        } else if (std::islower(text[nextPos + 1])) {
                             validMatch = true;
-                        } else {
-                            char nextChar = line[nextPos];
-                            if (!std::isalpha(nextChar)) {
-                                validMatch = true;
-                            } else if (std::isupper(nextChar)) {
-                                if (nextPos + 1 >= line.length() || !std::isalpha(line[nextPos + 1])) {
-                                    validMatch = true;
-                                } else if (std::islower(line[nextPos + 1])) {
-                                    validMatch = true;
-                                }
-                            } else if (std::islower(nextChar)) {
-                                validMatch = true;
-                            }
-                        }
-                    }
-                    
-                    if (validMatch) {
-                        result += (char)it->second;
-                        pos += keyword.length();
-                        
-                        if (upper == "REM" || upper == "'") {
-                            inRemark = true;
                         }
-                        
-                        matched = true;
-                        break;
+                    } else if (std::islower(nextChar)) {
+                        validMatch = true;
                     }
                 }
             }
+            if (!validMatch) continue;
+            
+            if (candidate.function) result += (char)FUNCTION_ESCAPE;
+            result += (char)candidate.token;
+            pos += length;
+            matched = true;
+            
+            // Handle REM - rest of line is comment
+            if (candidate.remark) {
+                result.append(text + pos, n - pos);
+                pos = n;
+            }
+            break;
         }
         
         if (matched) continue;
@@ -208,6 +229,7 @@ std::string tokenizeBasicLine(const std::string& line, int lineNumber) {
 }
 
 std::string tokenizeBasicProgram(const std::string& program) {
+    HX20_TRACE_SPAN("tokenizeBasicProgram");
     std::vector<std::string> lines;
     std::stringstream ss(program);
     std::string line;
@@ -222,9 +244,8 @@ std::string tokenizeBasicProgram(const std::string& program) {
     }
     
     std::ostringstream binary;
-    binary.put(0xFF);
+    binary.put((char)0xFF);
     
-    size_t sizePos = binary.tellp();
     binary.put(0x00);
     binary.put(0x00);
     
@@ -262,10 +283,11 @@ std::string tokenizeBasicProgram(const std::string& program) {
 }
 
 std::string detokenizeBasicProgram(const std::string& binaryData) {
+    HX20_TRACE_SPAN("detokenizeBasicProgram");
     initReverseMaps();
     std::ostringstream output;
     
-    if (binaryData.empty() || (uint8_t)binaryData[0] != 0xFF) {
+    if (binaryData.size() < 3 || (uint8_t)binaryData[0] != 0xFF) {
         return "Error: Not a valid HX-20 BASIC file\n";
     }
     
@@ -275,7 +297,7 @@ std::string detokenizeBasicProgram(const std::string& binaryData) {
     while (pos < size && pos < binaryData.length()) {
         // Skip dummy word
         pos += 2;
-        if (pos >= binaryData.length()) break;
+        if (pos + 2 > binaryData.length()) break;
         
         // Read line number (big-endian)
         uint16_t lineNumber = ((uint8_t)binaryData[pos] << 8) | (uint8_t)binaryData[pos + 1];
@@ -331,11 +353,13 @@ std::string detokenizeBasicProgram(const std::string& binaryData) {
             std::string cleaned = currentLine.substr(0, firstSpace + 1);
             std::string rest = currentLine.substr(firstSpace + 1);
             
-            // Remove redundant spaces
+            // Remove redundant spaces, but not from string literals
             std::string result;
             bool lastWasSpace = false;
+            bool quoted = false;
             for (char ch : rest) {
-                if (ch == ' ') {
+                if (ch == '"') quoted = !quoted;
+                if (ch == ' ' && !quoted) {
                     if (!lastWasSpace) result += ch;
                     lastWasSpace = true;
                 } else {
@@ -355,78 +379,3009 @@ std::string detokenizeBasicProgram(const std::string& binaryData) {
     return output.str();
 }
 
-void printUsage(const char* progName) {
-    std::cerr << "HX-20 BASIC Tokenizer/Detokenizer\n";
-    std::cerr << "Usage: " << progName << " -i <input> -o <output>\n";
-    std::cerr << "  -i <file>   Input file\n";
-    std::cerr << "  -o <file>   Output file\n";
-    std::cerr << "\nIf input starts with 0xFF, it will be detokenized to ASCII.\n";
-    std::cerr << "Otherwise, it will be tokenized to binary format.\n";
+const int MAX_LINE_NUMBER = 65529;
+
+// Tokens that take a line number reference
+const uint8_t TOKEN_DATA = 0x83;
+const uint8_t TOKEN_GO = 0x87;
+const uint8_t TOKEN_RUN = 0x88;
+const uint8_t TOKEN_RESTORE = 0x8A;
+const uint8_t TOKEN_RETURN = 0x8B;
+const uint8_t TOKEN_REM = 0x8C;
+const uint8_t TOKEN_REM_QUOTE = 0x8D;
+const uint8_t TOKEN_ELSE = 0x8F;
+const uint8_t TOKEN_RESUME = 0x9D;
+const uint8_t TOKEN_TO = 0xD0;
+const uint8_t TOKEN_SUB = 0xD1;
+const uint8_t TOKEN_ERL = 0xD6;
+const uint8_t TOKEN_THEN = 0xDA;
+const uint8_t TOKEN_GREATER = 0xE9;
+const uint8_t TOKEN_LESS = 0xEB;
+
+// A line number in a line body: the ASCII digits at [offset, offset +
+// length). A GO TO / GO SUB followed by an expression instead of digits is
+// reported with length 0 and target -1.
+struct LineReference {
+    enum Kind { GOTO, GOSUB, THEN, ELSE, RESTORE, RESUME, RETURN, ERL, RUN } kind;
+    size_t offset;
+    size_t length;
+    long target;
+};
+
+// Call fn for each line reference in the body [pos, end) of one line: after
+// GO TO / GO SUB (the tokenizer also emits "GO" as plain letters before
+// TO/SUB), including ON ... GOTO lists, THEN, ELSE, RESTORE, RESUME,
+// RETURN, RUN and ERL <relation>. Strings, REM text and DATA items are skipped.
+template <typename Fn>
+void forEachLineReference(const uint8_t* data, size_t pos, size_t end, Fn fn) {
+    const size_t body = pos;
+    auto skipSpaces = [&] {
+        while (pos < end && data[pos] == ' ') pos++;
+    };
+    // Report one ASCII line number at pos, if there is one
+    auto reference = [&](LineReference::Kind kind) {
+        skipSpaces();
+        size_t digits = pos;
+        long target = 0;
+        while (pos < end && std::isdigit(data[pos]) && pos - digits < 5) {
+            target = target * 10 + (data[pos++] - '0');
+        }
+        if (pos == digits) return false;
+        fn(LineReference{kind, digits, pos - digits, target});
+        return true;
+    };
+
+    bool inString = false;
+    while (pos < end) {
+        uint8_t token = data[pos++];
+        if (inString) {
+            inString = token != '"';
+            continue;
+        }
+        switch (token) {
+            case '"':
+                inString = true;
+                break;
+            case FUNCTION_ESCAPE:
+                if (pos < end) pos++;
+                break;
+            case TOKEN_REM:
+            case TOKEN_REM_QUOTE:
+                pos = end;
+                break;
+            case TOKEN_DATA: {
+                bool quoted = false;
+                while (pos < end && (quoted || data[pos] != ':')) {
+                    if (data[pos] == '"') quoted = !quoted;
+                    pos++;
+                }
+                break;
+            }
+            case TOKEN_TO:
+            case TOKEN_SUB: {
+                // Only after GO, as a token or as the letters G O (but
+                // not the end of a name such as LOGO)
+                size_t back = pos - 1;
+                while (back > body && data[back - 1] == ' ') back--;
+                bool afterGo = back > body && data[back - 1] == TOKEN_GO;
+                if (back >= body + 2 && data[back - 1] == 'O' && data[back - 2] == 'G') {
+                    afterGo = back == body + 2 || !std::isalnum(data[back - 3]);
+                }
+                if (!afterGo) break;
+                LineReference::Kind kind = token == TOKEN_TO ? LineReference::GOTO : LineReference::GOSUB;
+                if (!reference(kind)) {
+                    fn(LineReference{kind, pos, 0, -1});
+                    break;
+                }
+                // ON ... GOTO/GOSUB takes a comma-separated list
+                for (;;) {
+                    size_t mark = pos;
+                    skipSpaces();
+                    if (pos == end || data[pos] != ',') {
+                        pos = mark;
+                        break;
+                    }
+                    pos++;
+                    if (!reference(kind)) break;
+                }
+                break;
+            }
+            case TOKEN_THEN:
+                reference(LineReference::THEN);
+                break;
+            case TOKEN_ELSE:
+                reference(LineReference::ELSE);
+                break;
+            case TOKEN_RESTORE:
+                reference(LineReference::RESTORE);
+                break;
+            case TOKEN_RESUME:
+                reference(LineReference::RESUME);
+                break;
+            case TOKEN_RETURN:
+                reference(LineReference::RETURN);
+                break;
+            case TOKEN_RUN:
+                reference(LineReference::RUN);
+                break;
+            case TOKEN_ERL:
+                skipSpaces();
+                if (pos < end && data[pos] >= TOKEN_GREATER && data[pos] <= TOKEN_LESS) {
+                    pos++;
+                    skipSpaces();
+                    if (pos < end && data[pos] >= TOKEN_GREATER && data[pos] <= TOKEN_LESS) pos++;
+                    reference(LineReference::ERL);
+                }
+                break;
+            default:
+                break;
+        }
+    }
 }
 
-int main(int argc, char* argv[]) {
-    std::string inputFile;
-    std::string outputFile;
-    
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
-            inputFile = argv[++i];
-        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
-            outputFile = argv[++i];
-        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            printUsage(argv[0]);
-            return 0;
+struct RenumberReport {
+    size_t lines = 0;
+    size_t references = 0;
+    std::vector<std::string> warnings;  // undefined line references
+};
+
+// Renumber a tokenized image (as built by tokenizeBasicProgram) without
+// detokenizing it. The line headers are walked once to map old numbers to
+// start, start+step, ...; a second, linear pass copies the image and
+// rewrites the references found by forEachLineReference, except RUN.
+// References to missing lines are kept and reported. The size field
+// (bytes 1-2) is rewritten since a reference may change length.
+bool renumberTokenizedProgram(std::string& image, int start, int step,
+                              RenumberReport& report, std::string& error) {
+    HX20_TRACE_SPAN("renumberTokenizedProgram");
+    if (image.size() < 3 || (uint8_t)image[0] != 0xFF) {
+        error = "not a tokenized HX-20 BASIC program";
+        return false;
+    }
+    if (start < 1 || step < 1) {
+        error = "start and step must be positive";
+        return false;
+    }
+    const uint8_t* data = (const uint8_t*)image.data();
+    size_t size = std::min<size_t>(image.size(), (data[1] << 8) | data[2]);
+
+    // Pass 1: line headers only, skipping each body with memchr
+    std::vector<int32_t> newNumber(65536, -1);
+    int previous = -1;
+    long next = start;
+    for (size_t pos = 3; pos + 4 <= size;) {
+        int number = (data[pos + 2] << 8) | data[pos + 3];
+        if (number <= previous) {
+            error = "line " + std::to_string(number) + " is out of order";
+            return false;
         }
+        if (next > MAX_LINE_NUMBER) {
+            error = "new line numbers would pass " + std::to_string(MAX_LINE_NUMBER);
+            return false;
+        }
+        previous = number;
+        newNumber[number] = (int32_t)next;
+        next += step;
+        report.lines++;
+
+        const void* end = memchr(data + pos + 4, 0x00, size - pos - 4);
+        if (!end) break;
+        pos = (const uint8_t*)end - data + 1;
     }
-    
-    if (inputFile.empty() || outputFile.empty()) {
-        printUsage(argv[0]);
-        return 1;
+
+    // Pass 2: copy and rewrite references
+    std::string out;
+    out.reserve(image.size() + image.size() / 8);
+    out.append(image, 0, 3);
+
+    size_t pos = 3;
+    while (pos + 4 <= size) {
+        int lineNumber = (data[pos + 2] << 8) | data[pos + 3];
+        int renumbered = newNumber[lineNumber];
+        out += (char)data[pos];
+        out += (char)data[pos + 1];
+        out += (char)(renumbered >> 8);
+        out += (char)(renumbered & 0xFF);
+        pos += 4;
+        const void* terminator = memchr(data + pos, 0x00, size - pos);
+        size_t end = terminator ? (const uint8_t*)terminator - data : size;
+
+        size_t copied = pos;
+        forEachLineReference(data, pos, end, [&](const LineReference& ref) {
+            if (ref.length == 0 || ref.kind == LineReference::RUN) return;
+            out.append((const char*)data + copied, ref.offset - copied);
+            copied = ref.offset + ref.length;
+            if (ref.target > 0 && ref.target <= 65535 && newNumber[ref.target] >= 0) {
+                out += std::to_string(newNumber[ref.target]);
+                report.references++;
+            } else {
+                out.append((const char*)data + ref.offset, ref.length);
+                if (ref.target > 0) {
+                    report.warnings.push_back("undefined line " + std::to_string(ref.target) +
+                                              " in " + std::to_string(lineNumber));
+                }
+            }
+        });
+        out.append((const char*)data + copied, end - copied);
+        pos = end;
+        if (pos < size) out += (char)data[pos++];   // line terminator
     }
-    
-    // Read input file
-    std::ifstream inFile(inputFile, std::ios::binary);
-    if (!inFile) {
-        std::cerr << "Error: Could not open input file: " << inputFile << "\n";
-        return 1;
+    size_t newSize = out.size();
+    out.append(image, pos, std::string::npos);
+
+    if (newSize > 0xFFFF) {
+        error = "renumbered program exceeds 65535 bytes";
+        return false;
     }
-    
-    std::stringstream buffer;
-    buffer << inFile.rdbuf();
-    std::string inputData = buffer.str();
-    inFile.close();
-    
-    // Determine operation based on first byte
-    bool isTokenized = !inputData.empty() && (uint8_t)inputData[0] == 0xFF;
-    std::string output;
-    
-    if (isTokenized) {
-        std::cout << "Detokenizing...\n";
-        output = detokenizeBasicProgram(inputData);
-        
-        std::ofstream outFile(outputFile);
-        if (!outFile) {
-            std::cerr << "Error: Could not open output file: " << outputFile << "\n";
-            return 1;
+    out[1] = (char)((newSize >> 8) & 0xFF);  // Big-endian
+    out[2] = (char)(newSize & 0xFF);
+    image.swap(out);
+    return true;
+}
+
+// One line of a tokenized image: header offset and length including the
+// 4-byte header and the terminator
+struct LineIndexEntry {
+    uint16_t number;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Index the lines of a tokenized image in one pass over the headers. A
+// program's lines must be in ascending order; a MERGE source may be in any
+// order, as lines typed or merged into BASIC may.
+bool indexTokenizedProgram(const std::string& image, std::vector<LineIndexEntry>& index,
+                           std::string& error, bool ordered = true) {
+    index.clear();
+    if (image.size() < 3 || (uint8_t)image[0] != 0xFF) {
+        error = "not a tokenized HX-20 BASIC program";
+        return false;
+    }
+    const uint8_t* data = (const uint8_t*)image.data();
+    size_t size = std::min<size_t>(image.size(), (data[1] << 8) | data[2]);
+    for (size_t pos = 3; pos + 4 <= size;) {
+        const void* end = memchr(data + pos + 4, 0x00, size - pos - 4);
+        if (!end) {
+            error = "line at offset " + std::to_string(pos) + " has no terminator";
+            return false;
         }
-        outFile << output;
-        outFile.close();
-    } else {
-        std::cout << "Tokenizing...\n";
-        output = tokenizeBasicProgram(inputData);
-        
-        std::ofstream outFile(outputFile, std::ios::binary);
-        if (!outFile) {
-            std::cerr << "Error: Could not open output file: " << outputFile << "\n";
-            return 1;
+        size_t next = (const uint8_t*)end - data + 1;
+        uint16_t number = (uint16_t)((data[pos + 2] << 8) | data[pos + 3]);
+        if (ordered && !index.empty() && number <= index.back().number) {
+            error = "line " + std::to_string(number) + " is out of order";
+            return false;
         }
-        outFile.write(output.c_str(), output.length());
-        outFile.close();
+        index.push_back({number, (uint32_t)pos, (uint32_t)(next - pos)});
+        pos = next;
     }
-    
-    std::cout << "Complete!\n";
-    std::cout << "Input:  " << inputFile << " (" << inputData.length() << " bytes)\n";
-    std::cout << "Output: " << outputFile << " (" << output.length() << " bytes)\n";
-    
-    return 0;
+    return true;
+}
+
+// An edit to one line, or to a range of lines for DELETE. Text is ASCII
+// BASIC without the line number; MERGE takes a whole tokenized image.
+struct LinePatch {
+    enum Kind { INSERT, REPLACE, DELETE, MERGE } kind;
+    uint16_t number = 0;
+    uint16_t last = 0;          // DELETE: end of the range
+    std::string text;           // INSERT/REPLACE: statement text; MERGE: image
+};
+
+struct PatchReport {
+    size_t inserted = 0, replaced = 0, deleted = 0, merged = 0;
+};
+
+// Apply patches to a tokenized image in order. INSERT needs a free line
+// number, REPLACE an existing one; MERGE adds every line of another image,
+// replacing lines with the same number as BASIC's MERGE does. Only the new
+// lines are tokenized; the image is then rebuilt in one linear merge of
+// the old line index with the edits. Untouched lines are copied as they
+// are; new lines get the 00 00 link word tokenizeBasicProgram writes (the
+// HX-20 relinks on load). The size word is updated.
+bool patchTokenizedProgram(std::string& image, const std::vector<LinePatch>& patches,
+                           PatchReport& report, std::string& error) {
+    HX20_TRACE_SPAN("patchTokenizedProgram");
+    std::vector<LineIndexEntry> index;
+    if (!indexTokenizedProgram(image, index, error)) return false;
+
+    // Final state of every touched line: tokenized body, or deleted
+    struct Edit {
+        bool deleted;
+        std::string body;       // tokens without header or terminator
+    };
+    std::map<uint16_t, Edit> edits;
+    auto exists = [&](uint16_t number) {
+        auto edit = edits.find(number);
+        if (edit != edits.end()) return !edit->second.deleted;
+        return std::binary_search(index.begin(), index.end(), LineIndexEntry{number, 0, 0},
+                                  [](const LineIndexEntry& a, const LineIndexEntry& b) {
+                                      return a.number < b.number;
+                                  });
+    };
+    auto checkNumber = [&](uint16_t number) {
+        if (number == 0 || number > MAX_LINE_NUMBER) {
+            error = "line number " + std::to_string(number) + " out of range";
+            return false;
+        }
+        return true;
+    };
+
+    for (const LinePatch& patch : patches) {
+        switch (patch.kind) {
+            case LinePatch::INSERT:
+            case LinePatch::REPLACE: {
+                if (!checkNumber(patch.number)) return false;
+                bool present = exists(patch.number);
+                if (patch.kind == LinePatch::INSERT && present) {
+                    error = "insert: line " + std::to_string(patch.number) + " already exists";
+                    return false;
+                }
+                if (patch.kind == LinePatch::REPLACE && !present) {
+                    error = "replace: line " + std::to_string(patch.number) + " does not exist";
+                    return false;
+                }
+                std::string body = tokenizeBasicLine(std::to_string(patch.number) + " " + patch.text,
+                                                     patch.number);
+                if (body.find('\0') != std::string::npos) {
+                    error = "line " + std::to_string(patch.number) + " contains a NUL byte";
+                    return false;
+                }
+                edits[patch.number] = {false, body};
+                patch.kind == LinePatch::INSERT ? report.inserted++ : report.replaced++;
+                break;
+            }
+            case LinePatch::DELETE: {
+                size_t before = report.deleted;
+                auto first = std::lower_bound(index.begin(), index.end(), patch.number,
+                                              [](const LineIndexEntry& e, uint16_t n) { return e.number < n; });
+                for (auto it = first; it != index.end() && it->number <= patch.last; ++it) {
+                    if (exists(it->number)) report.deleted++;
+                    edits[it->number] = {true, ""};
+                }
+                for (auto it = edits.lower_bound(patch.number);
+                     it != edits.end() && it->first <= patch.last; ++it) {
+                    if (!it->second.deleted) {
+                        it->second.deleted = true;
+                        report.deleted++;
+                    }
+                }
+                if (report.deleted == before) {
+                    error = "delete: no lines in " + std::to_string(patch.number) +
+                            (patch.last != patch.number ? "-" + std::to_string(patch.last) : "");
+                    return false;
+                }
+                break;
+            }
+            case LinePatch::MERGE: {
+                std::vector<LineIndexEntry> other;
+                if (!indexTokenizedProgram(patch.text, other, error, false)) {
+                    error = "merge: " + error;
+                    return false;
+                }
+                for (const LineIndexEntry& line : other) {
+                    edits[line.number] = {false, patch.text.substr(line.offset + 4, line.length - 5)};
+                    report.merged++;
+                }
+                break;
+            }
+        }
+    }
+
+    // One linear merge of the existing lines with the edits
+    std::string out;
+    out.reserve(image.size() + patches.size() * 64);
+    out.append(image, 0, 3);
+    auto appendLine = [&](uint16_t number, const char* body, size_t length) {
+        out += (char)0x00;
+        out += (char)0x00;
+        out += (char)(number >> 8);
+        out += (char)(number & 0xFF);
+        out.append(body, length);
+        out += (char)0x00;
+    };
+
+    auto edit = edits.begin();
+    for (const LineIndexEntry& line : index) {
+        for (; edit != edits.end() && edit->first < line.number; ++edit) {
+            if (!edit->second.deleted) appendLine(edit->first, edit->second.body.data(), edit->second.body.size());
+        }
+        if (edit != edits.end() && edit->first == line.number) {
+            if (!edit->second.deleted) appendLine(edit->first, edit->second.body.data(), edit->second.body.size());
+            ++edit;
+        } else {
+            out.append(image, line.offset, line.length);
+        }
+    }
+    for (; edit != edits.end(); ++edit) {
+        if (!edit->second.deleted) appendLine(edit->first, edit->second.body.data(), edit->second.body.size());
+    }
+
+    if (out.size() > 0xFFFF) {
+        error = "patched program exceeds 65535 bytes";
+        return false;
+    }
+    out[1] = (char)((out.size() >> 8) & 0xFF);  // Big-endian
+    out[2] = (char)(out.size() & 0xFF);
+    image.swap(out);
+    return true;
+}
+
+const uint8_t TOKEN_END = 0x80;
+const uint8_t TOKEN_FOR = 0x81;
+const uint8_t TOKEN_NEXT = 0x82;
+const uint8_t TOKEN_IF = 0x89;
+const uint8_t TOKEN_STOP = 0x8E;
+const uint8_t TOKEN_WHILE = 0xA8;
+const uint8_t TOKEN_WEND = 0xA9;
+const uint8_t TOKEN_NEW = 0xAA;
+
+// Statement-level facts about one line body that decide its successors
+struct LineFlow {
+    bool fallsThrough = true;   // may continue with the next line
+    bool isData = false;
+    int loopOpens = 0;          // FOR and WHILE
+    int loopCloses = 0;         // NEXT and WEND
+};
+
+LineFlow analyzeLineFlow(const uint8_t* data, size_t pos, size_t end) {
+    LineFlow flow;
+    bool conditional = false, stops = false;
+    bool statementStart = true;
+    bool inString = false;
+    while (pos < end) {
+        uint8_t token = data[pos++];
+        if (inString) {
+            inString = token != '"';
+            continue;
+        }
+        if (token == ' ') continue;
+        if (statementStart) {
+            // The first token of a statement: does control stop here? (Not
+            // at STOP: CONT carries on with what follows it.)
+            statementStart = false;
+            size_t next = pos;
+            while (next < end && data[next] == ' ') next++;
+            bool goTo = (token == TOKEN_GO && next < end && data[next] == TOKEN_TO) ||
+                        (token == 'G' && next + 1 < end && data[next] == 'O' && data[next + 1] == TOKEN_TO);
+            if (goTo || token == TOKEN_END || token == TOKEN_RETURN ||
+                token == TOKEN_RESUME || token == TOKEN_RUN || token == TOKEN_NEW) {
+                stops = true;
+            }
+            if (token == TOKEN_DATA) flow.isData = true;
+        }
+        switch (token) {
+            case '"':
+                inString = true;
+                break;
+            case ':':
+                statementStart = true;
+                break;
+            case FUNCTION_ESCAPE:
+                if (pos < end) pos++;
+                break;
+            case TOKEN_REM:
+            case TOKEN_REM_QUOTE:
+                pos = end;
+                break;
+            case TOKEN_DATA: {
+                flow.isData = true;
+                bool quoted = false;
+                while (pos < end && (quoted || data[pos] != ':')) {
+                    if (data[pos] == '"') quoted = !quoted;
+                    pos++;
+                }
+                break;
+            }
+            case TOKEN_IF:
+                conditional = true;
+                break;
+            case TOKEN_FOR:
+            case TOKEN_WHILE:
+                flow.loopOpens++;
+                break;
+            case TOKEN_NEXT:
+            case TOKEN_WEND:
+                flow.loopCloses++;
+                break;
+            default:
+                break;
+        }
+    }
+    // With an IF anywhere on the line, assume any statement may be skipped
+    flow.fallsThrough = conditional || !stops;
+    return flow;
+}
+
+struct DeadCodeReport {
+    size_t lines = 0;
+    std::vector<uint16_t> removed;
+    size_t bytesBefore = 0;
+    size_t bytesAfter = 0;
+    double tapeSecondsSaved = 0;
+    std::string keptAll;        // why nothing could be removed
+};
+
+// Tape time of the data blocks hx20tape writes for an image: 256-byte
+// blocks, the last one zero-padded, each written twice with sync field,
+// preamble, ID, CRC, postamble and a 100-byte gap, then 300 gap bytes per
+// pair. A 0 bit takes 545 us and a 1 bit 1080 us; ID and CRC bytes are
+// counted at the average of the two.
+double estimateDataTapeSeconds(const std::string& image) {
+    const double zero = 545e-6, one = 1080e-6;
+    auto byteTime = [&](uint8_t byte) {
+        int ones = 0;
+        for (int i = 0; i < 8; i++) ones += (byte >> i) & 1;
+        return ones * one + (8 - ones) * zero + one;       // plus the stop bit
+    };
+    const double copyOverhead = 80 * zero + one + byteTime(0xFF) + byteTime(0xAA)    // sync, preamble
+                              + 6 * (4 * (zero + one) + one)                         // ID and CRC
+                              + byteTime(0xAA) + byteTime(0x00)                      // postamble
+                              + 100 * byteTime(0xFF);
+    size_t blocks = (image.size() + 255) / 256;
+    double payload = (blocks * 256 - image.size()) * byteTime(0x00);
+    for (char c : image) payload += byteTime((uint8_t)c);
+    return 2 * (blocks * copyOverhead + payload) + blocks * 300 * byteTime(0xFF);
+}
+
+// Remove the lines of a tokenized image that cannot be reached from its
+// first line. Edges are fall-through (unless the line ends in an
+// unconditional GOTO, END, STOP, RETURN, RESUME, RUN or NEW), every line
+// reference found by forEachLineReference, and, since a loop that is not
+// entered skips to its NEXT or WEND, loop openers to the closers that
+// follow them. DATA lines and the targets of RESTORE and ERL are always
+// kept. A computed GO TO / GO SUB could go anywhere, so then nothing is
+// removed and report.keptAll says why.
+bool eliminateDeadLines(std::string& image, DeadCodeReport& report, std::string& error) {
+    HX20_TRACE_SPAN("eliminateDeadLines");
+    std::vector<LineIndexEntry> index;
+    if (!indexTokenizedProgram(image, index, error)) return false;
+    const uint8_t* data = (const uint8_t*)image.data();
+    report.lines = index.size();
+    report.bytesBefore = image.size();
+    report.bytesAfter = image.size();
+    if (index.empty()) return true;
+
+    std::vector<int32_t> lineAt(65536, -1);
+    for (size_t i = 0; i < index.size(); i++) lineAt[index[i].number] = (int32_t)i;
+
+    std::vector<LineFlow> flows(index.size());
+    std::vector<std::vector<uint32_t>> jumps(index.size());
+    std::vector<char> kept(index.size(), 0);
+    for (size_t i = 0; i < index.size() && report.keptAll.empty(); i++) {
+        size_t body = index[i].offset + 4;
+        size_t end = index[i].offset + index[i].length - 1;
+        flows[i] = analyzeLineFlow(data, body, end);
+        if (flows[i].isData) kept[i] = 1;
+        forEachLineReference(data, body, end, [&](const LineReference& ref) {
+            if (ref.length == 0) {
+                report.keptAll = "computed jump in line " + std::to_string(index[i].number);
+                return;
+            }
+            if (ref.target <= 0 || ref.target > 65535 || lineAt[ref.target] < 0) return;
+            uint32_t target = (uint32_t)lineAt[ref.target];
+            if (ref.kind == LineReference::RESTORE || ref.kind == LineReference::ERL) {
+                kept[target] = 1;
+            } else {
+                jumps[i].push_back(target);
+            }
+        });
+    }
+    if (!report.keptAll.empty()) return true;
+
+    // Depth-first walk from the entry point
+    std::vector<char> reached(index.size(), 0);
+    std::vector<uint32_t> stack = {0};
+    reached[0] = 1;
+    auto visit = [&](size_t line) {
+        if (!reached[line]) {
+            reached[line] = 1;
+            stack.push_back((uint32_t)line);
+        }
+    };
+    while (!stack.empty()) {
+        size_t i = stack.back();
+        stack.pop_back();
+        if (flows[i].fallsThrough && i + 1 < index.size()) visit(i + 1);
+        for (uint32_t target : jumps[i]) visit(target);
+        int depth = flows[i].loopOpens;
+        for (size_t j = i + 1; depth > 0 && j < index.size(); j++) {
+            if (flows[j].loopCloses) visit(j);
+            depth += flows[j].loopOpens - flows[j].loopCloses;
+        }
+    }
+
+    std::string out;
+    out.reserve(image.size());
+    out.append(image, 0, 3);
+    for (size_t i = 0; i < index.size(); i++) {
+        if (reached[i] || kept[i]) {
+            out.append(image, index[i].offset, index[i].length);
+        } else {
+            report.removed.push_back(index[i].number);
+        }
+    }
+    if (report.removed.empty()) return true;
+
+    size_t endOfLines = index.back().offset + index.back().length;
+    size_t newSize = out.size();
+    out.append(image, endOfLines, std::string::npos);
+    out[1] = (char)((newSize >> 8) & 0xFF);  // Big-endian
+    out[2] = (char)(newSize & 0xFF);
+    report.tapeSecondsSaved = estimateDataTapeSeconds(image) - estimateDataTapeSeconds(out);
+    report.bytesAfter = out.size();
+    image.swap(out);
+    return true;
+}
+
+const uint8_t TOKEN_DIM = 0x84;
+const uint8_t TOKEN_LET = 0x86;
+const uint8_t TOKEN_DEFSTR = 0x93;
+const uint8_t TOKEN_DEFINT = 0x94;
+const uint8_t TOKEN_DEFDBL = 0x96;
+const uint8_t TOKEN_ON = 0x98;
+const uint8_t TOKEN_LPRINT = 0x99;
+const uint8_t TOKEN_DEF = 0xA0;
+const uint8_t TOKEN_POKE = 0xA1;
+const uint8_t TOKEN_PRINT = 0xA2;
+const uint8_t TOKEN_RANDOMIZE = 0xA7;
+const uint8_t TOKEN_SOUND = 0xB6;
+const uint8_t TOKEN_LOCATE = 0xBD;
+const uint8_t TOKEN_CLS = 0xBE;
+const uint8_t TOKEN_NOT = 0xDB;
+const uint8_t TOKEN_STEP = 0xDC;
+const uint8_t TOKEN_PLUS = 0xDD;
+const uint8_t TOKEN_MINUS = 0xDE;
+const uint8_t TOKEN_TIMES = 0xDF;
+const uint8_t TOKEN_DIVIDE = 0xE0;
+const uint8_t TOKEN_POWER = 0xE1;
+const uint8_t TOKEN_AND = 0xE2;
+const uint8_t TOKEN_IMP = 0xE6;
+const uint8_t TOKEN_MOD = 0xE7;
+const uint8_t TOKEN_IDIV = 0xE8;
+const uint8_t TOKEN_EQUAL = 0xEA;
+const size_t MAX_LINE_BODY = 255;
+
+// One lexical item of a line body as the optimizer sees it. Remark text and
+// DATA items are single TEXT items, so no pass looks inside them.
+struct BodyItem {
+    enum Kind { TOKEN, FUNCTION, NAME, NUMBER, STRING, TEXT, SPACE, OTHER } kind;
+    std::string text;
+
+    bool is(uint8_t token) const { return kind == TOKEN && (uint8_t)text[0] == token; }
+    bool isChar(char c) const { return kind == OTHER && text[0] == c; }
+};
+
+void lexLineBody(const std::string& body, std::vector<BodyItem>& items) {
+    items.clear();
+    const size_t n = body.size();
+    size_t pos = 0;
+    auto take = [&](BodyItem::Kind kind, size_t end) {
+        items.push_back({kind, body.substr(pos, end - pos)});
+        pos = end;
+    };
+    while (pos < n) {
+        uint8_t c = body[pos];
+        size_t end = pos + 1;
+        if (c == ' ') {
+            while (end < n && body[end] == ' ') end++;
+            take(BodyItem::SPACE, end);
+        } else if (c == '"') {
+            while (end < n && body[end] != '"') end++;
+            take(BodyItem::STRING, std::min(end + 1, n));
+        } else if (c == FUNCTION_ESCAPE) {
+            take(BodyItem::FUNCTION, std::min(pos + 2, n));
+        } else if (c == TOKEN_REM || c == TOKEN_REM_QUOTE || c == TOKEN_DATA) {
+            take(BodyItem::TOKEN, end);
+            end = pos;
+            bool quoted = false;
+            while (end < n && (c != TOKEN_DATA || quoted || body[end] != ':')) {
+                if (body[end] == '"') quoted = !quoted;
+                end++;
+            }
+            if (end > pos) take(BodyItem::TEXT, end);
+        } else if (c >= 0x80) {
+            take(BodyItem::TOKEN, end);
+        } else if (std::isalpha(c)) {
+            while (end < n && std::isalnum((uint8_t)body[end])) end++;
+            if (end < n && strchr("$%!#", body[end])) end++;
+            take(BodyItem::NAME, end);
+        } else if (std::isdigit(c) || c == '.') {
+            while (end < n && (std::isdigit((uint8_t)body[end]) || body[end] == '.')) end++;
+            if (end + 1 < n && strchr("EeDd", body[end])) {
+                size_t e = end + 1;
+                if ((uint8_t)body[e] == TOKEN_PLUS || (uint8_t)body[e] == TOKEN_MINUS) e++;
+                if (e < n && std::isdigit((uint8_t)body[e])) {
+                    while (e < n && std::isdigit((uint8_t)body[e])) e++;
+                    end = e;
+                }
+            }
+            if (end < n && strchr("%!#", body[end])) end++;
+            take(BodyItem::NUMBER, end);
+        } else {
+            take(BodyItem::OTHER, end);
+        }
+    }
+}
+
+std::string joinLineBody(const std::vector<BodyItem>& items) {
+    std::string body;
+    for (const BodyItem& item : items) body += item.text;
+    return body;
+}
+
+// Index of the next non-space item at or after i (items.size() if none)
+size_t nextItem(const std::vector<BodyItem>& items, size_t i) {
+    while (i < items.size() && items[i].kind == BodyItem::SPACE) i++;
+    return i;
+}
+
+// Index of the previous non-space item before i, or -1
+long previousItem(const std::vector<BodyItem>& items, size_t i) {
+    long j = (long)i - 1;
+    while (j >= 0 && items[j].kind == BodyItem::SPACE) j--;
+    return j;
+}
+
+// Statements of a line body as [first, last) item ranges. A statement
+// starts the line, follows ':' or follows a THEN or ELSE that is not
+// followed by a line number.
+void splitStatements(const std::vector<BodyItem>& items, std::vector<std::pair<size_t, size_t>>& statements) {
+    statements.clear();
+    size_t start = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        const BodyItem& item = items[i];
+        bool split = item.isChar(':');
+        if ((item.is(TOKEN_THEN) || item.is(TOKEN_ELSE))) {
+            size_t next = nextItem(items, i + 1);
+            split = next == items.size() || items[next].kind != BodyItem::NUMBER;
+        }
+        if (split) {
+            statements.push_back({start, i});
+            start = i + 1;
+        }
+    }
+    statements.push_back({start, items.size()});
+}
+
+// A plain decimal integer literal (no fraction, exponent or suffix)
+bool integerLiteral(const BodyItem& item, long& value) {
+    if (item.kind != BodyItem::NUMBER || item.text.size() > 6) return false;
+    value = 0;
+    for (char c : item.text) {
+        if (!std::isdigit((uint8_t)c)) return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+struct ProgramLine {
+    uint16_t number;
+    std::string body;
+};
+
+bool splitTokenizedProgram(const std::string& image, std::vector<ProgramLine>& lines, std::string& error) {
+    std::vector<LineIndexEntry> index;
+    if (!indexTokenizedProgram(image, index, error)) return false;
+    lines.clear();
+    for (const LineIndexEntry& entry : index) {
+        lines.push_back({entry.number, image.substr(entry.offset + 4, entry.length - 5)});
+    }
+    return true;
+}
+
+std::string joinTokenizedProgram(const std::vector<ProgramLine>& lines) {
+    std::string image(3, '\0');
+    image[0] = (char)0xFF;
+    for (const ProgramLine& line : lines) {
+        image += '\0';
+        image += '\0';
+        image += (char)(line.number >> 8);
+        image += (char)(line.number & 0xFF);
+        image += line.body;
+        image += '\0';
+    }
+    image[1] = (char)((image.size() >> 8) & 0xFF);  // Big-endian
+    image[2] = (char)(image.size() & 0xFF);
+    return image;
+}
+
+struct OptimizeOptions {
+    bool dropLet = true;
+    bool foldConstants = true;
+    bool hoistDefint = true;
+    bool orderVariables = true;
+    bool joinLines = true;
+    std::vector<std::vector<std::string>> samples;  // INPUT values, one list per run
+    uint64_t maxStatements = 1000000;
+    bool allowUnverified = false;   // write a result the runs could not check
+};
+
+struct OptimizeReport {
+    size_t letsDropped = 0;
+    size_t constantsFolded = 0;
+    std::string defint;                 // letters, e.g. "I,J"
+    std::vector<std::string> ordered;   // variables created first
+    size_t linesJoined = 0;
+    size_t bytesBefore = 0;
+    size_t bytesAfter = 0;
+    std::vector<std::string> notes;     // passes skipped, and why
+
+    size_t runs = 0;
+    bool verified = false;
+    std::string verification;           // why it could not be checked
+    InterpreterCounters before, after;
+};
+
+// Drop LET at the start of statements
+size_t dropLet(std::vector<BodyItem>& items) {
+    std::vector<std::pair<size_t, size_t>> statements;
+    splitStatements(items, statements);
+    size_t dropped = 0;
+    for (auto it = statements.rbegin(); it != statements.rend(); ++it) {
+        size_t first = nextItem(items, it->first);
+        if (first < it->second && items[first].is(TOKEN_LET)) {
+            size_t last = nextItem(items, first + 1);
+            items.erase(items.begin() + first, items.begin() + last);
+            dropped++;
+        }
+    }
+    return dropped;
+}
+
+// Fold <integer> <op> <integer> where neither neighbour binds tighter, e.g.
+// X=A+60*60 -> X=A+3600. Only +, -, * and exact / of values and results
+// within -32768..32767 are folded, so no rounding can differ.
+size_t foldConstants(std::vector<BodyItem>& items) {
+    auto isOperator = [](const BodyItem& item, std::initializer_list<uint8_t> tokens) {
+        if (item.kind != BodyItem::TOKEN) return false;
+        for (uint8_t token : tokens) {
+            if (item.is(token)) return true;
+        }
+        return false;
+    };
+    size_t folded = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < items.size(); i++) {
+            long a, b;
+            if (!integerLiteral(items[i], a)) continue;
+            size_t op = nextItem(items, i + 1);
+            if (op == items.size() || !isOperator(items[op], {TOKEN_PLUS, TOKEN_MINUS, TOKEN_TIMES, TOKEN_DIVIDE})) {
+                continue;
+            }
+            size_t right = nextItem(items, op + 1);
+            if (right == items.size() || !integerLiteral(items[right], b)) continue;
+            bool additive = items[op].is(TOKEN_PLUS) || items[op].is(TOKEN_MINUS);
+
+            // Left context: the start of an expression, or (for * and /) + or -
+            long before = previousItem(items, i);
+            if (before < 0) continue;
+            const BodyItem& left = items[before];
+            bool boundary = left.isChar('(') || left.isChar(',') || left.isChar(';') ||
+                            isOperator(left, {TOKEN_EQUAL, TOKEN_GREATER, TOKEN_LESS, TOKEN_PRINT,
+                                              TOKEN_LPRINT, TOKEN_IF, TOKEN_STEP, TOKEN_NOT}) ||
+                            (left.kind == BodyItem::TOKEN && (uint8_t)left.text[0] >= TOKEN_AND &&
+                             (uint8_t)left.text[0] <= TOKEN_IMP);
+            if (left.is(TOKEN_TO)) {
+                // FOR ... TO, but not GO TO
+                long go = previousItem(items, before);
+                boundary = go < 0 || !(items[go].is(TOKEN_GO) ||
+                                       (items[go].kind == BodyItem::NAME && items[go].text == "GO"));
+            }
+            if (!boundary && !(!additive && isOperator(left, {TOKEN_PLUS, TOKEN_MINUS}))) continue;
+
+            // Right context must not bind tighter
+            size_t after = nextItem(items, right + 1);
+            if (after < items.size() &&
+                (isOperator(items[after], {TOKEN_POWER}) ||
+                 (additive && isOperator(items[after], {TOKEN_TIMES, TOKEN_DIVIDE, TOKEN_MOD, TOKEN_IDIV})) ||
+                 items[after].kind == BodyItem::NAME || items[after].kind == BodyItem::NUMBER)) {
+                continue;
+            }
+
+            long value;
+            switch ((uint8_t)items[op].text[0]) {
+                case TOKEN_PLUS: value = a + b; break;
+                case TOKEN_MINUS: value = a - b; break;
+                case TOKEN_TIMES: value = a * b; break;
+                default:
+                    if (b == 0 || a % b != 0) continue;
+                    value = a / b;
+                    break;
+            }
+            if (a > 32767 || b > 32767 || value < -32768 || value > 32767) continue;
+
+            std::vector<BodyItem> replacement;
+            if (value < 0) replacement.push_back({BodyItem::TOKEN, std::string(1, (char)TOKEN_MINUS)});
+            replacement.push_back({BodyItem::NUMBER, std::to_string(value < 0 ? -value : value)});
+            items.erase(items.begin() + i, items.begin() + right + 1);
+            items.insert(items.begin() + i, replacement.begin(), replacement.end());
+            folded++;
+            changed = true;
+        }
+    }
+    return folded;
+}
+
+// Whether the variable at items[i] can become an integer without changing
+// a result. On the HX-20, + - * of two integers is integer arithmetic and
+// overflows above 32767. So wherever the variable is an operand, the whole
+// run of operators around it must be + and - of products of integer literals
+// and variables whose values `range` knows. Every partial result must stay
+// within -32768..32767. Anything else next to an operator (/, ^, MOD, a
+// function, an array, a bracketed subexpression) rules it out.
+template <typename Range>
+bool integerArithmeticSafe(const std::vector<BodyItem>& items, size_t i, Range range) {
+    auto arithmetic = [](const BodyItem& item) {
+        return item.is(TOKEN_PLUS) || item.is(TOKEN_MINUS) || item.is(TOKEN_TIMES) || item.is(TOKEN_DIVIDE) ||
+               item.is(TOKEN_POWER) || item.is(TOKEN_MOD) || item.is(TOKEN_IDIV);
+    };
+    auto operand = [](const BodyItem& item) { return item.kind == BodyItem::NAME || item.kind == BodyItem::NUMBER; };
+
+    // The run is [start, stop]: operands and operators at one bracket level
+    size_t start = i, stop = i;
+    for (;;) {
+        long op = previousItem(items, start);
+        if (op < 0 || !arithmetic(items[op])) break;
+        long left = previousItem(items, op);
+        if (left >= 0 && operand(items[left])) {
+            start = left;
+        } else if (left >= 0 && (items[left].isChar(')') || items[left].kind == BodyItem::STRING)) {
+            return false;
+        } else {
+            start = op;             // a sign
+            break;
+        }
+    }
+    for (;;) {
+        size_t op = nextItem(items, stop + 1);
+        if (op < items.size() && items[op].isChar('(')) return false;   // an array
+        if (op >= items.size() || !arithmetic(items[op])) break;
+        size_t right = nextItem(items, op + 1);
+        if (right < items.size() && (items[right].is(TOKEN_PLUS) || items[right].is(TOKEN_MINUS))) {
+            right = nextItem(items, right + 1);
+        }
+        if (right >= items.size() || !operand(items[right])) return false;
+        stop = right;
+    }
+    // A bracketed run, as in (I+1)*2, must not feed more arithmetic. The
+    // brackets of an array subscript or a function call are a new start.
+    long before = previousItem(items, start);
+    size_t after = nextItem(items, stop + 1);
+    if (before >= 0 && items[before].isChar('(') && after < items.size() && items[after].isChar(')')) {
+        long outside = previousItem(items, before);
+        size_t next = nextItem(items, after + 1);
+        bool call = outside >= 0 && (items[outside].kind == BodyItem::NAME || items[outside].kind == BodyItem::FUNCTION);
+        if (!call && ((outside >= 0 && arithmetic(items[outside])) || (next < items.size() && arithmetic(items[next])))) {
+            return false;
+        }
+    }
+    if (start == stop) return true;     // not an operand
+
+    // Interval arithmetic, left to right, * before + and -
+    const long LOW = -32768, HIGH = 32767;
+    long sumLow = 0, sumHigh = 0, productLow = 0, productHigh = 0;
+    int sumSign = 1;                // of the term being built
+    bool haveProduct = false, negate = false, expectOperand = true;
+    for (size_t k = start; k <= stop; k = nextItem(items, k + 1)) {
+        const BodyItem& item = items[k];
+        if (item.is(TOKEN_PLUS) || item.is(TOKEN_MINUS)) {
+            if (expectOperand) {
+                negate ^= item.is(TOKEN_MINUS);     // a sign
+                continue;
+            }
+            sumLow += sumSign > 0 ? productLow : -productHigh;
+            sumHigh += sumSign > 0 ? productHigh : -productLow;
+            if (sumLow < LOW || sumHigh > HIGH) return false;
+            sumSign = item.is(TOKEN_PLUS) ? 1 : -1;
+            haveProduct = false;
+            expectOperand = true;
+            continue;
+        }
+        if (item.is(TOKEN_TIMES)) {
+            expectOperand = true;
+            continue;
+        }
+        if (arithmetic(item)) return false;
+        expectOperand = false;
+
+        long low, high;
+        if (item.kind == BodyItem::NUMBER) {
+            if (!integerLiteral(item, low) || low > HIGH) return false;
+            high = low;
+        } else if (!range(item, low, high)) {
+            return false;
+        }
+        if (negate) {
+            long negatedHigh = -low;
+            low = -high;
+            high = negatedHigh;
+            negate = false;
+        }
+        if (haveProduct) {
+            long corners[] = {productLow * low, productLow * high, productHigh * low, productHigh * high};
+            low = *std::min_element(std::begin(corners), std::end(corners));
+            high = *std::max_element(std::begin(corners), std::end(corners));
+        }
+        if (low < LOW || high > HIGH) return false;
+        productLow = low;
+        productHigh = high;
+        haveProduct = true;
+    }
+    sumLow += sumSign > 0 ? productLow : -productHigh;
+    sumHigh += sumSign > 0 ? productHigh : -productLow;
+    return sumLow >= LOW && sumHigh <= HIGH;
+}
+
+// Letters whose untyped variables are only ever given integer constants or
+// counted by FOR loops with integer bounds, so DEFINT cannot change a
+// result. Arrays, explicit % or ! names, other assignments and every
+// statement not known to only read its variables rule a letter out. So does
+// arithmetic that could overflow once it is done in integers: see
+// integerArithmeticSafe.
+std::string defintLetters(const std::vector<ProgramLine>& lines) {
+    enum { UNUSED, INTEGER, OTHER };
+    int letterState[26] = {};
+    long lowest[26], highest[26];       // every value a letter's variables are given
+    std::fill(std::begin(lowest), std::end(lowest), 32767L);
+    std::fill(std::begin(highest), std::end(highest), -32768L);
+    std::vector<BodyItem> items;
+    std::vector<std::pair<size_t, size_t>> statements;
+
+    auto isReadOnly = [](uint8_t token) {
+        static const uint8_t readers[] = {TOKEN_PRINT, TOKEN_LPRINT, TOKEN_IF, TOKEN_ON, TOKEN_GO,
+                                          TOKEN_NEXT, TOKEN_WHILE, TOKEN_WEND, TOKEN_RETURN, TOKEN_END,
+                                          TOKEN_STOP, TOKEN_POKE, TOKEN_RESTORE, TOKEN_CLS, TOKEN_LOCATE,
+                                          TOKEN_SOUND, TOKEN_DIM, TOKEN_RANDOMIZE, TOKEN_REM,
+                                          TOKEN_REM_QUOTE, TOKEN_DATA, TOKEN_ELSE, TOKEN_THEN};
+        return std::find(std::begin(readers), std::end(readers), token) != std::end(readers);
+    };
+    auto letterOf = [](const BodyItem& item) { return std::toupper((uint8_t)item.text[0]) - 'A'; };
+    auto signedLiteral = [&](size_t& i, size_t last, long& value) {
+        i = nextItem(items, i);
+        bool negative = i < last && items[i].is(TOKEN_MINUS);
+        if (negative) i = nextItem(items, i + 1);
+        if (i >= last || !integerLiteral(items[i], value)) return false;
+        if (negative) value = -value;
+        i = nextItem(items, i + 1);
+        return value >= -32768 && value <= 32767;
+    };
+
+    for (const ProgramLine& line : lines) {
+        lexLineBody(line.body, items);
+        splitStatements(items, statements);
+        for (auto [first, last] : statements) {
+            size_t head = nextItem(items, first);
+            if (head >= last) continue;
+
+            // The variable this statement gives an integer constant, if any
+            size_t target = items.size();
+            bool readOnly = false;
+            if (items[head].kind == BodyItem::TOKEN) {
+                readOnly = isReadOnly((uint8_t)items[head].text[0]);
+                if (items[head].is(TOKEN_LET) || items[head].is(TOKEN_FOR)) {
+                    target = nextItem(items, head + 1);
+                }
+            } else if (items[head].kind == BodyItem::NAME) {
+                size_t next = nextItem(items, head + 1);
+                readOnly = items[head].text == "GO" && next < last &&
+                           (items[next].is(TOKEN_TO) || items[next].is(TOKEN_SUB));
+                if (!readOnly) target = head;
+            }
+            bool integerTarget = false;
+            if (target < last && items[target].kind == BodyItem::NAME) {
+                size_t i = nextItem(items, target + 1);
+                long start, limit, step = 1;
+                if (i < last && items[i].is(TOKEN_EQUAL) && signedLiteral(++i, last, start)) {
+                    limit = start;
+                    if (items[head].is(TOKEN_FOR)) {
+                        integerTarget = i < last && items[i].is(TOKEN_TO) && signedLiteral(++i, last, limit) &&
+                                        (i == last || (items[i].is(TOKEN_STEP) && signedLiteral(++i, last, step))) &&
+                                        i == last && step != 0 && limit + step >= -32768 && limit + step <= 32767;
+                        if (integerTarget) limit += step;   // the value the loop ends with
+                    } else {
+                        integerTarget = i == last;
+                    }
+                }
+                if (integerTarget) {
+                    int letter = letterOf(items[target]);
+                    if (letter >= 0 && letter < 26) {
+                        lowest[letter] = std::min({lowest[letter], start, limit});
+                        highest[letter] = std::max({highest[letter], start, limit});
+                    }
+                }
+            }
+
+            for (size_t i = first; i < last; i++) {
+                if (items[i].kind != BodyItem::NAME || items[i].text == "GO") continue;
+                int letter = letterOf(items[i]);
+                if (letter < 0 || letter >= 26) continue;
+                char suffix = items[i].text.back();
+                size_t next = nextItem(items, i + 1);
+                bool isArray = next < last && items[next].isChar('(');
+                if (suffix == '$' || suffix == '#') continue;
+                if (suffix == '%' || suffix == '!' || isArray) {
+                    letterState[letter] = OTHER;
+                } else if (i == target) {
+                    if (!integerTarget) letterState[letter] = OTHER;
+                    else if (letterState[letter] == UNUSED) letterState[letter] = INTEGER;
+                } else if (!readOnly && target == items.size()) {
+                    letterState[letter] = OTHER;
+                }
+            }
+        }
+    }
+
+    for (const ProgramLine& line : lines) {
+        lexLineBody(line.body, items);
+        for (size_t i = 0; i < items.size(); i++) {
+            if (items[i].kind != BodyItem::NAME) continue;
+            int letter = letterOf(items[i]);
+            if (letter < 0 || letter >= 26 || letterState[letter] != INTEGER) continue;
+            if (!integerArithmeticSafe(items, i, [&](const BodyItem& name, long& low, long& high) {
+                    int l = letterOf(name);
+                    char suffix = name.text.back();
+                    if (l < 0 || l >= 26 || letterState[l] != INTEGER || !std::isalnum((uint8_t)suffix)) return false;
+                    low = lowest[l];
+                    high = highest[l];
+                    return true;
+                })) {
+                letterState[letter] = OTHER;
+            }
+        }
+    }
+
+    std::string letters;
+    for (int letter = 0; letter < 26; letter++) {
+        if (letterState[letter] != INTEGER) continue;
+        if (!letters.empty()) letters += ',';
+        letters += (char)('A' + letter);
+    }
+    return letters;
+}
+
+// Rewrite a tokenized image to run faster on the HX-20: drop LET, fold
+// integer constants, DEFINT the letters whose variables only hold integers,
+// create the most looked-up variables first (the ROM searches its variable
+// table linearly, in creation order) and join lines that nothing jumps to.
+// The original and the result are then run side by side in the reference
+// interpreter on the sample inputs; any difference is an error.
+bool optimizeTokenizedProgram(std::string& image, const OptimizeOptions& options, OptimizeReport& report,
+                              std::string& error) {
+    HX20_TRACE_SPAN("optimizeTokenizedProgram");
+    std::vector<ProgramLine> lines;
+    if (!splitTokenizedProgram(image, lines, error)) return false;
+    report.bytesBefore = image.size();
+    if (lines.empty()) {
+        report.bytesAfter = image.size();
+        return true;
+    }
+
+    // Run the original once per sample: the baseline, and variable usage
+    BasicInterpreter original(image);
+    std::vector<InterpreterRun> baseline;
+    for (const auto& inputs : options.samples) {
+        baseline.push_back(original.run(inputs, options.maxStatements));
+        report.before.add(baseline.back().counters);
+    }
+
+    // Everything that names a line, and whether jumps can be computed
+    std::vector<char> referenced(65536, 0);
+    bool computed = false, usesErl = false, declares = false;
+    std::vector<BodyItem> items;
+    for (const ProgramLine& line : lines) {
+        const uint8_t* body = (const uint8_t*)line.body.data();
+        forEachLineReference(body, 0, line.body.size(), [&](const LineReference& ref) {
+            if (ref.length == 0) computed = true;
+            else if (ref.target >= 0 && ref.target <= 65535) referenced[ref.target] = 1;
+            usesErl = usesErl || ref.kind == LineReference::ERL;
+        });
+        lexLineBody(line.body, items);
+        for (const BodyItem& item : items) {
+            if (item.kind != BodyItem::TOKEN) continue;
+            uint8_t token = (uint8_t)item.text[0];
+            usesErl = usesErl || token == TOKEN_ERL;
+            declares = declares || (token >= TOKEN_DEFSTR && token <= TOKEN_DEFDBL) || token == TOKEN_DEF;
+        }
+    }
+
+    for (ProgramLine& line : lines) {
+        if (!options.dropLet && !options.foldConstants) break;
+        lexLineBody(line.body, items);
+        if (options.dropLet) report.letsDropped += dropLet(items);
+        if (options.foldConstants) report.constantsFolded += foldConstants(items);
+        line.body = joinLineBody(items);
+    }
+
+    // Prologue: DEFINT, then the busiest variables in order of use
+    std::vector<std::string> prologue;
+    if (options.hoistDefint) {
+        if (declares) {
+            report.notes.push_back("DEFINT: the program already declares types");
+        } else {
+            report.defint = defintLetters(lines);
+            if (!report.defint.empty()) prologue.push_back(std::string(1, (char)TOKEN_DEFINT) + " " + report.defint);
+        }
+    }
+    if (options.orderVariables && !baseline.empty()) {
+        // Lookups per variable over all runs, in first-run creation order
+        std::vector<std::string> names;
+        std::map<std::string, uint64_t> lookups;
+        bool complete = true;
+        for (const InterpreterRun& run : baseline) {
+            complete = complete && run.outcome != InterpreterRun::UNSUPPORTED;
+            for (const auto& variable : run.variables) {
+                std::string name = variable.name;
+                std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+                if (!lookups.count(name)) names.push_back(name);
+                lookups[name] += variable.lookups;
+            }
+        }
+        std::vector<std::string> busiest = names;
+        std::stable_sort(busiest.begin(), busiest.end(),
+                         [&](const std::string& a, const std::string& b) { return lookups[a] > lookups[b]; });
+        busiest.resize(std::min<size_t>(busiest.size(), 8));
+
+        // Probes saved: each lookup of a variable costs its position
+        std::vector<std::string> order = busiest;
+        for (const std::string& name : names) {
+            if (std::find(busiest.begin(), busiest.end(), name) == busiest.end()) order.push_back(name);
+        }
+        int64_t saved = 0;
+        for (size_t i = 0; i < names.size(); i++) {
+            size_t moved = std::find(order.begin(), order.end(), names[i]) - order.begin();
+            saved += (int64_t)lookups[names[i]] * ((int64_t)i - (int64_t)moved);
+        }
+        if (!complete) {
+            report.notes.push_back("variable order: the sample runs did not complete");
+        } else if (saved > 0) {
+            for (const std::string& name : busiest) {
+                prologue.push_back(name + (char)TOKEN_EQUAL + (name.back() == '$' ? "\"\"" : "0"));
+            }
+            report.ordered = busiest;
+        }
+    }
+    if (!prologue.empty()) {
+        std::string body;
+        for (const std::string& statement : prologue) body += (body.empty() ? "" : ":") + statement;
+        if (lines[0].number > 1) {
+            lines.insert(lines.begin(), {(uint16_t)(lines[0].number - 1), body});
+        } else if (!referenced[lines[0].number] && !computed && body.size() + 1 + lines[0].body.size() <= MAX_LINE_BODY) {
+            lines[0].body = body + ":" + lines[0].body;
+        } else {
+            report.notes.push_back("prologue: line 1 is a jump target and there is no free line before it");
+            report.defint.clear();
+            report.ordered.clear();
+        }
+    }
+
+    // Join each line that nothing refers to onto the one before it
+    if (options.joinLines) {
+        if (computed || usesErl) {
+            report.notes.push_back(computed ? "join: the program has a computed jump"
+                                            : "join: the program uses ERL");
+        } else {
+            std::vector<ProgramLine> joined;
+            for (ProgramLine& line : lines) {
+                bool canJoin = !joined.empty() && !referenced[line.number] &&
+                               joined.back().body.size() + 1 + line.body.size() <= MAX_LINE_BODY;
+                if (canJoin) {
+                    // Not after IF (it would become conditional), a remark,
+                    // DATA or a string left open at the end of the line
+                    lexLineBody(joined.back().body, items);
+                    for (const BodyItem& item : items) {
+                        if (item.is(TOKEN_IF) || item.is(TOKEN_REM) || item.is(TOKEN_REM_QUOTE) ||
+                            item.is(TOKEN_DATA) ||
+                            (item.kind == BodyItem::STRING && (item.text.size() < 2 || item.text.back() != '"'))) {
+                            canJoin = false;
+                        }
+                    }
+                }
+                if (canJoin) {
+                    joined.back().body += ":" + line.body;
+                    report.linesJoined++;
+                } else {
+                    joined.push_back(std::move(line));
+                }
+            }
+            lines.swap(joined);
+        }
+    }
+
+    std::string optimized = joinTokenizedProgram(lines);
+    if (optimized.size() > 0xFFFF) {
+        error = "optimized program exceeds 65535 bytes";
+        return false;
+    }
+
+    // Check the result against the baseline
+    BasicInterpreter candidate(optimized);
+    report.verified = !options.samples.empty();
+    for (size_t s = 0; s < options.samples.size(); s++) {
+        InterpreterRun run = candidate.run(options.samples[s], options.maxStatements);
+        report.after.add(run.counters);
+        report.runs++;
+        const InterpreterRun& base = baseline[s];
+        std::string sample = "sample " + std::to_string(s + 1);
+        if (base.outcome == InterpreterRun::UNSUPPORTED || run.outcome == InterpreterRun::UNSUPPORTED) {
+            const InterpreterRun& stop = base.outcome == InterpreterRun::UNSUPPORTED ? base : run;
+            initReverseMaps();
+            const auto& names = stop.detail == "function" ? functionTokens : commandTokens;
+            auto name = names.find(stop.token);
+            report.verified = false;
+            if (report.verification.empty()) {
+                report.verification = sample + " reaches" +
+                                      (name != names.end() ? name->second : " token " + std::to_string(stop.token) + " ") +
+                                      "in line " + std::to_string(stop.line) + ", which the reference interpreter does not run";
+            }
+            continue;
+        }
+        bool limited = base.outcome == InterpreterRun::STEP_LIMIT || run.outcome == InterpreterRun::STEP_LIMIT;
+        const std::string& shorter = base.output.size() < run.output.size() ? base.output : run.output;
+        bool same = limited ? base.output.compare(0, shorter.size(), shorter) == 0 &&
+                                  run.output.compare(0, shorter.size(), shorter) == 0
+                            : base.outcome == run.outcome && base.detail == run.detail && base.output == run.output;
+        if (same && !limited) {
+            // Same final variables, by name: DEFINT changes the numeric
+            // type, and the prologue only adds zeroes
+            auto untyped = [](const std::string& key) {
+                return key.back() == '$' ? key : key.substr(0, key.size() - 1);
+            };
+            std::map<std::string, BasicValue> values;
+            for (const auto& variable : run.variables) values[untyped(variable.key)] = variable.value;
+            for (const auto& variable : base.variables) {
+                auto it = values.find(untyped(variable.key));
+                BasicValue fresh;
+                fresh.isString = variable.value.isString;
+                same = same && variable.value == (it == values.end() ? fresh : it->second);
+            }
+        }
+        if (!same) {
+            error = "optimized program behaves differently on " + sample;
+            if (base.output != run.output) error += " (output differs)";
+            else if (base.outcome != run.outcome || base.detail != run.detail) {
+                error += " (original: " + (base.detail.empty() ? "ended" : base.detail) + ", optimized: " +
+                         (run.detail.empty() ? "ended" : run.detail) + ")";
+            } else {
+                error += " (final variables differ)";
+            }
+            return false;
+        }
+    }
+
+    report.bytesAfter = optimized.size();
+    image.swap(optimized);
+    return true;
+}
+
+// Pre-flight syntax check. Every line is tokenized the way it will be saved
+// and then parsed statement by statement, so a typo shows up before the
+// tape is recorded rather than after a four-minute load. Each command in
+// basicCommands has a statement form below, or none for keywords that only
+// appear inside a statement, and each function in basicFunctions has an
+// argument count. A statement with an error is skipped up to the next ':'
+// so the rest of the line is still checked.
+enum StatementForm {
+    NOT_A_STATEMENT,
+    NO_ARGUMENTS,
+    ARGUMENTS,              // expressions separated by ',', any of them empty
+    FREE_FORM,              // devices, files and graphics: balanced parentheses
+    REMARK,                 // REM, ' and DATA
+    ASSIGNMENT, PRINT_LIST, INPUT_LIST, VARIABLES, SWAP_PAIR, FOR_LOOP, NEXT_LIST,
+    GO_LINE, IF_THEN, ON_GOTO, DEF_FN, DEF_TYPE, OPTIONAL_LINE, RESUME_LINE,
+    RUN_TARGET, EXPRESSION, OPTIONAL_EXPRESSION, OPTION_BASE, LINE_INPUT
+};
+
+struct StatementSyntax {
+    StatementForm form = NOT_A_STATEMENT;
+    int minArguments = 0;   // ARGUMENTS only
+    int maxArguments = 0;
+};
+
+// Statements by keyword; a keyword of basicCommands missing here cannot
+// start a statement
+const std::map<std::string, StatementSyntax> statementSyntax = {
+    {"END", {NO_ARGUMENTS}}, {"FOR", {FOR_LOOP}}, {"NEXT", {NEXT_LIST}}, {"DATA", {REMARK}},
+    {"DIM", {VARIABLES}}, {"READ", {VARIABLES}}, {"LET", {ASSIGNMENT}}, {"GO", {GO_LINE}},
+    {"RUN", {RUN_TARGET}}, {"IF", {IF_THEN}}, {"RESTORE", {OPTIONAL_LINE}}, {"RETURN", {OPTIONAL_LINE}},
+    {"REM", {REMARK}}, {"'", {REMARK}}, {"STOP", {NO_ARGUMENTS}}, {"TRON", {NO_ARGUMENTS}},
+    {"TROFF", {NO_ARGUMENTS}}, {"SWAP", {SWAP_PAIR}}, {"DEFSTR", {DEF_TYPE}}, {"DEFINT", {DEF_TYPE}},
+    {"DEFSNG", {DEF_TYPE}}, {"DEFDBL", {DEF_TYPE}}, {"DEFFIL", {FREE_FORM}}, {"ON", {ON_GOTO}},
+    {"LPRINT", {PRINT_LIST}}, {"LLIST", {FREE_FORM}}, {"RENUM", {FREE_FORM}}, {"ERROR", {EXPRESSION}},
+    {"RESUME", {RESUME_LINE}}, {"AUTO", {FREE_FORM}}, {"DELETE", {FREE_FORM}}, {"DEF", {DEF_FN}},
+    {"POKE", {ARGUMENTS, 2, 2}}, {"PRINT", {PRINT_LIST}}, {"CONT", {NO_ARGUMENTS}}, {"LIST", {FREE_FORM}},
+    {"CLEAR", {ARGUMENTS, 0, 2}}, {"OPTION", {OPTION_BASE}}, {"RANDOMIZE", {OPTIONAL_EXPRESSION}},
+    {"WHILE", {EXPRESSION}}, {"WEND", {NO_ARGUMENTS}}, {"NEW", {NO_ARGUMENTS}}, {"ERASE", {VARIABLES}},
+    {"LOADM", {FREE_FORM}}, {"LOAD?", {FREE_FORM}}, {"SAVEM", {FREE_FORM}}, {"SAVE", {FREE_FORM}},
+    {"LOAD", {FREE_FORM}}, {"MERGE", {FREE_FORM}}, {"OPEN", {FREE_FORM}}, {"CLOSE", {FREE_FORM}},
+    {"LINE", {LINE_INPUT}}, {"SCROLL", {FREE_FORM}}, {"SOUND", {ARGUMENTS, 2, 2}}, {"MON", {NO_ARGUMENTS}},
+    {"FILES", {FREE_FORM}}, {"MOTOR", {FREE_FORM}}, {"PUT", {FREE_FORM}}, {"GET", {FREE_FORM}},
+    {"LOCATES", {FREE_FORM}}, {"LOCATE", {ARGUMENTS, 2, 3}}, {"CLS", {NO_ARGUMENTS}}, {"KEY", {FREE_FORM}},
+    {"WIDTH", {FREE_FORM}}, {"PSET", {FREE_FORM}}, {"PRESET", {FREE_FORM}}, {"COPY", {FREE_FORM}},
+    {"EXEC", {FREE_FORM}}, {"WIND", {FREE_FORM}}, {"GCLS", {NO_ARGUMENTS}}, {"SCREEN", {FREE_FORM}},
+    {"COLOR", {FREE_FORM}}, {"LOGIN", {FREE_FORM}}, {"TITLE", {FREE_FORM}}, {"STAT", {FREE_FORM}},
+    {"PCOPY", {FREE_FORM}}, {"MEMSET", {FREE_FORM}}
+};
+
+// Argument counts by function; a function whose minimum is 0 and maximum
+// is not takes an optional argument list, one with a maximum of 0 none
+const std::map<std::string, std::pair<int, int>> functionArity = {
+    {"SGN", {1, 1}}, {"INT", {1, 1}}, {"ABS", {1, 1}}, {"FRE", {1, 1}},
+    {"POS", {1, 1}}, {"SQR", {1, 1}}, {"LOG", {1, 1}}, {"EXP", {1, 1}},
+    {"COS", {1, 1}}, {"SIN", {1, 1}}, {"TAN", {1, 1}}, {"ATN", {1, 1}},
+    {"PEEK", {1, 1}}, {"LEN", {1, 1}}, {"STR$", {1, 1}}, {"VAL", {1, 1}},
+    {"ASC", {1, 1}}, {"CHR$", {1, 1}}, {"EOF", {1, 1}}, {"LOF", {1, 1}},
+    {"CINT", {1, 1}}, {"CSNG", {1, 1}}, {"CDBL", {1, 1}}, {"FIX", {1, 1}},
+    {"SPACE$", {1, 1}}, {"HEX$", {1, 1}}, {"OCT$", {1, 1}}, {"LEFT$", {2, 2}},
+    {"RIGHT$", {2, 2}}, {"MID$", {2, 3}}, {"INSTR", {2, 3}}, {"VARPTR", {1, 1}},
+    {"STRING$", {2, 2}}, {"RND", {0, 1}}, {"TIME", {0, 0}}, {"DATE", {0, 0}},
+    {"DAY", {0, 0}}, {"INKEY$", {0, 0}}, {"INPUT", {1, 2}}, {"CSRLIN", {0, 0}},
+    {"POINT", {2, 2}}, {"TAPCNT", {0, 0}}
+};
+
+const uint8_t TOKEN_FN = 0xD2;
+const uint8_t TOKEN_USING = 0xD4;
+const uint8_t TOKEN_USR = 0xD5;
+const uint8_t TOKEN_ERR = 0xD7;
+const uint8_t TOKEN_TAB = 0xCF;
+const uint8_t TOKEN_SPC = 0xD3;
+const uint8_t TOKEN_ERROR = 0x9C;
+const uint8_t TOKEN_BASE = 0xCE;
+const uint8_t FUNCTION_MID = 0x9D;
+const uint8_t FUNCTION_TIME = 0xA2;
+const uint8_t FUNCTION_DATE = 0xA3;
+const uint8_t FUNCTION_DAY = 0xA4;
+const uint8_t FUNCTION_INPUT = 0xA6;
+
+struct SyntaxIssue {
+    int line;               // BASIC line number, -1 for a source line without one
+    bool fatal;
+    std::string message;
+};
+
+struct SyntaxReport {
+    size_t lines = 0;
+    size_t statements = 0;
+    std::vector<SyntaxIssue> issues;
+
+    bool ok() const {
+        for (const SyntaxIssue& issue : issues) {
+            if (issue.fatal) return false;
+        }
+        return true;
+    }
+};
+
+// One line as the checker sees it; sourceLength is 0 for tokenized input
+struct CheckedLine {
+    long number;
+    std::string body;
+    size_t sourceLength;
+};
+
+// Recursive-descent parser over the lexed items of one tokenized line
+class LineParser {
+    struct Tables {
+        StatementSyntax statements[256];
+        std::pair<int, int> arity[256];
+        bool knownFunction[256] = {};
+
+        Tables() {
+            for (const auto& pair : basicCommands) {
+                auto syntax = statementSyntax.find(pair.first);
+                statements[pair.second] = syntax == statementSyntax.end() ? StatementSyntax{NOT_A_STATEMENT}
+                                                                          : syntax->second;
+            }
+            for (const auto& pair : basicFunctions) {
+                arity[pair.second] = functionArity.at(pair.first);
+                knownFunction[pair.second] = true;
+            }
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+
+    std::vector<BodyItem> items;
+    size_t pos = 0;
+    bool ifOpen = false;
+    std::string error;
+
+    const BodyItem* peek() {
+        pos = nextItem(items, pos);
+        return pos < items.size() ? &items[pos] : nullptr;
+    }
+    void advance() { pos = nextItem(items, pos) + 1; }
+    bool peekChar(char c) {
+        const BodyItem* item = peek();
+        return item && item->isChar(c);
+    }
+    bool peekToken(uint8_t token) {
+        const BodyItem* item = peek();
+        return item && item->is(token);
+    }
+    bool atStatementEnd() {
+        const BodyItem* item = peek();
+        return !item || item->isChar(':') || item->is(TOKEN_ELSE) || item->is(TOKEN_REM_QUOTE);
+    }
+
+    static std::string name(const BodyItem& item) {
+        initReverseMaps();
+        const auto& names = item.kind == BodyItem::FUNCTION ? functionTokens : commandTokens;
+        uint8_t token = item.kind == BodyItem::FUNCTION ? (item.text.size() > 1 ? item.text[1] : 0) : item.text[0];
+        auto it = names.find(token);
+        if (it == names.end()) return "token " + std::to_string(token);
+        return it->second.substr(1, it->second.size() - 2);
+    }
+    std::string found() {
+        const BodyItem* item = peek();
+        if (!item) return "end of line";
+        if (item->kind == BodyItem::TOKEN || item->kind == BodyItem::FUNCTION) return "'" + name(*item) + "'";
+        return "'" + item->text + "'";
+    }
+    bool fail(const std::string& expected) {
+        if (error.empty()) error = "expected " + expected + ", found " + found();
+        return false;
+    }
+    bool failWith(const std::string& message) {
+        if (error.empty()) error = message;
+        return false;
+    }
+    bool expectChar(char c) {
+        if (!peekChar(c)) return fail(std::string("'") + c + "'");
+        advance();
+        return true;
+    }
+    bool expectToken(uint8_t token, const char* what) {
+        if (!peekToken(token)) return fail(what);
+        advance();
+        return true;
+    }
+    bool lineNumber() {
+        const BodyItem* item = peek();
+        long value;
+        if (!item || !integerLiteral(*item, value)) return fail("a line number");
+        advance();
+        return true;
+    }
+    // GO TO / GO SUB, or the letters GO the tokenizer leaves before TO/SUB
+    bool goKeyword() {
+        const BodyItem* item = peek();
+        if (!item) return false;
+        if (item->is(TOKEN_GO)) return true;
+        if (item->kind != BodyItem::NAME || item->text.size() != 2 || toupper(item->text[0]) != 'G' ||
+            toupper(item->text[1]) != 'O') {
+            return false;
+        }
+        size_t next = nextItem(items, pos + 1);
+        return next < items.size() && (items[next].is(TOKEN_TO) || items[next].is(TOKEN_SUB));
+    }
+    bool goLine(bool allowSub) {
+        advance();
+        if (peekToken(TOKEN_TO) || (allowSub && peekToken(TOKEN_SUB))) {
+            advance();
+        } else {
+            return fail(allowSub ? "TO or SUB after GO" : "TO after GO");
+        }
+        return lineNumber();
+    }
+
+    // Expressions: only the shape is checked, not precedence or types
+    bool binaryOperator() {
+        const BodyItem* item = peek();
+        if (!item || item->kind != BodyItem::TOKEN) return false;
+        uint8_t token = item->text[0];
+        if (token < TOKEN_PLUS || token > TOKEN_LESS) return false;
+        advance();
+        // <>, <=, >= and the like are two tokens
+        if (token >= TOKEN_GREATER) {
+            const BodyItem* second = peek();
+            if (second && second->kind == BodyItem::TOKEN && (uint8_t)second->text[0] >= TOKEN_GREATER &&
+                (uint8_t)second->text[0] <= TOKEN_LESS) {
+                advance();
+            }
+        }
+        return true;
+    }
+    bool expression() {
+        if (!operand()) return false;
+        while (binaryOperator()) {
+            if (!operand()) return false;
+        }
+        return true;
+    }
+    // '(' expression {',' expression} ')', returning the count; '#' may
+    // prefix an argument (file numbers)
+    bool argumentList(int& count) {
+        count = 0;
+        if (!expectChar('(')) return false;
+        if (peekChar(')')) {
+            advance();
+            return true;
+        }
+        for (;;) {
+            if (peekChar('#')) advance();
+            if (!expression()) return false;
+            count++;
+            if (!peekChar(',')) break;
+            advance();
+        }
+        return expectChar(')');
+    }
+    bool operand() {
+        const BodyItem* item = peek();
+        if (!item) return fail("an expression");
+        switch (item->kind) {
+            case BodyItem::NUMBER:
+            case BodyItem::STRING:
+                advance();
+                return true;
+            case BodyItem::NAME:
+                return variable();
+            case BodyItem::FUNCTION:
+                return function();
+            case BodyItem::TOKEN: {
+                uint8_t token = item->text[0];
+                int count;
+                if (token == TOKEN_PLUS || token == TOKEN_MINUS || token == TOKEN_NOT) {
+                    advance();
+                    return operand();
+                }
+                if (token == TOKEN_ERL || token == TOKEN_ERR) {
+                    advance();
+                    return true;
+                }
+                if (token == TOKEN_FN) {
+                    advance();
+                    if (!peek() || peek()->kind != BodyItem::NAME) return fail("a function name after FN");
+                    advance();
+                    return !peekChar('(') || argumentList(count);
+                }
+                if (token == TOKEN_USR) {
+                    advance();
+                    if (peek() && peek()->kind == BodyItem::NUMBER) advance();
+                    if (!argumentList(count)) return false;
+                    return count == 1 || failWith("USR takes 1 argument, found " + std::to_string(count));
+                }
+                if (token == TOKEN_TAB || token == TOKEN_SPC) {
+                    std::string keyword = name(*item);
+                    advance();
+                    if (!argumentList(count)) return false;
+                    return count == 1 || failWith(keyword + " takes 1 argument, found " + std::to_string(count));
+                }
+                return fail("an expression");
+            }
+            case BodyItem::OTHER:
+                if (item->isChar('(')) {
+                    advance();
+                    if (!expression()) return false;
+                    return expectChar(')');
+                }
+                if (item->isChar('&')) {
+                    // &H and &O constants lex as '&' and a name or number
+                    advance();
+                    if (!peek() || (peek()->kind != BodyItem::NAME && peek()->kind != BodyItem::NUMBER)) {
+                        return fail("a hexadecimal or octal constant after '&'");
+                    }
+                    advance();
+                    return true;
+                }
+                return fail("an expression");
+            default:
+                return fail("an expression");
+        }
+    }
+    bool function() {
+        const BodyItem& item = *peek();
+        uint8_t token = item.text.size() > 1 ? item.text[1] : 0;
+        std::string keyword = name(item);
+        advance();
+        if (!tables().knownFunction[token]) return failWith("unknown function token " + std::to_string(token));
+        // TIME$, DATE$ and INPUT$ lex as the function and a '$'
+        bool dollar = peekChar('$');
+        if (dollar && (token == FUNCTION_TIME || token == FUNCTION_DATE || token == FUNCTION_INPUT)) {
+            advance();
+            keyword += "$";
+        } else if (token == FUNCTION_INPUT) {
+            return failWith("INPUT cannot be used in an expression");
+        }
+        std::pair<int, int> arity = tables().arity[token];
+        int count = 0;
+        if (peekChar('(')) {
+            if (arity.second == 0) return failWith(keyword + " takes no arguments");
+            if (!argumentList(count)) return false;
+        } else if (arity.first > 0) {
+            return fail("'(' after " + keyword);
+        }
+        if (count < arity.first || count > arity.second) {
+            std::string expected = std::to_string(arity.first);
+            if (arity.second != arity.first) expected += " or " + std::to_string(arity.second);
+            return failWith(keyword + " takes " + expected + " argument" + (arity.second == 1 ? "" : "s") +
+                            ", found " + std::to_string(count));
+        }
+        return true;
+    }
+    bool variable() {
+        const BodyItem* item = peek();
+        if (!item || item->kind != BodyItem::NAME) return fail("a variable");
+        advance();
+        int count;
+        return !peekChar('(') || argumentList(count);
+    }
+    bool variableList() {
+        for (;;) {
+            if (!variable()) return false;
+            if (!peekChar(',')) return true;
+            advance();
+        }
+    }
+
+    // Statements
+    bool assignment() {
+        const BodyItem* item = peek();
+        if (item && item->kind == BodyItem::FUNCTION) {
+            uint8_t token = item->text.size() > 1 ? item->text[1] : 0;
+            if (token != FUNCTION_MID && token != FUNCTION_TIME && token != FUNCTION_DATE && token != FUNCTION_DAY) {
+                return failWith(name(*item) + " cannot be assigned to");
+            }
+            if (!function()) return false;
+        } else if (!variable()) {
+            return false;
+        }
+        return expectToken(TOKEN_EQUAL, "'='") && expression();
+    }
+    bool printList() {
+        if (peekChar('#')) {
+            advance();
+            if (!expression() || !expectChar(',')) return false;
+        }
+        if (peekToken(TOKEN_USING)) {
+            advance();
+            if (!expression()) return false;
+            if (!peekChar(';') && !peekChar(',')) return fail("';' after the USING format");
+        }
+        while (!atStatementEnd()) {
+            if (peekChar(';') || peekChar(',')) {
+                advance();
+            } else if (!expression()) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool inputList() {
+        if (peekChar('#')) {
+            advance();
+            if (!expression() || !expectChar(',')) return false;
+        }
+        const BodyItem* item = peek();
+        if (item && item->kind == BodyItem::STRING) {
+            advance();
+            if (!peekChar(';') && !peekChar(',')) return fail("';' or ',' after the prompt");
+            advance();
+        }
+        return variableList();
+    }
+    bool arguments(const StatementSyntax& syntax, const std::string& keyword) {
+        int count = 0;
+        while (!atStatementEnd()) {
+            if (!peekChar(',') && !expression()) return false;
+            count++;
+            if (!peekChar(',')) break;
+            advance();
+            if (atStatementEnd()) count++;
+        }
+        if (count < syntax.minArguments || count > syntax.maxArguments) {
+            std::string expected = std::to_string(syntax.minArguments);
+            if (syntax.maxArguments != syntax.minArguments) expected += " to " + std::to_string(syntax.maxArguments);
+            return failWith(keyword + " takes " + expected + " argument" + (syntax.maxArguments == 1 ? "" : "s") +
+                            ", found " + std::to_string(count));
+        }
+        return true;
+    }
+    bool freeForm() {
+        int depth = 0;
+        while (!atStatementEnd()) {
+            if (peekChar('(')) depth++;
+            if (peekChar(')') && --depth < 0) return failWith("')' without '('");
+            advance();
+        }
+        return depth == 0 || fail("')'");
+    }
+    bool letterRanges() {
+        for (;;) {
+            const BodyItem* item = peek();
+            if (!item || item->kind != BodyItem::NAME || item->text.size() != 1) return fail("a letter");
+            advance();
+            if (peekToken(TOKEN_MINUS)) {
+                advance();
+                item = peek();
+                if (!item || item->kind != BodyItem::NAME || item->text.size() != 1) return fail("a letter");
+                advance();
+            }
+            if (!peekChar(',')) return true;
+            advance();
+        }
+    }
+    // The branch after THEN or ELSE: a line number or statements
+    bool branch() {
+        const BodyItem* item = peek();
+        long value;
+        if (item && integerLiteral(*item, value)) {
+            advance();
+            return true;
+        }
+        return statement();
+    }
+
+    bool statement() {
+        const BodyItem* item = peek();
+        if (!item || item->isChar(':')) return true;
+        if (item->kind == BodyItem::NAME) {
+            if (goKeyword()) return goLine(true);
+            return assignment();
+        }
+        if (item->kind == BodyItem::FUNCTION) {
+            uint8_t token = item->text.size() > 1 ? item->text[1] : 0;
+            if (token == FUNCTION_INPUT) {
+                advance();
+                return inputList();
+            }
+            return assignment();
+        }
+        if (item->kind != BodyItem::TOKEN) return fail("a statement");
+
+        const StatementSyntax& syntax = tables().statements[(uint8_t)item->text[0]];
+        std::string keyword = name(*item);
+        if (syntax.form == NOT_A_STATEMENT) return failWith(keyword + " cannot start a statement");
+        if (syntax.form == GO_LINE) return goLine(true);
+        advance();
+        switch (syntax.form) {
+            case NO_ARGUMENTS:
+                return atStatementEnd() || fail("end of statement after " + keyword);
+            case ARGUMENTS:
+                return arguments(syntax, keyword);
+            case FREE_FORM:
+                return freeForm();
+            case REMARK:
+                if (peek() && peek()->kind == BodyItem::TEXT) advance();
+                return true;
+            case ASSIGNMENT:
+                return assignment();
+            case PRINT_LIST:
+                return printList();
+            case INPUT_LIST:
+                return inputList();
+            case VARIABLES:
+                return variableList();
+            case SWAP_PAIR:
+                return variable() && expectChar(',') && variable();
+            case FOR_LOOP:
+                if (!peek() || peek()->kind != BodyItem::NAME) return fail("a loop variable");
+                advance();
+                if (!expectToken(TOKEN_EQUAL, "'='") || !expression()) return false;
+                if (!expectToken(TOKEN_TO, "TO") || !expression()) return false;
+                if (peekToken(TOKEN_STEP)) {
+                    advance();
+                    return expression();
+                }
+                return true;
+            case NEXT_LIST:
+                return atStatementEnd() || variableList();
+            case IF_THEN:
+                ifOpen = true;
+                if (!expression()) return false;
+                if (goKeyword()) return goLine(false);
+                if (!expectToken(TOKEN_THEN, "THEN or GOTO")) return false;
+                return branch();
+            case ON_GOTO:
+                if (peekToken(TOKEN_ERROR)) {
+                    advance();
+                    if (!goKeyword()) return fail("GOTO after ON ERROR");
+                    return goLine(false);
+                }
+                if (!expression()) return false;
+                if (!goKeyword()) return fail("GOTO or GOSUB after ON");
+                if (!goLine(true)) return false;
+                while (peekChar(',')) {
+                    advance();
+                    if (!lineNumber()) return false;
+                }
+                return true;
+            case DEF_FN:
+                if (peekToken(TOKEN_USR)) {
+                    advance();
+                    if (peek() && peek()->kind == BodyItem::NUMBER) advance();
+                } else {
+                    if (!expectToken(TOKEN_FN, "FN or USR after DEF")) return false;
+                    if (!peek() || peek()->kind != BodyItem::NAME) return fail("a function name after FN");
+                    advance();
+                    if (peekChar('(')) {
+                        advance();
+                        if (!variableList() || !expectChar(')')) return false;
+                    }
+                }
+                return expectToken(TOKEN_EQUAL, "'='") && expression();
+            case DEF_TYPE:
+                return letterRanges();
+            case OPTIONAL_LINE:
+                return atStatementEnd() || lineNumber();
+            case RESUME_LINE:
+                if (peekToken(TOKEN_NEXT)) {
+                    advance();
+                    return true;
+                }
+                return atStatementEnd() || lineNumber();
+            case RUN_TARGET:
+                return atStatementEnd() || expression();
+            case EXPRESSION:
+                return expression();
+            case OPTIONAL_EXPRESSION:
+                return atStatementEnd() || expression();
+            case OPTION_BASE:
+                return expectToken(TOKEN_BASE, "BASE after OPTION") && lineNumber();
+            case LINE_INPUT:
+                if (peek() && peek()->kind == BodyItem::FUNCTION && (uint8_t)peek()->text[1] == FUNCTION_INPUT) {
+                    advance();
+                    return inputList();
+                }
+                return freeForm();
+            default:
+                return failWith(keyword + " cannot start a statement");
+        }
+    }
+
+public:
+    // Parse one line body, adding an issue per bad statement
+    void check(const std::string& body, long line, SyntaxReport& report) {
+        lexLineBody(body, items);
+        pos = 0;
+        ifOpen = false;
+        for (const BodyItem& item : items) {
+            if (item.kind == BodyItem::STRING && (item.text.size() < 2 || item.text.back() != '"')) {
+                report.issues.push_back({(int)line, false, "string not closed before the end of the line"});
+            }
+        }
+
+        bool branchNext = false;
+        for (;;) {
+            error.clear();
+            report.statements++;
+            bool good = branchNext ? branch() : statement();
+            if (good && !atStatementEnd()) good = fail("end of statement");
+            if (!good) {
+                report.issues.push_back({(int)line, true, error});
+                while (peek() && !peek()->isChar(':')) advance();
+            }
+            branchNext = false;
+            const BodyItem* item = peek();
+            if (!item) break;
+            if (item->is(TOKEN_ELSE)) {
+                if (!ifOpen) report.issues.push_back({(int)line, true, "ELSE without IF"});
+                branchNext = true;
+            } else if (item->is(TOKEN_REM_QUOTE)) {
+                continue;
+            }
+            advance();
+        }
+    }
+};
+
+// Whether the GOTO target at offset follows ON ERROR GO TO, where 0 turns
+// error trapping off rather than naming a line
+static bool afterOnErrorGoto(const std::string& body, size_t offset) {
+    size_t pos = offset;
+    auto skipBack = [&](uint8_t byte) {
+        while (pos > 0 && body[pos - 1] == ' ') pos--;
+        if (pos == 0 || (uint8_t)body[pos - 1] != byte) return false;
+        pos--;
+        return true;
+    };
+    if (!skipBack(TOKEN_TO)) return false;
+    if (!skipBack(TOKEN_GO) && !(skipBack('O') && skipBack('G'))) return false;
+    return skipBack(TOKEN_ERROR) && (pos == 0 || (uint8_t)body[pos - 1] != FUNCTION_ESCAPE) && skipBack(TOKEN_ON);
+}
+
+// Check a program line by line: numbering, length, syntax and targets
+void checkProgramLines(const std::vector<CheckedLine>& lines, SyntaxReport& report) {
+    auto issue = [&](long line, bool fatal, const std::string& message) {
+        report.issues.push_back({(int)line, fatal, message});
+    };
+
+    std::vector<long> defined;
+    long previous = 0;
+    LineParser parser;
+    for (const CheckedLine& line : lines) {
+        report.lines++;
+        if (line.number <= 0 || line.number > MAX_LINE_NUMBER) {
+            issue(line.number, true, "line number " + std::to_string(line.number) + " out of range");
+        } else if (line.number == previous) {
+            issue(line.number, true, "duplicate line " + std::to_string(line.number));
+        } else if (line.number < previous) {
+            issue(line.number, true, "line " + std::to_string(line.number) + " follows line " +
+                                         std::to_string(previous));
+        }
+        previous = std::max(previous, line.number);
+        defined.push_back(line.number);
+        if (line.sourceLength > MAX_LINE_BODY) {
+            issue(line.number, true, "line is " + std::to_string(line.sourceLength) +
+                                         " characters long; the HX-20 accepts " +
+                                         std::to_string(MAX_LINE_BODY));
+        }
+        if (line.body.size() > MAX_LINE_BODY) {
+            issue(line.number, true, "line is " + std::to_string(line.body.size()) +
+                                         " bytes tokenized; the HX-20 accepts " +
+                                         std::to_string(MAX_LINE_BODY));
+        }
+        parser.check(line.body, line.number, report);
+    }
+
+    // References to lines that do not exist
+    std::sort(defined.begin(), defined.end());
+    static const char* kinds[] = {"GOTO", "GOSUB", "THEN", "ELSE", "RESTORE", "RESUME", "RETURN", "ERL", "RUN"};
+    for (const CheckedLine& line : lines) {
+        forEachLineReference((const uint8_t*)line.body.data(), 0, line.body.size(), [&](const LineReference& ref) {
+            if (ref.target < 0) return;
+            if (ref.target == 0 && (ref.kind == LineReference::RESUME ||
+                                    (ref.kind == LineReference::GOTO && afterOnErrorGoto(line.body, ref.offset)))) {
+                return;
+            }
+            if (std::binary_search(defined.begin(), defined.end(), ref.target)) return;
+            issue(line.number, ref.kind != LineReference::ERL,
+                  std::string(kinds[ref.kind]) + " " + std::to_string(ref.target) + ": no such line");
+        });
+    }
+}
+
+// Check ASCII source as the tokenizer will save it. Lines are taken in
+// file order, so duplicates and lines out of order are reported.
+void checkBasicSource(const std::string& program, SyntaxReport& report) {
+    std::vector<CheckedLine> lines;
+    size_t start = 0, sourceLine = 0;
+    while (start < program.size()) {
+        size_t end = program.find('\n', start);
+        if (end == std::string::npos) end = program.size();
+        size_t length = end - start;
+        if (length && program[end - 1] == '\r') length--;
+        std::string line = program.substr(start, length);
+        start = end + 1;
+        sourceLine++;
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+
+        size_t pos = line.find_first_not_of(" \t");
+        long number = 0;
+        size_t digits = pos;
+        while (pos < line.size() && std::isdigit((uint8_t)line[pos]) && pos - digits < 6) {
+            number = number * 10 + (line[pos++] - '0');
+        }
+        if (pos == digits || number == 0) {
+            report.issues.push_back({-1, true, "source line " + std::to_string(sourceLine) +
+                                                   " has no line number and would be dropped"});
+            continue;
+        }
+        // The length the HX-20 would see: number, a space and the text
+        size_t text = pos;
+        while (text < line.size() && std::isspace((uint8_t)line[text])) text++;
+        lines.push_back({number, tokenizeBasicLine(line, (int)number),
+                         std::to_string(number).size() + 1 + line.size() - text});
+    }
+    checkProgramLines(lines, report);
+}
+
+// Check a file's contents, tokenized or ASCII. An image that fails the
+// structural checks is not parsed.
+void checkProgram(const std::string& data, SyntaxReport& report) {
+    if (data.empty() || (uint8_t)data[0] != 0xFF) {
+        checkBasicSource(data, report);
+        return;
+    }
+    ValidationResult validation;
+    validateTokenizedProgram((const uint8_t*)data.data(), data.size(), validation);
+    for (const ValidationIssue& issue : validation.issues) {
+        report.issues.push_back({issue.line, issue.fatal, issue.message});
+    }
+    std::vector<ProgramLine> program;
+    std::string error;
+    if (!validation.ok() || !splitTokenizedProgram(data, program, error)) return;
+    std::vector<CheckedLine> lines;
+    for (ProgramLine& line : program) lines.push_back({line.number, std::move(line.body), 0});
+    checkProgramLines(lines, report);
+}
+
+#ifndef HX20TOKENIZER_NO_MAIN
+void printUsage(const char* progName) {
+    std::cerr << "HX-20 BASIC Tokenizer/Detokenizer\n";
+    std::cerr << "Usage: " << progName << " -i <input> -o <output>\n";
+    std::cerr << "       " << progName << " -b <joblist> | -D\n";
+    std::cerr << "       " << progName << " -i <dir|'glob'> [-o <output dir>] [-j <n>] [--detokenize] [--force]\n";
+    std::cerr << "  -i <file>   Input file\n";
+    std::cerr << "  -o <file>   Output file\n";
+    std::cerr << "  -b <file>   Batch mode: convert every job listed in <file> ('-' = stdin)\n";
+    std::cerr << "  -D          Daemon mode: read jobs from stdin, answer each immediately\n";
+    std::cerr << "  --renum [<start>[,<step>]]  Renumber the program (default: 10,10); output is tokenized\n";
+    std::cerr << "  --validate  Check tokenized images (-i file, directory or glob) without converting\n";
+    std::cerr << "  --check     Syntax-check programs (-i file, directory of *.txt or glob) before saving\n";
+    std::cerr << "  --patch <script>  Apply line edits (insert/replace/delete/merge); output is tokenized\n";
+    std::cerr << "  --remove-dead  Remove lines unreachable from the first line; output is tokenized\n";
+    std::cerr << "  --optimize[=<passes>]  Rewrite for speed: let,fold,defint,order,join (default: all)\n";
+    std::cerr << "  --samples <file>  --optimize: INPUT values for the equivalence runs, one run per line\n";
+    std::cerr << "  --unverified  --optimize: write the result even if the runs could not check it\n";
+    std::cerr << "  -j <n>      Tree mode: worker threads (default: one per core)\n";
+    std::cerr << "  --detokenize  Tree mode: detokenize *.bas to *.txt instead\n";
+    std::cerr << "  --force     Tree mode: rebuild every output\n";
+    std::cerr << "  --db <file> Tree mode: build database (default: <output dir>/.hx20tokenize.db)\n";
+    std::cerr << "  --stats[=json]  Report phase timings and counters on stderr\n";
+    std::cerr << "  --trace <file>  Write a Chrome/Perfetto trace-event timeline\n";
+    std::cerr << "\nIf input starts with 0xFF, it will be detokenized to ASCII.\n";
+    std::cerr << "Otherwise, it will be tokenized to binary format.\n";
+    std::cerr << "Jobs (-b, -D) are one per line: <input> <output>\n";
+    std::cerr << "A directory or glob input (\"**\" recurses) converts every *.txt source to\n";
+    std::cerr << "*.bas, skipping outputs that are already up to date.\n";
+}
+#endif
+
+// Tokenize or detokenize one file; returns a process exit code
+int convertFile(const std::string& inputFile, const std::string& outputFile) {
+    // Read input file
+    std::string inputData;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        std::ifstream inFile(inputFile, std::ios::binary);
+        if (!inFile) {
+            std::cerr << "Error: Could not open input file: " << inputFile << "\n";
+            return 1;
+        }
+        
+        std::stringstream buffer;
+        buffer << inFile.rdbuf();
+        inputData = buffer.str();
+        inFile.close();
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, inputData.size());
+    
+    // Determine operation based on first byte
+    bool isTokenized = !inputData.empty() && (uint8_t)inputData[0] == 0xFF;
+    std::string output;
+    
+    if (isTokenized) {
+        std::cout << "Detokenizing...\n";
+        {
+            HX20_STATS_PHASE(PHASE_TOKENIZE);
+            output = detokenizeBasicProgram(inputData);
+        }
+        
+        HX20_STATS_PHASE(PHASE_WRITE);
+        HX20_TRACE_SPAN("write output");
+        std::ofstream outFile(outputFile);
+        if (!outFile) {
+            std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+            return 1;
+        }
+        outFile << output;
+        outFile.close();
+    } else {
+        std::cout << "Tokenizing...\n";
+        {
+            HX20_STATS_PHASE(PHASE_TOKENIZE);
+            output = tokenizeBasicProgram(inputData);
+        }
+        
+        HX20_STATS_PHASE(PHASE_WRITE);
+        HX20_TRACE_SPAN("write output");
+        std::ofstream outFile(outputFile, std::ios::binary);
+        if (!outFile) {
+            std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+            return 1;
+        }
+        outFile.write(output.c_str(), output.length());
+        outFile.close();
+    }
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, output.length());
+    HX20_STATS_MAX(STAT_PEAK_BUFFER, std::max(inputData.size(), output.size()));
+    
+    std::cout << "Complete!\n";
+    std::cout << "Input:  " << inputFile << " (" << inputData.length() << " bytes)\n";
+    std::cout << "Output: " << outputFile << " (" << output.length() << " bytes)\n";
+    
+    return 0;
+}
+
+// Renumber one program; ASCII input is tokenized first. The output is
+// always tokenized. Returns a process exit code.
+int renumberFile(const std::string& inputFile, const std::string& outputFile, int start, int step) {
+    std::string image;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        std::ifstream inFile(inputFile, std::ios::binary);
+        if (!inFile) {
+            std::cerr << "Error: Could not open input file: " << inputFile << "\n";
+            return 1;
+        }
+        image.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, image.size());
+
+    RenumberReport report;
+    std::string error;
+    {
+        HX20_STATS_PHASE(PHASE_TOKENIZE);
+        if (image.empty() || (uint8_t)image[0] != 0xFF) {
+            std::cout << "Tokenizing...\n";
+            image = tokenizeBasicProgram(image);
+        }
+        if (!renumberTokenizedProgram(image, start, step, report, error)) {
+            std::cerr << "Error: " << inputFile << ": " << error << "\n";
+            return 1;
+        }
+    }
+    for (const std::string& warning : report.warnings) {
+        std::cerr << "Warning: " << warning << "\n";
+    }
+
+    HX20_STATS_PHASE(PHASE_WRITE);
+    HX20_TRACE_SPAN("write output");
+    std::ofstream outFile(outputFile, std::ios::binary);
+    if (!outFile) {
+        std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+        return 1;
+    }
+    outFile.write(image.data(), image.size());
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, image.size());
+
+    std::cout << "Renumbered " << report.lines << " lines from " << start << " step " << step
+              << ", " << report.references << " references updated\n";
+    std::cout << "Output: " << outputFile << " (" << image.size() << " bytes)\n";
+    return 0;
+}
+
+// Read a tokenized program, tokenizing ASCII input on the way
+bool readTokenized(const std::string& file, std::string& image) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return false;
+    image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (image.empty() || (uint8_t)image[0] != 0xFF) image = tokenizeBasicProgram(image);
+    return true;
+}
+
+// Parse a patch script, one edit per line:
+//   insert <line> <text>   replace <line> <text>
+//   delete <line>[-<last>] merge <file>
+// Blank lines and lines starting with '#' are ignored.
+bool parsePatchScript(std::istream& script, std::vector<LinePatch>& patches, std::string& error) {
+    std::string line;
+    for (int lineNo = 1; std::getline(script, line); lineNo++) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream fields(line);
+        std::string command;
+        if (!(fields >> command) || command[0] == '#') continue;
+        std::transform(command.begin(), command.end(), command.begin(), ::tolower);
+
+        LinePatch patch;
+        std::string where = "patch line " + std::to_string(lineNo) + ": ";
+        if (command == "insert" || command == "replace") {
+            long number;
+            if (!(fields >> number) || number < 1 || number > MAX_LINE_NUMBER) {
+                error = where + "expected a line number";
+                return false;
+            }
+            patch.kind = command == "insert" ? LinePatch::INSERT : LinePatch::REPLACE;
+            patch.number = (uint16_t)number;
+            fields >> std::ws;
+            std::getline(fields, patch.text);
+        } else if (command == "delete") {
+            std::string range;
+            fields >> range;
+            char* end;
+            long first = strtol(range.c_str(), &end, 10);
+            long last = *end == '-' ? strtol(end + 1, &end, 10) : first;
+            if (range.empty() || *end || first < 1 || last < first || last > MAX_LINE_NUMBER) {
+                error = where + "expected <line> or <first>-<last>";
+                return false;
+            }
+            patch.kind = LinePatch::DELETE;
+            patch.number = (uint16_t)first;
+            patch.last = (uint16_t)last;
+        } else if (command == "merge") {
+            std::string file;
+            fields >> std::ws;
+            std::getline(fields, file);
+            if (file.empty() || !readTokenized(file, patch.text)) {
+                error = where + "could not read " + file;
+                return false;
+            }
+            patch.kind = LinePatch::MERGE;
+        } else {
+            error = where + "unknown command '" + command + "'";
+            return false;
+        }
+        patches.push_back(std::move(patch));
+    }
+    return true;
+}
+
+// Apply a patch script to one program; the output is tokenized
+int patchFile(const std::string& inputFile, const std::string& outputFile, const std::string& scriptFile) {
+    std::string image;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        if (!readTokenized(inputFile, image)) {
+            std::cerr << "Error: Could not open input file: " << inputFile << "\n";
+            return 1;
+        }
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, image.size());
+
+    std::vector<LinePatch> patches;
+    std::string error;
+    std::ifstream scriptIn;
+    if (scriptFile != "-") {
+        scriptIn.open(scriptFile);
+        if (!scriptIn) {
+            std::cerr << "Error: Could not open patch script: " << scriptFile << "\n";
+            return 1;
+        }
+    }
+    PatchReport report;
+    {
+        HX20_STATS_PHASE(PHASE_TOKENIZE);
+        if (!parsePatchScript(scriptFile == "-" ? std::cin : scriptIn, patches, error) ||
+            !patchTokenizedProgram(image, patches, report, error)) {
+            std::cerr << "Error: " << error << "\n";
+            return 1;
+        }
+    }
+
+    HX20_STATS_PHASE(PHASE_WRITE);
+    HX20_TRACE_SPAN("write output");
+    std::ofstream outFile(outputFile, std::ios::binary);
+    if (!outFile) {
+        std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+        return 1;
+    }
+    outFile.write(image.data(), image.size());
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, image.size());
+
+    std::cout << "Patched: " << report.inserted << " inserted, " << report.replaced << " replaced, "
+              << report.deleted << " deleted, " << report.merged << " merged\n";
+    std::cout << "Output: " << outputFile << " (" << image.size() << " bytes)\n";
+    return 0;
+}
+
+// INPUT values for the equivalence runs: one run per line of the file,
+// values separated by commas. Without a file: ascending numbers, zeroes and
+// pseudo-random numbers, 32 values each.
+bool loadSamples(const std::string& file, std::vector<std::vector<std::string>>& samples) {
+    samples.clear();
+    if (file.empty()) {
+        samples.resize(3);
+        uint32_t state = 12345;
+        for (int i = 0; i < 32; i++) {
+            state = state * 1103515245 + 12345;
+            samples[0].push_back(std::to_string(i + 1));
+            samples[1].push_back("0");
+            samples[2].push_back(std::to_string((state >> 16) % 1000));
+        }
+        return true;
+    }
+    std::ifstream in(file);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        std::vector<std::string> values;
+        std::stringstream fields(line);
+        for (std::string value; std::getline(fields, value, ',');) values.push_back(value);
+        samples.push_back(values);
+    }
+    return true;
+}
+
+int optimizeFile(const std::string& inputFile, const std::string& outputFile, OptimizeOptions options,
+                 const std::string& samplesFile) {
+    std::string image;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        if (!readTokenized(inputFile, image)) {
+            std::cerr << "Error: Could not open input file: " << inputFile << "\n";
+            return 1;
+        }
+        if (!loadSamples(samplesFile, options.samples)) {
+            std::cerr << "Error: Could not open samples file: " << samplesFile << "\n";
+            return 1;
+        }
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, image.size());
+
+    OptimizeReport report;
+    std::string error;
+    {
+        HX20_STATS_PHASE(PHASE_TOKENIZE);
+        if (!optimizeTokenizedProgram(image, options, report, error)) {
+            std::cerr << "Error: " << inputFile << ": " << error << "\n";
+            return 1;
+        }
+    }
+    for (const std::string& note : report.notes) std::cerr << "Note: " << note << "\n";
+    if (!report.verified) {
+        std::string why = report.verification.empty() ? "no sample runs" : report.verification;
+        if (!options.allowUnverified) {
+            std::cerr << "Error: " << inputFile << ": equivalence not verified: " << why
+                      << " (--unverified writes it anyway)\n";
+            return 1;
+        }
+        std::cerr << "Warning: equivalence not verified: " << why << "\n";
+    }
+
+    HX20_STATS_PHASE(PHASE_WRITE);
+    HX20_TRACE_SPAN("write output");
+    std::ofstream outFile(outputFile, std::ios::binary);
+    if (!outFile) {
+        std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+        return 1;
+    }
+    outFile.write(image.data(), image.size());
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, image.size());
+
+    std::cout << "Dropped " << report.letsDropped << " LET, folded " << report.constantsFolded
+              << " constants, joined " << report.linesJoined << " lines\n";
+    if (!report.defint.empty()) std::cout << "DEFINT " << report.defint << "\n";
+    if (!report.ordered.empty()) {
+        std::cout << "Variables created first:";
+        for (const std::string& name : report.ordered) std::cout << " " << name;
+        std::cout << "\n";
+    }
+    if (report.verified) {
+        std::cout << "Equivalent on " << report.runs << " sample runs\n";
+        // What the HX-20 interpreter does for the same runs, before and after
+        auto row = [](const char* name, uint64_t before, uint64_t after) {
+            double saved = before ? 100.0 * ((double)before - (double)after) / before : 0.0;
+            printf("  %-20s %12llu %12llu %7.1f%%\n", name, (unsigned long long)before,
+                   (unsigned long long)after, saved);
+        };
+        std::cout << std::flush;
+        printf("  %-20s %12s %12s %8s\n", "interpreter work", "original", "optimized", "saved");
+        row("statements", report.before.statements, report.after.statements);
+        row("bytes scanned", report.before.bytesScanned, report.after.bytesScanned);
+        row("line headers walked", report.before.linesWalked, report.after.linesWalked);
+        row("variable probes", report.before.variableProbes, report.after.variableProbes);
+        row("operations", report.before.operations, report.after.operations);
+        fflush(stdout);
+    }
+    std::cout << "Output: " << outputFile << " (" << report.bytesBefore << " -> " << image.size() << " bytes)\n";
+    return 0;
+}
+
+int removeDeadLinesFile(const std::string& inputFile, const std::string& outputFile) {
+    std::string image;
+    {
+        HX20_STATS_PHASE(PHASE_READ);
+        HX20_TRACE_SPAN("read input");
+        if (!readTokenized(inputFile, image)) {
+            std::cerr << "Error: Could not open input file: " << inputFile << "\n";
+            return 1;
+        }
+    }
+    HX20_STATS_ADD(STAT_FILES, 1);
+    HX20_STATS_ADD(STAT_INPUT_BYTES, image.size());
+
+    DeadCodeReport report;
+    std::string error;
+    {
+        HX20_STATS_PHASE(PHASE_TOKENIZE);
+        if (!eliminateDeadLines(image, report, error)) {
+            std::cerr << "Error: " << inputFile << ": " << error << "\n";
+            return 1;
+        }
+    }
+    if (!report.keptAll.empty()) {
+        std::cerr << "Warning: " << report.keptAll << ", keeping every line\n";
+    }
+
+    HX20_STATS_PHASE(PHASE_WRITE);
+    HX20_TRACE_SPAN("write output");
+    std::ofstream outFile(outputFile, std::ios::binary);
+    if (!outFile) {
+        std::cerr << "Error: Could not open output file: " << outputFile << "\n";
+        return 1;
+    }
+    outFile.write(image.data(), image.size());
+    HX20_STATS_ADD(STAT_BYTES_WRITTEN, image.size());
+
+    std::cout << "Removed " << report.removed.size() << " of " << report.lines << " lines";
+    for (size_t i = 0; i < report.removed.size(); i++) {
+        std::cout << (i == 0 ? ": " : " ") << report.removed[i];
+    }
+    std::cout << "\n";
+    std::cout << "Saved " << report.bytesBefore - report.bytesAfter << " bytes, about "
+              << std::fixed << std::setprecision(1) << report.tapeSecondsSaved << " s of tape\n";
+    std::cout << "Output: " << outputFile << " (" << image.size() << " bytes)\n";
+    return 0;
+}
+
+// Print one issue as "<file>: line <n> (offset <o>): <message>"
+void printValidationIssue(const std::string& file, const ValidationIssue& issue) {
+    std::cerr << file << ": " << (issue.fatal ? "error" : "warning");
+    if (issue.line >= 0) std::cerr << ": line " << issue.line;
+    std::cerr << " (offset " << issue.offset << "): " << issue.message << "\n";
+}
+
+// Check every tokenized image in a file, directory (*.bas) or glob.
+// Returns 1 if any image is invalid.
+int validateFiles(const std::string& input, unsigned jobs) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SourceFile> files;
+    hx20fs::path base;
+    std::string error;
+    if (!expandSources(input, ".bas", files, base, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    std::vector<ValidationResult> results(files.size());
+    std::vector<uint64_t> sizes(files.size(), 0);
+    parallelFor(files.size(), jobs, [&](size_t i) {
+        std::ifstream in(files[i].path, std::ios::binary);
+        std::string image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!in.good() && !in.eof()) {
+            results[i].issues.push_back({0, -1, true, "could not read file"});
+            return;
+        }
+        sizes[i] = image.size();
+        validateTokenizedProgram((const uint8_t*)image.data(), image.size(), results[i]);
+    });
+
+    size_t invalid = 0, warnings = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        HX20_STATS_ADD(STAT_FILES, 1);
+        HX20_STATS_ADD(STAT_INPUT_BYTES, sizes[i]);
+        if (!results[i].ok()) invalid++;
+        for (const ValidationIssue& issue : results[i].issues) {
+            if (!issue.fatal) warnings++;
+            printValidationIssue(files[i].path.string(), issue);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Validated " << files.size() << " images: " << files.size() - invalid << " valid, "
+              << invalid << " invalid, " << warnings << " warnings in " << seconds << " s\n";
+    return invalid ? 1 : 0;
+}
+
+// Syntax-check ASCII sources or tokenized images (file, directory of *.txt
+// or glob); returns non-zero if any program has an error
+int checkFiles(const std::string& input, unsigned jobs) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SourceFile> files;
+    hx20fs::path base;
+    std::string error;
+    if (!expandSources(input, ".txt", files, base, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    std::vector<SyntaxReport> reports(files.size());
+    std::vector<uint64_t> sizes(files.size(), 0);
+    parallelFor(files.size(), jobs, [&](size_t i) {
+        std::ifstream in(files[i].path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!in.good() && !in.eof()) {
+            reports[i].issues.push_back({-1, true, "could not read file"});
+            return;
+        }
+        sizes[i] = data.size();
+        checkProgram(data, reports[i]);
+    });
+
+    size_t failed = 0, errors = 0, warnings = 0, lines = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        HX20_STATS_ADD(STAT_FILES, 1);
+        HX20_STATS_ADD(STAT_INPUT_BYTES, sizes[i]);
+        lines += reports[i].lines;
+        if (!reports[i].ok()) failed++;
+        for (const SyntaxIssue& issue : reports[i].issues) {
+            (issue.fatal ? errors : warnings)++;
+            std::cerr << files[i].path.string() << ": " << (issue.fatal ? "error" : "warning");
+            if (issue.line >= 0) std::cerr << ": line " << issue.line;
+            std::cerr << ": " << issue.message << "\n";
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Checked " << files.size() << " programs (" << lines << " lines): " << files.size() - failed
+              << " clean, " << failed << " with errors, " << errors << " errors, " << warnings
+              << " warnings in " << seconds << " s\n";
+    return failed ? 1 : 0;
+}
+
+// Batch and daemon mode: read "<input> <output>" jobs from `jobs`, answer
+// each with "OK <output> <ms>" or "ERR <input>" on stdout. In daemon mode
+// every answer is flushed immediately so a client can wait for it.
+int runJobs(std::istream& jobs, bool daemon) {
+    std::ostream reply(std::cout.rdbuf());
+    std::ostringstream discard;
+    std::cout.rdbuf(discard.rdbuf());
+
+    size_t done = 0, failed = 0;
+    std::string line;
+    while (std::getline(jobs, line)) {
+        std::istringstream fields(line);
+        std::string inputFile, outputFile;
+        if (!(fields >> inputFile)) continue;
+        if (daemon && inputFile == "quit") break;
+
+        int result = 1;
+        auto start = std::chrono::steady_clock::now();
+        if (fields >> outputFile) {
+            HX20_TRACE_SPAN("job");
+            result = convertFile(inputFile, outputFile);
+        } else {
+            std::cerr << "Error: No output file for " << inputFile << "\n";
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count();
+        discard.str("");
+
+        if (result == 0) {
+            reply << "OK " << outputFile << " " << ms << "\n";
+            done++;
+        } else {
+            reply << "ERR " << inputFile << "\n";
+            failed++;
+        }
+        if (daemon) reply.flush();
+    }
+
+    std::cout.rdbuf(reply.rdbuf());
+    if (!daemon) {
+        std::cout << "Processed " << done + failed << " files, " << failed << " failed\n";
+    }
+    return failed ? 1 : 0;
+}
+
+// Settings for converting a whole tree (-i <dir|glob>)
+struct TreeOptions {
+    std::string outputDir;      // mirror the tree here; empty = beside each source
+    std::string database;       // default: .hx20<mode>.db in the output root
+    bool detokenize = false;
+    bool force = false;
+    unsigned jobs = 0;          // worker threads, 0 = one per core
+};
+
+// Key for the build database: outputs depend on the mode and the token tables
+std::string treeConfig(bool detokenize) {
+    uint64_t hash = contentHash(detokenize ? "detokenize" : "tokenize");
+    for (const auto& pair : basicCommands) hash = contentHash(pair.first.c_str(), pair.first.size() + 1, hash ^ pair.second);
+    for (const auto& pair : basicFunctions) hash = contentHash(pair.first.c_str(), pair.first.size() + 1, hash ^ pair.second);
+    char key[64];
+    snprintf(key, sizeof(key), "%s %016llx", detokenize ? "detokenize" : "tokenize", (unsigned long long)hash);
+    return key;
+}
+
+// Convert every source under `input`, skipping outputs that are current.
+// ASCII sources (*.txt) become tokenized *.bas files, or the reverse with
+// --detokenize. Prints one line per changed output and a summary.
+int buildTree(const std::string& input, const TreeOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    const char* sourceExt = options.detokenize ? ".bas" : ".txt";
+    const char* outputExt = options.detokenize ? ".txt" : ".bas";
+
+    std::vector<SourceFile> sources;
+    hx20fs::path base;
+    std::string error;
+    if (!expandSources(input, sourceExt, sources, base, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    hx20fs::path outputRoot = options.outputDir.empty() ? base : hx20fs::path(options.outputDir);
+    hx20fs::path databaseFile = options.database.empty()
+        ? outputRoot / (options.detokenize ? ".hx20detokenize.db" : ".hx20tokenize.db")
+        : hx20fs::path(options.database);
+    std::string config = treeConfig(options.detokenize);
+    BuildDatabase database;
+    if (!database.load(databaseFile, config)) {
+        std::cout << "Build database " << databaseFile.string()
+                  << " was made with other settings; rebuilding everything\n";
+    }
+
+    enum Status { CURRENT, TOUCHED, BUILT, SKIPPED, FAILED };
+    struct Result {
+        std::string output;
+        Status status = FAILED;
+        const char* reason = "";
+        BuildRecord record;
+        uint64_t inputBytes = 0, outputBytes = 0;
+    };
+    std::vector<Result> results(sources.size());
+
+    if (!options.outputDir.empty()) {
+        std::error_code ec;
+        hx20fs::create_directories(outputRoot, ec);
+    }
+
+    // Workers only read the database; their results are merged afterwards
+    parallelFor(sources.size(), options.jobs, [&](size_t i) {
+        const SourceFile& source = sources[i];
+        Result& result = results[i];
+        hx20fs::path output = options.outputDir.empty() ? source.path : outputRoot / source.relative;
+        output.replace_extension(outputExt);
+        result.output = output.string();
+        result.record.source = source.path.string();
+
+        BuildRecord& record = result.record;
+        if (!fileStamp(source.path, record.sourceSize, record.sourceMtime)) {
+            result.reason = "cannot read source";
+            return;
+        }
+        if (output == source.path) {
+            result.reason = "output would overwrite the source";
+            return;
+        }
+
+        // Fast path: both stamps unchanged means no reads at all
+        const BuildRecord* previous = database.find(result.output);
+        uint64_t outputSize;
+        int64_t outputMtime;
+        bool outputCurrent = previous && previous->source == record.source &&
+                             fileStamp(output, outputSize, outputMtime) &&
+                             outputSize == previous->outputSize && outputMtime == previous->outputMtime;
+        if (!options.force && outputCurrent && record.sourceSize == previous->sourceSize &&
+            record.sourceMtime == previous->sourceMtime) {
+            result.status = CURRENT;
+            result.record = *previous;
+            return;
+        }
+
+        HX20_TRACE_SPAN("tree file");
+        std::string inputData;
+        {
+            std::ifstream in(source.path, std::ios::binary);
+            if (!in) {
+                result.reason = "cannot read source";
+                return;
+            }
+            inputData.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        result.inputBytes = inputData.size();
+        record.sourceSize = inputData.size();
+        record.sourceHash = contentHash(inputData);
+
+        if (options.force) {
+            result.reason = "forced";
+        } else if (outputCurrent) {
+            if (record.sourceHash == previous->sourceHash) {
+                // Touched but not edited: keep the output, refresh the stamp
+                result.status = TOUCHED;
+                record.outputSize = previous->outputSize;
+                record.outputMtime = previous->outputMtime;
+                return;
+            }
+            result.reason = "source changed";
+        } else {
+            result.reason = !previous ? "new" : !hx20fs::exists(output) ? "output missing" : "output changed";
+        }
+
+        bool isTokenized = !inputData.empty() && (uint8_t)inputData[0] == 0xFF;
+        if (isTokenized != options.detokenize) {
+            result.status = SKIPPED;
+            result.reason = isTokenized ? "already tokenized" : "not tokenized";
+            return;
+        }
+        std::string outputData = options.detokenize ? detokenizeBasicProgram(inputData)
+                                                    : tokenizeBasicProgram(inputData);
+
+        // Write beside the target and rename, so a partial file never looks current
+        std::error_code ec;
+        hx20fs::create_directories(output.parent_path(), ec);
+        hx20fs::path temp = output;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary);
+            out.write(outputData.data(), outputData.size());
+            if (!out.flush()) {
+                result.reason = "cannot write output";
+                return;
+            }
+        }
+        hx20fs::rename(temp, output, ec);
+        if (ec || !fileStamp(output, record.outputSize, record.outputMtime)) {
+            result.reason = "cannot write output";
+            return;
+        }
+        result.outputBytes = outputData.size();
+        result.status = BUILT;
+    });
+
+    // Merge into the database and report what changed
+    size_t counts[FAILED + 1] = {};
+    std::unordered_map<std::string, bool> seen;
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        counts[result.status]++;
+        seen[result.output] = true;
+        HX20_STATS_ADD(STAT_FILES, result.status == BUILT);
+        HX20_STATS_ADD(STAT_INPUT_BYTES, result.inputBytes);
+        HX20_STATS_ADD(STAT_BYTES_WRITTEN, result.outputBytes);
+
+        switch (result.status) {
+            case CURRENT:
+                break;
+            case TOUCHED:
+                database.update(result.output, result.record);
+                break;
+            case BUILT:
+                database.update(result.output, result.record);
+                std::cout << "  built    " << sources[i].path.string() << " -> " << result.output
+                          << " (" << result.reason << ")\n";
+                break;
+            case SKIPPED:
+                std::cout << "  skipped  " << sources[i].path.string() << " (" << result.reason << ")\n";
+                break;
+            case FAILED:
+                std::cerr << "  FAILED   " << sources[i].path.string() << ": " << result.reason << "\n";
+                break;
+        }
+    }
+
+    // Sources that disappeared; their outputs are left alone
+    std::vector<std::string> removed;
+    for (const auto& entry : database.records()) {
+        std::error_code ec;
+        if (!seen.count(entry.first) && !hx20fs::exists(entry.second.source, ec)) removed.push_back(entry.first);
+    }
+    std::sort(removed.begin(), removed.end());
+    for (const std::string& output : removed) {
+        std::cout << "  removed  " << database.find(output)->source << " (output " << output << " kept)\n";
+        database.erase(output);
+    }
+
+    bool saved = database.save(databaseFile, config);
+    if (!saved) std::cerr << "Error: Could not write build database " << databaseFile.string() << "\n";
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Tree: " << sources.size() << " files, " << counts[BUILT] << " built, "
+              << counts[CURRENT] + counts[TOUCHED] << " up to date (" << counts[TOUCHED] << " touched), "
+              << counts[SKIPPED] << " skipped, " << counts[FAILED] << " failed, "
+              << removed.size() << " removed in " << seconds << " s\n";
+    return counts[FAILED] || !saved ? 1 : 0;
+}
+
+#ifndef HX20TOKENIZER_NO_MAIN
+int main(int argc, char* argv[]) {
+    auto wallStart = std::chrono::steady_clock::now();
+    std::string inputFile;
+    std::string outputFile;
+    std::string jobFile;
+    bool daemon = false;
+    std::string traceFile;
+    TreeOptions tree;
+    bool renumber = false;
+    int renumStart = 10, renumStep = 10;
+    std::string patchScript;
+    bool validate = false;
+    bool check = false;
+    bool removeDead = false;
+    bool optimize = false;
+    OptimizeOptions optimizeOptions;
+    std::string samplesFile;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            inputFile = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            jobFile = argv[++i];
+        } else if (strcmp(argv[i], "-D") == 0) {
+            daemon = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            tree.jobs = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--detokenize") == 0) {
+            tree.detokenize = true;
+        } else if (strcmp(argv[i], "--force") == 0) {
+            tree.force = true;
+        } else if (strcmp(argv[i], "--renum") == 0) {
+            renumber = true;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                // start[,step]
+                char* end;
+                renumStart = (int)strtol(argv[++i], &end, 10);
+                if (*end == ',') renumStep = (int)strtol(end + 1, nullptr, 10);
+            }
+        } else if (strcmp(argv[i], "--validate") == 0) {
+            validate = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        } else if (strcmp(argv[i], "--remove-dead") == 0) {
+            removeDead = true;
+        } else if (strncmp(argv[i], "--optimize", 10) == 0 && (argv[i][10] == 0 || argv[i][10] == '=')) {
+            optimize = true;
+            if (argv[i][10] == '=') {
+                std::string passes = std::string(",") + (argv[i] + 11) + ",";
+                auto has = [&](const char* pass) { return passes.find(std::string(",") + pass + ",") != std::string::npos; };
+                optimizeOptions.dropLet = has("let");
+                optimizeOptions.foldConstants = has("fold");
+                optimizeOptions.hoistDefint = has("defint");
+                optimizeOptions.orderVariables = has("order");
+                optimizeOptions.joinLines = has("join");
+            }
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samplesFile = argv[++i];
+        } else if (strcmp(argv[i], "--unverified") == 0) {
+            optimizeOptions.allowUnverified = true;
+        } else if (strcmp(argv[i], "--patch") == 0 && i + 1 < argc) {
+            patchScript = argv[++i];
+        } else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            tree.database = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+            STATS.enabled = true;
+            STATS.json = strcmp(argv[i], "--stats=json") == 0;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+            TRACER.enabled = true;
+            TRACER.setThreadName("main");
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+
+    int result;
+    if (daemon) {
+        result = runJobs(std::cin, true);
+    } else if (!jobFile.empty()) {
+        if (jobFile == "-") {
+            result = runJobs(std::cin, false);
+        } else {
+            std::ifstream jobs(jobFile);
+            if (!jobs) {
+                std::cerr << "Error: Could not open job list: " << jobFile << "\n";
+                return 1;
+            }
+            result = runJobs(jobs, false);
+        }
+    } else if (validate && !inputFile.empty()) {
+        result = validateFiles(inputFile, tree.jobs);
+    } else if (check && !inputFile.empty()) {
+        result = checkFiles(inputFile, tree.jobs);
+    } else if (!inputFile.empty() && (hasWildcard(inputFile) || hx20fs::is_directory(inputFile))) {
+        tree.outputDir = outputFile;
+        result = buildTree(inputFile, tree);
+    } else {
+        if (inputFile.empty() || outputFile.empty()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        
+        if (!patchScript.empty()) {
+            result = patchFile(inputFile, outputFile, patchScript);
+        } else if (optimize) {
+            result = optimizeFile(inputFile, outputFile, optimizeOptions, samplesFile);
+        } else if (removeDead) {
+            result = removeDeadLinesFile(inputFile, outputFile);
+        } else if (renumber) {
+            result = renumberFile(inputFile, outputFile, renumStart, renumStep);
+        } else {
+            result = convertFile(inputFile, outputFile);
+        }
+    }
+
+    if (!traceFile.empty() && !TRACER.writeTrace(traceFile)) {
+        std::cerr << "Error: Could not write trace file: " << traceFile << "\n";
+        result = 1;
+    }
+    if (STATS.enabled) {
+        printStats("hx20tokenizer", std::chrono::duration<double>(
+                                        std::chrono::steady_clock::now() - wallStart).count());
+    }
+    return result;
 }
+#endif // HX20TOKENIZER_NO_MAIN
@@ -0,0 +1,127 @@
+// Timeline tracing for the HX-20 tools (--trace out.json).
+//
+// Every thread records complete spans into its own fixed-size ring buffer.
+// Only the owning thread writes to a buffer, so recording takes no lock; the
+// registry mutex is taken once per thread, when its buffer is created. When
+// a ring fills up the oldest spans are overwritten. writeTrace() emits the
+// Chrome/Perfetto trace-event JSON format and must be called after worker
+// threads have finished. Build with -DHX20_NO_TRACE to compile it out.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    const char* name;       // string literal, never freed
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+struct TraceBuffer {
+    static const size_t CAPACITY = 1 << 16;     // power of two
+
+    std::vector<TraceEvent> events = std::vector<TraceEvent>(CAPACITY);
+    std::atomic<size_t> count{0};               // total recorded, wraps into events
+    uint32_t tid = 0;
+    std::string threadName;
+};
+
+class Tracer {
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    TraceBuffer* registerThread() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        TraceBuffer* buffer = buffers.back().get();
+        buffer->tid = (uint32_t)buffers.size();
+        buffer->threadName = "thread " + std::to_string(buffer->tid);
+        return buffer;
+    }
+
+public:
+    std::atomic<bool> enabled{false};
+
+    uint64_t nowNs() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    TraceBuffer& local() {
+        thread_local TraceBuffer* buffer = registerThread();
+        return *buffer;
+    }
+
+    void record(const char* name, uint64_t startNs, uint64_t endNs) {
+        TraceBuffer& buffer = local();
+        size_t i = buffer.count.load(std::memory_order_relaxed);
+        buffer.events[i & (TraceBuffer::CAPACITY - 1)] = {name, startNs, endNs - startNs};
+        buffer.count.store(i + 1, std::memory_order_release);
+    }
+
+    // Label the calling thread in the timeline
+    void setThreadName(const std::string& name) {
+        if (enabled.load(std::memory_order_relaxed)) local().threadName = name;
+    }
+
+    bool writeTrace(const std::string& filename) {
+        FILE* out = fopen(filename.c_str(), "w");
+        if (!out) return false;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (const auto& buffer : buffers) {
+            fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                         "\"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", buffer->tid, buffer->threadName.c_str());
+            first = false;
+
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            size_t begin = count > TraceBuffer::CAPACITY ? count - TraceBuffer::CAPACITY : 0;
+            for (size_t i = begin; i < count; i++) {
+                const TraceEvent& e = buffer->events[i & (TraceBuffer::CAPACITY - 1)];
+                fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                             "\"ts\": %.3f, \"dur\": %.3f}",
+                        e.name, buffer->tid, e.startNs / 1e3, e.durationNs / 1e3);
+            }
+        }
+        fprintf(out, "\n]}\n");
+        return fclose(out) == 0;
+    }
+};
+
+inline Tracer TRACER;
+
+#ifndef HX20_NO_TRACE
+
+// Records one span from construction to destruction when tracing is on
+class TraceSpan {
+    const char* name;
+    uint64_t startNs = 0;
+public:
+    explicit TraceSpan(const char* name)
+        : name(TRACER.enabled.load(std::memory_order_relaxed) ? name : nullptr) {
+        if (this->name) startNs = TRACER.nowNs();
+    }
+    ~TraceSpan() {
+        if (name) TRACER.record(name, startNs, TRACER.nowNs());
+    }
+};
+
+#define HX20_TRACE_CONCAT2(a, b) a##b
+#define HX20_TRACE_CONCAT(a, b) HX20_TRACE_CONCAT2(a, b)
+#define HX20_TRACE_SPAN(name) TraceSpan HX20_TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#else
+
+#define HX20_TRACE_SPAN(name) ((void)0)
+
+#endif // HX20_NO_TRACE
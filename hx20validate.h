@@ -0,0 +1,199 @@
+// Structural validation of tokenized HX-20 BASIC images.
+//
+// Checks the 0xFF magic, the size word against the file length, line
+// headers (complete, non-zero, strictly ascending), line terminators,
+// command tokens (0x80-0xEB), function tokens after 0xFF (0x80-0xA9),
+// stray control bytes and strings left open at the end of a line. The HX-20
+// itself accepts an open string at the end of a line, so that one is a
+// warning. Each line body is scanned with a small table-driven state
+// machine. Runs of plain code are classified eight bytes at a time with
+// independent table loads, strings are skipped with memchr and remarks
+// are not scanned at all. Only a line that fails is scanned again, slowly,
+// to report where.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct ValidationIssue {
+    size_t offset;          // byte offset in the image
+    int line;               // BASIC line number, -1 outside a line
+    bool fatal;
+    std::string message;
+};
+
+struct ValidationResult {
+    size_t lines = 0;
+    std::vector<ValidationIssue> issues;
+
+    bool ok() const {
+        for (const ValidationIssue& issue : issues) {
+            if (issue.fatal) return false;
+        }
+        return true;
+    }
+};
+
+class TokenValidator {
+public:
+    enum State : uint8_t { CODE, STRING, REMARK, ESCAPE, STATE_COUNT };
+    enum Flag : uint8_t { BAD_TOKEN = 1, BAD_FUNCTION = 2, CONTROL = 4, CHANGES_STATE = 8 };
+
+    static const uint8_t FIRST_TOKEN = 0x80;
+    static const uint8_t LAST_COMMAND = 0xEB;
+    static const uint8_t LAST_FUNCTION = 0xA9;
+    static const uint8_t ESCAPE_BYTE = 0xFF;
+    static const uint8_t REM_TOKEN = 0x8C;
+    static const uint8_t REM_QUOTE_TOKEN = 0x8D;
+
+    uint8_t next[STATE_COUNT][256];
+    uint8_t flags[STATE_COUNT][256];
+    uint8_t codeClass[256];     // flags[CODE], plus CHANGES_STATE
+
+    TokenValidator() {
+        for (int b = 0; b < 256; b++) {
+            // Code: plain text, quotes, command tokens and the function escape
+            next[CODE][b] = CODE;
+            flags[CODE][b] = 0;
+            if (b == '"') next[CODE][b] = STRING;
+            if (b == ESCAPE_BYTE) next[CODE][b] = ESCAPE;
+            if (b == REM_TOKEN || b == REM_QUOTE_TOKEN) next[CODE][b] = REMARK;
+            if (b > LAST_COMMAND && b != ESCAPE_BYTE) flags[CODE][b] = BAD_TOKEN;
+            if ((b < 0x20 && b != '\t') || b == 0x7F) flags[CODE][b] = CONTROL;
+
+            // Strings and remarks hold any byte but NUL
+            next[STRING][b] = b == '"' ? CODE : STRING;
+            flags[STRING][b] = 0;
+            next[REMARK][b] = REMARK;
+            flags[REMARK][b] = 0;
+
+            // One function token after the escape
+            next[ESCAPE][b] = CODE;
+            flags[ESCAPE][b] = (b < FIRST_TOKEN || b > LAST_FUNCTION) ? BAD_FUNCTION : 0;
+
+            codeClass[b] = flags[CODE][b] | (next[CODE][b] != CODE ? CHANGES_STATE : 0);
+        }
+    }
+
+    // Scan one line body; returns the OR of all flags and the final state
+    uint8_t scan(const uint8_t* p, const uint8_t* end, uint8_t& state) const {
+        uint8_t s = state, f = 0;
+        while (p < end) {
+            if (s == CODE) {
+                // Eight bytes that cannot leave CODE only add their flags
+                while (end - p >= 8) {
+                    uint8_t m = codeClass[p[0]] | codeClass[p[1]] | codeClass[p[2]] | codeClass[p[3]] |
+                                codeClass[p[4]] | codeClass[p[5]] | codeClass[p[6]] | codeClass[p[7]];
+                    if (m & CHANGES_STATE) break;
+                    f |= m;
+                    p += 8;
+                }
+                if (p == end) break;
+            } else if (s == STRING) {
+                const void* quote = memchr(p, '"', end - p);
+                if (!quote) {
+                    p = end;
+                    break;
+                }
+                p = static_cast<const uint8_t*>(quote);
+            } else if (s == REMARK) {
+                p = end;
+                break;
+            }
+            f |= flags[s][*p];
+            s = next[s][*p];
+            p++;
+        }
+        state = s;
+        return f;
+    }
+
+    static const TokenValidator& instance() {
+        static const TokenValidator validator;
+        return validator;
+    }
+};
+
+inline bool validateTokenizedProgram(const uint8_t* data, size_t length, ValidationResult& result,
+                                     int maxLineNumber = 65529) {
+    auto issue = [&](size_t offset, int line, bool fatal, const std::string& message) {
+        result.issues.push_back({offset, line, fatal, message});
+    };
+
+    if (length < 3 || data[0] != 0xFF) {
+        issue(0, -1, true, "missing 0xFF magic byte");
+        return false;
+    }
+    size_t size = (data[1] << 8) | data[2];
+    if (size < 3) {
+        issue(1, -1, true, "size word " + std::to_string(size) + " is smaller than the header");
+        return false;
+    }
+    if (size > length) {
+        issue(1, -1, true, "size word " + std::to_string(size) + " exceeds the file length " +
+                               std::to_string(length) + " (truncated file?)");
+        size = length;
+    } else if (size < length) {
+        issue(size, -1, false, std::to_string(length - size) + " bytes after the end of the program");
+    }
+
+    const TokenValidator& table = TokenValidator::instance();
+    int previous = 0;
+    size_t pos = 3;
+    while (pos < size) {
+        if (size - pos < 5) {
+            issue(pos, -1, true, "truncated line header");
+            break;
+        }
+        int number = (data[pos + 2] << 8) | data[pos + 3];
+        if (number == 0 || number > maxLineNumber) {
+            issue(pos + 2, number, true, "line number " + std::to_string(number) + " out of range");
+        } else if (number <= previous) {
+            issue(pos + 2, number, true, "line " + std::to_string(number) + " follows line " +
+                                             std::to_string(previous));
+        }
+        previous = number;
+        result.lines++;
+
+        const uint8_t* body = data + pos + 4;
+        const uint8_t* end = static_cast<const uint8_t*>(memchr(body, 0x00, data + size - body));
+        if (!end) {
+            issue(pos, number, true, "line " + std::to_string(number) + " has no terminator");
+            break;
+        }
+
+        uint8_t state = TokenValidator::CODE;
+        uint8_t flags = table.scan(body, end, state);
+        if (flags) {
+            // Slow path: walk the line again to locate each problem
+            uint8_t s = TokenValidator::CODE;
+            for (const uint8_t* p = body; p < end; p++) {
+                uint8_t f = table.flags[s][*p];
+                size_t offset = p - data;
+                char byte[8];
+                snprintf(byte, sizeof(byte), "0x%02X", *p);
+                if (f & TokenValidator::BAD_TOKEN) {
+                    issue(offset, number, true, std::string("invalid token ") + byte);
+                }
+                if (f & TokenValidator::BAD_FUNCTION) {
+                    issue(offset, number, true, std::string("invalid function token ") + byte);
+                }
+                if (f & TokenValidator::CONTROL) {
+                    issue(offset, number, true, std::string("control character ") + byte);
+                }
+                s = table.next[s][*p];
+            }
+        }
+        if (state == TokenValidator::ESCAPE) {
+            issue(end - data, number, true, "function escape at the end of the line");
+        } else if (state == TokenValidator::STRING) {
+            issue(end - data, number, false, "string not closed before the end of the line");
+        }
+        pos = end - data + 1;
+    }
+    if (result.lines == 0) issue(3, -1, false, "program has no lines");
+    return result.ok();
+}
@@ -57,6 +57,33 @@ def bits_from_edges(edges, rate, thr_us):
     dt_us = np.diff(edges)/rate*1e6
     return (dt_us>=thr_us).astype(np.uint8), dt_us
 
+SPEED_RANGE = 0.3
+
+def bits_tracking(edges, rate, c0, c1, speed_gain=1/64, spacing_gain=1/256):
+    # Same tracker as hx20decoder.h's PulseFramer: both centres follow the
+    # tape speed, their spacing is learnt slowly, a pulse only counts when
+    # the next one is of the same class, and neither centre leaves
+    # ±SPEED_RANGE of where it started
+    dt_us = np.diff(edges)/rate*1e6
+    start0, start1 = c0, c1
+    bits = np.zeros(len(dt_us), np.uint8)
+    thresholds = np.zeros(len(dt_us))
+    prev = None
+    for i, d in enumerate(dt_us):
+        thresholds[i] = (c0+c1)/2.0
+        one = d >= thresholds[i]
+        bits[i] = one
+        if prev is not None and prev[1] == one:
+            centre = c1 if one else c0
+            err = prev[0]/centre - 1.0
+            c0 *= 1 + speed_gain*err; c1 *= 1 + speed_gain*err
+            if one: c1 *= 1 + spacing_gain*err
+            else: c0 *= 1 + spacing_gain*err
+            c0 = min(max(c0, start0*(1-SPEED_RANGE)), start0*(1+SPEED_RANGE))
+            c1 = min(max(c1, start1*(1-SPEED_RANGE)), start1*(1+SPEED_RANGE))
+        prev = (d, one)
+    return bits, dt_us, thresholds
+
 def decode_bytes(bits, off):
     out=[]; stops_ok=0; total=0
     for i in range(off, len(bits)-9+1, 9):
@@ -80,6 +107,7 @@ def main():
     ap.add_argument("--invert", action="store_true", help="invert signal before edge detection")
     ap.add_argument("--edges", choices=["rise","fall","both"], default="rise", help="which edges to detect (default: rise)")
     ap.add_argument("--mingap-us", type=float, default=200.0, help="minimum gap between edges in microseconds (default: 200)")
+    ap.add_argument("--adaptive", action="store_true", help="let the threshold follow the tape speed (for stretched tapes)")
     ap.add_argument("--plot", action="store_true", help="plot a histogram of interval lengths (single chart)")
     args = ap.parse_args()
     rate, x = read_wav(args.wav)
@@ -95,9 +123,13 @@ def main():
         print("ERROR: could not estimate threshold.")
         sys.exit(3)
     thr, c0, c1 = choice
-    bits, _ = bits_from_edges(edges, rate, thr)
     print(f"SampleRate: {rate} Hz  Duration: {len(x)/rate:.3f} s  Edges: {len(edges)}")
     print(f"Intervals: short≈{c0:.1f} µs  long≈{c1:.1f} µs  thr≈{thr:.1f} µs")
+    if args.adaptive:
+        bits, _, thresholds = bits_tracking(edges, rate, c0, c1)
+        print(f"Adaptive threshold: {thresholds.min():.1f} .. {thresholds.max():.1f} µs")
+    else:
+        bits, _ = bits_from_edges(edges, rate, thr)
     best = None
     for off in range(9):
         bytes_arr, stops_ok, total = decode_bytes(bits, off)